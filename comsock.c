@@ -15,6 +15,7 @@
 #include <pthread.h>
 #include <string.h>
 #include <signal.h>
+#include <sys/uio.h>
 
 typedef struct {
     char type;           /** tipo del messaggio */
@@ -22,6 +23,21 @@ typedef struct {
     char* buffer;        /** buffer messaggio */
 } message_t; 
 
+/** buffer di ingresso di una connessione */
+typedef struct {
+    char * data;         /** byte letti dalla socket */
+    unsigned int start;  /** indice del primo byte non ancora interpretato */
+    unsigned int len;    /** numero di byte non ancora interpretati */
+    unsigned int dim;    /** dimensione effettiva di data */
+} msgbuf_t;
+
+/** messaggio gia' codificato, immutabile e condiviso */
+typedef struct {
+    unsigned int refs;   /** numero di riferimenti al frame */
+    unsigned int size;   /** numero di byte del frame (lunghezza compresa) */
+    char * data;         /** frame codificato: lunghezza, tipo, buffer */
+} frame_t;
+
 /** lunghezza buffer indirizzo AF_UNIX */
 #define UNIX_PATH_MAX    108
 
@@ -29,6 +45,10 @@ typedef struct {
 #define SEOF -2
 /** Error Socket Path Too Long (exceeding UNIX_PATH_MAX) */
 #define SNAMETOOLONG -11 
+/** nel buffer di ingresso non e' presente un messaggio completo */
+#define SNOMSG -3
+/** dimensione iniziale del buffer di ingresso */
+#define NMSGBUF 1024
 /** numero di tentativi di connessione da parte del client */
 #define  NTRIALCONN 5
 /** tipi dei messaggi scambiati fra server e client */
@@ -150,6 +170,37 @@ int acceptConnection(int s)
 	return fd_c;
 }
 
+/** legge esattamente n byte dalla socket (ripetendo la read in caso di letture parziali)
+ *  \param  sc  file descriptor della socket
+ *  \param  buf buffer in cui scrivere i byte letti
+ *  \param  n   numero di byte da leggere
+ *
+ *  \retval n     se OK
+ *  \retval 0     se il peer ha chiuso la connessione prima di n byte
+ *  \retval -1    in caso di errore (sets errno)
+ */
+static int readAll(int sc, char * buf, unsigned int n)
+{
+	int lr;
+	unsigned int letti = 0;
+	
+	while (letti < n) {
+		lr = read (sc, buf + letti, n - letti);
+		if (lr == 0) {
+			return 0;
+		}
+		if (lr < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		letti += lr;
+	}
+	
+	return n;
+}
+
 /** legge un messaggio dalla socket
  *  \param  sc  file descriptor della socket
  *  \param msg  struttura che conterra' il messagio letto 
@@ -175,7 +226,7 @@ int receiveMessage(int sc, message_t * msg)
 	
 	errno = 0;
 
-	lr = read (sc, &lungtot, sizeof (unsigned int)); /* lettura di un unsigned int */
+	lr = readAll (sc, (char *) &lungtot, sizeof (unsigned int)); /* lettura di un unsigned int */
 
 	if (lr == 0) { /* errno settata da read */
 		return SEOF;
@@ -185,7 +236,7 @@ int receiveMessage(int sc, message_t * msg)
 	}
 
 	/* lettura della tipologia del messaggio (lettura di un carrattere) */
-	lr = read (sc, &type, sizeof (char));
+	lr = readAll (sc, &type, sizeof (char));
 
 	if (lr == 0) { /* errno settata da read */
 		return SEOF;
@@ -211,12 +262,15 @@ int receiveMessage(int sc, message_t * msg)
 			return -1;
 		}
 		
-		lr = read (sc, msg->buffer, sizeof (char) * (lungtot - 1));
+		/* il kernel puo' restituire il messaggio a pezzi: lo leggo tutto prima di ritornare */
+		lr = readAll (sc, msg->buffer, sizeof (char) * (lungtot - 1));
 
 		if (lr == 0) {
+			free (msg->buffer);
 			return SEOF;
 		}
 		if (lr < 0) {
+			free (msg->buffer);
 			return -1;
 		}
 		
@@ -230,6 +284,244 @@ int receiveMessage(int sc, message_t * msg)
 	return -1;
 }
 
+/** crea un buffer di ingresso vuoto, da associare ad una connessione
+ *
+ *  \retval b     il buffer creato
+ *  \retval NULL  in caso di errore (sets errno)
+ */
+msgbuf_t * newMsgBuffer(void)
+{
+	msgbuf_t * b;
+	
+	b = malloc (sizeof (msgbuf_t));
+	if (b == NULL) {
+		return NULL;
+	}
+	b->data = malloc (sizeof (char) * NMSGBUF);
+	if (b->data == NULL) {
+		free (b);
+		return NULL;
+	}
+	b->start = 0;
+	b->len = 0;
+	b->dim = NMSGBUF;
+	
+	return b;
+}
+
+/** distrugge un buffer di ingresso
+ *  \param  b buffer da distruggere (puo' essere NULL)
+ */
+void freeMsgBuffer(msgbuf_t * b)
+{
+	if (b == NULL) {
+		return;
+	}
+	free (b->data);
+	free (b);
+}
+
+/** legge dalla socket, con una sola read, tutti i byte disponibili (fino allo spazio libero
+ *  nel buffer), accodandoli a quelli non ancora interpretati. Il buffer viene ingrandito
+ *  in modo che possa sempre contenere per intero il messaggio in testa.
+ *  \param  sc  file descriptor della socket
+ *  \param  b   buffer di ingresso della connessione
+ *  \param  nonblock se != 0 la lettura non si blocca (MSG_DONTWAIT)
+ *
+ *  \retval n     numero di byte letti (n > 0)
+ *  \retval 0     se la lettura non bloccante non ha trovato dati
+ *  \retval SEOF  se il peer ha chiuso la connessione 
+ *  \retval -1    in tutti gli altri casi di errore (sets errno)
+ */
+int fillMsgBuffer(int sc, msgbuf_t * b, int nonblock)
+{
+	int lr;
+	unsigned int lungtot;
+	unsigned long need; /* spazio necessario a contenere il messaggio in testa */
+	unsigned long dim;
+	char * tmp;
+	
+	errno = 0;
+	
+	if (b == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+	
+	/* sposto all'inizio del buffer i byte non ancora interpretati (al piu' un messaggio incompleto) */
+	if (b->start > 0) {
+		memmove (b->data, b->data + b->start, b->len);
+		b->start = 0;
+	}
+	
+	need = b->len + 1;
+	if (b->len >= sizeof (unsigned int)) {
+		memcpy (&lungtot, b->data, sizeof (unsigned int));
+		need = sizeof (unsigned int) + (unsigned long) lungtot;
+	}
+	
+	if (need > b->dim || b->len == b->dim) {
+		dim = 2 * (unsigned long) b->dim;
+		if (dim < need) {
+			dim = need;
+		}
+		if (dim > (unsigned int) -1) {
+			errno = EMSGSIZE;
+			return -1;
+		}
+		tmp = realloc (b->data, sizeof (char) * dim);
+		if (tmp == NULL) { /* errno settata da realloc */
+			return -1;
+		}
+		b->data = tmp;
+		b->dim = dim;
+	}
+	
+	do {
+		lr = recv (sc, b->data + b->len, b->dim - b->len, nonblock ? MSG_DONTWAIT : 0);
+	} while (lr == -1 && errno == EINTR);
+	
+	if (lr == 0) {
+		return SEOF;
+	}
+	if (lr < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			return 0;
+		}
+		if (errno == ECONNRESET) {
+			return SEOF;
+		}
+		return -1;
+	}
+	
+	b->len += lr;
+	return lr;
+}
+
+/** estrae dal buffer di ingresso il primo messaggio completo (non esegue letture sulla socket)
+ *  \param  b    buffer di ingresso della connessione
+ *  \param  msg  struttura che conterra' il messagio estratto 
+ *		(deve essere allocata all'esterno della funzione,
+ *		tranne il campo buffer)
+ *
+ *  \retval lung   lunghezza del buffer estratto, se OK 
+ *  \retval SNOMSG se il buffer non contiene un messaggio completo
+ *  \retval -1     se il messaggio non e' valido o in caso di errore (sets errno)
+ */
+int nextMessage(msgbuf_t * b, message_t * msg)
+{
+	unsigned int lungtot;
+	char * p;
+	
+	errno = 0;
+	
+	if (b == NULL || msg == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+	
+	if (b->len < sizeof (unsigned int) + 1) {
+		return SNOMSG;
+	}
+	p = b->data + b->start;
+	memcpy (&lungtot, p, sizeof (unsigned int));
+	if (lungtot == 0 || b->len - sizeof (unsigned int) < lungtot) {
+		return SNOMSG;
+	}
+	
+	msg->type = p [sizeof (unsigned int)];
+	
+	if (lungtot == 1) { /* ovvero type può essere solo un tipo dei seguenti: MSG_OK, MSG_ NO, MSG_EXIT */
+		msg->buffer = NULL;
+		msg->length = 0;
+	} else {
+		if ( (msg->type != MSG_CONNECT) && (msg->type != MSG_ERROR) && (msg->type != MSG_LIST) && 
+			(msg->type != MSG_TO_ONE) && (msg->type != MSG_BCAST) ) {
+			errno = EINVAL;
+			return -1;
+		}
+		msg->buffer = malloc (sizeof (char) * (lungtot - 1));
+		if (msg->buffer == NULL) { /* errno settata da malloc */
+			return -1;
+		}
+		memcpy (msg->buffer, p + sizeof (unsigned int) + 1, lungtot - 1);
+		msg->length = lungtot - 1;
+	}
+	
+	/* il messaggio e' stato interpretato */
+	b->start += sizeof (unsigned int) + lungtot;
+	b->len -= sizeof (unsigned int) + lungtot;
+	if (b->len == 0) {
+		b->start = 0;
+	}
+	
+	return msg->length;
+}
+
+/** legge un messaggio dalla socket passando per il buffer di ingresso della connessione:
+ *  se il buffer contiene gia' un messaggio completo non viene eseguita nessuna read,
+ *  altrimenti una read puo' ricevere piu' messaggi, che verranno restituiti dalle chiamate successive
+ *  \param  sc   file descriptor della socket (bloccante)
+ *  \param  b    buffer di ingresso della connessione
+ *  \param  msg  struttura che conterra' il messagio letto (vedi receiveMessage)
+ *
+ *  \retval lung  lunghezza del buffer letto, se OK 
+ *  \retval SEOF  se il peer ha chiuso la connessione 
+ *  \retval -1    in tutti gli altri casi di errore (sets errno)
+ */
+int receiveBufferedMessage(int sc, msgbuf_t * b, message_t * msg)
+{
+	int n;
+	
+	while ( (n = nextMessage (b, msg)) == SNOMSG ) {
+		n = fillMsgBuffer (sc, b, 0);
+		if (n == SEOF || n == -1) {
+			return n;
+		}
+	}
+	
+	return n;
+}
+
+/** scrive sulla socket tutti i byte descritti da iov, ripetendo la writev in caso
+ *  di scritture parziali (iov viene modificato)
+ *   \param  sc file descriptor della socket
+ *   \param  iov vettore dei buffer da scrivere
+ *   \param  iovcnt numero di elementi di iov
+ *   
+ *   \retval  n    il numero di byte scritti
+ *   \retval -1   in caso di errore (sets errno)
+ */
+static ssize_t writevAll(int sc, struct iovec * iov, int iovcnt)
+{
+	ssize_t n;
+	size_t tot = 0;
+	
+	while (iovcnt > 0) {
+		n = writev (sc, iov, iovcnt);
+		if (n == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		tot += n;
+		
+		/* salto i buffer scritti per intero e aggiorno quello scritto a meta' */
+		while (iovcnt > 0 && (size_t) n >= iov->iov_len) {
+			n -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt > 0) {
+			iov->iov_base = (char *) iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+	
+	return (ssize_t) tot;
+}
+
 /** scrive un messaggio sulla socket
  *   \param  sc file descriptor della socket
  *   \param msg struttura che contiene il messaggio da scrivere 
@@ -242,14 +534,12 @@ int receiveMessage(int sc, message_t * msg)
  */
 int sendMessage(int sc, message_t *msg)
 {	
-	/* Invio della lunghezza totale della stringa (lunghezza buffer + 1 per il carattere che identifica la tipologia del messaggio), 
-	 * eventuale concatenzione del buffer con il tipo di messaggio da inviare e invio della stringa concatenata .
+	/* Invio, con una sola writev, della lunghezza totale (lunghezza buffer + 1 per il carattere che identifica
+	 * la tipologia del messaggio), del tipo e del buffer del chiamante: nessuna allocazione e nessuna copia.
 	 */
 
-	int n;
-	int i;
-	char * str_msg;
-	
+	ssize_t n;
+	struct iovec iov [3];
 	unsigned int lungtot = 1; /* la lunghezza totale è almeno 1 in quanto si deve sempre inviare il carattere che identifica il tipo di messaggio */
 	
 	errno = 0;
@@ -259,74 +549,115 @@ int sendMessage(int sc, message_t *msg)
 		return -1;
 	}
 	
-	if (msg->length > 0)
-	{ /* il buffer non è vuoto */
-		lungtot += msg->length;
-		
-		n = write (sc, &lungtot , sizeof (unsigned int));
-		if (n == -1) {
-			return SEOF;
-		}
-		if (n < -1) {
-			return -1;
-		}
-
-		/* creazione della stringa da inviare sulla socket (il primo carattere sarà il tipo di messaggio) */
-		str_msg = malloc (sizeof (char) * ((msg->length) + 1)); /* msg->message + il carattere string connect */
-
-		/* qui non c arriva :( */
-		
-		if (str_msg == NULL) {
-			return -1;
-		}
-				
-		str_msg [0] = msg->type;
-
-		for (i = 1; i <= (msg->length); i++) {
-
-			str_msg [i] = (msg->buffer) [i - 1];
-		}
-		
-		n = write (sc, str_msg, lungtot);
-		
-		free (str_msg);
-		
-		if (n == -1) {
-			return SEOF;
-		}
-		if (n < -1) {
-			return -1;
-		}
-		
-		return n;
-	}
+	lungtot += msg->length;
 	
+	iov [0].iov_base = &lungtot;
+	iov [0].iov_len = sizeof (unsigned int);
+	iov [1].iov_base = &(msg->type);
+	iov [1].iov_len = sizeof (char);
+	iov [2].iov_base = msg->buffer;
+	iov [2].iov_len = msg->length; /* se la lunghezza del buffer è 0 può essere: MSG_EXIT, MSG_LIST, MSG_OK */
 	
-	/** la lunghezza del buffer è = 0 quindi può essere: MSG_EXIT, MSG_LIST, MSG_OK */
-
-	n = write (sc, &lungtot , sizeof (unsigned int));
+	n = writevAll (sc, iov, (msg->length > 0) ? 3 : 2);
 	if (n == -1) {
 		/* il peer si è disconnesso */
 		return SEOF;
 	}
-	if (n < -1) {
-		return -1;
+	
+	return lungtot;
+}
+
+/** codifica un messaggio in un frame immutabile, che puo' essere scritto su piu' socket
+ *  senza essere ricostruito (una sola allocazione, un solo riferimento)
+ *   \param msg messaggio da codificare
+ *   
+ *   \retval f     il frame creato
+ *   \retval NULL  in caso di errore (sets errno)
+ */
+frame_t * newFrame(message_t * msg)
+{
+	frame_t * f;
+	unsigned int lungtot;
+	
+	errno = 0;
+	
+	if (msg == NULL || (msg->length > 0 && msg->buffer == NULL)) {
+		errno = EINVAL;
+		return NULL;
+	}
+	
+	lungtot = msg->length + 1;
+	
+	/* struttura e frame in un unico blocco */
+	f = malloc (sizeof (frame_t) + sizeof (unsigned int) + lungtot);
+	if (f == NULL) {
+		return NULL;
+	}
+	f->refs = 1;
+	f->size = sizeof (unsigned int) + lungtot;
+	f->data = (char *) (f + 1);
+	
+	memcpy (f->data, &lungtot, sizeof (unsigned int));
+	f->data [sizeof (unsigned int)] = msg->type;
+	if (msg->length > 0) {
+		memcpy (f->data + sizeof (unsigned int) + 1, msg->buffer, msg->length);
 	}
 	
-	n = write (sc, (char *) &(msg->type), 1);
+	return f;
+}
 
-	if (n == -1) {
-		return SEOF;
+/** acquisisce un riferimento al frame
+ *   \param f frame
+ *   
+ *   \retval f  il frame stesso
+ */
+frame_t * retainFrame(frame_t * f)
+{
+	__sync_add_and_fetch (&(f->refs), 1);
+	return f;
+}
+
+/** rilascia un riferimento al frame, che viene deallocato quando non ne ha piu'
+ *   \param f frame (puo' essere NULL)
+ */
+void releaseFrame(frame_t * f)
+{
+	if (f == NULL) {
+		return;
+	}
+	if (__sync_sub_and_fetch (&(f->refs), 1) == 0) {
+		free (f);
 	}
-	if (n < -1) {
+}
+
+/** scrive un frame sulla socket (gestendo le scritture parziali)
+ *   \param  sc file descriptor della socket
+ *   \param  f  frame da scrivere 
+ *   
+ *   \retval  n    il numero di caratteri inviati, come sendMessage
+ *   \retval  SEOF se il peer ha chiuso la connessione 
+ *   \retval -1   in tutti gl ialtri casi di errore (sets errno)
+ */
+int sendFrame(int sc, frame_t * f)
+{
+	struct iovec iov;
+	
+	errno = 0;
+	
+	if (f == NULL) {
+		errno = EINVAL;
 		return -1;
 	}
 	
-	return n;
+	iov.iov_base = f->data;
+	iov.iov_len = f->size;
 	
-	/* caso in cui non corrisponda a nessun tipo di messaggio tra quelli elencati */
-	errno = EINVAL;
-	return -1;
+	if (writevAll (sc, &iov, 1) == -1) {
+		/* il peer si è disconnesso */
+		return SEOF;
+	}
+	
+	return f->size - sizeof (unsigned int);
 }
 
 /** crea una connessione alla socket del server. In caso di errore funzione tenta NTRIALCONN volte la connessione (a distanza di 1 secondo l'una dall'altra) prima di ritornare errore.
@@ -24,6 +24,41 @@ typedef struct {
     char* buffer;        /** buffer messaggio */
 } message_t; 
 
+/** <H3>Buffer di ingresso</H3>
+ * La struttura \c msgbuf_t rappresenta il buffer di ingresso di una connessione:
+ * una sola read puo' ricevere piu' messaggi, che vengono poi estratti uno alla volta
+ * - \c data contiene i byte letti dalla socket
+ * - \c start e' l'indice del primo byte non ancora interpretato
+ * - \c len e' il numero di byte non ancora interpretati
+ * - \c dim e' la dimensione effettiva di data
+ *
+ * <HR>
+ */
+
+typedef struct {
+    char * data;         /** byte letti dalla socket */
+    unsigned int start;  /** indice del primo byte non ancora interpretato */
+    unsigned int len;    /** numero di byte non ancora interpretati */
+    unsigned int dim;    /** dimensione effettiva di data */
+} msgbuf_t;
+
+/** <H3>Frame</H3>
+ * La struttura \c frame_t rappresenta un messaggio gia' codificato nel formato
+ * della socket, immutabile e con conteggio dei riferimenti: un messaggio inviato
+ * a piu' destinatari (broadcast) viene codificato una sola volta
+ * - \c refs e' il numero di riferimenti al frame
+ * - \c size e' il numero di byte del frame (lunghezza compresa)
+ * - \c data e' il frame codificato: lunghezza, tipo, buffer
+ *
+ * <HR>
+ */
+
+typedef struct {
+    unsigned int refs;   /** numero di riferimenti al frame */
+    unsigned int size;   /** numero di byte del frame (lunghezza compresa) */
+    char * data;         /** frame codificato: lunghezza, tipo, buffer */
+} frame_t;
+
 /** lunghezza buffer indirizzo AF_UNIX */
 #define UNIX_PATH_MAX    108
 
@@ -31,6 +66,10 @@ typedef struct {
 #define SEOF -2
 /** Error Socket Path Too Long (exceeding UNIX_PATH_MAX) */
 #define SNAMETOOLONG -11 
+/** nel buffer di ingresso non e' presente un messaggio completo */
+#define SNOMSG -3
+/** dimensione iniziale del buffer di ingresso */
+#define NMSGBUF 1024
 /** numero di tentativi di connessione da parte del client */
 
 #define  NTRIALCONN 3
@@ -96,6 +135,57 @@ int acceptConnection(int s);
  */
 int receiveMessage(int sc, message_t * msg);
 
+/** crea un buffer di ingresso vuoto, da associare ad una connessione
+ *
+ *  \retval b     il buffer creato
+ *  \retval NULL  in caso di errore (sets errno)
+ */
+msgbuf_t * newMsgBuffer(void);
+
+/** distrugge un buffer di ingresso
+ *  \param  b buffer da distruggere (puo' essere NULL)
+ */
+void freeMsgBuffer(msgbuf_t * b);
+
+/** legge dalla socket, con una sola read, tutti i byte disponibili (fino allo spazio libero
+ *  nel buffer), accodandoli a quelli non ancora interpretati. Il buffer viene ingrandito
+ *  in modo che possa sempre contenere per intero il messaggio in testa.
+ *  \param  sc  file descriptor della socket
+ *  \param  b   buffer di ingresso della connessione
+ *  \param  nonblock se != 0 la lettura non si blocca (MSG_DONTWAIT)
+ *
+ *  \retval n     numero di byte letti (n > 0)
+ *  \retval 0     se la lettura non bloccante non ha trovato dati
+ *  \retval SEOF  se il peer ha chiuso la connessione 
+ *  \retval -1    in tutti gli altri casi di errore (sets errno)
+ */
+int fillMsgBuffer(int sc, msgbuf_t * b, int nonblock);
+
+/** estrae dal buffer di ingresso il primo messaggio completo (non esegue letture sulla socket)
+ *  \param  b    buffer di ingresso della connessione
+ *  \param  msg  struttura che conterra' il messagio estratto 
+ *		(deve essere allocata all'esterno della funzione,
+ *		tranne il campo buffer)
+ *
+ *  \retval lung   lunghezza del buffer estratto, se OK 
+ *  \retval SNOMSG se il buffer non contiene un messaggio completo
+ *  \retval -1     se il messaggio non e' valido o in caso di errore (sets errno)
+ */
+int nextMessage(msgbuf_t * b, message_t * msg);
+
+/** legge un messaggio dalla socket passando per il buffer di ingresso della connessione:
+ *  se il buffer contiene gia' un messaggio completo non viene eseguita nessuna read,
+ *  altrimenti una read puo' ricevere piu' messaggi, che verranno restituiti dalle chiamate successive
+ *  \param  sc   file descriptor della socket (bloccante)
+ *  \param  b    buffer di ingresso della connessione
+ *  \param  msg  struttura che conterra' il messagio letto (vedi receiveMessage)
+ *
+ *  \retval lung  lunghezza del buffer letto, se OK 
+ *  \retval SEOF  se il peer ha chiuso la connessione 
+ *  \retval -1    in tutti gli altri casi di errore (sets errno)
+ */
+int receiveBufferedMessage(int sc, msgbuf_t * b, message_t * msg);
+
 /** scrive un messaggio sulla socket
  *   \param  sc file descriptor della socket
  *   \param msg struttura che contiene il messaggio da scrivere 
@@ -108,6 +198,37 @@ int receiveMessage(int sc, message_t * msg);
  */
 int sendMessage(int sc, message_t *msg);
 
+/** codifica un messaggio in un frame immutabile, che puo' essere scritto su piu' socket
+ *  senza essere ricostruito (una sola allocazione, un solo riferimento)
+ *   \param msg messaggio da codificare
+ *   
+ *   \retval f     il frame creato
+ *   \retval NULL  in caso di errore (sets errno)
+ */
+frame_t * newFrame(message_t * msg);
+
+/** acquisisce un riferimento al frame
+ *   \param f frame
+ *   
+ *   \retval f  il frame stesso
+ */
+frame_t * retainFrame(frame_t * f);
+
+/** rilascia un riferimento al frame, che viene deallocato quando non ne ha piu'
+ *   \param f frame (puo' essere NULL)
+ */
+void releaseFrame(frame_t * f);
+
+/** scrive un frame sulla socket (gestendo le scritture parziali)
+ *   \param  sc file descriptor della socket
+ *   \param  f  frame da scrivere 
+ *   
+ *   \retval  n    il numero di caratteri inviati, come sendMessage
+ *   \retval  SEOF se il peer ha chiuso la connessione 
+ *   \retval -1   in tutti gl ialtri casi di errore (sets errno)
+ */
+int sendFrame(int sc, frame_t * f);
+
 /** crea una connessione all socket del server. In caso di errore funzione tenta NTRIALCONN volte la connessione (a distanza di 1 secondo l'una dall'altra) prima di ritornare errore.
  *   \param  path  nome del socket su cui il server accetta le connessioni
  *   
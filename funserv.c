@@ -19,41 +19,81 @@
 #include <ctype.h>
 #include <dirent.h>
 #include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <semaphore.h>
+#include <sys/wait.h>
 
 #include "genHash.h"
 #include "genList.h"
 #include "comsock.h"
+#include "usrtab.h"
+#include "logring.h"
+#include "msglog.h"
+#include "funserv.h"
 
 /** ========== Macro ========== */
-#define NHASH 10 /* dimensione della tabella hash */
-#define NWRITE 1024 /* dimensione iniziale del buffer, raddoppiata se il buffer viene riempito piu' la metà */
 #define ALREADY_CONNECT "Un utente con il tuo username e' gia' connesso\n"
 #define NO_CONNECT "Non sei abilitato alla connessione su questo server\n"
 #define ERROR_RECEIVE_MSG "Server Errore nella ricezione del messaggio\n"
 #define ERROR_SEND_MSG "Server Errore nell'invio del messaggio\n"
 #define CLIENT_DISCONNECT "Server Il client ha chiuso la connessione\n"
 #define DEST_DISCONNECT "utente non connesso"
+#define NIOV 64 /* numero massimo di frame scritti con una sola sendmsg */
+#define NLOADER 16 /* numero massimo di thread che validano il file degli utenti autorizzati */
+#define NLOADMIN (1 << 16) /* byte minimi del file degli utenti assegnati ad ogni thread */
+#define NUSR 256 /* gli username devono essere lunghi meno di NUSR caratteri */
+#define LOGWAIT 100000 /* nanosecondi di attesa di un produttore che trova piena la coda dei record di log */
 
 /** ========== Strutture globali ========== */
-extern hashTable_t * hash_table; /* tabella hash, condivisa tra tutti i thread del server */
+extern userTable_t * hash_table; /* tabella hash degli utenti autorizzati, condivisa tra tutti i thread del server */
+extern userMph_t * user_mph; /* hash perfetto minimo sugli utenti di hash_table (NULL se non richiesto) */
 extern list_t * thread_list; /* lista che conterrà gli id dei thread */
-extern char * to_write; /* stringa da scrivere sul file di log */
-extern unsigned int dim_wr; /* dimensione effettiva della variabile "to_write" */
-extern char * users_list; /* array che conterrà la lista degli utenti connessi */
+extern logshard_t * log_shards; /* segmenti del file di log (ognuno con la sua coda dei record e il suo Writer) */
+extern int n_shards; /* numero di segmenti del file di log */
+extern unsigned long log_stamp; /* ultimo timbro di sequenza assegnato ad un record (log diviso in segmenti) */
+extern unsigned long log_threshold; /* byte in attesa oltre i quali il Writer viene risvegliato */
+extern int log_compact; /* 1 se i broadcast vengono registrati con un solo record (log compatto) */
+extern unsigned long bcast_seq; /* numero dell'ultimo broadcast registrato nel log compatto */
+extern field_t * users_head; /* primo utente connesso (lista in ordine di connessione) */
+extern field_t * users_tail; /* ultimo utente connesso */
+extern int n_users; /* numero di utenti connessi */
+extern unsigned long users_version; /* versione della lista degli utenti connessi (cresce ad ogni modifica) */
+extern frame_t * list_frame; /* risposta a MSG_LIST gia' codificata (NULL se non ancora costruita) */
+extern unsigned long list_version; /* versione della lista degli utenti connessi a cui corrisponde list_frame */
 extern int n_worker; /* variabile che indica il numero di worker attivi */
 
 /** ========== Variabili mutex globali ========== */
 extern pthread_mutex_t mtx_thread;
-extern pthread_mutex_t mtx_hash; /* mutex per accedere alla tabella hash da parte di un thread */
-extern pthread_mutex_t mtx_write; /* mutex per accedere alla variabile "to_write" e a "dim_wr" */
-extern pthread_mutex_t mtx_users; /* mutex per accedere alla variabile users_list */
+extern pthread_rwlock_t rw_hash; /* lettura: ricerca nella tabella hash, scrittura: modifica della struttura della tabella */
+extern pthread_mutex_t mtx_stripe [NSTRIPE]; /* mutex sullo stato (skt, q) degli utenti, scelto in base all id dell utente */
+extern pthread_mutex_t mtx_users; /* mutex per accedere alla lista degli utenti connessi */
 extern pthread_mutex_t mtx_n; /* mutex per accedere alla variabile n_worker */
-
-typedef struct field {
-	/* struttura a cui punteranno i payload degli elementi della tabella hash*/
-	int skt;
-	pthread_mutex_t mtx;
-} field_t;
+extern pthread_mutex_t mtx_flush; /* mutex per accedere alla lista del Flusher */
+extern pthread_mutex_t mtx_list; /* mutex per accedere a list_frame e list_version */
+extern pthread_mutex_t mtx_qpool; /* mutex per accedere a free_queues */
+extern pthread_mutex_t mtx_fields; /* mutex per accedere a field_chunks e name_blocks */
+
+/** ========== Sessioni ========== */
+extern fchunk_t * field_chunks; /* blocchi di payload preallocati (il primo e' quello corrente) */
+extern nblock_t * name_blocks; /* blocchi che contengono gli username degli utenti autorizzati */
+
+/** ========== Code di uscita ========== */
+extern outq_t ** flush_list; /* code con frame in attesa che la socket sia pronta in scrittura */
+extern int n_flush; /* numero di code in flush_list */
+extern int dim_flush; /* dimensione effettiva di flush_list */
+extern int flush_pipe [2]; /* pipe per risvegliare il Flusher */
+extern unsigned int q_frames; /* massimo numero di frame in una coda di uscita */
+extern unsigned long q_bytes; /* massimo numero di byte in una coda di uscita */
+extern outq_t * free_queues; /* code di uscita libere, da riusare per le nuove sessioni */
+extern frame_t * ok_frame; /* messaggio MSG_OK gia' codificato, condiviso da tutti i login */
+extern int q_policy; /* politica applicata quando la coda di un destinatario e' piena */
+extern int q_secs; /* secondi senza progressi dopo i quali un destinatario viene disconnesso (0 = mai) */
+
+/** ========== Thread Fanout ========== */
+extern int n_fanout; /* numero di thread Fanout (0 = broadcast inviati dal thread mittente) */
+extern int fan_min; /* numero minimo di destinatari per affidare un broadcast ai thread Fanout */
+extern fanq_t * fan_queues; /* code degli shard, una per ogni thread Fanout */
 
 /** Funzione che restituisce un puntatore alla copia di un intero
  *  
@@ -185,373 +225,2174 @@ void Unlock (pthread_mutex_t * mtx) {
 	}
 }
 
-/** Procedura che inserisce una stringa nella variabile users_list
- * 
- * 	\param str, stringa da inserire
+/** Esegue l'unlocking sulla variabile mtx, usata come procedura di cleanup
+ *  per i thread cancellati mentre attendono su una variabile di condizione
+
+    \param mtx variabile per la mutua esclusione
+ */
+void Cleanup_unlock (void * mtx) {
+	Unlock ( (pthread_mutex_t *) mtx );
+}
+
+/** Esegue il locking in lettura sulla variabile rw
+
+    \param rw variabile per la mutua esclusione lettori/scrittori
  */
-void Add_user (char * str) {
-	if (strlen (users_list) == 0) { /* users_list è vuota */
-		sprintf (users_list, "%s", str);
-	} else { /* users_list non è vuota */
-		strcat (users_list, " ");
-		strcat (users_list, str);
+void Rdlock (pthread_rwlock_t * rw) {
+	if ( pthread_rwlock_rdlock (rw) != 0 ) {
+		fprintf (stderr, "Errore durante il locking in lettura");
+		exit (EXIT_FAILURE);
 	}
 }
 
-/** Procedura che elimina una stringa nella variabile users_list
- * 	
- * 	\param str, stringa da rimuovere
+/** Esegue il locking in scrittura sulla variabile rw
+
+    \param rw variabile per la mutua esclusione lettori/scrittori
  */
-void Remove_user (char * str) {
-	
-		int dim;
-		int i;
-		
-		dim = strlen (users_list) + 1;
-		
-		if (strstr (users_list, str) != users_list) { /* se l'utente da rimuovere non è il primo nella lista */
+void Wrlock (pthread_rwlock_t * rw) {
+	if ( pthread_rwlock_wrlock (rw) != 0 ) {
+		fprintf (stderr, "Errore durante il locking in scrittura");
+		exit (EXIT_FAILURE);
+	}
+}
 
-			/* sovrascrivo users_list dallo spazio prima di str (strstr (users_list, str) - 1) con la stringa che
-			*  inizia dopo la fine di str (strstr (users_list, str) + strlen (str))
-			*/
-			sprintf (strstr (users_list, str) - 1,  "%s", strstr (users_list, str) + strlen (str));
-		
-			for (i = 0; users_list [i] != '\0'; i++); /* calcolo da dove partire per ripulire la stringa users_list*/
-		
-			for (; i < dim; i++) { /* ripulisco la stringa */
-				users_list [i] = '\0';
-			}
-		} else { /* l'utente da rimuovere è il primo nella lista */
-		
-			if (users_list [strlen (str)] == '\0') { /* è connesso solo l'utente str */
-				for (i = 0; i <= strlen (str); i++) { /* ripulisco la stringa */
-					users_list [i] = '\0';
-				}
-				return;
-			}
-			
-			/* ci sono altri utenti connessi presenti in users_list */
-			sprintf (users_list,  "%s", users_list + strlen (str) + 1); /* sovrascrivo users_list con users_list meno il primo username */
-		
-			for (i = 0; users_list [i] != '\0'; i++); /* calcolo da dove partire per ripulire la stringa users_list*/
-		
-			for (; i < dim; i++) { /* ripulisco la stringa */
-				users_list [i] = '\0';
-			}
-		}
+/** Esegue l'unlocking sulla variabile rw
+
+    \param rw variabile per la mutua esclusione lettori/scrittori
+ */
+void Rwunlock (pthread_rwlock_t * rw) {
+	if ( pthread_rwlock_unlock (rw) != 0 ) {
+		fprintf (stderr, "Errore durante l'unlocking");
+		exit (EXIT_FAILURE);
+	}
 }
 
-/** Procedura che ritorna un puntatore alla copia delle variabile users_list
+/** Procedura che inserisce un utente in coda alla lista degli utenti connessi, in O(1)
+ *  (mtx_users gia' acquisito: nel log compatto l'ingresso viene registrato nello stesso
+ *  ordine delle fotografie dei destinatari dei broadcast, in una cella prenotata dal chiamante)
  * 
- * 	\retval users_list, lista degli utenti connessi
+ * 	\param p, payload dell'utente appena connesso
  */
-char * Listing () {
-
-	return copy_string (users_list);
+void Add_user (field_t * p) {
+	p->next = NULL;
+	p->prev = users_tail;
+	if (users_tail == NULL) { /* la lista è vuota */
+		users_head = p;
+	} else {
+		users_tail->next = p;
+	}
+	users_tail = p;
+	n_users++;
+	__sync_add_and_fetch (&users_version, 1);
+	
+	if (log_compact == 1) { /* il log compatto ricostruisce dai login i destinatari dei broadcast */
+		Add_reserved (LREC_JOIN, p->id, p->id, 0, NULL);
+	}
 }
 
-/** [MTX] Procedura che prende in ingresso 3 stringhe e le concatena
- *  nel formato "mittente:destinatario:messaggio\n" alla variabile to_write
+/** Procedura che rimuove un utente dalla lista degli utenti connessi, in O(1)
+ *  (mtx_users gia' acquisito; nel log compatto il chiamante ha prenotato la cella del record)
  * 	
- * 	\param mit, mittente
- * 	\param dest, destinatario
- *  \param mess, messaggio
+ * 	\param p, payload dell'utente che si e' disconnesso
  */
-void Add_string (char * mit, char * dest, char * mess) {
+void Remove_user (field_t * p) {
+	if (p->prev == NULL) { /* l'utente da rimuovere è il primo nella lista */
+		users_head = p->next;
+	} else {
+		p->prev->next = p->next;
+	}
+	if (p->next == NULL) { /* l'utente da rimuovere è l'ultimo nella lista */
+		users_tail = p->prev;
+	} else {
+		p->next->prev = p->prev;
+	}
+	p->prev = NULL;
+	p->next = NULL;
+	n_users--;
+	__sync_add_and_fetch (&users_version, 1);
+	
+	if (log_compact == 1) {
+		Add_reserved (LREC_LEAVE, p->id, p->id, 0, NULL);
+	}
+}
 
-	int n;
+/** Procedura che ritorna una stringa con gli username degli utenti connessi,
+ *  separati da uno spazio, nell'ordine in cui si sono connessi
+ * 
+ * 	\retval str, lista degli utenti connessi (allocata all interno della funzione)
+ */
+char * Listing () {
+	int n = 0;
 	char * str;
+	char * s;
+	field_t * p;
 	
-	n = (strlen (mit) + strlen (dest) + strlen (mess) - strlen (mit) - 3 + 4); /* - strlen (mit) per cioe che sta tra [mit]
-																				* - 3 per '[', ']', ' '
-																				* + 2 per ':', + 1 per '\n', + 1 per '\0'  */
+	for (p = users_head; p != NULL; p = p->next) { /* dimensione della stringa */
+		n += strlen (p->name) + 1; /* + 1 per lo spazio o il carattere terminatore */
+	}
 	
-	str = malloc (sizeof (char) * n);
+	str = calloc ( (n == 0) ? 1 : n, sizeof (char) );
 	if (str == NULL) {
-		perror ("Errore durante l'allocazione della stringa per la concatenazione");
+		perror ("Errore durante la creazione della lista degli utenti connessi");
 		exit (EXIT_FAILURE);
 	}
-	sprintf (str, "%s:%s:%s\n", mit, dest, mess + (strlen (mit)) + 3);
-	
-	Lock (&mtx_write);
-
-		while ( (strlen (to_write) + strlen (str) + 1) >= ((dim_wr) / 2) ) { /* controllo sulla dimensione di to_write */
-			/* se la variabile to_write non è abbastanza grande gli si raddoppi la dimensione */
-			dim_wr *= 2;
-			to_write = realloc (to_write, dim_wr * sizeof (char));
-			
-			if (to_write == NULL) {
-				perror ("Errore durante l'espansione del buffer per la scrittura su file");
-				exit (EXIT_FAILURE);
-			}
-		}	
-			
-		strcat (to_write, str); /* aggiornamento della variabile to_write */
 	
-	Unlock (&mtx_write);
+	s = str;
+	for (p = users_head; p != NULL; p = p->next) {
+		if (s != str) {
+			*s++ = ' ';
+		}
+		strcpy (s, p->name);
+		s += strlen (p->name);
+	}
 	
-	free (str);	
-
+	return str;
 }
 
-/** Procedura che ridimensiona al valore NWRITE e resetta la variabile to_write
+/** [MTX] Funzione che restituisce la risposta a MSG_LIST gia' codificata.
+ *  Il frame viene ricostruito (una sola volta) solo se la lista degli utenti connessi
+ *  e' cambiata dall'ultima costruzione; altrimenti si acquisisce un riferimento al frame
+ *  corrente tenendo mtx_list solo per il tempo dello scambio del puntatore, senza
+ *  toccare la tabella hash. Il frame non viene mai modificato: chi lo sta inviando continua
+ *  ad usare la propria copia anche se nel frattempo ne viene pubblicata una nuova.
+ * 
+ * 	\retval f, frame con la lista degli utenti connessi (con un riferimento da rilasciare)
  */
-void Reset_string () {
-
-	free (to_write);
-	to_write = calloc (NWRITE, sizeof (char));
-	dim_wr = NWRITE;
+frame_t * List_frame () {
+	unsigned long v;
+	message_t msg;
+	frame_t * f;
 	
-}
-
-/** [MTX] Aggiunge un thread alla lista dei thread attivi
-
-    \param thread_id identificatore del thread
-    \param type tipolologia del thread (Dispatcher, Worker, Writer)
- */
-void Add_thread_list (pthread_t thread_id, char * type) {
-	int err;
+	Lock (&mtx_list);
+		if (list_frame != NULL && list_version == __sync_fetch_and_add (&users_version, 0)) {
+			f = retainFrame (list_frame);
+	Unlock (&mtx_list);
+			return f;
+		}
+	Unlock (&mtx_list);
 	
-	Lock (&mtx_thread);
-		err = add_ListElement (thread_list, &thread_id, type);
+	/* la lista e' cambiata: costruisco un nuovo frame */
+	Lock (&mtx_users);
+		msg.buffer = Listing ();
+		v = users_version;
+	Unlock (&mtx_users);
 	
-		if (err == -1) {
-			perror ("Errore durante l'aggiunta del thread alla lista dei thread attivi");
-			exit (EXIT_FAILURE);
+	msg.type = MSG_LIST;
+	msg.length = strlen (msg.buffer) + 1;
+	f = newFrame (&msg);
+	free (msg.buffer);
+	if (f == NULL) {
+		perror ("Errore durante la codifica della lista degli utenti connessi");
+		exit (EXIT_FAILURE);
+	}
+	
+	/* pubblico il nuovo frame, a meno che un altro thread non ne abbia gia' pubblicato uno piu' recente */
+	Lock (&mtx_list);
+		if (list_frame == NULL || list_version < v) {
+			if (list_frame != NULL) {
+				releaseFrame (list_frame);
+			}
+			list_frame = retainFrame (f);
+			list_version = v;
 		}
-	Unlock (&mtx_thread);
+	Unlock (&mtx_list);
+	
+	return f;
 }
 
-/** [MTX] Rimuove un thread alla lista dei thread attivi (usato esclusivamente dai thread worker)
-
-    \param thread_id identificatore del thread
+/** Funzione che restituisce il segmento del file di log su cui scrive il thread chiamante:
+ *  ogni thread riceve un segmento (a rotazione) al suo primo record e lo usa sempre,
+ *  cosi' i thread di segmenti diversi non si contendono ne' la coda ne' il file
+ * 
+ * 	\retval sh, segmento del thread
  */
-void Remove_thread_list (pthread_t thread_id) {
-	int err;
+logshard_t * Log_shard () {
+	static int next = 0; /* prossimo segmento da assegnare */
+	static __thread int shard = -1; /* segmento del thread (-1 se non ancora assegnato) */
 	
-	Lock (&mtx_thread);
-		err = remove_ListElement (thread_list, &thread_id);
+	if (shard == -1) {
+		shard = __sync_fetch_and_add (&next, 1) % n_shards;
+	}
 	
-		if (err == -1) {
-			perror ("Errore durante la rimozione del thread nella lista dei thread attivi");
-			exit (EXIT_FAILURE);
-		}
-		
-		/* decremento il numero di worker attivi */
-		Lock (&mtx_n);
-			n_worker--;
-		Unlock (&mtx_n);
-		
-	Unlock (&mtx_thread);
+	return &(log_shards [shard]);
 }
 
-/**  Chiude la socket gestendo l'errore
- *   \param skt, socket da chiudere
+/** Procedura che prenota n celle nella coda dei record del segmento del thread chiamante:
+ *  se la coda e' piena sveglia il Writer e attende che si liberino. Va chiamata prima di
+ *  acquisire i lock sotto i quali i record vengono poi accodati (Add_reserved), in modo
+ *  che un Writer lento non blocchi chi attende quei lock.
+ * 
+ * 	\param n, numero di celle
  */
-void Close_skt ( int skt) {
-	if (closeSocket (skt) == -1) {
-		perror ("Errore durante la chiusura della socket");
-		exit (EXIT_FAILURE);
+void Reserve_records (int n) {
+	logshard_t * sh = Log_shard ();
+	struct timespec log_wait = { 0, LOGWAIT };
+	
+	for (; n > 0; n--) {
+		if (reserve_logRing (sh->ring) == -1) {
+			sem_post (&(sh->sem));
+			while (reserve_logRing (sh->ring) == -1) {
+				nanosleep (&log_wait, NULL); /* lascio il processore al Writer */
+			}
+		}
 	}
 }
 
-/** Lettura dalla socket gestendo l'errore 
+/** Procedura che annulla n prenotazioni fatte con Reserve_records e non usate
  * 
- *  \param skt, socket da cui leggere
- *  \param msg, messaggio da leggere
- * 
- *   \retval n, numero di byte letti
+ * 	\param n, numero di celle
  */
-int Receive_skt (int skt, message_t * msg) {
-	int n;
+void Cancel_records (int n) {
+	logshard_t * sh = Log_shard ();
 	
-	n = receiveMessage (skt, msg);
-	if (n == -1) {
-		perror (ERROR_RECEIVE_MSG);
-		Close_skt (skt);
-		exit (EXIT_FAILURE);
+	for (; n > 0; n--) {
+		unreserve_logRing (sh->ring);
 	}
-	return n;
 }
 
-/** Scrittura sulla socket gestendo l'errore 
+/** Procedura che accoda, senza lock e senza attese, un record di log in una cella gia'
+ *  prenotata (Reserve_records) nel segmento del thread chiamante: le righe vengono composte
+ *  solo dal Writer del segmento (Write_log), che converte gli id negli username. Il testo
+ *  non viene copiato: il record tiene un riferimento al frame. Il Writer viene svegliato
+ *  dal produttore che porta i byte in attesa oltre log_threshold.
  * 	
- *  \param skt, socket su cui scrivere
- *  \param msg, messaggio da scrivere
- * 
- *  \retval n, numero di byte scritti
+ * 	\param type, tipo del record (LREC_*)
+ * 	\param mit, id del mittente (o dell'utente entrato/uscito)
+ * 	\param dest, id del destinatario
+ * 	\param seq, numero del broadcast (LREC_BCAST, LREC_SKIP)
+ *  \param f, frame con buffer "[mittente] testo" (NULL se il record non ha testo)
  */
-int Send_skt (int skt, message_t * msg) {
-	int n;
+void Add_reserved (int type, usr_id_t mit, usr_id_t dest, unsigned long seq, frame_t * f) {
+	unsigned long n, size;
+	logRec_t rec;
+	logshard_t * sh = Log_shard ();
 	
-	n = sendMessage (skt, msg);
-	if (n == -1) {
-		perror (ERROR_SEND_MSG);
-		Close_skt (skt);
-		exit (EXIT_FAILURE);
+	rec.type = type;
+	rec.mit = mit;
+	rec.dest = dest;
+	rec.seq = seq;
+	rec.f = (f != NULL) ? retainFrame (f) : NULL;
+	size = (f != NULL) ? f->size : sizeof (logRec_t);
+	
+	/* il timbro ordina i record di tutti i segmenti: logmerge ricostruisce da questo l'unico flusso di righe */
+	rec.stamp = (sh->stamped == 1) ? __sync_add_and_fetch (&log_stamp, 1) : 0;
+	
+	/* i byte vengono contati prima dell'inserimento: il Writer li sottrae solo per i record estratti */
+	n = __sync_add_and_fetch (&(sh->bytes), size);
+	
+	putres_logRing (sh->ring, &rec);
+	if (n >= log_threshold && n - size < log_threshold) { /* solo chi supera la soglia sveglia il Writer */
+		sem_post (&(sh->sem));
 	}
-	return n;
 }
 
-/** Funzione restituisce un puntatore al payload di un elemento
- *  della tabella hash con key == username
+/** Procedura che accoda, senza lock, un record di log nel segmento del thread chiamante
+ *  (Add_reserved); se la coda e' piena sveglia il Writer e attende che si liberi una cella.
  * 	
- *  \param username, nome utente da cercare
- *  \retval payload, puntatore al payload
- *  \retval NULL, se non è presente nessun elemento nella tabella hash con chiave username
+ * 	\param type, tipo del record (LREC_*)
+ * 	\param mit, id del mittente (o dell'utente entrato/uscito)
+ * 	\param dest, id del destinatario
+ * 	\param seq, numero del broadcast (LREC_BCAST, LREC_SKIP)
+ *  \param f, frame con buffer "[mittente] testo" (NULL se il record non ha testo)
  */
-field_t * Field_hash_element (char * key) {
-	
-	unsigned int i;
-	list_t ** l;
-	elem_t * elem;
-	field_t * payload;
-
-	i = hash_table->hash (key, hash_table->size); /* indice dell'elemento nella tabella hash in cui è possibile ci sia un elem_t con chiave di valore key */
-	l = (list_t **) (hash_table->table + i); /* ritorna l'indirizzo della i-esima list_t in cui può essere presente la chiave key */
-	if (*l == NULL)
-	{
-		return NULL;	
-	}
-
-	elem = find_ListElement(*l, key);
+void Add_record (int type, usr_id_t mit, usr_id_t dest, unsigned long seq, frame_t * f) {
+	Reserve_records (1);
+	Add_reserved (type, mit, dest, seq, f);
+}
 
+/** Procedura che accoda il record di log di un messaggio consegnato, scritto dal Writer
+ *  come riga "mittente:destinatario:messaggio\n"
+ * 	
+ * 	\param mit_id, id del mittente
+ * 	\param dest_id, id del destinatario
+ *  \param f, frame consegnato (con buffer "[mittente] testo")
+ */
+void Add_string (usr_id_t mit_id, usr_id_t dest_id, frame_t * f) {
+	Add_record (LREC_MSG, mit_id, dest_id, 0, f);
+}
 
-	if (elem == NULL)
-	{
-		return NULL;	
+/** Funzione che scrive n byte su un file, gestendo le scritture parziali
+ * 
+ * 	\param fd, file
+ * 	\param buf, byte da scrivere
+ * 	\param n, numero di byte
+ * 	\retval 0, se tutti i byte sono stati scritti
+ * 	\retval -1, in caso di errore (setta errno)
+ */
+int Write_all (int fd, char * buf, size_t n) {
+	ssize_t k;
+	
+	while (n > 0) {
+		k = write (fd, buf, n);
+		if (k == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		buf += k;
+		n -= k;
 	}
 	
+	return 0;
+}
+
+/** Funzione che aggiunge una riga, data in k pezzi, al buffer del Writer: il buffer viene
+ *  scritto quando non contiene la riga; una riga piu' lunga dell'intero buffer viene scritta a pezzi
+ * 
+ * 	\param fd, file di log
+ * 	\param buf, buffer del Writer
+ * 	\param dim, dimensione del buffer
+ * 	\param used, byte occupati nel buffer (aggiornato)
+ * 	\param piece, pezzi della riga
+ * 	\param len, lunghezza di ogni pezzo
+ * 	\param k, numero di pezzi
+ * 	\retval n, byte scritti sul file
+ * 	\retval -1, in caso di errore di scrittura (setta errno)
+ */
+long Log_line (int fd, char * buf, size_t dim, size_t * used, char ** piece, size_t * len, int k) {
+	int i;
+	size_t tot;
+	long n;
+	
+	for (i = 0, tot = 0; i < k; i++) {
+		tot += len [i];
+	}
 	
-	payload = (field_t *)(elem->payload);
+	n = 0;
+	if (*used + tot > dim) { /* il buffer non contiene la riga: lo scrivo */
+		if (Write_all (fd, buf, *used) == -1) {
+			return -1;
+		}
+		n = *used;
+		*used = 0;
+	}
+	for (i = 0; i < k; i++) {
+		if (tot > dim) { /* riga piu' lunga dell'intero buffer */
+			if (Write_all (fd, piece [i], len [i]) == -1) {
+				return -1;
+			}
+			n += len [i];
+		} else {
+			memcpy (buf + *used, piece [i], len [i]);
+			*used += len [i];
+		}
+	}
 	
-	return payload;
+	return n;
 }
 
-/** [MTX] Procedura che disconnette un thread da un client che desidera
- *  disconnettersi o che si è gia disconnesso, aggiornando la tabella hash
- *  e la lista dei thread attivi.
+/** Procedura che aggiorna gli utenti connessi seguiti dal Writer con un record estratto dalla coda
+ *  (log compatto con rotazione): servono per la fotografia all'inizio di ogni segmento (Log_members)
  * 
- *  \param thread_id, id del thread che chiama la procedura
- *  \param client, username del client da disconnettere
- * 
- * */
-void Disconnect (pthread_t thread_id, char * client, int skt) {
-	field_t payload;
-	pthread_mutex_t * mtx;
-
-	/** ========== Aggiornamento della tabella hash ========== */
-	Lock (&mtx_hash);
+ * 	\param sh, segmento
+ * 	\param rec, record estratto
+ */
+void Track_member (logshard_t * sh, logRec_t * rec) {
+	usr_id_t id = rec->mit;
+	unsigned int n;
 	
-		/* distruzione della variabile mutex */
-		mtx = &((Field_hash_element(client))->mtx);
-		if ( pthread_mutex_destroy(mtx) != 0 ) {
-			fprintf (stderr, "Errore durante la distruzione della variabile mutex");
+	if (rec->type != LREC_JOIN && rec->type != LREC_LEAVE) {
+		return;
+	}
+	if (id >= sh->m_dim) { /* gli id sono densi: raddoppio */
+		for (n = (sh->m_dim == 0) ? NFCHUNK : sh->m_dim; n <= id; n *= 2);
+		sh->m_prev = realloc (sh->m_prev, n * sizeof (usr_id_t));
+		sh->m_next = realloc (sh->m_next, n * sizeof (usr_id_t));
+		if (sh->m_prev == NULL || sh->m_next == NULL) {
+			perror ("Errore durante la scrittura sul file di log");
 			exit (EXIT_FAILURE);
 		}
-		/* rimuovo e reinserisco l'elemento con payload = -1 */
-		if (remove_hashElement (hash_table, client)  == -1) {
-			perror ("Errore durante l'aggiornamento della tabella hash");
-			exit (EXIT_FAILURE);
+		sh->m_dim = n;
+	}
+	
+	/* stesse operazioni di Add_user e Remove_user, nell'ordine in cui sono state registrate */
+	if (rec->type == LREC_JOIN) {
+		sh->m_prev [id] = sh->m_tail;
+		sh->m_next [id] = NO_USER;
+		if (sh->m_tail == NO_USER) {
+			sh->m_head = id;
+		} else {
+			sh->m_next [sh->m_tail] = id;
 		}
-		payload.skt = -1;	
-		if (add_hashElement (hash_table, client, &payload) == -1) {
-			perror ("Errore durante l'aggiornamento della tabella hash");
-			exit (EXIT_FAILURE);
+		sh->m_tail = id;
+	} else {
+		if (sh->m_prev [id] == NO_USER) {
+			sh->m_head = sh->m_next [id];
+		} else {
+			sh->m_next [sh->m_prev [id]] = sh->m_next [id];
 		}
+		if (sh->m_next [id] == NO_USER) {
+			sh->m_tail = sh->m_prev [id];
+		} else {
+			sh->m_prev [sh->m_next [id]] = sh->m_prev [id];
+		}
+	}
+}
+
+/** Funzione che scrive sul file di log i record presenti nella coda di un segmento, nell'ordine
+ *  in cui sono stati accodati, e rilascia i rispettivi frame (chiamata solo dal Writer del segmento).
+ *  Le righe vengono composte nel buffer del Writer, che viene scritto con una sola write
+ *  quando e' pieno: nessun lock, nessuna allocazione. Nei segmenti ogni riga e' preceduta
+ *  dal timbro di sequenza e da uno spazio.
+ * 
+ * 	\param sh, segmento
+ * 	\param fd, file di log
+ * 	\param buf, buffer del Writer
+ * 	\param dim, dimensione del buffer
+ * 	\retval n, numero di byte scritti
+ * 	\retval -1, in caso di errore di scrittura (setta errno)
+ */
+long Write_log (logshard_t * sh, int fd, char * buf, size_t dim) {
+	int i, k;
+	size_t used;
+	long tot, n;
+	unsigned long drained;
+	char seq [24];
+	char stamp [24];
+	char * mit;
+	char * piece [7];
+	size_t len [7];
+	logRec_t rec;
 	
-		/** ========== Rimozione del client dall'array dei client connessi ==========*/
-		Lock (&mtx_users);
-			Remove_user (client);
-		Unlock (&mtx_users);
+	if (sh->out != NULL) {
+		return Write_binlog (sh, fd, buf, dim);
+	}
+	
+	for (used = 0, tot = 0, drained = 0, n = 0; n != -1 && get_logRing (sh->ring, &rec) == 0; ) {
+		if (sh->members == 1) {
+			Track_member (sh, &rec);
+		}
+		mit = User_name (rec.mit);
+		k = 0;
+		
+		if (sh->stamped == 1) { /* "timbro " */
+			sprintf (stamp, "%lu ", rec.stamp);
+			piece [k++] = stamp;
+		}
+		
+		switch (rec.type) {
+			case LREC_MSG: /* "mittente:destinatario:testo" */
+				piece [k++] = mit;
+				piece [k++] = ":";
+				piece [k++] = User_name (rec.dest);
+				piece [k++] = ":";
+				break;
+			case LREC_BCAST: /* "*seq:mittente:testo" */
+				sprintf (seq, "*%lu:", rec.seq);
+				piece [k++] = seq;
+				piece [k++] = mit;
+				piece [k++] = ":";
+				break;
+			case LREC_JOIN: /* "+utente" */
+				piece [k++] = "+";
+				piece [k++] = mit;
+				break;
+			case LREC_LEAVE: /* "-utente" */
+				piece [k++] = "-";
+				piece [k++] = mit;
+				break;
+			case LREC_SKIP: /* "~seq:destinatario" */
+				sprintf (seq, "~%lu:", rec.seq);
+				piece [k++] = seq;
+				piece [k++] = User_name (rec.dest);
+				break;
+		}
+		if (rec.f != NULL) { /* buffer "[mittente] testo": + 3 per '[', ']', ' ' */
+			piece [k++] = rec.f->data + sizeof (unsigned int) + 1 + strlen (mit) + 3;
+		}
+		piece [k++] = "\n";
+		for (i = 0; i < k; i++) {
+			len [i] = strlen (piece [i]);
+		}
 		
-		Close_skt (skt); /* chiusura della socket */
+		n = Log_line (fd, buf, dim, &used, piece, len, k);
+		if (n > 0) {
+			tot += n;
+		}
 		
-	Unlock (&mtx_hash);
-	
+		drained += (rec.f != NULL) ? rec.f->size : sizeof (logRec_t);
+		releaseFrame (rec.f);
+	}
+	if (n != -1 && used > 0) {
+		n = (Write_all (fd, buf, used) == -1) ? -1 : 0;
+		tot += used;
+	}
+	__sync_sub_and_fetch (&(sh->bytes), drained);
 	
-	/** ========= Aggiornamento della lista dei thread attivi ========== */
-	Remove_thread_list (thread_id);
+	return (n == -1) ? -1 : tot;
 }
 
-/** Procedura che distrugge la tabella hash rimuovendo evenutali variabili
- *  di tipo pthread_mutex_t presenti nei payload degli elementi della tabella hash
+/** Funzione che aggiunge un record binario (intestazione, testo, riempimento) al buffer del Writer
  * 
+ * 	\param sh, segmento
+ * 	\param fd, file di log
+ * 	\param buf, buffer del Writer
+ * 	\param dim, dimensione del buffer
+ * 	\param used, byte occupati nel buffer (aggiornato)
+ * 	\param type, mit, dest, seq, stamp, time, campi del record
+ * 	\param text, testo del record (non terminato da '\0')
+ * 	\param len, lunghezza del testo
+ * 	\retval n, byte scritti sul file
+ * 	\retval -1, in caso di errore (setta errno)
  */
-void Destroy_hash () {
-	
-	list_t ** l;
-	elem_t * tmp;
-	elem_t * p;
-	unsigned int i;
+long Bin_record (logshard_t * sh, int fd, char * buf, size_t dim, size_t * used, unsigned int type, usr_id_t mit,
+		usr_id_t dest, unsigned long seq, unsigned long stamp, unsigned long long time, char * text, size_t len) {
+	static char zero [8] = {0};
+	mlogHdr_t h;
+	char * piece [3];
+	size_t plen [3];
+	int pad;
 	
+	pad = rec_mlogOut (sh->out, &h, type, mit, dest, seq, stamp, time, len);
+	if (pad == -1) {
+		return -1;
+	}
+	piece [0] = (char *) &h;
+	plen [0] = sizeof (mlogHdr_t);
+	piece [1] = text;
+	plen [1] = len;
+	piece [2] = zero;
+	plen [2] = pad;
 	
-		if (hash_table == NULL) /* *pt non punta a nessuna tabella hash */
-		return;
+	return Log_line (fd, buf, dim, used, piece, plen, 3);
+}
 
-		for(i = 0; i < ((hash_table)->size); i++)
-		{
-			l = (list_t **) ((hash_table)->table + i); /* l continene l'indirizzo dell'i-esimo elemento (i-esima lista) della tabella hash */
-			
-			if (*l != NULL) {
-				
-				p = (*l)->head;
-				
-				while (p != NULL) {	/* scorro la lista e libero la memoria di ogni elemento */
-					tmp = p->next;
-					
-					if ( ( ((field_t *)(p->payload))->skt ) > -1) { /* se il client è connesso */
-						
-						/* chiudo la socket */
-						Close_skt ( ( ((field_t *)(p->payload))->skt ) );
-					
-						if ( pthread_mutex_destroy ( &( (field_t *) (p->payload))->mtx  ) != 0 ) { /* distruggo la mutex */
-							fprintf (stderr, "Errore durante la distruzione della variabile mutex");
-							exit (EXIT_FAILURE);
-						}
-					}
-					
-					
-					
-					free (p->payload);
-					free (p->key);
-					free (p);
-					
-					p = tmp;
+/** Funzione che scrive sul file di log binario i record accodati in un segmento (chiamata da
+ *  Write_log se il log e' binario): gli id compaiono nel file preceduti, la prima volta,
+ *  dal loro username; tutti i record estratti insieme hanno lo stesso istante di scrittura.
+ * 
+ * 	\param sh, segmento
+ * 	\param fd, file di log
+ * 	\param buf, buffer del Writer
+ * 	\param dim, dimensione del buffer
+ * 	\retval n, numero di byte scritti
+ * 	\retval -1, in caso di errore (setta errno)
+ */
+long Write_binlog (logshard_t * sh, int fd, char * buf, size_t dim) {
+	int i, k, r;
+	size_t used, len;
+	long tot, n;
+	unsigned long drained;
+	unsigned long long now;
+	usr_id_t id [2];
+	char * mit;
+	char * text;
+	logRec_t rec;
+	struct timespec ts;
+	
+	/* un solo istante per tutto il gruppo di record: la granularita' e' l'attesa del Writer */
+	clock_gettime (CLOCK_REALTIME, &ts);
+	now = (unsigned long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+	
+	for (used = 0, tot = 0, drained = 0, n = 0; n != -1 && get_logRing (sh->ring, &rec) == 0; ) {
+		if (sh->members == 1) {
+			Track_member (sh, &rec);
+		}
+		mit = User_name (rec.mit);
+		
+		/* username dei nuovi id del segmento */
+		id [0] = rec.mit;
+		id [1] = rec.dest;
+		k = (rec.dest != rec.mit) ? 2 : 1;
+		for (i = 0; i < k && n != -1; i++) {
+			r = known_mlogOut (sh->out, id [i]);
+			if (r == -1) {
+				n = -1;
+			} else if (r == 0) {
+				text = User_name (id [i]);
+				n = Bin_record (sh, fd, buf, dim, &used, MLOG_USER, id [i], id [i], 0, 0, now, text, strlen (text));
+				if (n > 0) {
+					tot += n;
 				}
 			}
-			free (*l);
-			*l = NULL;
 		}
-		free ((hash_table)->table);
-		free (hash_table);
-		hash_table = NULL;
 		
+		if (n != -1) {
+			text = "";
+			len = 0;
+			if (rec.f != NULL) { /* buffer "[mittente] testo": + 3 per '[', ']', ' ' */
+				text = rec.f->data + sizeof (unsigned int) + 1 + strlen (mit) + 3;
+				len = strlen (text);
+			}
+			n = Bin_record (sh, fd, buf, dim, &used, rec.type, rec.mit, rec.dest, rec.seq, rec.stamp, now, text, len);
+			if (n > 0) {
+				tot += n;
+			}
+		}
+		
+		drained += (rec.f != NULL) ? rec.f->size : sizeof (logRec_t);
+		releaseFrame (rec.f);
+	}
+	if (n != -1 && used > 0) {
+		n = (Write_all (fd, buf, used) == -1) ? -1 : 0;
+		tot += used;
+	}
+	__sync_sub_and_fetch (&(sh->bytes), drained);
 	
-	
+	return (n == -1) ? -1 : tot;
 }
 
-/** Funzione che restituisce un puntatore alla stringa (destinatario) a cui spedire il messaggio.
- * 	A ritorno della funzione, msg è la struttura che deve essere effettivamente 
- *  inviata al destinatario.
- * 
- * 	\param msg, struttura da manipolare per ottenere il destinatario e da modificare
- * 				affinche, al ritorno dalla funzione, msg contenga la struttura da inviare
- * 				tramite una Send_skt
- *  \param mit, mittente del messaggio
+/** Funzione che scrive l'intestazione di un nuovo file di log binario (non fa nulla se il log e' testuale)
  * 
- *	\reval dest, puntatore alla stringa che continene l username del destinatario
- * 				 (allocato all interno della funzione)
+ * 	\param sh, segmento
+ * 	\param fd, file di log (vuoto)
+ * 	\retval 0, in caso di successo
+ * 	\retval -1, in caso di errore di scrittura (setta errno)
  */
-char * Divide_to_one ( message_t * msg, char * mit ) {
-	int i, j;
-	char * dest; /* username del destinatario */
-	char * tmp_buffer; /* buffer temporaneo che conterrà il messaggio effettivo (senza il destinatario) */
+int Begin_binlog (logshard_t * sh, int fd) {
+	mlogHead_t head;
+	size_t n;
 	
-	dest = malloc ( sizeof (char) * (  strlen (msg->buffer) + 1 )  );
-			
-	sprintf (dest, "%s", msg->buffer);
-						
+	if (sh->out == NULL) {
+		return 0;
+	}
+	n = head_mlogOut (sh->out, &head);
+	
+	return Write_all (fd, (char *) &head, n);
+}
+
+/** Funzione che chiude un file di log binario scrivendo dizionario, indice sparso e coda
+ *  (non fa nulla se il log e' testuale); va chiamata dopo l'ultima Write_log
+ * 
+ * 	\param sh, segmento
+ * 	\param fd, file di log
+ * 	\param buf, buffer del Writer
+ * 	\param dim, dimensione del buffer
+ * 	\retval 0, in caso di successo
+ * 	\retval -1, in caso di errore (setta errno)
+ */
+int End_binlog (logshard_t * sh, int fd, char * buf, size_t dim) {
+	unsigned int i;
+	size_t used, len, tot;
+	char * names;
+	char * name;
+	mlogTail_t tail;
+	mlogOut_t * o = sh->out;
+	
+	if (o == NULL) {
+		return 0;
+	}
+	
+	/* dizionario: coppie (id, username con '\0') */
+	for (i = 0, tot = 0; i < o->n_ids; i++) {
+		tot += sizeof (unsigned int) + strlen (User_name (o->ids [i])) + 1;
+	}
+	names = malloc (tot + 1);
+	if (names == NULL) {
+		return -1;
+	}
+	for (i = 0, len = 0; i < o->n_ids; i++) {
+		name = User_name (o->ids [i]);
+		memcpy (names + len, &(o->ids [i]), sizeof (unsigned int));
+		len += sizeof (unsigned int);
+		strcpy (names + len, name);
+		len += strlen (name) + 1;
+	}
+	
+	used = 0;
+	tail.names = o->off;
+	memcpy (tail.magic, MLOG_TMAGIC, sizeof (tail.magic));
+	if (Bin_record (sh, fd, buf, dim, &used, MLOG_NAMES, 0, 0, 0, 0, 0, names, tot) == -1 ||
+		Bin_record (sh, fd, buf, dim, &used, MLOG_INDEX, 0, 0, 0, 0, 0, (char *) o->idx, o->n_idx * sizeof (mlogIdx_t)) == -1 ||
+		Write_all (fd, buf, used) == -1 || Write_all (fd, (char *) &tail, sizeof (mlogTail_t)) == -1) {
+		free (names);
+		return -1;
+	}
+	free (names);
+	
+	return 0;
+}
+
+/** Funzione che scrive all'inizio di un nuovo segmento del log compatto la fotografia degli utenti
+ *  connessi seguiti dal Writer (un record LREC_MEMBERS e un LREC_JOIN per ogni connesso): ogni
+ *  segmento ruotato si espande da solo, e chi li concatena riparte dalla fotografia. Il record
+ *  LREC_MEMBERS porta il numero dell'ultimo broadcast, da cui riparte un nuovo avvio (Last_bcast)
+ * 
+ * 	\param sh, segmento
+ * 	\param fd, file di log (appena aperto)
+ * 	\param buf, buffer del Writer
+ * 	\param dim, dimensione del buffer
+ * 	\retval n, numero di byte scritti
+ * 	\retval -1, in caso di errore (setta errno)
+ */
+long Log_members (logshard_t * sh, int fd, char * buf, size_t dim) {
+	size_t used;
+	long tot, n;
+	usr_id_t id;
+	char * name;
+	char * piece [3];
+	size_t len [3];
+	char seq [24];
+	unsigned long last;
+	unsigned long long now;
+	struct timespec ts;
+	
+	clock_gettime (CLOCK_REALTIME, &ts);
+	now = (unsigned long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+	
+	/* i record gia' scritti hanno un numero assegnato prima di questa lettura: nessuno lo supera */
+	last = __sync_fetch_and_add (&bcast_seq, 0);
+	
+	used = 0;
+	if (sh->out != NULL) {
+		n = Bin_record (sh, fd, buf, dim, &used, LREC_MEMBERS, 0, 0, last, 0, now, "", 0);
+	} else { /* "=seq" */
+		sprintf (seq, "=%lu\n", last);
+		piece [0] = seq;
+		len [0] = strlen (seq);
+		n = Log_line (fd, buf, dim, &used, piece, len, 1);
+	}
+	tot = (n > 0) ? n : 0;
+	
+	for (id = sh->m_head; id != NO_USER && n != -1; id = sh->m_next [id]) {
+		name = User_name (id);
+		if (sh->out != NULL) { /* il segmento e' nuovo: il dizionario e' vuoto */
+			n = known_mlogOut (sh->out, id);
+			if (n == 0) {
+				n = Bin_record (sh, fd, buf, dim, &used, MLOG_USER, id, id, 0, 0, now, name, strlen (name));
+			}
+			if (n != -1) {
+				tot += n;
+				n = Bin_record (sh, fd, buf, dim, &used, LREC_JOIN, id, id, 0, 0, now, "", 0);
+			}
+		} else {
+			piece [0] = "+";
+			piece [1] = name;
+			piece [2] = "\n";
+			len [0] = 1;
+			len [1] = strlen (name);
+			len [2] = 1;
+			n = Log_line (fd, buf, dim, &used, piece, len, 3);
+		}
+		if (n > 0) {
+			tot += n;
+		}
+	}
+	if (n != -1 && used > 0) {
+		n = (Write_all (fd, buf, used) == -1) ? -1 : 0;
+		tot += used;
+	}
+	
+	return (n == -1) ? -1 : tot;
+}
+
+/** Funzione che cerca il numero dell'ultimo broadcast registrato nel file di log attivo lasciato
+ *  da un'esecuzione precedente (log compatto con rotazione): il file inizia con la fotografia
+ *  degli utenti connessi, che porta il numero raggiunto all'apertura, e i segmenti chiusi
+ *  prima di esso non possono contenere numeri maggiori
+ * 
+ * 	\param sh, segmento
+ * 	\retval n, numero dell'ultimo broadcast (0 se il file non c'e' o non ne contiene)
+ */
+unsigned long Last_bcast (logshard_t * sh) {
+	FILE * fp;
+	mlog_t * l;
+	mlogHdr_t * h;
+	char * line = NULL;
+	size_t dim = 0;
+	unsigned long n, max = 0;
+	
+	if (sh->out != NULL) {
+		l = open_mlog (sh->file);
+		if (l == NULL) {
+			return 0;
+		}
+		for (h = first_mlog (l, 0); h != NULL; h = next_mlog (l, h)) {
+			if ((h->type == LREC_BCAST || h->type == LREC_SKIP || h->type == LREC_MEMBERS) && h->seq > max) {
+				max = h->seq;
+			}
+		}
+		close_mlog (&l);
+		return max;
+	}
+	
+	fp = fopen (sh->file, "r");
+	if (fp == NULL) {
+		return 0;
+	}
+	/* righe "*seq:mittente:testo", "~seq:destinatario" e "=seq" (il log compatto ruotato non ha timbri) */
+	while (getline (&line, &dim, fp) != -1) {
+		if (line [0] == '*' || line [0] == '~' || line [0] == '=') {
+			n = strtoul (line + 1, NULL, 10);
+			if (n > max) {
+				max = n;
+			}
+		}
+	}
+	free (line);
+	fclose (fp);
+	
+	return max;
+}
+
+/** Funzione che cerca i segmenti chiusi di un file di log ("file.n" e "file.n.gz")
+ *  ed elimina quelli con numero minore di below
+ * 
+ * 	\param file, file di log attivo
+ * 	\param below, numero del segmento piu' vecchio da tenere (0 per non eliminare nulla)
+ * 	\retval n, numero del segmento piu' recente (0 se non ce ne sono)
+ */
+unsigned long Scan_segments (char * file, unsigned long below) {
+	DIR * d;
+	struct dirent * e;
+	char * dir;
+	char * base;
+	char * end;
+	char * slash = strrchr (file, '/');
+	size_t len;
+	unsigned long n, max = 0;
+	
+	dir = (slash == NULL) ? strdup (".") : strndup (file, slash - file + 1);
+	if (dir == NULL) {
+		return 0;
+	}
+	base = (slash == NULL) ? file : slash + 1;
+	len = strlen (base);
+	
+	d = opendir (dir);
+	if (d == NULL) {
+		free (dir);
+		return 0;
+	}
+	while ((e = readdir (d)) != NULL) {
+		/* "base.n" oppure "base.n.gz" */
+		if (strncmp (e->d_name, base, len) != 0 || e->d_name [len] != '.' || !isdigit ((unsigned char) e->d_name [len + 1])) {
+			continue;
+		}
+		n = strtoul (e->d_name + len + 1, &end, 10);
+		if (*end != '\0' && strcmp (end, ".gz") != 0) {
+			continue;
+		}
+		if (n > max) {
+			max = n;
+		}
+		if (n < below) {
+			Remove_segment (file, n);
+		}
+	}
+	closedir (d);
+	free (dir);
+	
+	return max;
+}
+
+/** Procedura che elimina un segmento chiuso del file di log (compresso o no) e i suoi indici
+ * 
+ * 	\param file, file di log attivo
+ * 	\param n, numero del segmento
+ */
+void Remove_segment (char * file, unsigned long n) {
+	char * name = malloc (strlen (file) + 32);
+	
+	if (name == NULL) {
+		return;
+	}
+	sprintf (name, "%s.%lu.sidx", file, n);
+	unlink (name);
+	sprintf (name, "%s.%lu.qidx", file, n);
+	unlink (name);
+	sprintf (name, "%s.%lu.gz", file, n);
+	unlink (name);
+	sprintf (name, "%s.%lu", file, n);
+	unlink (name);
+	free (name);
+}
+
+/** Funzione che comprime un segmento chiuso con gzip (in un processo figlio, attendendone la fine)
+ * 
+ * 	\param name, segmento
+ * 	\retval 0, se il segmento e' stato compresso
+ * 	\retval -1, in caso di errore
+ */
+int Gzip_segment (char * name) {
+	pid_t pid;
+	int status;
+	
+	pid = fork ();
+	if (pid == -1) {
+		return -1;
+	}
+	if (pid == 0) {
+		execlp ("gzip", "gzip", "-f", "-q", name, (char *) NULL);
+		_exit (127);
+	}
+	while (waitpid (pid, &status, 0) == -1) {
+		if (errno != EINTR) {
+			return -1;
+		}
+	}
+	
+	return (WIFEXITED (status) && WEXITSTATUS (status) == 0) ? 0 : -1;
+}
+
+/** [MTX] Procedura che accoda un segmento chiuso per l'Archiver
+ * 
+ * 	\param cq, coda dei segmenti chiusi
+ * 	\param c, segmento
+ */
+void Push_closed (closedq_t * cq, closed_t * c) {
+	c->next = NULL;
+	Lock (&(cq->mtx));
+		if (cq->head == NULL) {
+			cq->head = c;
+		} else {
+			cq->tail->next = c;
+		}
+		cq->tail = c;
+		pthread_cond_signal (&(cq->cond));
+	Unlock (&(cq->mtx));
+}
+
+/** [MTX] Funzione che estrae il prossimo segmento chiuso, attendendo se la coda e' vuota (punto di cancellazione)
+ * 
+ * 	\param cq, coda dei segmenti chiusi
+ * 	\retval c, segmento
+ */
+closed_t * Pop_closed (closedq_t * cq) {
+	closed_t * c;
+	
+	Lock (&(cq->mtx));
+	pthread_cleanup_push ( Cleanup_unlock, &(cq->mtx) );
+		while (cq->head == NULL) {
+			pthread_cond_wait (&(cq->cond), &(cq->mtx));
+		}
+		c = cq->head;
+		cq->head = c->next;
+		if (cq->head == NULL) {
+			cq->tail = NULL;
+		}
+	pthread_cleanup_pop (1);
+	
+	return c;
+}
+
+/** [MTX] Aggiunge un thread alla lista dei thread attivi
+
+    \param thread_id identificatore del thread
+    \param type tipolologia del thread (Dispatcher, Worker, Writer)
+ */
+void Add_thread_list (pthread_t thread_id, char * type) {
+	int err;
+	
+	Lock (&mtx_thread);
+		err = add_ListElement (thread_list, &thread_id, type);
+	
+		if (err == -1) {
+			perror ("Errore durante l'aggiunta del thread alla lista dei thread attivi");
+			exit (EXIT_FAILURE);
+		}
+	Unlock (&mtx_thread);
+}
+
+/** [MTX] Rimuove un thread alla lista dei thread attivi (usato esclusivamente dai thread worker)
+
+    \param thread_id identificatore del thread
+ */
+void Remove_thread_list (pthread_t thread_id) {
+	int err;
+	
+	Lock (&mtx_thread);
+		err = remove_ListElement (thread_list, &thread_id);
+	
+		if (err == -1) {
+			perror ("Errore durante la rimozione del thread nella lista dei thread attivi");
+			exit (EXIT_FAILURE);
+		}
+		
+		/* decremento il numero di worker attivi */
+		Lock (&mtx_n);
+			n_worker--;
+		Unlock (&mtx_n);
+		
+	Unlock (&mtx_thread);
+}
+
+/**  Chiude la socket gestendo l'errore
+ *   \param skt, socket da chiudere
+ */
+void Close_skt ( int skt) {
+	if (closeSocket (skt) == -1) {
+		perror ("Errore durante la chiusura della socket");
+		exit (EXIT_FAILURE);
+	}
+}
+
+/** Lettura dalla socket gestendo l'errore 
+ * 
+ *  \param skt, socket da cui leggere
+ *  \param msg, messaggio da leggere
+ * 
+ *   \retval n, numero di byte letti
+ */
+int Receive_skt (int skt, message_t * msg) {
+	int n;
+	
+	n = receiveMessage (skt, msg);
+	if (n == -1) {
+		perror (ERROR_RECEIVE_MSG);
+		Close_skt (skt);
+		exit (EXIT_FAILURE);
+	}
+	return n;
+}
+
+/** Lettura dalla socket, tramite il buffer di ingresso della connessione, gestendo l'errore 
+ * 
+ *  \param skt, socket da cui leggere
+ *  \param b, buffer di ingresso associato alla socket
+ *  \param msg, messaggio da leggere
+ * 
+ *   \retval n, numero di byte letti
+ */
+int Receive_buf_skt (int skt, msgbuf_t * b, message_t * msg) {
+	int n;
+	
+	n = receiveBufferedMessage (skt, b, msg);
+	if (n == -1) {
+		perror (ERROR_RECEIVE_MSG);
+		Close_skt (skt);
+		exit (EXIT_FAILURE);
+	}
+	return n;
+}
+
+/** Scrittura sulla socket gestendo l'errore 
+ * 	
+ *  \param skt, socket su cui scrivere
+ *  \param msg, messaggio da scrivere
+ * 
+ *  \retval n, numero di byte scritti
+ */
+int Send_skt (int skt, message_t * msg) {
+	int n;
+	
+	n = sendMessage (skt, msg);
+	if (n == -1) {
+		perror (ERROR_SEND_MSG);
+		Close_skt (skt);
+		exit (EXIT_FAILURE);
+	}
+	return n;
+}
+
+/** [MTX] Funzione che restituisce la coda di uscita di un utente appena connesso.
+ *  Le code delle sessioni terminate vengono riciclate (vedi Release_queue):
+ *  una nuova coda viene allocata solo se non ce ne sono di libere.
+ * 
+ * 	\param skt, socket dell'utente
+ * 	\retval q, coda vuota (con un riferimento, quello della sessione)
+ */
+outq_t * New_queue (int skt) {
+	outq_t * q;
+	
+	Lock (&mtx_qpool);
+		q = free_queues;
+		if (q != NULL) {
+			free_queues = q->next;
+		}
+	Unlock (&mtx_qpool);
+	
+	if (q == NULL) {
+		q = calloc (1, sizeof (outq_t));
+		if (q == NULL) {
+			perror ("Errore durante la creazione della coda di uscita");
+			exit (EXIT_FAILURE);
+		}
+		if (pthread_mutex_init (&(q->mtx), NULL) != 0 || pthread_cond_init (&(q->space), NULL) != 0) {
+			fprintf (stderr, "Errore nell inizializzazione della coda di uscita");
+			exit (EXIT_FAILURE);
+		}
+	}
+	
+	/* la coda riciclata e' gia' vuota (Discard_queue): azzero solo lo stato della sessione */
+	q->skt = skt;
+	q->refs = 1;
+	q->closed = 0;
+	q->pending = 0;
+	q->max_depth = 0;
+	q->max_bytes = 0;
+	q->dropped = 0;
+	q->kicked = 0;
+	q->next = NULL;
+	
+	return q;
+}
+
+/** Funzione che restituisce un elemento libero della coda, allocandolo solo se la coda
+ *  non ne ha (coda gia' in mutua esclusione)
+ * 
+ * 	\param q, coda
+ * 	\retval p, elemento
+ */
+outfrm_t * Get_outfrm (outq_t * q) {
+	outfrm_t * p = q->spare;
+	
+	if (p != NULL) {
+		q->spare = p->next;
+		return p;
+	}
+	p = malloc (sizeof (outfrm_t));
+	if (p == NULL) {
+		perror ("Errore durante l'accodamento di un messaggio");
+		exit (EXIT_FAILURE);
+	}
+	
+	return p;
+}
+
+/** Procedura che rilascia il frame di un elemento della coda e lo rimette tra quelli
+ *  liberi della coda (coda gia' in mutua esclusione): gli elementi liberi non superano
+ *  il massimo numero di frame mai presenti insieme nella coda
+ * 
+ * 	\param q, coda
+ * 	\param p, elemento
+ */
+void Put_outfrm (outq_t * q, outfrm_t * p) {
+	releaseFrame (p->f);
+	p->next = q->spare;
+	q->spare = p;
+}
+
+/** Procedura che scarta tutti i frame presenti nella coda (coda gia' in mutua esclusione)
+ * 
+ * 	\param q, coda da svuotare
+ */
+void Discard_queue (outq_t * q) {
+	outfrm_t * p;
+	
+	while (q->head != NULL) {
+		p = q->head;
+		q->head = p->next;
+		Put_outfrm (q, p);
+	}
+	q->tail = NULL;
+	q->off = 0;
+	q->depth = 0;
+	q->bytes = 0;
+}
+
+/** [MTX] Procedura che rilascia un riferimento alla coda; se era l'ultimo la coda
+ *  viene svuotata e rimessa tra quelle libere, per essere riusata da un'altra sessione
+ * 
+ * 	\param q, coda
+ */
+void Release_queue (outq_t * q) {
+	if (__sync_sub_and_fetch (&(q->refs), 1) > 0) {
+		return;
+	}
+	Discard_queue (q);
+	
+	Lock (&mtx_qpool);
+		q->next = free_queues;
+		free_queues = q;
+	Unlock (&mtx_qpool);
+}
+
+/** Procedura che dealloca le code libere (usata alla terminazione del server)
+ */
+void Destroy_queues () {
+	outq_t * q;
+	outfrm_t * p;
+	
+	while (free_queues != NULL) {
+		q = free_queues;
+		free_queues = q->next;
+		while (q->spare != NULL) {
+			p = q->spare;
+			q->spare = p->next;
+			free (p);
+		}
+		if ( pthread_mutex_destroy (&(q->mtx)) != 0 || pthread_cond_destroy (&(q->space)) != 0 ) {
+			fprintf (stderr, "Errore durante la distruzione della coda di uscita");
+			exit (EXIT_FAILURE);
+		}
+		free (q);
+	}
+}
+
+/** [MTX] Procedura che termina la sessione associata alla coda: scarta i frame non inviati,
+ *  chiude la socket e risveglia eventuali mittenti in attesa di spazio
+ * 
+ * 	\param q, coda
+ */
+void Close_queue (outq_t * q) {
+	Lock (&(q->mtx));
+		q->closed = 1;
+		Discard_queue (q);
+		Close_skt (q->skt); /* chiusura della socket (in mutua esclusione con le scritture) */
+		pthread_cond_broadcast (&(q->space));
+	Unlock (&(q->mtx));
+}
+
+/** Procedura che scrive sulla socket, senza bloccarsi, quanti piu' frame possibile
+ *  (con una sola sendmsg per al piu' NIOV frame). Coda gia' in mutua esclusione.
+ * 
+ * 	\param q, coda da svuotare
+ * 	\retval 0, se la coda e' vuota o la socket non e' pronta in scrittura
+ * 	\retval SEOF, se il destinatario non e' piu' raggiungibile (la coda viene chiusa)
+ */
+int Flush_queue (outq_t * q) {
+	int i, n;
+	outfrm_t * p;
+	struct iovec iov [NIOV];
+	struct msghdr mh;
+	
+	while (q->head != NULL && q->closed == 0) {
+		
+		/* il primo frame puo' essere gia' stato inviato in parte */
+		iov [0].iov_base = q->head->f->data + q->off;
+		iov [0].iov_len = q->head->f->size - q->off;
+		for (i = 1, p = q->head->next; i < NIOV && p != NULL; i++, p = p->next) {
+			iov [i].iov_base = p->f->data;
+			iov [i].iov_len = p->f->size;
+		}
+		
+		memset (&mh, 0, sizeof (mh));
+		mh.msg_iov = iov;
+		mh.msg_iovlen = i;
+		
+		n = sendmsg (q->skt, &mh, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (n == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				return 0;
+			}
+			/* il destinatario non e' piu' raggiungibile: sara' il suo thread a disconnetterlo */
+			q->closed = 1;
+			Discard_queue (q);
+			pthread_cond_broadcast (&(q->space));
+			return SEOF;
+		}
+		
+		/* elimino dalla coda i frame inviati per intero */
+		q->since = time (NULL);
+		q->bytes -= n;
+		while (q->head != NULL && n >= q->head->f->size - q->off) {
+			n -= q->head->f->size - q->off;
+			p = q->head;
+			q->head = p->next;
+			q->off = 0;
+			q->depth--;
+			Put_outfrm (q, p);
+		}
+		if (q->head == NULL) {
+			q->tail = NULL;
+		} else {
+			q->off += n;
+		}
+		pthread_cond_broadcast (&(q->space));
+	}
+	
+	return 0;
+}
+
+/** Procedura che chiude la sessione di un destinatario lento secondo la politica
+ *  configurata, o di un utente non piu' autorizzato (coda gia' in mutua esclusione).
+ *  La socket non viene chiusa ma solo interrotta con shutdown: sara' il thread che serve
+ *  il client a leggere la fine della comunicazione e a disconnetterlo normalmente.
+ * 
+ * 	\param q, coda del destinatario
+ * 	\param kicked, 1 se il destinatario era troppo lento, 0 se non e' piu' autorizzato
+ */
+void Shutdown_queue (outq_t * q, int kicked) {
+	q->closed = 1;
+	q->kicked = kicked;
+	q->dropped += q->depth;
+	Discard_queue (q);
+	shutdown (q->skt, SHUT_RDWR);
+	pthread_cond_broadcast (&(q->space));
+}
+
+/** Funzione che verifica se un destinatario non riceve nulla da almeno q_secs secondi
+ *  pur avendo frame in coda (coda gia' in mutua esclusione)
+ * 
+ * 	\param q, coda del destinatario
+ * 	\retval 1, se il destinatario e' bloccato da troppo tempo
+ * 	\retval 0, altrimenti
+ */
+int Stalled_queue (outq_t * q) {
+	return (q_secs > 0 && q->head != NULL && time (NULL) - q->since >= q_secs);
+}
+
+/** Funzione che scarta il frame piu' vecchio della coda non ancora inviato, neanche
+ *  in parte (coda gia' in mutua esclusione)
+ * 
+ * 	\param q, coda del destinatario
+ * 	\retval 1, se e' stato scartato un frame
+ * 	\retval 0, se in coda c'e' solo un frame gia' inviato in parte
+ */
+int Drop_oldest (outq_t * q) {
+	outfrm_t * p;
+	
+	if (q->off == 0) { /* il primo frame non e' ancora stato inviato */
+		p = q->head;
+		q->head = p->next;
+		if (q->head == NULL) {
+			q->tail = NULL;
+		}
+	} else {
+		p = q->head->next;
+		if (p == NULL) {
+			return 0;
+		}
+		q->head->next = p->next;
+		if (q->tail == p) {
+			q->tail = q->head;
+		}
+	}
+	
+	q->depth--;
+	q->bytes -= p->f->size;
+	q->dropped++;
+	Put_outfrm (q, p);
+	
+	return 1;
+}
+
+/** [MTX] Procedura che affida la coda al Flusher (coda gia' in mutua esclusione)
+ * 
+ * 	\param q, coda con frame in attesa che la socket sia pronta in scrittura
+ */
+void Pending_queue (outq_t * q) {
+	char c = 0;
+	
+	q->pending = 1;
+	__sync_add_and_fetch (&(q->refs), 1); /* riferimento del Flusher */
+	
+	Lock (&mtx_flush);
+		if (n_flush == dim_flush) {
+			dim_flush = (dim_flush == 0) ? 16 : 2 * dim_flush;
+			flush_list = realloc (flush_list, dim_flush * sizeof (outq_t *));
+			if (flush_list == NULL) {
+				perror ("Errore durante l'espansione della lista del Flusher");
+				exit (EXIT_FAILURE);
+			}
+		}
+		flush_list [n_flush++] = q;
+	Unlock (&mtx_flush);
+	
+	/* risveglio il Flusher (se la pipe e' piena e' gia' stato risvegliato) */
+	if (write (flush_pipe [1], &c, 1) == -1 && errno != EAGAIN) {
+		perror ("Errore durante la notifica al Flusher");
+		exit (EXIT_FAILURE);
+	}
+}
+
+/** [MTX] Funzione che accoda un frame nella coda di uscita di un utente, senza attendere
+ *  che venga scritto sulla socket. Se la coda era vuota prova subito a scriverlo
+ *  (senza bloccarsi); cio' che resta viene inviato dal Flusher. Se la coda e' piena
+ *  si applica la politica q_policy (attesa, scarto del frame piu' vecchio o di quello
+ *  nuovo, disconnessione del destinatario).
+ * 
+ * 	\param q, coda del destinatario
+ * 	\param f, frame da accodare (viene acquisito un riferimento)
+ * 	\retval 0, se il frame e' stato accodato (o scartato secondo la politica)
+ *  \retval SEOF, se il destinatario si e' disconnesso
+ */
+int Enqueue_frame (outq_t * q, frame_t * f) {
+	outfrm_t * p;
+	int empty;
+	
+	retainFrame (f);
+	
+	Lock (&(q->mtx));
+	
+		if (q->closed == 0 && Stalled_queue (q)) {
+			Shutdown_queue (q, 1);
+		}
+		
+		/* coda piena: si applica la politica per i destinatari lenti */
+		while ( q->closed == 0 && q->head != NULL && 
+			(q->depth >= q_frames || q->bytes + f->size > q_bytes) ) {
+			
+			if (q_policy == QDROP_NEW) { /* scarto il frame da accodare */
+				q->dropped++;
+	Unlock (&(q->mtx));
+				releaseFrame (f);
+				return 0;
+			}
+			
+			if (q_policy == QDROP_OLD) { /* scarto i frame piu' vecchi */
+				if (Drop_oldest (q) == 0) {
+					break; /* resta solo un frame inviato in parte: accodo comunque */
+				}
+				continue;
+			}
+			
+			if (q_policy == QDISCONNECT) {
+				Shutdown_queue (q, 1);
+				break;
+			}
+			
+			/* QBLOCK: attendo che il Flusher (o un altro mittente) liberi spazio,
+			 * al piu' finche' il destinatario non resta bloccato per q_secs secondi */
+			if (q_secs > 0) {
+				struct timespec ts;
+				
+				ts.tv_sec = q->since + q_secs;
+				ts.tv_nsec = 0;
+				pthread_cond_timedwait (&(q->space), &(q->mtx), &ts);
+				if (q->closed == 0 && Stalled_queue (q)) {
+					Shutdown_queue (q, 1);
+				}
+			} else {
+				pthread_cond_wait (&(q->space), &(q->mtx));
+			}
+		}
+		
+		if (q->closed == 1) {
+	Unlock (&(q->mtx));
+			releaseFrame (f);
+			return SEOF;
+		}
+		
+		p = Get_outfrm (q); /* a regime la coda ha gia' un elemento libero: nessuna allocazione */
+		p->f = f;
+		p->next = NULL;
+		
+		empty = (q->head == NULL);
+		if (empty) {
+			q->head = p;
+		} else {
+			q->tail->next = p;
+		}
+		q->tail = p;
+		q->depth++;
+		q->bytes += f->size;
+		if (q->depth > q->max_depth) {
+			q->max_depth = q->depth;
+		}
+		if (q->bytes > q->max_bytes) {
+			q->max_bytes = q->bytes;
+		}
+		
+		if (empty) {
+			q->since = time (NULL);
+			Flush_queue (q);
+		}
+		if (q->head != NULL && q->pending == 0) {
+			Pending_queue (q);
+		}
+		
+	Unlock (&(q->mtx));
+	
+	return 0;
+}
+
+/** [MTX] Funzione che codifica un messaggio e lo accoda nella coda di uscita di un utente
+ * 
+ * 	\param q, coda del destinatario
+ * 	\param msg, messaggio da inviare
+ * 	\retval 0, se il messaggio e' stato accodato
+ *  \retval SEOF, se il destinatario si e' disconnesso
+ */
+int Send_queue (outq_t * q, message_t * msg) {
+	int n;
+	frame_t * f;
+	
+	f = newFrame (msg);
+	if (f == NULL) {
+		perror ("Errore durante la codifica di un messaggio");
+		exit (EXIT_FAILURE);
+	}
+	n = Enqueue_frame (q, f);
+	releaseFrame (f);
+	
+	return n;
+}
+
+/** [MTX] Procedura che garantisce che ci siano almeno n payload liberi nel blocco corrente,
+ *  allocando un nuovo blocco (di almeno NFCHUNK payload) se necessario
+ * 
+ * 	\param n, numero di payload che verranno richiesti
+ */
+void Reserve_fields (unsigned int n) {
+	fchunk_t * c;
+	
+	Lock (&mtx_fields);
+		if (field_chunks == NULL || field_chunks->dim - field_chunks->n < n) {
+			if (n < NFCHUNK) {
+				n = NFCHUNK;
+			}
+			/* un solo blocco di memoria per l'intestazione e i payload */
+			c = calloc (1, sizeof (fchunk_t) + n * sizeof (field_t));
+			if (c == NULL) {
+				perror ("Errore durante l'allocazione dei payload degli utenti");
+				exit (EXIT_FAILURE);
+			}
+			c->f = (field_t *) (c + 1);
+			c->dim = n;
+			c->n = 0;
+			/* gli id sono densi: il blocco continua dall'ultimo id assegnato */
+			c->base = (field_chunks == NULL) ? 0 : field_chunks->base + field_chunks->n;
+			c->next = field_chunks;
+			__sync_synchronize (); /* Field_id legge field_chunks senza mutex */
+			field_chunks = c;
+			/* gli eventuali payload liberi del blocco precedente non verranno piu' assegnati */
+			if (c->next != NULL) {
+				c->next->dim = c->next->n;
+			}
+		}
+	Unlock (&mtx_fields);
+}
+
+/** [MTX] Funzione che restituisce il payload (inizialmente offline) di un nuovo utente
+ *  autorizzato, preso dal blocco corrente. I payload non vengono mai deallocati ne'
+ *  spostati fino alla terminazione del server.
+ * 
+ * 	\param name, username dell'utente (non viene copiato)
+ * 	\retval p, payload dell'utente
+ */
+field_t * New_field (char * name) {
+	field_t * p;
+	
+	do { /* il blocco corrente potrebbe essere stato riempito tra Reserve_fields e Lock */
+		Reserve_fields (1);
+		Lock (&mtx_fields);
+			p = NULL;
+			if (field_chunks->n < field_chunks->dim) {
+				p = &(field_chunks->f [field_chunks->n]);
+				p->id = field_chunks->base + field_chunks->n;
+				field_chunks->n++;
+			}
+		Unlock (&mtx_fields);
+	} while (p == NULL);
+	
+	p->skt = -1;
+	p->q = NULL;
+	p->gen = 0;
+	p->fan_pending = 0;
+	p->name = name;
+	p->prev = NULL;
+	p->next = NULL;
+	
+	return p;
+}
+
+/** Funzione che restituisce il payload dell'utente con un dato id, senza consultare
+ *  la tabella hash. I blocchi sono in ordine di id decrescente e di solito ce n'e' uno solo.
+ * 
+ * 	\param id, id di un utente autorizzato
+ * 	\retval p, payload dell'utente
+ */
+field_t * Field_id (usr_id_t id) {
+	fchunk_t * c;
+	
+	for (c = field_chunks; c->base > id; c = c->next);
+	
+	return &(c->f [id - c->base]);
+}
+
+/** Funzione che restituisce l'username (internato) dell'utente con un dato id
+ * 
+ * 	\param id, id di un utente autorizzato
+ * 	\retval name, username dell'utente (da non deallocare)
+ */
+char * User_name (usr_id_t id) {
+	return Field_id (id)->name;
+}
+
+/** Funzione che restituisce il mutex che protegge lo stato (skt, q) dell'utente id:
+ *  utenti con id diverso (a meno di NSTRIPE) non si contendono lo stesso mutex
+ * 	
+ *  \param id, id dell'utente
+ *  \retval mtx, mutex associato a id
+ */
+pthread_mutex_t * Stripe_id (usr_id_t id) {
+	return &(mtx_stripe [id % NSTRIPE]);
+}
+
+/** Funzione che verifica che i len caratteri di s siano tutti alfanumerici (ASCII),
+ *  esaminandone 8 alla volta (SWAR: confronti byte per byte su una parola a 64 bit)
+ * 
+ * 	\param s, caratteri da verificare
+ * 	\param len, numero di caratteri
+ * 	\retval 1, se sono tutti alfanumerici
+ * 	\retval 0, altrimenti
+ */
+int Alnum_string (char * s, size_t len) {
+	unsigned long long x, ok;
+	const unsigned long long ones = 0x0101010101010101ULL, high = 0x8080808080808080ULL;
+	
+	/* per un byte b < 0x80 e c <= 0x80, ((b | 0x80) - c) ha il bit alto a 1 se e solo se b >= c,
+	 * senza prestiti tra un byte e l'altro */
+#define GE(x, c) ( ((x) | high) - (c) * ones )
+	for (; len >= 8; len -= 8, s += 8) {
+		memcpy (&x, s, 8);
+		ok = (GE (x, '0') & ~GE (x, '9' + 1))
+			| (GE (x, 'A') & ~GE (x, 'Z' + 1))
+			| (GE (x, 'a') & ~GE (x, 'z' + 1));
+		if ( (ok & ~x & high) != high ) { /* un byte non e' alfanumerico o non e' ASCII */
+			return 0;
+		}
+	}
+#undef GE
+	for (; len > 0; len--, s++) {
+		if ( isalnum ((unsigned char) *s) == 0 ) {
+			return 0;
+		}
+	}
+	
+	return 1;
+}
+
+/** Thread che valida una porzione del file degli utenti autorizzati: per ogni riga verifica
+ *  che sia un username valido, lo copia nel blocco dei nomi (allo stesso offset che ha nel file,
+ *  con '\0' al posto di '\n') e ne calcola il valore hash
+ * 
+ * 	\param arg, porzione del file (loader_t)
+ */
+void * Loader (void * arg) {
+	loader_t * l = (loader_t *) arg;
+	char * p, * q, * end;
+	size_t len;
+	
+	end = l->data + l->end;
+	
+	/* prima passata: numero di righe, per allocare gli elementi una volta sola */
+	l->n = 0;
+	for (p = l->data + l->start; p < end && (q = memchr (p, '\n', end - p)) != NULL; p = q + 1) {
+		l->n++;
+	}
+	l->e = malloc ((l->n + 1) * sizeof (userElem_t));
+	if (l->e == NULL) {
+		l->err = ENOMEM;
+		return NULL;
+	}
+	
+	l->n = 0;
+	for (p = l->data + l->start; p < end; p = q + 1) {
+		q = memchr (p, '\n', end - p);
+		if (q == NULL) { /* ultima riga senza '\n' */
+			q = end;
+		}
+		len = q - p;
+		if (len == 0) { /* le righe vuote vengono ignorate */
+			continue;
+		}
+		if (len >= NUSR || Alnum_string (p, len) == 0) {
+			l->err = EINVAL;
+			return NULL;
+		}
+		memcpy (l->names + (p - l->data), p, len);
+		l->names [q - l->data] = '\0';
+		
+		l->e [l->n].key = l->names + (p - l->data);
+		l->e [l->n].hash = hash_user (l->e [l->n].key);
+		l->e [l->n].payload = NULL;
+		l->n++;
+	}
+	
+	return NULL;
+}
+
+/** Funzione che legge il file degli utenti autorizzati: il file viene mappato in memoria
+ *  e diviso in porzioni (che iniziano e finiscono ad inizio riga) validate in parallelo
+ *  da piu' thread Loader. Gli username vengono copiati in un unico blocco.
+ * 
+ * 	\param file, file degli utenti autorizzati
+ * 	\param n, in cui viene restituito il numero di username letti
+ * 	\param names, in cui viene restituito il blocco con gli username (da deallocare o da affidare a Keep_names)
+ * 	\param n_thread, in cui viene restituito il numero di thread usati
+ * 	\retval e, username nell'ordine del file, con il valore hash gia' calcolato (payload NULL)
+ * 	\retval NULL, in caso di errore (setta errno: EINVAL se il file contiene righe non valide)
+ */
+userElem_t * Parse_users (char * file, unsigned int * n, char ** names, int * n_thread) {
+	int fd, t, i, err;
+	size_t size, k;
+	struct stat st;
+	char * data;
+	loader_t * l;
+	userElem_t * e;
+	
+	fd = open (file, O_RDONLY);
+	if (fd == -1) {
+		return NULL;
+	}
+	if (fstat (fd, &st) == -1) {
+		err = errno;
+		close (fd);
+		errno = err;
+		return NULL;
+	}
+	size = st.st_size;
+	
+	data = NULL;
+	if (size > 0) {
+		data = mmap (NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED) {
+			err = errno;
+			close (fd);
+			errno = err;
+			return NULL;
+		}
+		madvise (data, size, MADV_SEQUENTIAL);
+	}
+	close (fd); /* la mappatura resta valida */
+	
+	/* un thread ogni NLOADMIN byte, al piu' uno per processore */
+	t = sysconf (_SC_NPROCESSORS_ONLN);
+	if (t > NLOADER) {
+		t = NLOADER;
+	}
+	if ((size_t) t > size / NLOADMIN) {
+		t = size / NLOADMIN;
+	}
+	if (t < 1) {
+		t = 1;
+	}
+	
+	*names = malloc (size + 1);
+	l = calloc (t, sizeof (loader_t));
+	if (*names == NULL || l == NULL) {
+		free (*names);
+		free (l);
+		if (data != NULL) {
+			munmap (data, size);
+		}
+		errno = ENOMEM;
+		return NULL;
+	}
+	
+	for (i = 0; i < t; i++) {
+		l [i].data = data;
+		l [i].names = *names;
+		/* la porzione inizia dopo il primo '\n' che precede il suo inizio teorico */
+		k = size / t * i;
+		while (k > 0 && data [k - 1] != '\n') {
+			k++;
+			if (k >= size) {
+				k = size;
+				break;
+			}
+		}
+		l [i].start = k;
+		if (i > 0) {
+			l [i - 1].end = k;
+		}
+	}
+	l [t - 1].end = size;
+	
+	for (i = 1; i < t; i++) {
+		if (pthread_create (&(l [i].tid), NULL, &Loader, &(l [i])) != 0) {
+			fprintf (stderr, "Errore nella creazione dei thread Loader");
+			exit (EXIT_FAILURE);
+		}
+	}
+	Loader (&(l [0])); /* la prima porzione la valida il chiamante */
+	for (i = 1; i < t; i++) {
+		pthread_join (l [i].tid, NULL);
+	}
+	if (data != NULL) {
+		munmap (data, size);
+	}
+	
+	/* concatenazione degli username delle porzioni, nell'ordine del file */
+	err = 0;
+	*n = 0;
+	for (i = 0; i < t; i++) {
+		if (l [i].err != 0 && err == 0) {
+			err = l [i].err;
+		}
+		*n += l [i].n;
+	}
+	e = (err == 0) ? malloc ((*n + 1) * sizeof (userElem_t)) : NULL;
+	if (err == 0 && e == NULL) {
+		err = ENOMEM;
+	}
+	for (i = 0, k = 0; i < t; i++) {
+		if (e != NULL) {
+			memcpy (e + k, l [i].e, l [i].n * sizeof (userElem_t));
+			k += l [i].n;
+		}
+		free (l [i].e);
+	}
+	free (l);
+	
+	if (err != 0) {
+		free (*names);
+		*names = NULL;
+		errno = err;
+		return NULL;
+	}
+	*n_thread = t;
+	
+	return e;
+}
+
+/** [MTX] Procedura che conserva un blocco di username fino alla terminazione del server
+ *  (i payload e la tabella hash ne usano direttamente le stringhe)
+ * 
+ * 	\param names, blocco di username
+ */
+void Keep_names (char * names) {
+	nblock_t * b;
+	
+	b = malloc (sizeof (nblock_t));
+	if (b == NULL) {
+		perror ("Errore durante il caricamento degli utenti autorizzati");
+		exit (EXIT_FAILURE);
+	}
+	b->names = names;
+	
+	Lock (&mtx_fields);
+		b->next = name_blocks;
+		name_blocks = b;
+	Unlock (&mtx_fields);
+}
+
+/** Funzione che costruisce l'hash perfetto minimo sugli utenti presenti in hash_table
+ *  (rw_hash gia' acquisito almeno in lettura, oppure un solo thread attivo)
+ * 
+ * 	\retval m, hash perfetto minimo (chiavi e payload sono quelli di hash_table)
+ * 	\retval NULL, se la costruzione non e' riuscita (setta errno)
+ */
+userMph_t * Build_mph () {
+	unsigned int i, n;
+	char ** keys;
+	void ** payloads;
+	userMph_t * m;
+	
+	keys = malloc ((hash_table->n + 1) * sizeof (char *));
+	payloads = malloc ((hash_table->n + 1) * sizeof (void *));
+	if (keys == NULL || payloads == NULL) {
+		free (keys);
+		free (payloads);
+		return NULL;
+	}
+	
+	for (i = 0, n = 0; i < hash_table->size; i++) {
+		if (hash_table->table [i].hash != 0) {
+			keys [n] = hash_table->table [i].key;
+			payloads [n] = hash_table->table [i].payload;
+			n++;
+		}
+	}
+	
+	m = new_userMph (keys, payloads, n); /* le chiavi di hash_table sono distinte */
+	
+	free (keys);
+	free (payloads);
+	
+	return m;
+}
+
+/** [MTX] Funzione che rilegge il file degli utenti autorizzati e applica alla tabella hash
+ *  solo le differenze: gli utenti aggiunti ricevono un nuovo payload (e un nuovo id: gli id
+ *  non vengono mai riusati), quelli rimossi escono dalla tabella e, se connessi, vengono
+ *  disconnessi. Le sessioni degli utenti rimasti non vengono toccate.
+ *  L'hash perfetto minimo (se usato) viene ricostruito prima di acquisire rw_hash.
+ *  Va chiamata da un solo thread (Handler), l'unico che modifica la tabella hash.
+ * 
+ * 	\param file, file degli utenti autorizzati
+ * 	\param added, in cui viene restituito il numero di utenti aggiunti
+ * 	\param removed, in cui viene restituito il numero di utenti rimossi
+ * 	\retval 0, se il nuovo insieme di utenti e' stato applicato
+ * 	\retval -1, in caso di errore, lasciando invariato l'insieme precedente (setta errno:
+ * 				EINVAL se il file contiene righe non valide, EEXIST se contiene username ripetuti)
+ */
+int Reload_users (char * file, unsigned int * added, unsigned int * removed) {
+	unsigned int n, i, k, na, nr, ids;
+	size_t len;
+	int n_thread;
+	char * names; /* blocco con gli username letti dal file */
+	char * fresh; /* blocco con gli username dei soli utenti aggiunti */
+	char * s;
+	char * seen; /* utenti gia' presenti ritrovati nel file (indicizzato per id) */
+	char ** keys;
+	void ** payloads;
+	field_t ** gone; /* utenti rimossi */
+	userElem_t * e;
+	userTable_t * dup; /* username nuovi, per trovare eventuali ripetizioni */
+	userMph_t * m;
+	field_t * p;
+	pthread_mutex_t * stripe;
+	
+	e = Parse_users (file, &n, &names, &n_thread);
+	if (e == NULL) {
+		return -1;
+	}
+	
+	/* solo questo thread aggiunge payload e modifica la tabella: la si puo' leggere senza rw_hash */
+	ids = field_chunks->base + field_chunks->n;
+	seen = calloc (ids + 1, sizeof (char));
+	keys = malloc ((n + 1) * sizeof (char *));
+	payloads = malloc ((n + 1) * sizeof (void *));
+	gone = malloc ((hash_table->n + 1) * sizeof (field_t *));
+	dup = new_userTable (0);
+	if (seen == NULL || keys == NULL || payloads == NULL || gone == NULL || dup == NULL) {
+		perror ("Errore durante il caricamento degli utenti autorizzati");
+		exit (EXIT_FAILURE);
+	}
+	
+	/** ========== Confronto con l'insieme corrente ========== */
+	for (i = 0, na = 0, len = 0; i < n; i++) {
+		p = (field_t *) find_userElement (hash_table, e [i].key);
+		if (p != NULL) { /* utente invariato: si riusa il suo payload */
+			if (seen [p->id] == 1) {
+				break;
+			}
+			seen [p->id] = 1;
+			keys [i] = p->name;
+			payloads [i] = p;
+		} else { /* utente aggiunto */
+			if (add_userElement (dup, e [i].key, NULL) == -1) {
+				break;
+			}
+			keys [i] = NULL;
+			na++;
+			len += strlen (e [i].key) + 1;
+		}
+	}
+	if (i < n) { /* username ripetuto: l'insieme corrente resta quello in uso */
+		free (e); free (names); free (seen); free (keys); free (payloads); free (gone);
+		free_userTable (&dup);
+		errno = EEXIST;
+		return -1;
+	}
+	free_userTable (&dup);
+	
+	for (i = 0, nr = 0; i < hash_table->size; i++) {
+		if (hash_table->table [i].hash != 0) {
+			p = (field_t *) (hash_table->table [i].payload);
+			if (seen [p->id] == 0) {
+				gone [nr++] = p;
+			}
+		}
+	}
+	free (seen);
+	
+	/* gli username aggiunti vengono copiati in un blocco a parte: quello del file viene liberato */
+	fresh = malloc (len + 1);
+	if (fresh == NULL) {
+		perror ("Errore durante il caricamento degli utenti autorizzati");
+		exit (EXIT_FAILURE);
+	}
+	for (i = 0, s = fresh; i < n; i++) {
+		if (keys [i] == NULL) {
+			strcpy (s, e [i].key);
+			keys [i] = s;
+			payloads [i] = New_field (s); /* nuovo utente, inizialmente offline */
+			s += strlen (s) + 1;
+		}
+	}
+	free (names);
+	free (e);
+	
+	/** ========== Ricostruzione dell'hash perfetto minimo (fuori dal lock) ========== */
+	m = NULL;
+	if (user_mph != NULL) {
+		m = new_userMph (keys, payloads, n);
+		if (m == NULL) {
+			perror ("Impossibile ricostruire l'hash perfetto minimo, uso la tabella hash");
+		}
+	}
+	
+	/** ========== Aggiornamento della tabella hash ========== */
+	Wrlock (&rw_hash);
+		for (k = 0; k < nr; k++) {
+			remove_userElement (hash_table, gone [k]->name);
+		}
+		for (i = 0; i < n; i++) {
+			p = (field_t *) payloads [i];
+			if (p->id >= ids && add_userElement (hash_table, p->name, p) == -1) { /* utente aggiunto */
+				perror ("Errore durante il caricamento degli utenti nella tabella hash");
+				exit (EXIT_FAILURE);
+			}
+		}
+		if (user_mph != NULL) {
+			free_userMph (&user_mph);
+			user_mph = m;
+		}
+	Rwunlock (&rw_hash);
+	
+	/** ========== Disconnessione degli utenti rimossi ========== */
+	/* un login successivo non li trova piu' nella tabella: basta chiudere le sessioni aperte */
+	for (k = 0; k < nr; k++) {
+		p = gone [k];
+		stripe = Stripe_id (p->id);
+		Lock (stripe);
+			if (p->q != NULL) {
+				Lock (&(p->q->mtx));
+					if (p->q->closed == 0) {
+						Shutdown_queue (p->q, 0);
+					}
+				Unlock (&(p->q->mtx));
+			}
+		Unlock (stripe);
+	}
+	
+	if (na > 0) {
+		Keep_names (fresh);
+	} else {
+		free (fresh);
+	}
+	free (keys);
+	free (payloads);
+	free (gone);
+	
+	*added = na;
+	*removed = nr;
+	return 0;
+}
+
+/** Funzione restituisce un puntatore al payload di un elemento
+ *  della tabella hash con key == username (rw_hash gia' acquisito almeno in lettura).
+ *  Il payload resta lo stesso per tutta la vita del server: viene aggiornato sul posto.
+ *  Con l'hash perfetto minimo la ricerca costa un hash e un confronto, senza scansioni.
+ * 	
+ *  \param username, nome utente da cercare
+ *  \retval payload, puntatore al payload
+ *  \retval NULL, se non è presente nessun elemento nella tabella hash con chiave username
+ */
+field_t * Field_hash_element (char * key) {
+	
+	if (user_mph != NULL) {
+		return (field_t *) find_userMph (user_mph, key);
+	}
+	return (field_t *) find_userElement (hash_table, key);
+}
+
+/** [MTX] Procedura che disconnette un client che desidera disconnettersi
+ *  o che si è gia disconnesso, aggiornando la tabella hash e la lista
+ *  degli utenti connessi (non tocca la lista dei thread attivi, in modo
+ *  da poter essere usata anche dagli event loop)
+ * 
+ *  La socket del client appartiene alla sua coda di uscita e viene chiusa da Close_queue,
+ *  in mutua esclusione con le scritture.
+ * 
+ *  \param client, id del client da disconnettere
+ */
+void Disconnect_client (usr_id_t client) {
+	field_t * p;
+	outq_t * q;
+	pthread_mutex_t * stripe;
+
+	/* il payload viene trovato tramite l'id, senza calcolare l'hash dell'username */
+	p = Field_id (client);
+	
+	/* il record di uscita del log compatto viene accodato sotto i lock: la cella si prenota prima */
+	if (log_compact == 1) {
+		Reserve_records (1);
+	}
+
+	/** ========== Aggiornamento della tabella hash ========== */
+	Rdlock (&rw_hash);
+	stripe = Stripe_id (client);
+	Lock (stripe);
+	
+		/* il payload viene aggiornato sul posto, in modo che resti lo stesso per tutta la vita del server */
+		q = p->q;
+	
+		/** ========== Rimozione del client dalla lista dei client connessi ==========*/
+		/* prima di azzerare p->q: un broadcast trova nella lista solo utenti con una coda valida */
+		Lock (&mtx_users);
+			Remove_user (p);
+		Unlock (&mtx_users);
+		
+		p->skt = -1;
+		p->q = NULL;
+		__sync_add_and_fetch (&(p->gen), 1); /* la sessione termina: generazione pari (offline) */
+		
+	Unlock (stripe);
+	Rwunlock (&rw_hash);
+	
+	/* chiusura della coda di uscita e della socket */
+	Close_queue (q);
+	if (q->dropped > 0 || q->kicked == 1) {
+		fprintf (stderr, "Utente %s: %lu messaggi scartati%s (coda massima: %u messaggi, %lu byte)\n",
+			p->name, q->dropped, (q->kicked == 1) ? ", disconnesso perche' troppo lento" : "",
+			q->max_depth, q->max_bytes);
+	}
+	Release_queue (q);
+}
+
+/** [MTX] Procedura che disconnette un thread da un client che desidera
+ *  disconnettersi o che si è gia disconnesso, aggiornando la tabella hash
+ *  e la lista dei thread attivi.
+ * 
+ *  \param thread_id, id del thread che chiama la procedura
+ *  \param client, id del client da disconnettere
+ * 
+ * */
+void Disconnect (pthread_t thread_id, usr_id_t client) {
+	
+	Disconnect_client (client);
+	
+	/** ========= Aggiornamento della lista dei thread attivi ========== */
+	Remove_thread_list (thread_id);
+}
+
+/** Procedura che distrugge la tabella hash rimuovendo evenutali variabili
+ *  di tipo pthread_mutex_t presenti nei payload degli elementi della tabella hash
+ * 
+ */
+void Destroy_hash () {
+	
+	unsigned int i;
+	field_t * p;
+	fchunk_t * c;
+	nblock_t * b;
+	
+		if (hash_table == NULL) /* non c'è nessuna tabella hash */
+		return;
+
+		for(i = 0; i < hash_table->size; i++) /* scorro le celle e libero la memoria di ogni elemento */
+		{
+			if (hash_table->table [i].hash == 0) { /* cella vuota */
+				continue;
+			}
+			
+			p = (field_t *) (hash_table->table [i].payload);
+			
+			if (p->skt > -1) { /* se il client è connesso */
+				
+				/* chiudo la socket e la coda di uscita */
+				Close_queue (p->q);
+				Release_queue (p->q);
+			}
+			
+		}
+		free_userTable (&hash_table);
+		free_userMph (&user_mph);
+		
+		while (field_chunks != NULL) { /* i payload sono allocati a blocchi */
+			c = field_chunks;
+			field_chunks = c->next;
+			free (c);
+		}
+		while (name_blocks != NULL) { /* anche gli username (che sono le chiavi degli elementi) */
+			b = name_blocks;
+			name_blocks = b->next;
+			free (b->names);
+			free (b);
+		}
+}
+
+/** Funzione che restituisce un puntatore alla stringa (destinatario) a cui spedire il messaggio.
+ * 	A ritorno della funzione, msg è la struttura che deve essere effettivamente 
+ *  inviata al destinatario.
+ * 
+ * 	\param msg, struttura da manipolare per ottenere il destinatario e da modificare
+ * 				affinche, al ritorno dalla funzione, msg contenga la struttura da inviare
+ * 				tramite una Send_skt
+ *  \param mit, mittente del messaggio
+ * 
+ *	\reval dest, puntatore alla stringa che continene l username del destinatario
+ * 				 (allocato all interno della funzione)
+ */
+char * Divide_to_one ( message_t * msg, char * mit ) {
+	int i, j;
+	char * dest; /* username del destinatario */
+	char * tmp_buffer; /* buffer temporaneo che conterrà il messaggio effettivo (senza il destinatario) */
+	
+	dest = malloc ( sizeof (char) * (  strlen (msg->buffer) + 1 )  );
+			
+	sprintf (dest, "%s", msg->buffer);
+						
 	tmp_buffer = malloc ( sizeof (char) *  (msg->length - ( strlen (dest) + 1)  )  );
 			
 	j = 0;
@@ -600,225 +2441,392 @@ void Divide_bcast ( message_t * msg, char * mit ) {
 /** [MTX] Procedura che invia un messaggio ad un utente destinatario se questo è connesso al server,
  *  o invia al mittente un messaggio d'errore se il destinatario non è conneesso.
  * 
- * 	\param mit, mittente del messaggio
- * 	\param dest, destinatario del messaggio
+ * 	\param mit, id del mittente del messaggio
+ * 	\param dest, username del destinatario del messaggio
  *  \param msg, messaggio da inviare
- * 	\param this_cli_mtx, variabile per la mutua esclusione con il mittente
+ * 	\param mit_q, coda di uscita del mittente
  * 						(in questo modo la complessità dell'invio al mittente è O(1) )
  * 	\retval 1, se è andato tutto a buon fine
  *  \retval 0, se è stato inviato un messaggio d'errore ed buffer "vecchio" (contenuto in msg) è gia stato deallocato
  */
-int Send_to_one (char * mit, char * dest, message_t * msg, int mit_skt, pthread_mutex_t * mit_mtx) {
-	int dest_skt;
+int Send_to_one (usr_id_t mit, char * dest, message_t * msg, outq_t * mit_q) {
 	int k;
+	bcast_t * b;
+	frame_t * f;
+	usr_id_t dest_id;
 	field_t * payload;
-	pthread_mutex_t * dest_mtx_skt;
+	outq_t * dest_q;
+	pthread_mutex_t * stripe;
+	
+	/* l'username del destinatario viene convertito nel suo id con una sola ricerca nella tabella hash:
+	 * da qui in poi (instradamento e log) si usano solo gli id */
+	dest_q = NULL;
+	Rdlock (&rw_hash);
 	
-	if (strcmp (dest, mit) == 0) { /* se il mittente è lo stesso del destinatario */
-				Lock (mit_mtx);
-					k = Send_skt (mit_skt, msg);
-				Unlock (mit_mtx);
-				
-				if (k != SEOF) { /* se il destinatario non si è disconnesso nel frattempo */
-					Add_string (mit, dest, msg->buffer);
-				}
-				return 1;
-				
-	}
-	/* il nome del destinatario è diverso da quello del mittente */
-	Lock (&mtx_hash);
 		/* controllo se il destinatario è presente nella tabella hash */
 		payload = Field_hash_element (dest);
-				
-		if (payload != NULL) { /* è presente nella tabella hash */
 		
-			dest_skt = payload->skt;
-			dest_mtx_skt = &(payload->mtx);
-					
-			if (dest_skt == -1) { /* il destinatario del messaggio non è connesso */
-	Unlock (&mtx_hash);
-				
-				free (msg->buffer);
-						
-				msg->type = MSG_ERROR;
-				msg->buffer = malloc (sizeof (char) * (strlen (dest) + strlen (DEST_DISCONNECT) + 3) );
-				sprintf (msg->buffer, "%s: %s", dest, DEST_DISCONNECT);
-				msg->length = strlen (msg->buffer) + 1;
-					
-				Lock (mit_mtx);
-					Send_skt (mit_skt, msg);
-				Unlock (mit_mtx);
-				
-				free (msg->buffer);
-				return 0;
-			}
-					
-			/* il destinatario è connesso */
-					
-			Lock (dest_mtx_skt);
-				k = Send_skt (dest_skt, msg);
-			Unlock (dest_mtx_skt);
-			
-			if (k != SEOF) { /* se il destinatario non si è disconnesso nel frattempo */
-				Add_string (mit, dest, msg->buffer);
-			}
-	Unlock (&mtx_hash);
-				
-		} else { /* l'username del destinatario non è presente nella tabella hash */
-					
-	Unlock (&mtx_hash);
-			
-			free (msg->buffer);
-			
-			msg->type = MSG_ERROR;
-			
-			msg->buffer = malloc (sizeof (char) * (strlen (dest) + strlen (DEST_DISCONNECT) + 3) );
-			
-			sprintf (msg->buffer, "%s: %s", dest, DEST_DISCONNECT);
-			msg->length = strlen (msg->buffer) + 1;
-					
-			Lock (mit_mtx);
-				Send_skt (mit_skt, msg);
-			Unlock (mit_mtx);
-			
-			free (msg->buffer);
-
-			return 0;
+		if (payload != NULL && payload->id == mit) { /* se il mittente è lo stesso del destinatario */
+			dest_id = mit;
+			dest_q = mit_q;
+			__sync_add_and_fetch (&(dest_q->refs), 1);
+		
+		/* se il destinatario è offline (generazione pari) non serve bloccarne lo stato */
+		} else if (payload != NULL && (__sync_fetch_and_add (&(payload->gen), 0) & 1) == 1) {
+			dest_id = payload->id;
+			stripe = Stripe_id (dest_id); /* solo lo stato del destinatario viene bloccato */
+			Lock (stripe);
+				if (payload->skt != -1) {
+					/* il destinatario è connesso: acquisisco un riferimento alla sua coda e rilascio la tabella hash
+					 * prima di accodare il messaggio (un destinatario lento non blocca gli altri thread) */
+					dest_q = payload->q;
+					__sync_add_and_fetch (&(dest_q->refs), 1);
+				}
+			Unlock (stripe);
+		}
+		
+	Rwunlock (&rw_hash);
+	
+	if (dest_q == NULL) { /* il destinatario del messaggio non è connesso o non è presente nella tabella hash */
+		
+		free (msg->buffer);
+		
+		msg->type = MSG_ERROR;
+		msg->buffer = malloc (sizeof (char) * (strlen (dest) + strlen (DEST_DISCONNECT) + 3) );
+		sprintf (msg->buffer, "%s: %s", dest, DEST_DISCONNECT);
+		msg->length = strlen (msg->buffer) + 1;
+		
+		Send_queue (mit_q, msg);
+		
+		free (msg->buffer);
+		return 0;
+	}
+	
+	f = newFrame (msg);
+	if (f == NULL) {
+		perror ("Errore durante la codifica di un messaggio");
+		exit (EXIT_FAILURE);
+	}
+	
+	/* il mittente ha broadcast ancora in mano ai thread Fanout: il messaggio li segue nella
+	 * coda del thread Fanout del destinatario, altrimenti potrebbe arrivare prima di loro */
+	if (n_fanout > 0 && Fan_pending (mit)) {
+		b = malloc (sizeof (bcast_t));
+		if (b == NULL || (b->ids = malloc (sizeof (usr_id_t))) == NULL || (b->qs = malloc (sizeof (outq_t *))) == NULL) {
+			perror ("Errore durante l'invio di un messaggio");
+			exit (EXIT_FAILURE);
 		}
+		b->f = f; /* il riferimento del frame passa al messaggio */
+		b->mit = mit;
+		b->to_one = 1;
+		b->seq = 0;
+		b->n = 1;
+		b->ids [0] = dest_id;
+		b->qs [0] = dest_q; /* anche il riferimento alla coda */
+		Fan_out (b);
+		return 1;
+	}
+	
+	k = Enqueue_frame (dest_q, f);
+	
+	if (k != SEOF) { /* se il destinatario non si è disconnesso nel frattempo */
+		Add_string (mit, dest_id, f); /* il log usa lo stesso frame, senza copiarne il testo */
+	}
+	releaseFrame (f);
+	Release_queue (dest_q);
 		
 	return 1;
 }
 
-/** Funzione che restituisce una copia della n-esima stringa contenuta in
- * 	users_list (separata l una dalle altra da uno spazio).
- * 	Per essere usata correttamente n <= al numero di stringhe separate da
- * 	spazio presenti in users_list.
+/** [MTX] Procedura che invia un messaggio ai destinatari di uno shard, accoda
+ *  i record di log e rilascia i riferimenti alle code; l'ultimo shard completato
+ *  dealloca il messaggio
  * 
- * 	\param n, n-esima stringa da restituire come copia
- * 	\retval str, puntatore alla stringa da restituire (allocata all interno della funzione)
+ * 	\param s, shard da inviare (viene deallocato)
  */
-char * User (int n) {
-	int i;
-	char * p;
-	char * str;
+void Send_shard (shard_t * s) {
+	int i, j, k;
+	bcast_t * b = s->b;
 	
-	
-	if (n == 0) { /* si deve restituire l'username del primo utente */
+	for (j = 0; j < s->n; j++) {
 		
-		for (i = 0; users_list [i] != '\0' && users_list [i] != ' '; i++); /* calcolo la dimensione dell username */
+		i = (s->idx == NULL) ? j : s->idx [j];
 		
-		/* i contiene la dimensione dell'username */
-		str = calloc ( i + 1, sizeof (char) ); /* i + 1 per il carattere terminatore */
+		k = Enqueue_frame (b->qs [i], b->f); /* ogni destinatario riceve lo stesso frame */
 		
-		strncat ( str, users_list, i); /* copio i primi i caratteri in str */
+		if (b->to_one == 1) { /* messaggio ad un solo destinatario: una riga anche nel log compatto */
+			if (k != SEOF) {
+				Add_string (b->mit, b->ids [i], b->f);
+			}
+		} else if (log_compact == 1) { /* il broadcast ha gia' il suo record: registro solo chi non l'ha ricevuto */
+			if (k == SEOF) {
+				Add_record (LREC_SKIP, b->mit, b->ids [i], b->seq, NULL);
+			}
+		} else if (k != SEOF) { /* se il client non si è disconnesso nel mentre accodo il record del messaggio inviato,
+						  *	che dovrà essere scritto dal Writer
+						  */
+				Add_string (b->mit, b->ids [i], b->f);
+		}
 		
-		return str;
+		Release_queue (b->qs [i]);
 	}
 	
-	/* non è il primo utente */
-	p = users_list;
-	for (i = 0; i < n; i++) { /* scorro la stringa fino a reperire il puntatore del primo carattere dell'n-esimo username */
-		p = strstr (p, " ");
-		p++; 
-	}
-	
-	for (i = 0; p [i] != '\0' && p [i] != ' '; i++); /* calcolo dimensione dell'username */
+	free (s->idx);
+	free (s);
 	
-	str = calloc ( i + 1, sizeof (char) ); /* i + 1 per il carattere terminatore */
+	/* dopo gli accodamenti: chi legge fan_pending a 0 trova i frame gia' nelle code */
+	if (b->p_mit != NULL) {
+		__sync_sub_and_fetch (&(b->p_mit->fan_pending), 1);
+	}
+	if (__sync_sub_and_fetch (&(b->refs), 1) == 0) { /* ultimo shard del broadcast */
+		releaseFrame (b->f);
+		free (b->ids);
+		free (b->qs);
+		free (b);
+	}
+}
+
+/** [MTX] Procedura che accoda uno shard nella coda di un thread Fanout
+ * 
+ * 	\param fq, coda del thread Fanout
+ * 	\param s, shard da accodare
+ */
+void Push_shard (fanq_t * fq, shard_t * s) {
+	s->next = NULL;
+	Lock (&(fq->mtx));
+		if (fq->head == NULL) {
+			fq->head = s;
+		} else {
+			fq->tail->next = s;
+		}
+		fq->tail = s;
+		pthread_cond_signal (&(fq->cond));
+	Unlock (&(fq->mtx));
+}
+
+/** [MTX] Funzione che estrae uno shard dalla coda di un thread Fanout,
+ *  attendendo che ne venga accodato uno se la coda e' vuota
+ *  (la pthread_cond_wait e' un punto di cancellazione)
+ * 
+ * 	\param fq, coda del thread Fanout
+ * 	\retval s, shard da inviare
+ */
+shard_t * Pop_shard (fanq_t * fq) {
+	shard_t * s;
 	
-	/* i contiene la dimensione dell'username */
-	strncat ( str, p, i); /* copio i primi i caratteri in str */
-		
-	return str;
+	Lock (&(fq->mtx));
+	pthread_cleanup_push ( Cleanup_unlock, &(fq->mtx) );
+		while (fq->head == NULL) {
+			pthread_cond_wait (&(fq->cond), &(fq->mtx));
+		}
+		s = fq->head;
+		fq->head = s->next;
+		if (fq->head == NULL) {
+			fq->tail = NULL;
+		}
+	pthread_cleanup_pop (1);
 	
+	return s;
 }
 
-/** Procedura che invia msg a tutti gli utenti connessi
+/** Procedura che invia msg a tutti gli utenti connessi.
+ *  Sotto mtx_users si fotografa soltanto l'insieme dei destinatari
+ *  (id e un riferimento alla coda di uscita di ciascuno); l'accodamento
+ *  e l'accodamento dei record di log avvengono dopo aver rilasciato i lock globali.
+ *  Un destinatario che si disconnette nel frattempo ha la coda chiusa e viene
+ *  saltato: il riferimento impedisce che la coda venga deallocata o riusata
+ *  da una nuova sessione dello stesso utente.
+ *  Con almeno fan_min destinatari (e n_fanout > 0) i destinatari vengono divisi
+ *  in shard in base alla socket, in modo che un utente sia servito sempre dallo
+ *  stesso thread Fanout e riceva i broadcast nell'ordine in cui sono stati accodati.
+ *  Finche' il mittente ha shard in attesa anche i suoi broadcast piccoli (e i suoi
+ *  messaggi ad un solo destinatario, vedi Send_to_one) passano dai thread Fanout.
+ * 
  * 	\param msg, messaggio da inviare
- * 	\param mit, mittente del messaggio da utilizzare per l'aggiornamento
- * 				della variabile to_write
+ * 	\param mit, id del mittente del messaggio da utilizzare per il file di log
  */
-void Bcast (message_t * msg, char * mit) {
+void Bcast (message_t * msg, usr_id_t mit) {
 	
 	int i, n; /* n conterrà il numero di utenti connessi */
-	int k;
-	int skt; /* socket del destinatario */
-	char * str;
-	field_t * payload;
-	pthread_mutex_t * mtx; /* mutex sulla socket del destinatario */
+	field_t * p;
+	bcast_t * b;
+	shard_t * s;
+	
+	b = malloc (sizeof (bcast_t));
+	if (b == NULL) {
+		perror ("Errore durante la preparazione del messaggio di broadcast");
+		exit (EXIT_FAILURE);
+	}
+	b->f = newFrame (msg); /* messaggio codificato una sola volta per tutti i destinatari */
+	if (b->f == NULL) {
+		perror ("Errore durante la codifica del messaggio di broadcast");
+		exit (EXIT_FAILURE);
+	}
+	b->mit = mit;
+	b->p_mit = NULL;
+	b->to_one = 0;
+	
+	/* il record del log compatto viene accodato sotto mtx_users: la cella si prenota prima */
+	if (log_compact == 1) {
+		Reserve_records (1);
+	}
 	
-	Lock (&mtx_hash);
+	/* la lista degli utenti connessi contiene solo utenti con una coda valida:
+	 * non serve acquisire la tabella hash */
 		Lock (&mtx_users);
 		
-		n = 0;
-		for (i = 0; i <= strlen (users_list); i++) { /* reperisco il numero di utenti connessi */
-			if (users_list [i] == ' ' || users_list [i] == '\0') {
-				n++;
-			}
-
+		n = n_users;
+		
+		b->n = n;
+		b->ids = malloc (n * sizeof (usr_id_t));
+		b->qs = malloc (n * sizeof (outq_t *));
+		if (b->ids == NULL || b->qs == NULL) {
+			perror ("Errore durante la preparazione del messaggio di broadcast");
+			exit (EXIT_FAILURE);
 		}
 		
-		for (i = 0; i < n; i++) { /* invio il messaggio ad ogni utente connesso */
-			
-			str = User (i); /* str conterrà l'username dell'utente i-esimo a cui inviare il messaggio */
-
-			payload = Field_hash_element ( str ); /* reperisco il payload */
-			
-			skt = payload->skt;
-			mtx = &(payload->mtx);
-			
-			Lock (mtx);
-				k = Send_skt (skt, msg);
-			Unlock (mtx);
-			
-			if (k != SEOF) { /* se il client non si è disconnesso nel mentre aggiungo il messaggio inviato al buffer
-							  *	che dovrà essere scritto dal Writer
-							  */
-					Add_string (mit, str, msg->buffer);
-			}
-			
-			free (str);
+		for (i = 0, p = users_head; p != NULL; i++, p = p->next) { /* fotografia dei destinatari */
+			b->ids [i] = p->id;
+			b->qs [i] = p->q;
+			__sync_add_and_fetch (&(b->qs [i]->refs), 1);
+		}
+		
+		/* log compatto: un solo record (il testo una volta sola) al posto di una riga per destinatario;
+		 * registrato sotto mtx_users, i destinatari sono gli utenti connessi secondo i record "+" e "-" che lo precedono */
+		if (log_compact == 1) {
+			b->seq = ++bcast_seq;
+			Add_reserved (LREC_BCAST, mit, mit, b->seq, b->f);
 		}
 		
 		Unlock (&mtx_users);
-	Unlock (&mtx_hash);
+	
+	/* broadcast piccolo: lo invio direttamente, se non deve seguire broadcast del mittente ancora in attesa */
+	if (n_fanout == 0 || (n < fan_min && !Fan_pending (mit))) {
+		s = malloc (sizeof (shard_t));
+		if (s == NULL) {
+			perror ("Errore durante la preparazione del messaggio di broadcast");
+			exit (EXIT_FAILURE);
+		}
+		s->b = b;
+		s->n = n;
+		s->idx = NULL;
+		b->refs = 1;
+		Send_shard (s);
+		return;
+	}
+	
+	Fan_out (b);
 }
 
-/** [MTX] Funzione che abilita o meno un utente alla connessione sul server
- *	se abilitato, viene aggiornato il socket (associato a quel client) sulla tabella hash
- *	e ritornato un puntatore alla variabile mutex dell elemento sulla tabella hash con
- *  key == username
+/** [MTX] Procedura che divide i destinatari di un messaggio in shard, uno per ogni thread
+ *  Fanout (in base alla socket, in modo che un utente sia servito sempre dallo stesso thread),
+ *  e li accoda senza attenderne l'invio
+ * 
+ * 	\param b, messaggio (con mittente, destinatari e riferimenti alle loro code)
+ */
+void Fan_out (bcast_t * b) {
+	int i, t;
+	int * cnt; /* numero di destinatari di ogni shard */
+	shard_t * s;
+	shard_t ** ss;
+	
+	/* divisione dei destinatari in shard, uno per ogni thread Fanout */
+	cnt = calloc (n_fanout, sizeof (int));
+	ss = calloc (n_fanout, sizeof (shard_t *));
+	if (cnt == NULL || ss == NULL) {
+		perror ("Errore durante la preparazione del messaggio di broadcast");
+		exit (EXIT_FAILURE);
+	}
+	for (i = 0; i < b->n; i++) {
+		cnt [b->qs [i]->skt % n_fanout]++;
+	}
+	
+	b->refs = 0;
+	for (t = 0; t < n_fanout; t++) {
+		if (cnt [t] == 0) {
+			continue;
+		}
+		ss [t] = malloc (sizeof (shard_t));
+		if (ss [t] == NULL || (ss [t]->idx = malloc (cnt [t] * sizeof (int))) == NULL) {
+			perror ("Errore durante la preparazione del messaggio di broadcast");
+			exit (EXIT_FAILURE);
+		}
+		ss [t]->b = b;
+		ss [t]->n = 0;
+		b->refs++;
+	}
+	for (i = 0; i < b->n; i++) {
+		s = ss [b->qs [i]->skt % n_fanout];
+		s->idx [s->n++] = i;
+	}
+	
+	/* gli shard in attesa vengono contati prima di accodarli: il mittente e' servito
+	 * da un solo thread alla volta, che legge il contatore solo tra un messaggio e l'altro */
+	b->p_mit = Field_id (b->mit);
+	__sync_add_and_fetch (&(b->p_mit->fan_pending), b->refs);
+	
+	/* il thread mittente non attende l'invio e torna a servire il proprio client */
+	for (t = 0; t < n_fanout; t++) {
+		if (ss [t] != NULL) {
+			Push_shard (&(fan_queues [t]), ss [t]);
+		}
+	}
+	
+	free (cnt);
+	free (ss);
+}
+
+/** Funzione che indica se un utente ha messaggi affidati ai thread Fanout non ancora inviati:
+ *  finche' ne ha, anche i suoi messaggi successivi passano dai thread Fanout, in modo da non
+ *  raggiungere un destinatario prima di quelli precedenti
+ * 
+ * 	\param mit, id dell'utente
+ * 	\retval 1, se l'utente ha shard in attesa
+ * 	\retval 0, altrimenti
+ */
+int Fan_pending (usr_id_t mit) {
+	return __sync_fetch_and_add (&(Field_id (mit)->fan_pending), 0) > 0;
+}
+
+/** [MTX] Funzione che, ricevuto il messaggio di connessione, abilita o meno
+ *  un utente alla connessione sul server (vedi Enable_connect).
+ *  Usata direttamente dagli event loop, che ricevono il messaggio di
+ *  connessione senza bloccarsi sulla socket.
  *	
  *	\param skt socket del client
+ *	\param msg messaggio di connessione ricevuto (il buffer viene deallocato)
+ *	\param id in cui viene restituito l'id del client (se abilitato)
  *	
- *	\retval mtx se il client non è abilitato
+ *	\retval q coda di uscita del client, se il client è abilitato
  *	\retval NULL se il client non viene abilitato, chiude eventuali socket aperte
  */
-pthread_mutex_t * Enable_connect (int skt, char * username)
+outq_t * Enable_user (int skt, message_t * msg_conn, usr_id_t * id)
 {
 	int n;
 	message_t msg;
-	field_t * cpy_p;
-	field_t payload;
-	pthread_mutex_t * mtx;
+	field_t * p;
+	outq_t * q;
+	pthread_mutex_t * stripe;
 	
-	n = Receive_skt (skt, &msg);
-	if ( n == SEOF ) {
-		fprintf (stderr, CLIENT_DISCONNECT);
-		Close_skt (skt);
-		return NULL;
-	}
+	msg = * msg_conn;
 	
-	Lock (&mtx_hash);
+	/* nel log compatto l'ingresso viene registrato sotto i lock: la cella si prenota prima,
+	 * e viene resa se l'utente non si connette */
+	if (log_compact == 1) {
+		Reserve_records (1);
+	}
 	
-		sprintf (username, "%s", msg.buffer);
-		free (msg.buffer); /* deallocazione del buffer */
+	/* l'username viene usato solo per trovare l'id: la sessione non ne conserva una copia */
+	Rdlock (&rw_hash);
+	p = Field_hash_element (msg.buffer);
+	free (msg.buffer); /* deallocazione del buffer */
 	
-		cpy_p = find_hashElement (hash_table, username);
-		
-		if ((cpy_p) == NULL) {
+		if (p == NULL) {
 			/* l'username del client non è presente nella tabella hash */
-			Unlock (&mtx_hash);
+			Rwunlock (&rw_hash);
+			if (log_compact == 1) {
+				Cancel_records (1);
+			}
 			
 			msg.type = MSG_ERROR;
 			msg.buffer = NO_CONNECT;
@@ -828,10 +2836,16 @@ pthread_mutex_t * Enable_connect (int skt, char * username)
 			return NULL;
 		}
 
-		if ((cpy_p->skt) > -1) {
+	stripe = Stripe_id (p->id); /* il login blocca solo lo stato dell'utente */
+	Lock (stripe);
+	
+		if ((p->skt) > -1) {
 			/* un client con quell username è gia connesso */
-			free (cpy_p);
-			Unlock (&mtx_hash);
+			Unlock (stripe);
+			Rwunlock (&rw_hash);
+			if (log_compact == 1) {
+				Cancel_records (1);
+			}
 			msg.type = MSG_ERROR;
 			msg.buffer = ALREADY_CONNECT;
 			msg.length = strlen (ALREADY_CONNECT) + 1;
@@ -842,67 +2856,129 @@ pthread_mutex_t * Enable_connect (int skt, char * username)
 		}
 
 		/* il client può connettersi */
-		free (cpy_p);
-		
-		/** ========== Aggiornamento della tabella hash ========== */
-		if (remove_hashElement (hash_table, username)  == -1) {
-			perror ("Errore durante l'aggiornamento della tabella hash");
-			exit (EXIT_FAILURE);
-		}
-		
-		payload.skt = skt;
-		
-		if (pthread_mutex_init ( &(payload.mtx), NULL) == -1) {
-			perror ("Errore nell inizializzazione della variabile mutex");
-			exit (EXIT_FAILURE);
-		}
-
-		if (add_hashElement (hash_table, username, &payload) == -1) {
-			perror ("Errore durante l'aggiornamento della tabella hash");
-			exit (EXIT_FAILURE);
-		}
 		
-		/** ========== Invio del messaggio di conferma abilitazione ========== */
-		msg.type = MSG_OK;
-		msg.buffer = NULL;
-		msg.length = 0;
+		/** ========== Aggiornamento della tabella hash (sul posto) ========== */
+		p->skt = skt;
+		p->q = q = New_queue (skt); /* coda riciclata: il login non alloca memoria */
+		__sync_add_and_fetch (&(p->gen), 1); /* nuova sessione: generazione dispari (online) */
 		
-		n = Send_skt (skt, &msg);
+		/** ========== Invio della conferma e inserzione nella lista dei client connessi ========== */
+		/* nella stessa sezione critica: un broadcast che trova l'utente tra i destinatari viene accodato
+		 * dopo la conferma, uno inviato dopo la conferma lo trova (la coda e' nuova, l'accodamento
+		 * non si blocca); anche un MSG_LIST del client lo include gia' */
+		Lock (&mtx_users);
+			n = Enqueue_frame (q, ok_frame); /* frame condiviso, codificato all'avvio */
+			if (n != SEOF) {
+				Add_user (p);
+			}
+		Unlock (&mtx_users);
 
 		if (n == SEOF) {
 			perror (CLIENT_DISCONNECT);
 			
 			/** ========== Aggiornamento della tabella hash ========== */
-			/* distruzione della variabile mutex */
-			mtx = &((Field_hash_element (username))->mtx);
-			if ( pthread_mutex_destroy(mtx) != 0 ) {
-				fprintf (stderr, "Errore durante la distruzione della variabile mutex");
-				exit (EXIT_FAILURE);
-			}
-	
-			if (remove_hashElement (hash_table, username)  == -1) {
-				perror ("Errore durante l'aggiornamento della tabella hash");
-				exit (EXIT_FAILURE);
-			}
-			payload.skt = -1;
-			if (add_hashElement (hash_table, username, &payload) == -1) {
-				perror ("Errore durante l'aggiornamento della tabella hash");
-				exit (EXIT_FAILURE);
-			}
+			p->skt = -1;
+			p->q = NULL;
+			__sync_add_and_fetch (&(p->gen), 1);
 			
-			Close_skt (skt);
-			Unlock (&mtx_hash);
+			Close_queue (q); /* chiude anche la socket */
+			Release_queue (q);
+			Unlock (stripe);
+			Rwunlock (&rw_hash);
+			if (log_compact == 1) {
+				Cancel_records (1);
+			}
 			return NULL;
 		}
 		
-		mtx = &((Field_hash_element (username))->mtx);
-		
-		/** ========== Inserzione dell'username del client nell'array dei client connessi ==========*/
-		Lock (&mtx_users);
-			Add_user (username);
-		Unlock (&mtx_users);
-		
-	Unlock (&mtx_hash);
+	Unlock (stripe);
+	Rwunlock (&rw_hash);
+	
+	*id = p->id;
+	return q;
+}
+
+/** [MTX] Funzione che abilita o meno un utente alla connessione sul server
+ *	se abilitato, viene aggiornato il socket (associato a quel client) sulla tabella hash
+ *	e ritornato un puntatore alla coda di uscita dell elemento sulla tabella hash con
+ *  key == username
+ *	
+ *	\param skt socket del client
+ *	\param id in cui viene restituito l'id del client (se abilitato)
+ *	
+ *	\retval q se il client è abilitato
+ *	\retval NULL se il client non viene abilitato, chiude eventuali socket aperte
+ */
+outq_t * Enable_connect (int skt, usr_id_t * id)
+{
+	int n;
+	message_t msg;
 	
-	return mtx;
+	n = Receive_skt (skt, &msg);
+	if ( n == SEOF ) {
+		fprintf (stderr, CLIENT_DISCONNECT);
+		Close_skt (skt);
+		return NULL;
+	}
+	
+	return Enable_user (skt, &msg, id);
+}
+
+/** Procedura che serve un messaggio (MSG_LIST, MSG_TO_ONE, MSG_BCAST) ricevuto
+ *  da un client gia' abilitato. Usata sia dai thread Worker che dagli event loop,
+ *  in modo che i due modelli abbiano lo stesso comportamento (e lo stesso log).
+ *  I messaggi di fine comunicazione (SEOF, MSG_EXIT) sono gestiti dal chiamante.
+ * 
+ * 	\param msg, messaggio ricevuto (il buffer viene deallocato)
+ * 	\param id, id del mittente
+ * 	\param this_cli_q, coda di uscita del mittente
+ */
+void Serve_message (message_t * msg, usr_id_t id, outq_t * this_cli_q) {
+	char * dest_username;
+	char * username = User_name (id); /* solo per il prefisso "[mittente]" dei messaggi */
+	frame_t * f;
+	
+	/*******************************************************************/
+	/** ==================== Messaggio di listing ==================== */
+	/*******************************************************************/
+
+	if (msg->type == MSG_LIST) {
+		f = List_frame (); /* frame condiviso, ricostruito solo se la lista e' cambiata */
+
+		Enqueue_frame (this_cli_q, f);
+
+		releaseFrame (f);
+		free ( (msg->buffer) );
+	}
+
+
+	/********************************************************************************/
+	/** ==================== Messaggio ad uno specifico client ==================== */
+	/********************************************************************************/
+
+	if (msg->type == MSG_TO_ONE) {
+
+		dest_username = Divide_to_one (msg, username);
+
+		if ( Send_to_one (id, dest_username, msg, this_cli_q) == 1) {
+		/* è necessario deallocare il buffer */
+			free (msg->buffer);
+		}
+
+		free (dest_username);
+	}
+
+
+	/*********************************************************************/
+	/** ==================== Messaggio di broadcast ==================== */
+	/*********************************************************************/
+
+	if (msg->type == MSG_BCAST) {
+
+		Divide_bcast (msg, username);
+
+		Bcast (msg, id);
+
+		free (msg->buffer);		
+	}
 }
@@ -5,20 +5,175 @@
    Si dichiara che ogni singolo bit presente in questo file è solo ed esclusivamente "farina del sacco" del rispettivo autore :D
  */
 
+#ifndef __FUNSERV__H
+#define __FUNSERV__H
+
+#include <time.h>
+#include <semaphore.h>
+
 #include "genHash.h"
 #include "genList.h"
 #include "comsock.h"
+#include "usrtab.h"
+#include "usrmph.h"
+#include "logring.h"
+#include "msglog.h"
+
+
+#define NFCHUNK 1024 /* numero minimo di payload allocati insieme */
+#define NSTRIPE 64 /* numero di mutex sullo stato degli utenti (striping per id dell'utente) */
 
+/** Politiche applicate quando la coda di uscita di un destinatario e' piena */
+#define QBLOCK 0 /* il mittente attende che si liberi spazio */
+#define QDROP_OLD 1 /* si scartano i frame piu' vecchi non ancora inviati */
+#define QDROP_NEW 2 /* si scarta il frame da accodare */
+#define QDISCONNECT 3 /* il destinatario viene disconnesso */
+
+/** Politiche di sincronizzazione (fdatasync) del file di log */
+#define LSYNC_NONE 0 /* mai: i dati restano nella cache del sistema operativo */
+#define LSYNC_BATCH 1 /* dopo ogni gruppo di righe scritte dal Writer */
+#define LSYNC_INTERVAL 2 /* al piu' una volta ogni sync_ms millisecondi */
+
+#define NO_USER ((usr_id_t) -1) /* fine della lista degli utenti connessi seguita dal Writer */
 
 /** La stringa [MTX] sta ad indicare che la rispettiva funzione/procedura opera in mutua esclusione */
 
+/** Identificatore di un utente autorizzato: ogni username viene internato al caricamento
+ *  in un intero denso (0, 1, 2, ...) che non cambia e non viene riusato per tutta la vita
+ *  del server. Instradamento, sessioni e record di log usano l'id; il nome serve solo ai bordi
+ *  (messaggi ricevuti o inviati ai client e testo del file di log). */
+typedef unsigned int usr_id_t;
+
+
+typedef struct outfrm {
+	/* elemento della coda di uscita di un utente */
+	frame_t * f; /* frame da inviare (condiviso, ad esempio, tra tutti i destinatari di un broadcast) */
+	struct outfrm * next;
+} outfrm_t;
+
+typedef struct outq {
+	/* coda di uscita (limitata) di un utente connesso: chi invia accoda il frame e prosegue,
+	 * la coda viene svuotata senza bloccarsi quando la socket e' pronta in scrittura */
+	int skt; /* socket dell'utente */
+	pthread_mutex_t mtx; /* mutua esclusione sulla coda e sulle scritture sulla socket */
+	pthread_cond_t space; /* segnalata quando si libera spazio nella coda */
+	int refs; /* riferimenti alla coda (sessione, Flusher) */
+	int closed; /* 1 se la sessione e' terminata o la socket non e' piu' scrivibile */
+	int pending; /* 1 se la coda e' nella lista del Flusher */
+	outfrm_t * head; /* primo frame da inviare */
+	outfrm_t * tail; /* ultimo frame da inviare */
+	outfrm_t * spare; /* elementi liberi, riusati dagli accodamenti successivi (anche di altre sessioni) */
+	unsigned int off; /* byte del primo frame gia' inviati */
+	unsigned int depth; /* numero di frame in coda */
+	unsigned long bytes; /* byte in coda non ancora inviati */
+	unsigned int max_depth; /* massimo numero di frame in coda raggiunto */
+	unsigned long max_bytes; /* massimo numero di byte in coda raggiunto */
+	unsigned long dropped; /* frame scartati per la politica sui destinatari lenti */
+	int kicked; /* 1 se la sessione e' stata chiusa perche' il destinatario era troppo lento */
+	time_t since; /* istante dell'ultimo progresso nell'invio (valido se head != NULL) */
+	struct outq * next; /* coda libera successiva (valido solo tra le code libere) */
+} outq_t;
 
 typedef struct field {
-	/* struttura a cui punteranno i payload degli elementi della tabella hash*/
+	/* struttura a cui punteranno i payload degli elementi della tabella hash
+	 * (allocata in un blocco preallocato, resta allo stesso indirizzo per tutta la vita del server) */
 	int skt;
-	pthread_mutex_t mtx;
+	outq_t * q; /* coda di uscita dell'utente (NULL se non connesso) */
+	unsigned int gen; /* generazione della sessione: dispari se l'utente e' online, pari se offline */
+	int fan_pending; /* shard di messaggi dell'utente affidati ai thread Fanout e non ancora inviati */
+	usr_id_t id; /* id dell'utente */
+	char * name; /* username dell'utente (internato: unica copia, mai deallocata prima della terminazione) */
+	struct field * prev; /* utente connesso precedente (lista degli utenti connessi) */
+	struct field * next; /* utente connesso successivo (lista degli utenti connessi) */
 } field_t;
 
+typedef struct fchunk {
+	/* blocco di payload preallocati */
+	struct fchunk * next; /* blocco allocato in precedenza */
+	usr_id_t base; /* id del primo payload del blocco (il payload i ha id base + i) */
+	unsigned int n; /* payload gia' assegnati */
+	unsigned int dim; /* numero di payload del blocco */
+	field_t * f; /* payload (allocati insieme all'intestazione) */
+} fchunk_t;
+
+typedef struct nblock {
+	/* blocco di username degli utenti autorizzati (deallocato solo alla terminazione del server) */
+	struct nblock * next;
+	char * names;
+} nblock_t;
+
+typedef struct loader {
+	/* porzione del file degli utenti autorizzati validata da un thread Loader */
+	pthread_t tid;
+	char * data; /* file mappato in memoria */
+	char * names; /* blocco in cui copiare gli username (stessi offset del file) */
+	size_t start; /* primo byte della porzione (inizio di una riga) */
+	size_t end; /* byte successivo all'ultimo della porzione (inizio di una riga o fine del file) */
+	userElem_t * e; /* username della porzione, nell'ordine del file */
+	unsigned int n; /* numero di username della porzione */
+	int err; /* 0, oppure il codice di errore (EINVAL: riga non valida) */
+} loader_t;
+
+typedef struct logshard {
+	/* segmento del file di log: ha una coda dei record e un Writer propri */
+	logRing_t * ring; /* record in attesa del Writer */
+	sem_t sem; /* semaforo per risvegliare il Writer prima della scadenza */
+	unsigned long bytes; /* byte (approssimati) dei record in attesa */
+	char * file; /* file su cui scrive il Writer del segmento */
+	int stamped; /* 1 se ogni riga e' preceduta dal suo timbro di sequenza (log diviso in segmenti) */
+	mlogOut_t * out; /* stato del segmento binario (NULL se il log e' testuale) */
+	int members; /* 1 se il Writer segue gli utenti connessi, da riscrivere all'inizio di ogni segmento (log compatto con rotazione) */
+	usr_id_t * m_prev; /* utenti connessi secondo i record gia' scritti, nell'ordine di connessione (liste indicizzate per id) */
+	usr_id_t * m_next;
+	usr_id_t m_head, m_tail; /* primo e ultimo utente connesso (NO_USER se non ce ne sono) */
+	unsigned int m_dim; /* id coperti dalle liste */
+} logshard_t;
+
+typedef struct bcast {
+	/* broadcast la cui fotografia dei destinatari e' in corso di invio */
+	frame_t * f; /* messaggio codificato (un solo frame per tutti i destinatari) */
+	usr_id_t mit; /* mittente, per il file di log */
+	field_t * p_mit; /* payload del mittente se il messaggio e' affidato ai thread Fanout (NULL se inviato direttamente) */
+	int to_one; /* 1 se e' un messaggio ad un solo destinatario (MSG_TO_ONE), non un broadcast */
+	unsigned long seq; /* numero del broadcast nel log compatto */
+	int n; /* numero di destinatari */
+	usr_id_t * ids; /* id dei destinatari, per il file di log */
+	outq_t ** qs; /* code di uscita dei destinatari (un riferimento ciascuna) */
+	int refs; /* shard non ancora completati */
+} bcast_t;
+
+typedef struct shard {
+	/* sottoinsieme dei destinatari di un broadcast assegnato ad un thread Fanout */
+	bcast_t * b;
+	int n; /* numero di destinatari dello shard */
+	int * idx; /* indici dei destinatari in b (NULL = tutti i destinatari) */
+	struct shard * next;
+} shard_t;
+
+typedef struct closed {
+	/* segmento del file di log chiuso dalla rotazione, in attesa dell'Archiver */
+	char * name; /* nome del segmento ("file_log.n") */
+	char * file; /* nome del file di log attivo da cui e' stato ottenuto */
+	unsigned long n; /* numero del segmento */
+	struct closed * next;
+} closed_t;
+
+typedef struct closedq {
+	/* coda dei segmenti chiusi */
+	pthread_mutex_t mtx;
+	pthread_cond_t cond; /* segnalata quando viene accodato un segmento */
+	closed_t * head;
+	closed_t * tail;
+} closedq_t;
+
+typedef struct fanq {
+	/* coda degli shard da inviare di un thread Fanout */
+	pthread_mutex_t mtx;
+	pthread_cond_t cond; /* segnalata quando viene accodato uno shard */
+	shard_t * head;
+	shard_t * tail;
+} fanq_t;
+
 /** Funzione che restituisce un puntatore alla copia di un intero
  *  
  *  \param a, intero da copiare
@@ -89,36 +244,267 @@ void Lock (pthread_mutex_t * mtx);
  */
 void Unlock (pthread_mutex_t * mtx);
 
-/** Procedura che inserisce una stringa nella variabile users_list
+/** Esegue l'unlocking sulla variabile mtx, usata come procedura di cleanup
+ *  per i thread cancellati mentre attendono su una variabile di condizione
+
+    \param mtx variabile per la mutua esclusione
+ */
+void Cleanup_unlock (void * mtx);
+
+/** Esegue il locking in lettura sulla variabile rw
+
+    \param rw variabile per la mutua esclusione lettori/scrittori
+ */
+void Rdlock (pthread_rwlock_t * rw);
+
+/** Esegue il locking in scrittura sulla variabile rw
+
+    \param rw variabile per la mutua esclusione lettori/scrittori
+ */
+void Wrlock (pthread_rwlock_t * rw);
+
+/** Esegue l'unlocking sulla variabile rw
+
+    \param rw variabile per la mutua esclusione lettori/scrittori
+ */
+void Rwunlock (pthread_rwlock_t * rw);
+
+/** Procedura che inserisce un utente in coda alla lista degli utenti connessi, in O(1)
  * 
- * 	\param str, stringa da inserire
+ * 	\param p, payload dell'utente appena connesso
  */
-void Add_user (char * str);
+void Add_user (field_t * p);
 
-/** Procedura che elimina una stringa nella variabile users_list
+/** Procedura che rimuove un utente dalla lista degli utenti connessi, in O(1)
  * 	
- * 	\param str, stringa da rimuovere
+ * 	\param p, payload dell'utente che si e' disconnesso
  */
-void Remove_user (char * str);
+void Remove_user (field_t * p);
 
-/** Procedura che ritorna un puntatore alla copia delle variabile users_list
+/** Procedura che ritorna una stringa con gli username degli utenti connessi,
+ *  separati da uno spazio, nell'ordine in cui si sono connessi
  * 
- * 	\retval users_list, lista degli utenti connessi
+ * 	\retval str, lista degli utenti connessi (allocata all interno della funzione)
  */
 char * Listing ();
 
-/** [MTX] Procedura che prende in ingresso 3 stringhe e le concatena
- *  nel formato "mittente:destinatario:messaggio\n" alla variabile to_write
+/** [MTX] Funzione che restituisce la risposta a MSG_LIST gia' codificata,
+ *  ricostruendola solo se la lista degli utenti connessi e' cambiata
+ *  (non acquisisce rw_hash)
+ * 
+ * 	\retval f, frame con la lista degli utenti connessi (con un riferimento da rilasciare)
+ */
+frame_t * List_frame ();
+
+/** Funzione che restituisce il segmento del file di log su cui scrive il thread chiamante
+ *  (assegnato a rotazione al primo record del thread)
+ * 
+ * 	\retval sh, segmento del thread
+ */
+logshard_t * Log_shard ();
+
+/** Procedura che prenota n celle nella coda dei record del segmento del thread chiamante:
+ *  se la coda e' piena sveglia il Writer e attende che si liberino. Va chiamata prima di
+ *  acquisire i lock sotto i quali i record vengono poi accodati (Add_reserved).
+ * 
+ * 	\param n, numero di celle
+ */
+void Reserve_records (int n);
+
+/** Procedura che annulla n prenotazioni fatte con Reserve_records e non usate
+ * 
+ * 	\param n, numero di celle
+ */
+void Cancel_records (int n);
+
+/** Procedura che accoda, senza lock e senza attese, un record di log in una cella gia'
+ *  prenotata (Reserve_records) nel segmento del thread chiamante.
  * 	
- * 	\param mit, mittente
- * 	\param dest, destinatario
- *  \param mess, messaggio
+ * 	\param type, tipo del record (LREC_*)
+ * 	\param mit, id del mittente (o dell'utente entrato/uscito)
+ * 	\param dest, id del destinatario
+ * 	\param seq, numero del broadcast (LREC_BCAST, LREC_SKIP)
+ *  \param f, frame con buffer "[mittente] testo", di cui viene acquisito un riferimento (NULL se il record non ha testo)
  */
-void Add_string (char * mit, char * dest, char * mess);
+void Add_reserved (int type, usr_id_t mit, usr_id_t dest, unsigned long seq, frame_t * f);
 
-/** Procedura che ridimensiona al valore NWRITE e resetta la variabile to_write
+/** Procedura che accoda, senza lock, un record di log nel segmento del thread chiamante
+ *  (le righe vengono composte dal Writer del segmento).
+ *  Il Writer viene svegliato quando i byte in attesa superano log_threshold; se la coda
+ *  dei record e' piena lo si sveglia e si attende una cella libera.
+ * 	
+ * 	\param type, tipo del record (LREC_*)
+ * 	\param mit, id del mittente (o dell'utente entrato/uscito)
+ * 	\param dest, id del destinatario
+ * 	\param seq, numero del broadcast (LREC_BCAST, LREC_SKIP)
+ *  \param f, frame con buffer "[mittente] testo", di cui viene acquisito un riferimento (NULL se il record non ha testo)
  */
-void Reset_string ();
+void Add_record (int type, usr_id_t mit, usr_id_t dest, unsigned long seq, frame_t * f);
+
+/** Procedura che accoda il record di log di un messaggio consegnato
+ *  (la riga "mittente:destinatario:messaggio\n" viene composta dal Writer)
+ * 	
+ * 	\param mit, id del mittente
+ * 	\param dest, id del destinatario
+ *  \param f, frame consegnato (con buffer "[mittente] testo"), di cui viene acquisito un riferimento
+ */
+void Add_string (usr_id_t mit, usr_id_t dest, frame_t * f);
+
+/** Funzione che scrive n byte su un file, gestendo le scritture parziali
+ * 
+ * 	\param fd, file
+ * 	\param buf, byte da scrivere
+ * 	\param n, numero di byte
+ * 	\retval 0, se tutti i byte sono stati scritti
+ * 	\retval -1, in caso di errore (setta errno)
+ */
+int Write_all (int fd, char * buf, size_t n);
+
+/** Funzione che aggiunge una riga, data in k pezzi, al buffer del Writer: il buffer viene
+ *  scritto quando non contiene la riga; una riga piu' lunga dell'intero buffer viene scritta a pezzi
+ * 
+ * 	\param fd, file di log
+ * 	\param buf, buffer del Writer
+ * 	\param dim, dimensione del buffer
+ * 	\param used, byte occupati nel buffer (aggiornato)
+ * 	\param piece, pezzi della riga
+ * 	\param len, lunghezza di ogni pezzo
+ * 	\param k, numero di pezzi
+ * 	\retval n, byte scritti sul file
+ * 	\retval -1, in caso di errore di scrittura (setta errno)
+ */
+long Log_line (int fd, char * buf, size_t dim, size_t * used, char ** piece, size_t * len, int k);
+
+/** Procedura che aggiorna gli utenti connessi seguiti dal Writer con un record estratto dalla coda
+ *  (log compatto con rotazione): servono per la fotografia all'inizio di ogni segmento (Log_members)
+ * 
+ * 	\param sh, segmento
+ * 	\param rec, record estratto
+ */
+void Track_member (logshard_t * sh, logRec_t * rec);
+
+/** Funzione che scrive sul file di log i record accodati in un segmento, nell'ordine in cui
+ *  sono stati accodati, e rilascia i rispettivi frame (chiamata solo dal Writer del segmento).
+ *  Le righe vengono composte in un buffer di dimensione fissa, scritto con una sola write
+ *  quando e' pieno; nei segmenti ogni riga e' preceduta dal timbro di sequenza.
+ * 
+ * 	\param sh, segmento
+ * 	\param fd, file di log
+ * 	\param buf, buffer del Writer
+ * 	\param dim, dimensione del buffer
+ * 	\retval n, numero di byte scritti
+ * 	\retval -1, in caso di errore di scrittura (setta errno)
+ */
+long Write_log (logshard_t * sh, int fd, char * buf, size_t dim);
+
+/** Funzione che aggiunge un record binario (intestazione, testo, riempimento) al buffer del Writer
+ * 
+ * 	\param sh, segmento
+ * 	\param fd, file di log
+ * 	\param buf, buffer del Writer
+ * 	\param dim, dimensione del buffer
+ * 	\param used, byte occupati nel buffer (aggiornato)
+ * 	\param type, mit, dest, seq, stamp, time, campi del record
+ * 	\param text, testo del record (non terminato da '\0')
+ * 	\param len, lunghezza del testo
+ * 	\retval n, byte scritti sul file
+ * 	\retval -1, in caso di errore (setta errno)
+ */
+long Bin_record (logshard_t * sh, int fd, char * buf, size_t dim, size_t * used, unsigned int type, usr_id_t mit,
+		usr_id_t dest, unsigned long seq, unsigned long stamp, unsigned long long time, char * text, size_t len);
+
+/** Funzione che scrive sul file di log binario i record accodati in un segmento (chiamata da
+ *  Write_log se il log e' binario): gli id compaiono nel file preceduti, la prima volta,
+ *  dal loro username; tutti i record estratti insieme hanno lo stesso istante di scrittura.
+ * 
+ * 	\param sh, segmento
+ * 	\param fd, file di log
+ * 	\param buf, buffer del Writer
+ * 	\param dim, dimensione del buffer
+ * 	\retval n, numero di byte scritti
+ * 	\retval -1, in caso di errore (setta errno)
+ */
+long Write_binlog (logshard_t * sh, int fd, char * buf, size_t dim);
+
+/** Funzione che scrive l'intestazione di un nuovo file di log binario (non fa nulla se il log e' testuale)
+ * 
+ * 	\param sh, segmento
+ * 	\param fd, file di log (vuoto)
+ * 	\retval 0, in caso di successo
+ * 	\retval -1, in caso di errore di scrittura (setta errno)
+ */
+int Begin_binlog (logshard_t * sh, int fd);
+
+/** Funzione che chiude un file di log binario scrivendo dizionario, indice sparso e coda
+ *  (non fa nulla se il log e' testuale); va chiamata dopo l'ultima Write_log
+ * 
+ * 	\param sh, segmento
+ * 	\param fd, file di log
+ * 	\param buf, buffer del Writer
+ * 	\param dim, dimensione del buffer
+ * 	\retval 0, in caso di successo
+ * 	\retval -1, in caso di errore (setta errno)
+ */
+int End_binlog (logshard_t * sh, int fd, char * buf, size_t dim);
+
+/** Funzione che scrive all'inizio di un nuovo segmento del log compatto la fotografia degli utenti
+ *  connessi seguiti dal Writer (un record LREC_MEMBERS, con il numero dell'ultimo broadcast,
+ *  e un LREC_JOIN per ogni connesso)
+ * 
+ * 	\param sh, segmento
+ * 	\param fd, file di log (appena aperto)
+ * 	\param buf, buffer del Writer
+ * 	\param dim, dimensione del buffer
+ * 	\retval n, numero di byte scritti
+ * 	\retval -1, in caso di errore (setta errno)
+ */
+long Log_members (logshard_t * sh, int fd, char * buf, size_t dim);
+
+/** Funzione che cerca il numero dell'ultimo broadcast registrato nel file di log attivo lasciato
+ *  da un'esecuzione precedente (log compatto con rotazione)
+ * 
+ * 	\param sh, segmento
+ * 	\retval n, numero dell'ultimo broadcast (0 se il file non c'e' o non ne contiene)
+ */
+unsigned long Last_bcast (logshard_t * sh);
+
+/** Funzione che cerca i segmenti chiusi di un file di log ("file.n" e "file.n.gz")
+ *  ed elimina quelli con numero minore di below
+ * 
+ * 	\param file, file di log attivo
+ * 	\param below, numero del segmento piu' vecchio da tenere (0 per non eliminare nulla)
+ * 	\retval n, numero del segmento piu' recente (0 se non ce ne sono)
+ */
+unsigned long Scan_segments (char * file, unsigned long below);
+
+/** Procedura che elimina un segmento chiuso del file di log (compresso o no) e i suoi indici
+ * 
+ * 	\param file, file di log attivo
+ * 	\param n, numero del segmento
+ */
+void Remove_segment (char * file, unsigned long n);
+
+/** Funzione che comprime un segmento chiuso con gzip (in un processo figlio, attendendone la fine)
+ * 
+ * 	\param name, segmento
+ * 	\retval 0, se il segmento e' stato compresso
+ * 	\retval -1, in caso di errore
+ */
+int Gzip_segment (char * name);
+
+/** [MTX] Procedura che accoda un segmento chiuso per l'Archiver
+ * 
+ * 	\param cq, coda dei segmenti chiusi
+ * 	\param c, segmento
+ */
+void Push_closed (closedq_t * cq, closed_t * c);
+
+/** [MTX] Funzione che estrae il prossimo segmento chiuso, attendendo se la coda e' vuota (punto di cancellazione)
+ * 
+ * 	\param cq, coda dei segmenti chiusi
+ * 	\retval c, segmento
+ */
+closed_t * Pop_closed (closedq_t * cq);
 
 /** [MTX] Aggiunge un thread alla lista dei thread attivi
 
@@ -147,6 +533,16 @@ void Close_skt ( int skt);
  */
 int Receive_skt (int skt, message_t * msg);
 
+/** Lettura dalla socket, tramite il buffer di ingresso della connessione, gestendo l'errore 
+ * 
+ *  \param skt, socket da cui leggere
+ *  \param b, buffer di ingresso associato alla socket
+ *  \param msg, messaggio da leggere
+ * 
+ *   \retval n, numero di byte letti
+ */
+int Receive_buf_skt (int skt, msgbuf_t * b, message_t * msg);
+
 /** Scrittura sulla socket gestendo l'errore 
  * 	
  *  \param skt, socket su cui scrivere
@@ -156,8 +552,219 @@ int Receive_skt (int skt, message_t * msg);
  */
 int Send_skt (int skt, message_t * msg);
 
+/** [MTX] Funzione che restituisce la coda di uscita di un utente appena connesso,
+ *  riciclando se possibile quella di una sessione terminata
+ * 
+ * 	\param skt, socket dell'utente
+ * 	\retval q, coda vuota (con un riferimento, quello della sessione)
+ */
+outq_t * New_queue (int skt);
+
+/** Funzione che restituisce un elemento libero della coda, allocandolo solo se la coda
+ *  non ne ha (coda gia' in mutua esclusione)
+ * 
+ * 	\param q, coda
+ * 	\retval p, elemento
+ */
+outfrm_t * Get_outfrm (outq_t * q);
+
+/** Procedura che rilascia il frame di un elemento della coda e lo rimette tra quelli
+ *  liberi della coda (coda gia' in mutua esclusione)
+ * 
+ * 	\param q, coda
+ * 	\param p, elemento
+ */
+void Put_outfrm (outq_t * q, outfrm_t * p);
+
+/** Procedura che scarta tutti i frame presenti nella coda (coda gia' in mutua esclusione)
+ * 
+ * 	\param q, coda da svuotare
+ */
+void Discard_queue (outq_t * q);
+
+/** [MTX] Procedura che rilascia un riferimento alla coda; se era l'ultimo la coda
+ *  viene rimessa tra quelle libere
+ * 
+ * 	\param q, coda
+ */
+void Release_queue (outq_t * q);
+
+/** Procedura che dealloca le code libere (usata alla terminazione del server)
+ */
+void Destroy_queues ();
+
+/** [MTX] Procedura che termina la sessione associata alla coda: scarta i frame non inviati,
+ *  chiude la socket e risveglia eventuali mittenti in attesa di spazio
+ * 
+ * 	\param q, coda
+ */
+void Close_queue (outq_t * q);
+
+/** Procedura che scrive sulla socket, senza bloccarsi, quanti piu' frame possibile
+ *  (con una sola sendmsg per al piu' NIOV frame). Coda gia' in mutua esclusione.
+ * 
+ * 	\param q, coda da svuotare
+ * 	\retval 0, se la coda e' vuota o la socket non e' pronta in scrittura
+ * 	\retval SEOF, se il destinatario non e' piu' raggiungibile (la coda viene chiusa)
+ */
+int Flush_queue (outq_t * q);
+
+/** Procedura che chiude la sessione di un destinatario lento secondo la politica
+ *  configurata, o di un utente non piu' autorizzato (coda gia' in mutua esclusione):
+ *  la socket viene interrotta con shutdown e il client viene poi disconnesso normalmente
+ *  dal thread che lo serve
+ * 
+ * 	\param q, coda del destinatario
+ * 	\param kicked, 1 se il destinatario era troppo lento, 0 se non e' piu' autorizzato
+ */
+void Shutdown_queue (outq_t * q, int kicked);
+
+/** Funzione che verifica se un destinatario non riceve nulla da almeno q_secs secondi
+ *  pur avendo frame in coda (coda gia' in mutua esclusione)
+ * 
+ * 	\param q, coda del destinatario
+ * 	\retval 1, se il destinatario e' bloccato da troppo tempo
+ * 	\retval 0, altrimenti
+ */
+int Stalled_queue (outq_t * q);
+
+/** Funzione che scarta il frame piu' vecchio della coda non ancora inviato, neanche
+ *  in parte (coda gia' in mutua esclusione)
+ * 
+ * 	\param q, coda del destinatario
+ * 	\retval 1, se e' stato scartato un frame
+ * 	\retval 0, se in coda c'e' solo un frame gia' inviato in parte
+ */
+int Drop_oldest (outq_t * q);
+
+/** [MTX] Procedura che affida la coda al Flusher (coda gia' in mutua esclusione)
+ * 
+ * 	\param q, coda con frame in attesa che la socket sia pronta in scrittura
+ */
+void Pending_queue (outq_t * q);
+
+/** [MTX] Funzione che accoda un frame nella coda di uscita di un utente, senza attendere
+ *  che venga scritto sulla socket. Se la coda era vuota prova subito a scriverlo
+ *  (senza bloccarsi); cio' che resta viene inviato dal Flusher. Se la coda e' piena
+ *  si applica la politica q_policy (attesa, scarto del frame piu' vecchio o di quello
+ *  nuovo, disconnessione del destinatario).
+ * 
+ * 	\param q, coda del destinatario
+ * 	\param f, frame da accodare (viene acquisito un riferimento)
+ * 	\retval 0, se il frame e' stato accodato (o scartato secondo la politica)
+ *  \retval SEOF, se il destinatario si e' disconnesso
+ */
+int Enqueue_frame (outq_t * q, frame_t * f);
+
+/** [MTX] Funzione che codifica un messaggio e lo accoda nella coda di uscita di un utente
+ * 
+ * 	\param q, coda del destinatario
+ * 	\param msg, messaggio da inviare
+ * 	\retval 0, se il messaggio e' stato accodato
+ *  \retval SEOF, se il destinatario si e' disconnesso
+ */
+int Send_queue (outq_t * q, message_t * msg);
+
+/** [MTX] Procedura che garantisce che ci siano almeno n payload liberi nel blocco corrente,
+ *  allocando un nuovo blocco (di almeno NFCHUNK payload) se necessario
+ * 
+ * 	\param n, numero di payload che verranno richiesti
+ */
+void Reserve_fields (unsigned int n);
+
+/** [MTX] Funzione che restituisce il payload (inizialmente offline) di un nuovo utente
+ *  autorizzato, preso dal blocco corrente, e gli assegna l'id successivo
+ * 
+ * 	\param name, username dell'utente (non viene copiato)
+ * 	\retval p, payload dell'utente
+ */
+field_t * New_field (char * name);
+
+/** Funzione che restituisce il payload dell'utente con un dato id, senza consultare
+ *  la tabella hash (i blocchi dei payload sono pochi: di solito uno solo)
+ * 
+ * 	\param id, id di un utente autorizzato
+ * 	\retval p, payload dell'utente
+ */
+field_t * Field_id (usr_id_t id);
+
+/** Funzione che restituisce l'username (internato) dell'utente con un dato id
+ * 
+ * 	\param id, id di un utente autorizzato
+ * 	\retval name, username dell'utente (da non deallocare)
+ */
+char * User_name (usr_id_t id);
+
+/** Funzione che restituisce il mutex che protegge lo stato (skt, q) dell'utente id:
+ *  utenti con id diverso (a meno di NSTRIPE) non si contendono lo stesso mutex
+ * 	
+ *  \param id, id dell'utente
+ *  \retval mtx, mutex associato a id
+ */
+pthread_mutex_t * Stripe_id (usr_id_t id);
+
+/** Funzione che verifica che i len caratteri di s siano tutti alfanumerici (ASCII),
+ *  esaminandone 8 alla volta
+ * 
+ * 	\param s, caratteri da verificare
+ * 	\param len, numero di caratteri
+ * 	\retval 1, se sono tutti alfanumerici
+ * 	\retval 0, altrimenti
+ */
+int Alnum_string (char * s, size_t len);
+
+/** Thread che valida una porzione del file degli utenti autorizzati, copia gli username
+ *  nel blocco dei nomi e ne calcola il valore hash
+ * 
+ * 	\param arg, porzione del file (loader_t)
+ */
+void * Loader (void * arg);
+
+/** Funzione che legge il file degli utenti autorizzati: il file viene mappato in memoria
+ *  e diviso in porzioni validate in parallelo da piu' thread Loader
+ * 
+ * 	\param file, file degli utenti autorizzati
+ * 	\param n, in cui viene restituito il numero di username letti
+ * 	\param names, in cui viene restituito il blocco con gli username (da deallocare o da affidare a Keep_names)
+ * 	\param n_thread, in cui viene restituito il numero di thread usati
+ * 	\retval e, username nell'ordine del file, con il valore hash gia' calcolato (payload NULL)
+ * 	\retval NULL, in caso di errore (setta errno: EINVAL se il file contiene righe non valide)
+ */
+userElem_t * Parse_users (char * file, unsigned int * n, char ** names, int * n_thread);
+
+/** [MTX] Procedura che conserva un blocco di username fino alla terminazione del server
+ * 
+ * 	\param names, blocco di username
+ */
+void Keep_names (char * names);
+
+/** Funzione che costruisce l'hash perfetto minimo sugli utenti presenti in hash_table
+ *  (rw_hash gia' acquisito almeno in lettura, oppure un solo thread attivo). La costruzione
+ *  non modifica hash_table: puo' essere eseguita fuori dal percorso critico e il risultato
+ *  pubblicato poi in user_mph sotto rw_hash in scrittura.
+ * 
+ * 	\retval m, hash perfetto minimo
+ * 	\retval NULL, se la costruzione non e' riuscita (setta errno)
+ */
+userMph_t * Build_mph ();
+
+/** [MTX] Funzione che rilegge il file degli utenti autorizzati e applica alla tabella hash
+ *  solo le differenze: gli utenti aggiunti ricevono un nuovo payload (con un nuovo id),
+ *  quelli rimossi escono dalla tabella e, se connessi, vengono disconnessi; le sessioni
+ *  degli altri utenti non vengono toccate. Va chiamata da un solo thread (Handler).
+ * 
+ * 	\param file, file degli utenti autorizzati
+ * 	\param added, in cui viene restituito il numero di utenti aggiunti
+ * 	\param removed, in cui viene restituito il numero di utenti rimossi
+ * 	\retval 0, se il nuovo insieme di utenti e' stato applicato
+ * 	\retval -1, in caso di errore, lasciando invariato l'insieme precedente (setta errno:
+ * 				EINVAL se il file contiene righe non valide, EEXIST se contiene username ripetuti)
+ */
+int Reload_users (char * file, unsigned int * added, unsigned int * removed);
+
 /** Funzione restituisce un puntatore al payload di un elemento
- *  della tabella hash (hash_table) con key == username
+ *  della tabella hash (hash_table) con key == username (rw_hash gia' acquisito almeno in lettura).
+ *  Se e' stato costruito l'hash perfetto minimo (user_mph) la ricerca avviene su quello
  * 	
  *  \param username, nome utente da cercare
  *  \retval payload, puntatore al payload
@@ -170,10 +777,22 @@ field_t * Field_hash_element (char * key);
  *  e la lista dei thread attivi.
  * 
  *  \param thread_id, id del thread che chiama la procedura
- *  \param client, username del client da disconnettere
+ *  \param client, id del client da disconnettere
  * 
  * */
-void Disconnect (pthread_t thread_id, char * client, int skt);
+void Disconnect (pthread_t thread_id, usr_id_t client);
+
+/** [MTX] Procedura che disconnette un client che desidera disconnettersi
+ *  o che si è gia disconnesso, aggiornando la tabella hash e la lista
+ *  degli utenti connessi (non tocca la lista dei thread attivi, in modo
+ *  da poter essere usata anche dagli event loop)
+ * 
+ *  La socket del client appartiene alla sua coda di uscita e viene chiusa da Close_queue,
+ *  in mutua esclusione con le scritture.
+ * 
+ *  \param client, id del client da disconnettere
+ */
+void Disconnect_client (usr_id_t client);
 
 /** Procedura che distrugge la tabella hash ed evenutali variabili
  *  pthread_mutex_t presenti nel campo payload
@@ -217,41 +836,104 @@ void Divide_bcast ( message_t * msg, char * mit );
 /** [MTX] Procedura che invia un messaggio ad un utente, se questo è connesso al server
  *  o invia al mittente un messaggio d'errore se il destinatario non è conneesso.
  * 
- * 	\param mit, mittente del messaggio
- * 	\param dest, destinatario del messaggio
+ * 	\param mit, id del mittente del messaggio
+ * 	\param dest, username del destinatario del messaggio
  *  \param msg, messaggio da inviare
- * 	\param this_cli_mtx, variabile per la mutua esclusione con il mittente
+ * 	\param mit_q, coda di uscita del mittente
  * 						(in questo modo la complessità dell'invio è O(1) )
  * 	\retval 1, se è andato tutto a buon fine
  *  \retval 0, se è stato inviato un messaggio d'errore ed buffer "vecchio" (contenuto in msg) è gia stato deallocato
  */
-int Send_to_one (char * mit, char * dest, message_t * msg, int mit_skt, pthread_mutex_t * mit_mtx);
+int Send_to_one (usr_id_t mit, char * dest, message_t * msg, outq_t * mit_q);
 
-/** Funzione che restituisce una copia della n-esima stringa contenuta in
- * 	users_list (separata l una dalle altra da uno spazio).
- * 	Per essere usata correttamente n <= al numero di stringhe separate da
- * 	spazio presenti in users_list.
+/** [MTX] Procedura che invia msg a tutti gli utenti connessi: i lock globali
+ *  sono tenuti solo per fotografare i destinatari, non durante l'invio.
+ *  Con almeno fan_min destinatari, o se il mittente ha ancora shard in attesa,
+ *  l'invio e' diviso in shard affidati ai thread Fanout e la procedura ritorna
+ *  senza attenderne il completamento.
  * 
- * 	\param n, n-esima stringa da restituire come copia
- * 	\retval str, puntatore alla stringa da restituire (allocata all interno della funzione)
- */
-char * User (int n);
-
-/** Procedura che invia msg a tutti gli utenti connessi
  * 	\param msg, messaggio da inviare
- * 	\param mit, mittente del messaggio da utilizzare per l'aggiornamento
- * 				della variabile to_write
+ * 	\param mit, id del mittente del messaggio da utilizzare per il file di log
  */
-void Bcast (message_t * msg, char * mit);
+void Bcast (message_t * msg, usr_id_t mit);
 
 /** [MTX] Funzione che abilita o meno un utente alla connessione sul server
  *	se abilitato, viene aggiornato il socket (associato a quel client) sulla tabella hash
- *	e ritornato un puntatore alla variabile mutex dell elemento sulla tabella hash con
+ *	e ritornato un puntatore alla coda di uscita dell elemento sulla tabella hash con
  *  key == username
  *	
  *	\param skt socket del client
+ *	\param id in cui viene restituito l'id del client (se abilitato)
  *	
- *	\retval mtx se il client non è abilitato
+ *	\retval q se il client è abilitato
  *	\retval NULL se il client non viene abilitato, chiude eventuali socket aperte
  */
-pthread_mutex_t * Enable_connect (int skt, char * username);
+outq_t * Enable_connect (int skt, usr_id_t * id);
+
+/** [MTX] Procedura che divide i destinatari di un messaggio in shard, uno per ogni thread
+ *  Fanout (in base alla socket, in modo che un utente sia servito sempre dallo stesso thread),
+ *  e li accoda senza attenderne l'invio
+ * 
+ * 	\param b, messaggio (con mittente, destinatari e riferimenti alle loro code)
+ */
+void Fan_out (bcast_t * b);
+
+/** Funzione che indica se un utente ha messaggi affidati ai thread Fanout non ancora inviati:
+ *  finche' ne ha, anche i suoi messaggi successivi passano dai thread Fanout, in modo da non
+ *  raggiungere un destinatario prima di quelli precedenti
+ * 
+ * 	\param mit, id dell'utente
+ * 	\retval 1, se l'utente ha shard in attesa
+ * 	\retval 0, altrimenti
+ */
+int Fan_pending (usr_id_t mit);
+
+/** [MTX] Procedura che invia un messaggio ai destinatari di uno shard, accoda
+ *  i record di log e rilascia i riferimenti alle code; l'ultimo shard completato
+ *  dealloca il messaggio
+ * 
+ * 	\param s, shard da inviare (viene deallocato)
+ */
+void Send_shard (shard_t * s);
+
+/** [MTX] Procedura che accoda uno shard nella coda di un thread Fanout
+ * 
+ * 	\param fq, coda del thread Fanout
+ * 	\param s, shard da accodare
+ */
+void Push_shard (fanq_t * fq, shard_t * s);
+
+/** [MTX] Funzione che estrae uno shard dalla coda di un thread Fanout,
+ *  attendendo che ne venga accodato uno se la coda e' vuota
+ * 
+ * 	\param fq, coda del thread Fanout
+ * 	\retval s, shard da inviare
+ */
+shard_t * Pop_shard (fanq_t * fq);
+
+/** [MTX] Funzione che, ricevuto il messaggio di connessione, abilita o meno
+ *  un utente alla connessione sul server (vedi Enable_connect).
+ *  Usata direttamente dagli event loop, che ricevono il messaggio di
+ *  connessione senza bloccarsi sulla socket.
+ *	
+ *	\param skt socket del client
+ *	\param msg messaggio di connessione ricevuto (il buffer viene deallocato)
+ *	\param id in cui viene restituito l'id del client (se abilitato)
+ *	
+ *	\retval q coda di uscita del client, se il client è abilitato
+ *	\retval NULL se il client non viene abilitato, chiude eventuali socket aperte
+ */
+outq_t * Enable_user (int skt, message_t * msg, usr_id_t * id);
+
+/** Procedura che serve un messaggio (MSG_LIST, MSG_TO_ONE, MSG_BCAST) ricevuto
+ *  da un client gia' abilitato. Usata sia dai thread Worker che dagli event loop,
+ *  in modo che i due modelli abbiano lo stesso comportamento (e lo stesso log).
+ *  I messaggi di fine comunicazione (SEOF, MSG_EXIT) sono gestiti dal chiamante.
+ * 
+ * 	\param msg, messaggio ricevuto (il buffer viene deallocato)
+ * 	\param id, id del mittente
+ * 	\param this_cli_q, coda di uscita del mittente
+ */
+void Serve_message (message_t * msg, usr_id_t id, outq_t * this_cli_q);
+
+#endif
@@ -0,0 +1,260 @@
+/**
+   \file logcat.c
+   \author Marco Ponza
+   \brief  scrive i segmenti binari del log di msgserv (opzione -B) come righe "mittente:destinatario:messaggio"
+   Si dichiara che ogni singolo bit presente in questo file è solo ed esclusivamente "farina del sacco" del rispettivo autore :D
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "msglog.h"
+
+/** ========== Macro ========== */
+#define NOUTBUF (1 << 20) /* dimensione del buffer dello standard output */
+#define NONE ((unsigned int) -1) /* fine della lista degli utenti connessi */
+#define USAGE "Uso: %s [-s ms_inizio] [-e ms_fine] segmento_log...\n"
+
+/** ========== Strutture ========== */
+typedef struct entry {
+	/* record di log di uno dei segmenti */
+	mlogHdr_t * h;
+	mlog_t * l;
+} entry_t;
+
+typedef struct skip {
+	/* destinatario che non ha ricevuto il broadcast seq */
+	unsigned long long seq;
+	unsigned int dest;
+} skip_t;
+
+/** ========== Variabili globali ========== */
+static mlog_t ** seg; /* segmenti */
+static int n_seg; /* numero di segmenti */
+
+/** Procedura che termina il programma dopo un errore
+ *
+ * 	\param msg, messaggio d'errore
+ */
+static void Fail (char * msg) {
+	perror (msg);
+	exit (EXIT_FAILURE);
+}
+
+/** Funzione che restituisce lo username di un id (cercato prima nel segmento del record)
+ *
+ * 	\param l, segmento del record
+ * 	\param id, id dell'utente
+ * 	\retval name, username
+ */
+static char * Name (mlog_t * l, unsigned int id) {
+	char * name = name_mlog (l, id);
+	int i;
+
+	for (i = 0; name == NULL && i < n_seg; i++) {
+		name = name_mlog (seg [i], id);
+	}
+	if (name == NULL) {
+		errno = EINVAL;
+		Fail ("Id senza username nel file di log");
+	}
+
+	return name;
+}
+
+/** Funzioni di confronto per qsort e bsearch */
+static int Cmp_stamp (const void * a, const void * b) {
+	unsigned long long x = ((entry_t *) a)->h->stamp, y = ((entry_t *) b)->h->stamp;
+
+	return (x > y) - (x < y);
+}
+
+static int Cmp_skip (const void * a, const void * b) {
+	const skip_t * x = a;
+	const skip_t * y = b;
+
+	if (x->seq != y->seq) {
+		return (x->seq > y->seq) - (x->seq < y->seq);
+	}
+	return (x->dest > y->dest) - (x->dest < y->dest);
+}
+
+int main (int argc, char * argv []) {
+	int opt, i;
+	unsigned long long from = 0, to = (unsigned long long) -1;
+	entry_t * e = NULL;
+	size_t n = 0, dim = 0, k;
+	skip_t * skip = NULL;
+	size_t n_skip = 0, dim_skip = 0;
+	skip_t key;
+	mlogHdr_t * h;
+	unsigned int max_id = 0, id, head = NONE, tail = NONE;
+	unsigned int * prev = NULL;
+	unsigned int * next = NULL;
+	static char outbuf [NOUTBUF];
+
+	while ((opt = getopt (argc, argv, "s:e:")) != -1) {
+		switch (opt) {
+			case 's':
+				from = strtoull (optarg, NULL, 10);
+				break;
+			case 'e':
+				to = strtoull (optarg, NULL, 10);
+				break;
+			default:
+				fprintf (stderr, USAGE, argv [0]);
+				exit (EXIT_FAILURE);
+		}
+	}
+	n_seg = argc - optind;
+	if (n_seg <= 0) {
+		fprintf (stderr, USAGE, argv [0]);
+		exit (EXIT_FAILURE);
+	}
+	seg = malloc (n_seg * sizeof (mlog_t *));
+	if (seg == NULL) {
+		Fail ("Errore durante l'apertura dei segmenti");
+	}
+	sort_mlog (argv + optind, n_seg); /* segmenti di rotazione nell'ordine in cui sono stati scritti */
+	for (i = 0; i < n_seg; i++) {
+		seg [i] = open_mlog (argv [optind + i]);
+		if (seg [i] == NULL) {
+			Fail ("Errore nell'apertura di un segmento binario");
+		}
+		if (seg [i]->n_names > max_id) {
+			max_id = seg [i]->n_names;
+		}
+	}
+	setvbuf (stdout, outbuf, _IOFBF, NOUTBUF);
+
+	/* record di log di tutti i segmenti: nel log compatto servono anche gli ingressi e le uscite
+	 * precedenti l'istante from, negli altri casi l'indice sparso porta subito al primo record utile */
+	for (i = 0; i < n_seg; i++) {
+		h = first_mlog (seg [i], (seg [i]->flags & MLOG_COMPACT) ? 0 : from);
+		for (; h != NULL; h = next_mlog (seg [i], h)) {
+			if (h->type == LREC_SKIP) {
+				if (n_skip == dim_skip) {
+					dim_skip = (dim_skip == 0) ? 1024 : 2 * dim_skip;
+					skip = realloc (skip, dim_skip * sizeof (skip_t));
+					if (skip == NULL) {
+						Fail ("Errore durante la lettura dei segmenti");
+					}
+				}
+				skip [n_skip].seq = h->seq;
+				skip [n_skip++].dest = h->dest;
+				continue;
+			}
+			if (n == dim) {
+				dim = (dim == 0) ? 4096 : 2 * dim;
+				e = realloc (e, dim * sizeof (entry_t));
+				if (e == NULL) {
+					Fail ("Errore durante la lettura dei segmenti");
+				}
+			}
+			e [n].h = h;
+			e [n++].l = seg [i];
+		}
+	}
+	/* i segmenti di un log diviso si riuniscono nell'ordine dei timbri;
+	 * gli altri (segmenti di rotazione, gia' ordinati per numero) vengono concatenati */
+	if (n_seg > 1 && (seg [0]->flags & MLOG_STAMPED)) {
+		qsort (e, n, sizeof (entry_t), Cmp_stamp);
+	}
+	qsort (skip, n_skip, sizeof (skip_t), Cmp_skip);
+
+	/* utenti connessi, nell'ordine di connessione (liste indicizzate per id) */
+	prev = malloc ((max_id + 1) * sizeof (unsigned int));
+	next = malloc ((max_id + 1) * sizeof (unsigned int));
+	if (prev == NULL || next == NULL) {
+		Fail ("Errore durante la lettura dei segmenti");
+	}
+	for (id = 0; id <= max_id; id++) { /* nessuno connesso: fuori dalla lista prev e next valgono NONE */
+		prev [id] = NONE;
+		next [id] = NONE;
+	}
+
+	for (k = 0; k < n; k++) {
+		h = e [k].h;
+		if (h->mit > max_id || h->dest > max_id) {
+			errno = EINVAL;
+			Fail ("Id senza username nel file di log");
+		}
+		switch (h->type) {
+			case LREC_MSG:
+				if (h->time >= from && h->time <= to) {
+					line_mlog (Name (e [k].l, h->mit), Name (e [k].l, h->dest), h);
+				}
+				break;
+			case LREC_MEMBERS: /* inizio di un segmento ruotato o di un nuovo avvio: seguono gli utenti connessi */
+				while (head != NONE) {
+					id = head;
+					head = next [id];
+					prev [id] = NONE;
+					next [id] = NONE;
+				}
+				tail = NONE;
+				break;
+			case LREC_JOIN:
+				if (prev [h->mit] != NONE || head == h->mit) { /* gia' connesso */
+					break;
+				}
+				prev [h->mit] = tail;
+				next [h->mit] = NONE;
+				if (tail == NONE) {
+					head = h->mit;
+				} else {
+					next [tail] = h->mit;
+				}
+				tail = h->mit;
+				break;
+			case LREC_LEAVE:
+				if (prev [h->mit] == NONE && head != h->mit) { /* entrato prima dei segmenti letti */
+					break;
+				}
+				if (prev [h->mit] == NONE) {
+					head = next [h->mit];
+				} else {
+					next [prev [h->mit]] = next [h->mit];
+				}
+				if (next [h->mit] == NONE) {
+					tail = prev [h->mit];
+				} else {
+					prev [next [h->mit]] = prev [h->mit];
+				}
+				prev [h->mit] = NONE;
+				next [h->mit] = NONE;
+				break;
+			case LREC_BCAST: /* una riga per ogni utente connesso non saltato */
+				if (h->time < from || h->time > to) {
+					break;
+				}
+				key.seq = h->seq;
+				for (id = head; id != NONE; id = next [id]) {
+					key.dest = id;
+					if (n_skip > 0 && bsearch (&key, skip, n_skip, sizeof (skip_t), Cmp_skip) != NULL) {
+						continue;
+					}
+					line_mlog (Name (e [k].l, h->mit), Name (e [k].l, id), h);
+				}
+				break;
+		}
+	}
+	if (fflush (stdout) == EOF) {
+		Fail ("Errore durante la scrittura delle righe");
+	}
+
+	/* deallocazione */
+	for (i = 0; i < n_seg; i++) {
+		close_mlog (&(seg [i]));
+	}
+	free (seg);
+	free (e);
+	free (skip);
+	free (prev);
+	free (next);
+
+	return 0;
+}
@@ -0,0 +1,204 @@
+/**
+   \file logexport.c
+   \author Marco Ponza
+   \brief  espande un file di log compatto di msgserv (opzione -c) nelle righe "mittente:destinatario:messaggio"
+   Si dichiara che ogni singolo bit presente in questo file è solo ed esclusivamente "farina del sacco" del rispettivo autore :D
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "usrtab.h"
+
+/** ========== Macro ========== */
+#define NKEY 64 /* lunghezza massima del numero di un broadcast nelle chiavi "seq:destinatario" */
+#define NOUTBUF (1 << 20) /* dimensione del buffer dello standard output */
+#define USAGE "Uso: %s file_log\n"
+
+/** ========== Strutture ========== */
+typedef struct member {
+	/* utente connesso (nell'ordine di connessione, come la lista degli utenti connessi del server) */
+	char * name;
+	struct member * prev;
+	struct member * next;
+} member_t;
+
+/** Procedura che termina il programma dopo un errore
+ *
+ * 	\param msg, messaggio d'errore
+ */
+static void Fail (char * msg) {
+	perror (msg);
+	exit (EXIT_FAILURE);
+}
+
+/** Funzione che costruisce la chiave "seq:destinatario" di un destinatario saltato
+ *
+ * 	\param seq, numero del broadcast (stringa di cifre)
+ * 	\param len, lunghezza di seq
+ * 	\param dest, destinatario
+ * 	\param key, buffer in cui costruire la chiave
+ * 	\param dim, dimensione del buffer
+ * 	\retval key, la chiave
+ */
+static char * Skip_key (char * seq, size_t len, char * dest, char * key, size_t dim) {
+	size_t d = strlen (dest);
+
+	if (len + d + 2 > dim) {
+		errno = EINVAL;
+		Fail ("Riga del file di log non valida");
+	}
+	memcpy (key, seq, len);
+	key [len] = ':';
+	memcpy (key + len + 1, dest, d + 1);
+
+	return key;
+}
+
+int main (int argc, char * argv []) {
+	FILE * fp;
+	char * line = NULL;
+	size_t dim = 0;
+	ssize_t n;
+	char * p;
+	char * q;
+	char * key;
+	char kbuf [NKEY + 256 + 2];
+	userTable_t * skip; /* destinatari che non hanno ricevuto un broadcast ("seq:destinatario") */
+	userTable_t * online; /* utenti connessi (username -> member_t) */
+	member_t * head = NULL;
+	member_t * tail = NULL;
+	member_t * m;
+	static char outbuf [NOUTBUF];
+
+	if (argc != 2) {
+		fprintf (stderr, USAGE, argv [0]);
+		exit (EXIT_FAILURE);
+	}
+	fp = fopen (argv [1], "r");
+	if (fp == NULL) {
+		Fail ("Errore nell'apertura del file di log");
+	}
+	skip = new_userTable (0);
+	online = new_userTable (0);
+	if (skip == NULL || online == NULL) {
+		Fail ("Errore durante la creazione delle tabelle");
+	}
+	setvbuf (stdout, outbuf, _IOFBF, NOUTBUF);
+
+	/* prima passata: i destinatari saltati vengono registrati dopo il broadcast a cui si riferiscono */
+	while ((n = getline (&line, &dim, fp)) != -1) {
+		if (line [0] != '~') {
+			continue;
+		}
+		if (line [n - 1] == '\n') {
+			line [--n] = '\0';
+		}
+		p = strchr (line + 1, ':');
+		if (p == NULL || p - (line + 1) > NKEY) {
+			errno = EINVAL;
+			Fail ("Riga del file di log non valida");
+		}
+		key = strdup (Skip_key (line + 1, p - (line + 1), p + 1, kbuf, sizeof (kbuf)));
+		if (key == NULL || (add_userElement (skip, key, key) == -1 && errno != EEXIST)) {
+			Fail ("Errore durante la lettura del file di log");
+		}
+	}
+	rewind (fp);
+
+	/* seconda passata: le righe normali vengono copiate, i broadcast espansi sugli utenti connessi */
+	while ((n = getline (&line, &dim, fp)) != -1) {
+		switch (line [0]) {
+			case '=': /* "=seq": inizio di un segmento ruotato o di un nuovo avvio, seguono le righe "+utente" degli utenti connessi */
+				while (head != NULL) {
+					m = head;
+					head = m->next;
+					remove_userElement (online, m->name);
+					free (m->name);
+					free (m);
+				}
+				tail = NULL;
+				break;
+			case '+': /* "+utente": entra in coda alla lista degli utenti connessi */
+				line [strcspn (line, "\n")] = '\0';
+				m = malloc (sizeof (member_t));
+				if (m == NULL || (m->name = strdup (line + 1)) == NULL) {
+					Fail ("Errore durante la lettura del file di log");
+				}
+				if (add_userElement (online, m->name, m) == -1) {
+					Fail ("Utente connesso due volte nel file di log");
+				}
+				m->next = NULL;
+				m->prev = tail;
+				if (tail == NULL) {
+					head = m;
+				} else {
+					tail->next = m;
+				}
+				tail = m;
+				break;
+			case '-': /* "-utente": esce dalla lista degli utenti connessi */
+				line [strcspn (line, "\n")] = '\0';
+				m = (member_t *) remove_userElement (online, line + 1);
+				if (m == NULL) {
+					errno = EINVAL;
+					Fail ("Utente disconnesso ma non connesso nel file di log");
+				}
+				if (m->prev == NULL) {
+					head = m->next;
+				} else {
+					m->prev->next = m->next;
+				}
+				if (m->next == NULL) {
+					tail = m->prev;
+				} else {
+					m->next->prev = m->prev;
+				}
+				free (m->name);
+				free (m);
+				break;
+			case '*': /* "*seq:mittente:testo": una riga per ogni utente connesso non saltato */
+				p = strchr (line + 1, ':');
+				q = (p == NULL) ? NULL : strchr (p + 1, ':');
+				if (q == NULL || p - (line + 1) > NKEY) {
+					errno = EINVAL;
+					Fail ("Riga del file di log non valida");
+				}
+				for (m = head; m != NULL; m = m->next) {
+					if (find_userElement (skip, Skip_key (line + 1, p - (line + 1), m->name, kbuf, sizeof (kbuf))) != NULL) {
+						continue;
+					}
+					fwrite (p + 1, 1, q - p, stdout); /* "mittente:" */
+					fputs (m->name, stdout);
+					fwrite (q, 1, line + n - q, stdout); /* ":testo\n" */
+				}
+				break;
+			case '~': /* gia' letta nella prima passata */
+				break;
+			default: /* riga "mittente:destinatario:messaggio" */
+				fwrite (line, 1, n, stdout);
+		}
+	}
+	if (fflush (stdout) == EOF) {
+		Fail ("Errore durante la scrittura delle righe");
+	}
+
+	/* deallocazione */
+	while (head != NULL) {
+		m = head;
+		head = m->next;
+		free (m->name);
+		free (m);
+	}
+	for (n = 0; n < skip->size; n++) {
+		free (skip->table [n].key);
+	}
+	free_userTable (&skip);
+	free_userTable (&online);
+	free (line);
+	fclose (fp);
+
+	return 0;
+}
@@ -0,0 +1,252 @@
+/**
+   \file logmerge.c
+   \author Marco Ponza
+   \brief  riunisce i segmenti del file di log di msgserv (opzione -L) in un unico flusso di righe, nell'ordine dei timbri
+   Si dichiara che ogni singolo bit presente in questo file è solo ed esclusivamente "farina del sacco" del rispettivo autore :D
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+/** ========== Macro ========== */
+#define NOUTBUF (1 << 20) /* dimensione del buffer dello standard output */
+#define POLLMS 100 /* (-f) attesa tra due letture dei segmenti arrivati alla fine */
+#define GAPMS 2000 /* (-f) attesa massima di un timbro mancante prima di saltarlo */
+#define USAGE "Uso: %s [-f] segmento_log...\n"
+
+/** ========== Strutture ========== */
+typedef struct line {
+	/* riga letta da un segmento e non ancora scritta */
+	unsigned long stamp; /* timbro di sequenza */
+	char * text; /* riga senza timbro (con '\n' finale) */
+	size_t len; /* lunghezza di text */
+} line_t;
+
+typedef struct segment {
+	/* segmento del file di log */
+	FILE * fp;
+	unsigned long last; /* timbro dell'ultima riga letta */
+	int eof; /* 1 se il segmento e' (per ora) finito */
+} segment_t;
+
+/** Procedura che termina il programma dopo un errore
+ *
+ * 	\param msg, messaggio d'errore
+ */
+static void Fail (char * msg) {
+	perror (msg);
+	exit (EXIT_FAILURE);
+}
+
+/** Procedura che inserisce una riga nello heap (minimo sul timbro)
+ *
+ * 	\param heap, indirizzo dello heap (puo' venir riallocato)
+ * 	\param n, indirizzo del numero di righe nello heap
+ * 	\param dim, indirizzo della dimensione dello heap
+ * 	\param l, riga da inserire
+ */
+static void Push (line_t ** heap, size_t * n, size_t * dim, line_t l) {
+	size_t i, p;
+	line_t * h;
+
+	if (*n == *dim) {
+		*dim = (*dim == 0) ? 1024 : 2 * (*dim);
+		*heap = realloc (*heap, (*dim) * sizeof (line_t));
+		if (*heap == NULL) {
+			Fail ("Errore durante la lettura dei segmenti");
+		}
+	}
+	h = *heap;
+	for (i = (*n)++; i > 0 && h [p = (i - 1) / 2].stamp > l.stamp; i = p) {
+		h [i] = h [p];
+	}
+	h [i] = l;
+}
+
+/** Funzione che estrae la riga con il timbro minimo dallo heap (non vuoto)
+ *
+ * 	\param heap, heap
+ * 	\param n, indirizzo del numero di righe nello heap
+ * 	\retval l, la riga estratta
+ */
+static line_t Pop (line_t * heap, size_t * n) {
+	line_t top = heap [0];
+	line_t last = heap [--(*n)];
+	size_t i = 0, c;
+
+	while ((c = 2 * i + 1) < *n) {
+		if (c + 1 < *n && heap [c + 1].stamp < heap [c].stamp) {
+			c++;
+		}
+		if (heap [c].stamp >= last.stamp) {
+			break;
+		}
+		heap [i] = heap [c];
+		i = c;
+	}
+	heap [i] = last;
+
+	return top;
+}
+
+/** Funzione che legge la prossima riga di un segmento
+ *
+ * 	\param s, segmento
+ * 	\param follow, 1 se il segmento puo' ancora crescere (una riga senza '\n' non e' ancora completa)
+ * 	\param l, riga letta
+ * 	\retval 1 se e' stata letta una riga
+ * 	\retval 0 se il segmento e' (per ora) finito
+ */
+static int Read_line (segment_t * s, int follow, line_t * l) {
+	char * buf = NULL;
+	char * p;
+	size_t dim = 0;
+	ssize_t n;
+
+	n = getline (&buf, &dim, s->fp);
+	if (n == -1) {
+		if (ferror (s->fp)) {
+			Fail ("Errore durante la lettura dei segmenti");
+		}
+		clearerr (s->fp);
+		free (buf);
+		return 0;
+	}
+	if (buf [n - 1] != '\n') {
+		if (follow == 1) { /* il Writer sta ancora scrivendo la riga: la rileggo al prossimo giro */
+			fseek (s->fp, -n, SEEK_CUR);
+			free (buf);
+			return 0;
+		}
+		buf = realloc (buf, n + 2);
+		if (buf == NULL) {
+			Fail ("Errore durante la lettura dei segmenti");
+		}
+		buf [n++] = '\n';
+		buf [n] = '\0';
+	}
+
+	/* "timbro riga" */
+	errno = 0;
+	l->stamp = strtoul (buf, &p, 10);
+	if (errno != 0 || p == buf || *p != ' ') {
+		errno = EINVAL;
+		Fail ("Riga di un segmento senza timbro");
+	}
+	l->len = n - (p + 1 - buf);
+	memmove (buf, p + 1, l->len + 1);
+	l->text = buf;
+	s->last = l->stamp;
+
+	return 1;
+}
+
+/** Procedura che scrive una riga sullo standard output e la dealloca
+ *
+ * 	\param l, riga
+ */
+static void Emit (line_t l) {
+	if (fwrite (l.text, 1, l.len, stdout) != l.len) {
+		Fail ("Errore durante la scrittura delle righe");
+	}
+	free (l.text);
+}
+
+int main (int argc, char * argv []) {
+	int opt, i, k, n_seg;
+	int follow = 0; /* 1 se i segmenti vanno seguiti mentre il server li scrive */
+	int waited = 0; /* (-f) millisecondi passati ad attendere il timbro next */
+	unsigned long next = 1; /* prossimo timbro da scrivere (i timbri partono da 1 e non hanno buchi) */
+	segment_t * seg;
+	line_t * heap = NULL; /* righe lette in anticipo rispetto a next */
+	size_t n = 0, dim = 0;
+	line_t l;
+	struct timespec ts = {0, POLLMS * 1000000L};
+	static char outbuf [NOUTBUF];
+
+	while ((opt = getopt (argc, argv, "f")) != -1) {
+		if (opt != 'f') {
+			fprintf (stderr, USAGE, argv [0]);
+			exit (EXIT_FAILURE);
+		}
+		follow = 1;
+	}
+	n_seg = argc - optind;
+	if (n_seg <= 0) {
+		fprintf (stderr, USAGE, argv [0]);
+		exit (EXIT_FAILURE);
+	}
+	seg = calloc (n_seg, sizeof (segment_t));
+	if (seg == NULL) {
+		Fail ("Errore durante l'apertura dei segmenti");
+	}
+	for (i = 0; i < n_seg; i++) {
+		seg [i].fp = fopen (argv [optind + i], "r");
+		if (seg [i].fp == NULL) {
+			Fail ("Errore nell'apertura di un segmento");
+		}
+	}
+	setvbuf (stdout, outbuf, _IOFBF, NOUTBUF);
+
+	/* fusione in linea: una riga esce appena arriva il suo timbro, le altre aspettano nello heap.
+	 * Leggo sempre dal segmento rimasto piu' indietro, cosi' lo heap contiene solo le righe fuori ordine */
+	while (1) {
+		while (n > 0 && heap [0].stamp <= next) {
+			l = Pop (heap, &n);
+			next = l.stamp + 1;
+			Emit (l);
+			waited = 0;
+		}
+
+		for (i = 0, k = -1; i < n_seg; i++) {
+			if (seg [i].eof == 0 && (k == -1 || seg [i].last < seg [k].last)) {
+				k = i;
+			}
+		}
+		if (k != -1) {
+			if (Read_line (&(seg [k]), follow, &l) == 1) {
+				Push (&heap, &n, &dim, l);
+			} else {
+				seg [k].eof = 1;
+			}
+			continue;
+		}
+
+		/* tutti i segmenti sono finiti */
+		if (follow == 0) {
+			/* timbri mancanti (ad esempio record persi da un server terminato male): scrivo il resto in ordine */
+			while (n > 0) {
+				Emit (Pop (heap, &n));
+			}
+			break;
+		}
+		if (n > 0 && waited >= GAPMS) { /* il timbro next non arrivera' piu': lo salto */
+			next = heap [0].stamp;
+			continue;
+		}
+		if (fflush (stdout) == EOF) {
+			Fail ("Errore durante la scrittura delle righe");
+		}
+		nanosleep (&ts, NULL);
+		waited += POLLMS;
+		for (i = 0; i < n_seg; i++) {
+			seg [i].eof = 0;
+		}
+	}
+	if (fflush (stdout) == EOF) {
+		Fail ("Errore durante la scrittura delle righe");
+	}
+
+	/* deallocazione */
+	for (i = 0; i < n_seg; i++) {
+		fclose (seg [i].fp);
+	}
+	free (seg);
+	free (heap);
+
+	return 0;
+}
@@ -0,0 +1,162 @@
+/**
+   \file logq.c
+   \author Marco Ponza
+   \brief  ricerche per mittente, destinatario e intervallo di tempo sui segmenti binari del log di msgserv (opzione -B)
+   Si dichiara che ogni singolo bit presente in questo file è solo ed esclusivamente "farina del sacco" del rispettivo autore :D
+
+   Per ogni segmento si usa l'indice per mittente e destinatario (msgqidx.h): gli indici dei segmenti chiusi
+   sono costruiti dal server (opzione -X) o, se mancano, alla prima ricerca; i segmenti non ancora chiusi
+   vengono indicizzati in memoria ad ogni ricerca.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "msglog.h"
+#include "msgqidx.h"
+
+/** ========== Macro ========== */
+#define NOUTBUF (1 << 20) /* dimensione del buffer dello standard output */
+#define USAGE "Uso: %s [-i] [-f mittente] [-d destinatario] [-s ms_inizio] [-e ms_fine] segmento_log...\n"
+
+/** Procedura che termina il programma dopo un errore
+ *
+ * 	\param msg, messaggio d'errore
+ */
+static void Fail (char * msg) {
+	perror (msg);
+	exit (EXIT_FAILURE);
+}
+
+int main (int argc, char * argv []) {
+	int opt, i, only_index = 0, built = 0;
+	char * from_user = NULL;
+	char * to_user = NULL;
+	unsigned long long from = 0, to = (unsigned long long) -1;
+	unsigned int * post;
+	unsigned int n_post, lo, hi, mid, k;
+	qidxUser_t * us;
+	qidxUser_t * ud;
+	mlog_t * l;
+	mlogHdr_t * h;
+	qidx_t * x;
+	mlogHits_t hits = { NULL, 0, 0 };
+	int stamped = 0;
+	static char outbuf [NOUTBUF];
+
+	while ((opt = getopt (argc, argv, "if:d:s:e:")) != -1) {
+		switch (opt) {
+			case 'i': /* solo costruzione degli indici mancanti */
+				only_index = 1;
+				break;
+			case 'f':
+				from_user = optarg;
+				break;
+			case 'd':
+				to_user = optarg;
+				break;
+			case 's':
+				from = strtoull (optarg, NULL, 10);
+				break;
+			case 'e':
+				to = strtoull (optarg, NULL, 10);
+				break;
+			default:
+				fprintf (stderr, USAGE, argv [0]);
+				exit (EXIT_FAILURE);
+		}
+	}
+	if (optind >= argc) {
+		fprintf (stderr, USAGE, argv [0]);
+		exit (EXIT_FAILURE);
+	}
+	setvbuf (stdout, outbuf, _IOFBF, NOUTBUF);
+	sort_mlog (argv + optind, argc - optind); /* segmenti di rotazione nell'ordine in cui sono stati scritti */
+
+	for (i = optind; i < argc; i++) {
+		l = open_mlog (argv [i]);
+		if (l == NULL && errno == EINVAL) { /* indice, segmento compresso, ...: non e' un segmento binario */
+			fprintf (stderr, "%s: non e' un segmento binario, ignorato\n", argv [i]);
+			continue;
+		}
+		if (l == NULL) {
+			Fail ("Errore nell'apertura di un segmento binario");
+		}
+		stamped |= l->flags & MLOG_STAMPED;
+		x = load_msgqidx (argv [i], l, &built);
+		if (x == NULL) {
+			Fail ("Errore durante la costruzione dell'indice");
+		}
+		if (only_index == 1 || x->head->t_max < from || x->head->t_min > to) {
+			/* solo indice, o segmento fuori dall'intervallo: i record non servono */
+			free_msgqidx (&x);
+			close_mlog (&l);
+			continue;
+		}
+
+		/* posizioni dei record candidati: la lista piu' corta tra inviati e ricevuti */
+		post = NULL;
+		n_post = 0;
+		us = (from_user != NULL) ? find_msgqidx (x, from_user) : NULL;
+		ud = (to_user != NULL) ? find_msgqidx (x, to_user) : NULL;
+		if ((from_user != NULL && us == NULL) || (to_user != NULL && ud == NULL)) {
+			n_post = 0;
+			post = NULL;
+		} else if (us != NULL && (ud == NULL || us->n_sent <= ud->n_recv)) {
+			post = (unsigned int *) (x->map + us->sent);
+			n_post = us->n_sent;
+		} else if (ud != NULL) {
+			post = (unsigned int *) (x->map + ud->recv);
+			n_post = ud->n_recv;
+		}
+
+		if (from_user == NULL && to_user == NULL) { /* solo intervallo di tempo: indice sparso del segmento */
+			for (h = first_mlog (l, from); h != NULL && h->time <= to; h = next_mlog (l, h)) {
+				if ((h->type == LREC_MSG || h->type == LREC_BCAST) && addhit_mlog (&hits, l, h) == -1) {
+					Fail ("Errore durante la ricerca");
+				}
+			}
+		} else {
+			/* primo record non prima di from: le posizioni sono in ordine di tempo */
+			for (lo = 0, hi = n_post; lo < hi; ) {
+				mid = lo + (hi - lo) / 2;
+				if (((mlogHdr_t *) (l->map + (size_t) post [mid] * 8))->time < from) {
+					lo = mid + 1;
+				} else {
+					hi = mid;
+				}
+			}
+			for (k = lo; k < n_post; k++) {
+				h = (mlogHdr_t *) (l->map + (size_t) post [k] * 8);
+				if (h->time > to) {
+					break;
+				}
+				if ((from_user != NULL && strcmp (name_mlog (l, h->mit), from_user) != 0) ||
+				    (to_user != NULL && (h->type != LREC_MSG || strcmp (name_mlog (l, h->dest), to_user) != 0))) {
+					continue;
+				}
+				if (addhit_mlog (&hits, l, h) == -1) {
+					Fail ("Errore durante la ricerca");
+				}
+			}
+		}
+		free_msgqidx (&x);
+		/* il segmento resta mappato fino alla fine: i risultati puntano ai suoi record */
+	}
+
+	if (only_index == 1) {
+		fprintf (stderr, "%d indici costruiti\n", built);
+		return 0;
+	}
+
+	outhits_mlog (&hits, stamped);
+	if (fflush (stdout) == EOF) {
+		Fail ("Errore durante la scrittura delle righe");
+	}
+	free (hits.v);
+
+	return 0;
+}
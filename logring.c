@@ -0,0 +1,160 @@
+/**
+   \file logring.c
+   \author Marco Ponza
+   \brief  coda circolare senza lock (piu' produttori, un consumatore) per le righe del file di log
+   Si dichiara che ogni singolo bit presente in questo file è solo ed esclusivamente "farina del sacco" del rispettivo autore :D
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include "logring.h"
+
+/** legge la sequenza di una cella: le letture successive non vengono anticipate */
+static unsigned long load_seq (logCell_t * c)
+{
+	unsigned long seq = *((volatile unsigned long *) &(c->seq));
+
+	__sync_synchronize ();
+	return seq;
+}
+
+/** pubblica la sequenza di una cella dopo aver completato le scritture sul record */
+static void store_seq (logCell_t * c, unsigned long seq)
+{
+	__sync_synchronize ();
+	*((volatile unsigned long *) &(c->seq)) = seq;
+}
+
+/** crea una coda vuota
+ *  \param n numero minimo di celle (arrotondato alla potenza di 2 successiva)
+ *
+ *  \retval NULL in caso di errore (setta errno)
+ *  \retval r puntatore alla nuova coda
+ */
+logRing_t * new_logRing (unsigned long n)
+{
+	logRing_t * r;
+	unsigned long i, size;
+
+	for (size = 2; size < n; size *= 2);
+
+	r = malloc (sizeof (logRing_t));
+	if (r == NULL) {
+		return NULL;
+	}
+	r->cell = malloc (size * sizeof (logCell_t));
+	if (r->cell == NULL) {
+		free (r);
+		return NULL;
+	}
+	for (i = 0; i < size; i++) { /* ogni cella e' libera per la posizione con lo stesso indice */
+		r->cell [i].seq = i;
+	}
+	r->mask = size - 1;
+	r->head = 0;
+	r->room = size;
+	r->tail = 0;
+
+	return r;
+}
+
+/** distrugge la coda (i frame dei record non estratti non vengono rilasciati)
+ *  \param pr indirizzo del puntatore alla coda (viene messo a NULL)
+ */
+void free_logRing (logRing_t ** pr)
+{
+	if (pr == NULL || *pr == NULL) {
+		return;
+	}
+	free ((*pr)->cell);
+	free (*pr);
+	*pr = NULL;
+}
+
+/** inserisce un record (puo' essere chiamata da piu' thread contemporaneamente, senza lock)
+ *  \param r coda
+ *  \param rec record da inserire (viene copiato)
+ *
+ *  \retval 0 se il record e' stato inserito
+ *  \retval -1 se la coda e' piena
+ */
+int put_logRing (logRing_t * r, logRec_t * rec)
+{
+	if (reserve_logRing (r) == -1) {
+		return -1;
+	}
+	putres_logRing (r, rec);
+
+	return 0;
+}
+
+/** prenota una cella per un inserimento successivo (senza lock)
+ *  \param r coda
+ *
+ *  \retval 0 se la cella e' stata prenotata
+ *  \retval -1 se la coda e' piena
+ */
+int reserve_logRing (logRing_t * r)
+{
+	long room = *((volatile long *) &(r->room));
+
+	while (room > 0) {
+		if (__sync_bool_compare_and_swap (&(r->room), room, room - 1)) {
+			return 0;
+		}
+		room = *((volatile long *) &(r->room)); /* un altro produttore ha prenotato prima */
+	}
+
+	return -1;
+}
+
+/** inserisce un record in una cella gia' prenotata con reserve_logRing: non fallisce e non attende
+ *  \param r coda
+ *  \param rec record da inserire (viene copiato)
+ */
+void putres_logRing (logRing_t * r, logRec_t * rec)
+{
+	unsigned long pos;
+	logCell_t * c;
+
+	/* le prenotazioni non superano le celle: la cella della posizione presa e' gia' stata liberata
+	 * dal consumatore (che rende la prenotazione solo dopo aver liberato la cella) */
+	pos = __sync_fetch_and_add (&(r->head), 1);
+	c = &(r->cell [pos & r->mask]);
+
+	c->rec = *rec;
+	store_seq (c, pos + 1); /* il record diventa visibile al consumatore */
+}
+
+/** annulla una prenotazione fatta con reserve_logRing e non usata
+ *  \param r coda
+ */
+void unreserve_logRing (logRing_t * r)
+{
+	__sync_add_and_fetch (&(r->room), 1);
+}
+
+/** estrae il record piu' vecchio (da un solo thread consumatore)
+ *  \param r coda
+ *  \param rec in cui viene copiato il record estratto
+ *
+ *  \retval 0 se e' stato estratto un record
+ *  \retval -1 se la coda e' vuota (o il record piu' vecchio non e' ancora stato scritto dal suo produttore)
+ */
+int get_logRing (logRing_t * r, logRec_t * rec)
+{
+	logCell_t * c = &(r->cell [r->tail & r->mask]);
+
+	if (load_seq (c) != r->tail + 1) {
+		return -1;
+	}
+
+	*rec = c->rec;
+	store_seq (c, r->tail + r->mask + 1); /* la cella torna libera per il giro successivo */
+	r->tail++;
+	__sync_add_and_fetch (&(r->room), 1);
+
+	return 0;
+}
@@ -0,0 +1,135 @@
+/**  \file
+ *    \author Marco Ponza
+ *  \brief coda circolare senza lock (piu' produttori, un consumatore) per le righe del file di log
+ *
+*/
+
+#ifndef _LOGRING_H
+#define _LOGRING_H
+
+#include "comsock.h"
+
+/* -= TIPI =- */
+
+/** Tipi di record di log */
+#define LREC_MSG 0 /* messaggio consegnato: riga "mittente:destinatario:testo" */
+#define LREC_BCAST 1 /* broadcast (log compatto): riga "*seq:mittente:testo", un solo record per tutti i destinatari */
+#define LREC_JOIN 2 /* utente entrato nella lista dei connessi (log compatto): riga "+utente" */
+#define LREC_LEAVE 3 /* utente uscito dalla lista dei connessi (log compatto): riga "-utente" */
+#define LREC_SKIP 4 /* destinatario che non ha ricevuto il broadcast seq (log compatto): riga "~seq:destinatario" */
+#define LREC_MEMBERS 5 /* inizio di un segmento ruotato o di un nuovo avvio (log compatto): riga "=seq" (ultimo broadcast), seguita da un "+utente" per ogni connesso */
+
+/** <H3>Record di log</H3>
+ * La struttura \c logRec_t rappresenta un evento da scrivere sul file di log, tipicamente un messaggio
+ * consegnato da scrivere come riga "mittente:destinatario:testo": il testo non viene copiato, il record
+ * tiene un riferimento al frame gia' codificato e inviato al destinatario.
+ * - \c type e' il tipo del record (LREC_*)
+ * - \c mit e' l'id del mittente (o dell'utente entrato/uscito)
+ * - \c dest e' l'id del destinatario
+ * - \c seq e' il numero del broadcast (solo LREC_BCAST e LREC_SKIP; in LREC_MEMBERS l'ultimo assegnato)
+ * - \c stamp e' il timbro di sequenza del record (globale, solo se il log e' diviso in segmenti)
+ * - \c f e' il frame consegnato (un riferimento, rilasciato da chi estrae il record; NULL se il record non ha testo)
+ *
+ * <HR>
+ */
+
+typedef struct {
+    unsigned int type;   /** tipo del record */
+    unsigned int mit;    /** id del mittente */
+    unsigned int dest;   /** id del destinatario */
+    unsigned long seq;   /** numero del broadcast */
+    unsigned long stamp; /** timbro di sequenza */
+    frame_t * f;         /** frame consegnato ("[mittente] testo") */
+} logRec_t;
+
+/** <H3>Cella della coda</H3>
+ * - \c seq e' il numero di sequenza della cella: uguale alla posizione se la cella e' libera,
+ *   alla posizione + 1 se contiene un record pronto per il consumatore
+ * - \c rec e' il record
+ *
+ * <HR>
+ */
+
+typedef struct {
+    unsigned long seq;   /** numero di sequenza della cella */
+    logRec_t rec;        /** record */
+} logCell_t;
+
+/** <H3>Coda circolare</H3>
+ * La struttura \c logRing_t rappresenta una coda limitata (algoritmo di D. Vyukov): i produttori
+ * prenotano prima una cella libera (\c room) e poi si contendono solo la posizione di inserimento,
+ * il consumatore (unico) estrae i record nell'ordine in cui sono state prese le posizioni.
+ * La prenotazione puo' essere fatta in anticipo (reserve_logRing), ad esempio prima di acquisire
+ * un lock sotto il quale il record deve essere inserito senza mai attendere.
+ * - \c cell e' l'array delle celle
+ * - \c mask e' il numero di celle - 1 (il numero di celle e' una potenza di 2)
+ * - \c head e' la prossima posizione di inserimento (condivisa dai produttori)
+ * - \c room e' il numero di celle non ancora prenotate (condiviso dai produttori e dal consumatore)
+ * - \c tail e' la prossima posizione di estrazione (del solo consumatore)
+ *
+ * <HR>
+ */
+
+typedef struct {
+    logCell_t * cell;    /** celle */
+    unsigned long mask;  /** numero di celle - 1 */
+    char pad1 [64];      /** head e tail su linee di cache diverse */
+    unsigned long head;  /** prossima posizione di inserimento */
+    long room;           /** celle non ancora prenotate */
+    char pad2 [64];
+    unsigned long tail;  /** prossima posizione di estrazione */
+} logRing_t;
+
+/* -= FUNZIONI =- */
+
+/** crea una coda vuota
+ *  \param n numero minimo di celle (arrotondato alla potenza di 2 successiva)
+ *
+ *  \retval NULL in caso di errore (setta errno)
+ *  \retval r puntatore alla nuova coda
+ */
+logRing_t * new_logRing (unsigned long n);
+
+/** distrugge la coda (i frame dei record non estratti non vengono rilasciati)
+ *  \param pr indirizzo del puntatore alla coda (viene messo a NULL)
+ */
+void free_logRing (logRing_t ** pr);
+
+/** inserisce un record (puo' essere chiamata da piu' thread contemporaneamente, senza lock)
+ *  \param r coda
+ *  \param rec record da inserire (viene copiato)
+ *
+ *  \retval 0 se il record e' stato inserito
+ *  \retval -1 se la coda e' piena
+ */
+int put_logRing (logRing_t * r, logRec_t * rec);
+
+/** prenota una cella per un inserimento successivo (senza lock)
+ *  \param r coda
+ *
+ *  \retval 0 se la cella e' stata prenotata
+ *  \retval -1 se la coda e' piena
+ */
+int reserve_logRing (logRing_t * r);
+
+/** inserisce un record in una cella gia' prenotata con reserve_logRing: non fallisce e non attende
+ *  \param r coda
+ *  \param rec record da inserire (viene copiato)
+ */
+void putres_logRing (logRing_t * r, logRec_t * rec);
+
+/** annulla una prenotazione fatta con reserve_logRing e non usata
+ *  \param r coda
+ */
+void unreserve_logRing (logRing_t * r);
+
+/** estrae il record piu' vecchio (da un solo thread consumatore)
+ *  \param r coda
+ *  \param rec in cui viene copiato il record estratto
+ *
+ *  \retval 0 se e' stato estratto un record
+ *  \retval -1 se la coda e' vuota (o il record piu' vecchio non e' ancora stato scritto dal suo produttore)
+ */
+int get_logRing (logRing_t * r, logRec_t * rec);
+
+#endif
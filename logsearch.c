@@ -0,0 +1,190 @@
+/**
+   \file logsearch.c
+   \author Marco Ponza
+   \brief  ricerca per parole nei testi dei messaggi dei segmenti binari del log di msgserv (opzione -B)
+   Si dichiara che ogni singolo bit presente in questo file è solo ed esclusivamente "farina del sacco" del rispettivo autore :D
+
+   Vengono scritti i record che contengono tutte le parole richieste: per ogni segmento si prende la
+   lista piu' corta dell'indice invertito (msgidx.h) e la si interseca con le altre, decodificate
+   una posizione alla volta. Gli indici dei segmenti chiusi sono costruiti dal server (opzione -X)
+   o, se mancano, alla prima ricerca; i segmenti non ancora chiusi vengono indicizzati in memoria.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "msglog.h"
+#include "msgidx.h"
+
+/** ========== Macro ========== */
+#define NOUTBUF (1 << 20) /* dimensione del buffer dello standard output */
+#define NWORDS 32 /* parole massime in una ricerca */
+#define USAGE "Uso: %s [-i] [-s ms_inizio] [-e ms_fine] \"parole\" segmento_log...\n"
+
+/** Procedura che termina il programma dopo un errore
+ *
+ * 	\param msg, messaggio d'errore
+ */
+static void Fail (char * msg) {
+	perror (msg);
+	exit (EXIT_FAILURE);
+}
+
+/** Funzione di confronto per qsort */
+static int Cmp_post (const void * a, const void * b) {
+	unsigned int x = (*(sidxTerm_t **) a)->n_post, y = (*(sidxTerm_t **) b)->n_post;
+
+	return (x > y) - (x < y);
+}
+
+/** Funzione che interseca le liste delle parole di una ricerca
+ *
+ * 	\param x, indice del segmento
+ * 	\param t, parole (tutte presenti nell'indice)
+ * 	\param n_t, numero di parole
+ * 	\param n, numero di posizioni restituite
+ * 	\retval post, posizioni (/ 8) dei record con tutte le parole, in ordine (allocate con malloc)
+ */
+static unsigned int * Intersect (sidx_t * x, sidxTerm_t ** t, int n_t, unsigned int * n) {
+	unsigned int * post;
+	unsigned int i, k, pos;
+	sidxIter_t it;
+	int j, more;
+
+	/* dalla lista piu' corta: ogni intersezione puo' solo ridurre i candidati */
+	qsort (t, n_t, sizeof (sidxTerm_t *), Cmp_post);
+	post = malloc ((t [0]->n_post + 1) * sizeof (unsigned int));
+	if (post == NULL) {
+		Fail ("Errore durante la ricerca");
+	}
+	for (iter_msgidx (x, t [0], &it), *n = 0; next_msgidx (&it, &pos); ) {
+		post [(*n)++] = pos;
+	}
+
+	for (j = 1; j < n_t && *n > 0; j++) {
+		iter_msgidx (x, t [j], &it);
+		more = next_msgidx (&it, &pos);
+		for (i = 0, k = 0; i < *n && more; i++) {
+			while (more && pos < post [i]) {
+				more = next_msgidx (&it, &pos);
+			}
+			if (more && pos == post [i]) {
+				post [k++] = post [i];
+			}
+		}
+		*n = k;
+	}
+
+	return post;
+}
+
+int main (int argc, char * argv []) {
+	int opt, i, j, only_index = 0, built = 0, n_words = 0, stamped = 0;
+	unsigned long long from = 0, to = (unsigned long long) -1;
+	char words [NWORDS][NTERM];
+	sidxTerm_t * t [NWORDS];
+	char * p;
+	char * end;
+	unsigned int * post;
+	unsigned int n_post, k;
+	mlog_t * l;
+	mlogHdr_t * h;
+	sidx_t * x;
+	mlogHits_t hits = { NULL, 0, 0 };
+	static char outbuf [NOUTBUF];
+
+	while ((opt = getopt (argc, argv, "is:e:")) != -1) {
+		switch (opt) {
+			case 'i': /* solo costruzione degli indici mancanti */
+				only_index = 1;
+				break;
+			case 's':
+				from = strtoull (optarg, NULL, 10);
+				break;
+			case 'e':
+				to = strtoull (optarg, NULL, 10);
+				break;
+			default:
+				fprintf (stderr, USAGE, argv [0]);
+				exit (EXIT_FAILURE);
+		}
+	}
+	if (optind + (only_index == 0) >= argc) {
+		fprintf (stderr, USAGE, argv [0]);
+		exit (EXIT_FAILURE);
+	}
+
+	/* parole della ricerca, con le stesse regole dell'indice */
+	if (only_index == 0) {
+		p = argv [optind];
+		end = p + strlen (p);
+		while (n_words < NWORDS && token_msgidx (&p, end, words [n_words]) > 0) {
+			for (j = 0; j < n_words && strcmp (words [j], words [n_words]) != 0; j++);
+			if (j == n_words) {
+				n_words++;
+			}
+		}
+		if (n_words == 0) {
+			fprintf (stderr, "%s: nessuna parola da cercare\n", argv [0]);
+			exit (EXIT_FAILURE);
+		}
+		optind++;
+	}
+	setvbuf (stdout, outbuf, _IOFBF, NOUTBUF);
+	sort_mlog (argv + optind, argc - optind); /* segmenti di rotazione nell'ordine in cui sono stati scritti */
+
+	for (i = optind; i < argc; i++) {
+		l = open_mlog (argv [i]);
+		if (l == NULL && errno == EINVAL) { /* indice, segmento compresso, ...: non e' un segmento binario */
+			fprintf (stderr, "%s: non e' un segmento binario, ignorato\n", argv [i]);
+			continue;
+		}
+		if (l == NULL) {
+			Fail ("Errore nell'apertura di un segmento binario");
+		}
+		stamped |= l->flags & MLOG_STAMPED;
+		x = load_msgidx (argv [i], l, &built);
+		if (x == NULL) {
+			Fail ("Errore durante la costruzione dell'indice");
+		}
+		if (only_index == 1) {
+			free_msgidx (&x);
+			close_mlog (&l);
+			continue;
+		}
+
+		/* una parola assente esclude tutto il segmento */
+		for (j = 0; j < n_words && (t [j] = find_msgidx (x, words [j])) != NULL; j++);
+		if (j < n_words) {
+			free_msgidx (&x);
+			close_mlog (&l);
+			continue;
+		}
+		post = Intersect (x, t, n_words, &n_post);
+		for (k = 0; k < n_post; k++) {
+			h = (mlogHdr_t *) (l->map + (size_t) post [k] * 8);
+			if (h->time >= from && h->time <= to && addhit_mlog (&hits, l, h) == -1) {
+				Fail ("Errore durante la ricerca");
+			}
+		}
+		free (post);
+		free_msgidx (&x);
+		/* il segmento resta mappato fino alla fine: i risultati puntano ai suoi record */
+	}
+
+	if (only_index == 1) {
+		fprintf (stderr, "%d indici costruiti\n", built);
+		return 0;
+	}
+
+	outhits_mlog (&hits, stamped);
+	if (fflush (stdout) == EOF) {
+		Fail ("Errore durante la scrittura delle righe");
+	}
+	free (hits.v);
+
+	return 0;
+}
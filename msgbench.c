@@ -0,0 +1,390 @@
+/**
+   \file msgbench.c
+   \author Marco Ponza
+   \brief  benchmark: login e logout ripetuti contro un server in esecuzione (connessione),
+           ricerca degli utenti con genHash, tabella Robin Hood e hash perfetto minimo (-l)
+   Si dichiara che ogni singolo bit presente in questo file è solo ed esclusivamente "farina del sacco" del rispettivo autore :D
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "comsock.h"
+#include "genHash.h"
+#include "usrtab.h"
+#include "usrmph.h"
+
+/** ========== Macro ========== */
+#define SOCKNAME "./tmp/msgsock"
+#define NUSR 256 /* lunghezza massima di un username */
+#define NTHREAD 4 /* numero di client concorrenti di default */
+#define NLOGIN 10000 /* numero di login per client di default */
+#define NLOOKUP 10000000 /* numero di ricerche di default (-l) */
+#define FAILED (-1.0) /* latenza di un login fallito (esclusa dalle statistiche) */
+#define USAGE "Uso: %s [-t client] [-n login] file_utenti_autorizzati\n     %s -l [-n ricerche] file_utenti_autorizzati\n"
+
+/** ========== Strutture ========== */
+typedef struct {
+	/* stato di un client del benchmark */
+	pthread_t tid;
+	char name [NUSR + 1]; /* utente con cui il client si connette */
+	int n; /* login da effettuare */
+	double * lat; /* latenza di ogni login (microsecondi) */
+	int err; /* login rifiutati o falliti */
+} bench_t;
+
+/** Funzione che restituisce l'istante attuale in microsecondi
+ *
+ * 	\retval t, istante attuale (orologio monotono)
+ */
+static double Now () {
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/** Procedura di confronto tra latenze (per qsort)
+ */
+static int Cmp_lat (const void * a, const void * b) {
+	double x = * (double *) a, y = * (double *) b;
+
+	return (x > y) - (x < y);
+}
+
+/** Thread client: si connette, attende MSG_OK, invia MSG_EXIT e attende la chiusura
+ *  della connessione da parte del server, per b->n volte
+ *
+ * 	\param arg, stato del client (bench_t)
+ */
+static void * Client (void * arg) {
+	bench_t * b = (bench_t *) arg;
+	message_t msg;
+	int i, skt, n;
+	double t;
+
+	for (i = 0; i < b->n; i++) {
+		t = Now ();
+		skt = openConnection (SOCKNAME);
+		if (skt < 0) {
+			perror ("Errore durante la connessione al server");
+			exit (EXIT_FAILURE);
+		}
+
+		msg.type = MSG_CONNECT;
+		msg.buffer = b->name;
+		msg.length = strlen (b->name) + 1;
+		if (sendMessage (skt, &msg) < 0) {
+			b->err++;
+			b->lat [i] = FAILED;
+			closeSocket (skt);
+			continue;
+		}
+
+		n = receiveMessage (skt, &msg);
+		b->lat [i] = Now () - t;
+		if (n < 0 || msg.type != MSG_OK) {
+			b->err++;
+			b->lat [i] = FAILED;
+		}
+		if (n >= 0 && msg.length > 0) {
+			free (msg.buffer);
+		}
+
+		msg.type = MSG_EXIT;
+		msg.buffer = NULL;
+		msg.length = 0;
+		sendMessage (skt, &msg);
+
+		/* il login successivo viene rifiutato se il server non ha ancora chiuso questa sessione */
+		while ( receiveMessage (skt, &msg) >= 0 ) {
+			if (msg.length > 0) {
+				free (msg.buffer);
+			}
+		}
+		closeSocket (skt);
+	}
+
+	return NULL;
+}
+
+/** Funzioni di confronto e copia per genHash (chiavi stringa, payload intero)
+ */
+static int Cmp_key (void * a, void * b) {
+	return strcmp ((char *) a, (char *) b);
+}
+
+static void * Copy_key (void * a) {
+	return strdup ((char *) a);
+}
+
+static void * Copy_int (void * a) {
+	int * p = malloc (sizeof (int));
+
+	if (p != NULL) {
+		*p = * (int *) a;
+	}
+	return p;
+}
+
+/** Funzione che cerca n chiavi con una delle tre tabelle e restituisce il tempo medio
+ *
+ * 	\param kind, 0 genHash, 1 tabella Robin Hood, 2 hash perfetto minimo
+ * 	\param tab, tabella
+ * 	\param q, chiavi da cercare (n_q, usate ciclicamente)
+ * 	\param n, numero di ricerche
+ * 	\param found, in cui viene restituito il numero di chiavi trovate
+ * 	\retval t, nanosecondi per ricerca
+ */
+static double Lookup (int kind, void * tab, char ** q, int n_q, int n, int * found) {
+	int i;
+	void * p;
+	double t;
+
+	*found = 0;
+	t = Now ();
+	for (i = 0; i < n; i++) {
+		switch (kind) {
+			case 0: p = find_hashElement ((hashTable_t *) tab, q [i % n_q]); break;
+			case 1: p = find_userElement ((userTable_t *) tab, q [i % n_q]); break;
+			default: p = find_userMph ((userMph_t *) tab, q [i % n_q]); break;
+		}
+		*found += (p != NULL);
+		if (kind == 0) {
+			free (p); /* genHash restituisce una copia del payload */
+		}
+	}
+
+	return (Now () - t) * 1e3 / n;
+}
+
+/** Benchmark di ricerca: carica il file degli utenti e confronta genHash, la tabella
+ *  Robin Hood (usrtab) e l'hash perfetto minimo (usrmph) su ricerche di utenti
+ *  presenti e assenti
+ *
+ * 	\param file, file degli utenti autorizzati
+ * 	\param n, numero di ricerche per tabella e tipo di chiave
+ */
+static void Bench_lookup (char * file, int n) {
+	char buf [NUSR + 2];
+	char ** keys, ** hit, ** miss;
+	void ** payloads;
+	int * ids;
+	int i, k, n_keys = 0, dim = 1024, n_q, found;
+	double t, t_build [3], t_hit [3], t_miss [3];
+	void * tab [3];
+	char * name [3] = { "genHash", "usrtab (Robin Hood)", "usrmph (CHD)" };
+	FILE * fp;
+
+	keys = malloc (dim * sizeof (char *));
+	fp = fopen (file, "r");
+	if (keys == NULL || fp == NULL) {
+		perror ("Errore durante il caricamento degli utenti");
+		exit (EXIT_FAILURE);
+	}
+	while ( fgets (buf, NUSR + 2, fp) != NULL ) {
+		buf [strcspn (buf, "\n")] = '\0';
+		if (buf [0] == '\0') {
+			continue;
+		}
+		if (n_keys == dim) {
+			dim *= 2;
+			keys = realloc (keys, dim * sizeof (char *));
+		}
+		if (keys == NULL || (keys [n_keys++] = strdup (buf)) == NULL) {
+			perror ("Errore durante il caricamento degli utenti");
+			exit (EXIT_FAILURE);
+		}
+	}
+	fclose (fp);
+	if (n_keys == 0) {
+		fprintf (stderr, "Il file degli utenti autorizzati e' vuoto\n");
+		exit (EXIT_FAILURE);
+	}
+
+	ids = malloc (n_keys * sizeof (int));
+	payloads = malloc (n_keys * sizeof (void *));
+	if (ids == NULL || payloads == NULL) {
+		perror ("Errore di allocazione");
+		exit (EXIT_FAILURE);
+	}
+	for (i = 0; i < n_keys; i++) {
+		ids [i] = i;
+	}
+
+	/* costruzione delle tre tabelle (genHash con tante liste quanti sono gli utenti) */
+	t = Now ();
+	tab [0] = new_hashTable (n_keys, Cmp_key, Copy_key, Copy_int, hash_string);
+	for (i = 0; tab [0] != NULL && i < n_keys; i++) {
+		add_hashElement ((hashTable_t *) tab [0], keys [i], &(ids [i]));
+	}
+	t_build [0] = Now () - t;
+
+	t = Now ();
+	tab [1] = new_userTable (n_keys);
+	for (i = 0; tab [1] != NULL && i < n_keys; i++) {
+		if (add_userElement ((userTable_t *) tab [1], keys [i], &(ids [i])) == -1 && errno == EEXIST) {
+			fprintf (stderr, "Utente duplicato: %s\n", keys [i]);
+			exit (EXIT_FAILURE);
+		}
+	}
+	t_build [1] = Now () - t;
+
+	for (i = 0; i < n_keys; i++) {
+		payloads [i] = &(ids [i]);
+	}
+	t = Now ();
+	tab [2] = new_userMph (keys, payloads, n_keys);
+	t_build [2] = Now () - t;
+	if (tab [0] == NULL || tab [1] == NULL || tab [2] == NULL) {
+		perror ("Errore durante la costruzione delle tabelle");
+		exit (EXIT_FAILURE);
+	}
+
+	/* chiavi da cercare in ordine pseudocasuale: presenti e assenti (stessa lunghezza media) */
+	n_q = (n_keys < (1 << 20)) ? n_keys : (1 << 20);
+	hit = malloc (n_q * sizeof (char *));
+	miss = malloc (n_q * sizeof (char *));
+	if (hit == NULL || miss == NULL) {
+		perror ("Errore di allocazione");
+		exit (EXIT_FAILURE);
+	}
+	srand (1);
+	for (i = 0; i < n_q; i++) {
+		k = ((unsigned) rand () * RAND_MAX + rand ()) % n_keys;
+		hit [i] = keys [k];
+		miss [i] = malloc (strlen (keys [k]) + 2);
+		if (miss [i] == NULL) {
+			perror ("Errore di allocazione");
+			exit (EXIT_FAILURE);
+		}
+		sprintf (miss [i], "%s0", keys [k]);
+		miss [i] [0] = (miss [i] [0] == 'Z') ? 'Y' : 'Z';
+	}
+
+	for (k = 0; k < 3; k++) {
+		t_hit [k] = Lookup (k, tab [k], hit, n_q, n, &found);
+		if (found != n) {
+			fprintf (stderr, "%s: trovati %d utenti su %d\n", name [k], found, n);
+			exit (EXIT_FAILURE);
+		}
+		t_miss [k] = Lookup (k, tab [k], miss, n_q, n, &found);
+	}
+
+	printf ("utenti %d, ricerche %d per tabella\n", n_keys, n);
+	for (k = 0; k < 3; k++) {
+		printf ("%-20s costruzione %8.1f ms, presenti %6.1f ns, assenti %6.1f ns\n",
+			name [k], t_build [k] / 1e3, t_hit [k], t_miss [k]);
+	}
+
+	free_hashTable ((hashTable_t **) &(tab [0]));
+	free_userTable ((userTable_t **) &(tab [1]));
+	free_userMph ((userMph_t **) &(tab [2]));
+	for (i = 0; i < n_q; i++) {
+		free (miss [i]);
+	}
+	for (i = 0; i < n_keys; i++) {
+		free (keys [i]);
+	}
+	free (miss);
+	free (hit);
+	free (keys);
+	free (payloads);
+	free (ids);
+}
+
+int main (int argc, char * argv []) {
+	int opt, i, j, ok, n_thread = NTHREAD, n_login = NLOGIN, err = 0, lookup = 0;
+	bench_t * b;
+	double * lat, t, sum = 0;
+	FILE * fp;
+
+	while ( (opt = getopt (argc, argv, "t:n:l")) != -1 ) {
+		switch (opt) {
+			case 't':
+				n_thread = atoi (optarg);
+				break;
+			case 'n':
+				n_login = atoi (optarg);
+				break;
+			case 'l': /* benchmark di ricerca, senza server */
+				lookup = 1;
+				break;
+			default:
+				fprintf (stderr, USAGE, argv [0], argv [0]);
+				exit (EXIT_FAILURE);
+		}
+	}
+	if (optind != argc - 1 || n_thread <= 0 || n_login <= 0) {
+		fprintf (stderr, USAGE, argv [0], argv [0]);
+		exit (EXIT_FAILURE);
+	}
+	if (lookup == 1) {
+		Bench_lookup (argv [optind], (n_login == NLOGIN) ? NLOOKUP : n_login);
+		return 0;
+	}
+
+	b = calloc (n_thread, sizeof (bench_t));
+	lat = malloc (sizeof (double) * n_thread * n_login);
+	if (b == NULL || lat == NULL) {
+		perror ("Errore di allocazione");
+		exit (EXIT_FAILURE);
+	}
+
+	/* ogni client usa un utente diverso: le prime n_thread righe del file */
+	fp = fopen (argv [optind], "r");
+	if (fp == NULL) {
+		perror ("Errore nell apertura del file degli utenti autorizzati");
+		exit (EXIT_FAILURE);
+	}
+	for (i = 0; i < n_thread; i++) {
+		if ( fgets (b [i].name, NUSR + 1, fp) == NULL ) {
+			fprintf (stderr, "Il file degli utenti autorizzati contiene meno di %d utenti\n", n_thread);
+			exit (EXIT_FAILURE);
+		}
+		b [i].name [strcspn (b [i].name, "\n")] = '\0';
+		b [i].n = n_login;
+		b [i].lat = lat + i * n_login;
+	}
+	fclose (fp);
+
+	t = Now ();
+	for (i = 0; i < n_thread; i++) {
+		if ( pthread_create (&(b [i].tid), NULL, &Client, &(b [i])) != 0 ) {
+			fprintf (stderr, "Errore nella creazione dei client\n");
+			exit (EXIT_FAILURE);
+		}
+	}
+	for (i = 0; i < n_thread; i++) {
+		pthread_join (b [i].tid, NULL);
+		err += b [i].err;
+	}
+	t = Now () - t;
+
+	j = n_thread * n_login;
+	qsort (lat, j, sizeof (double), &Cmp_lat);
+
+	/* i login falliti (FAILED) finiscono in testa e non entrano nelle statistiche */
+	for (i = 0; i < j && lat [i] == FAILED; i++);
+	ok = j - i;
+	for (; i < j; i++) {
+		sum += lat [i];
+	}
+
+	printf ("client %d, login %d, errori %d\n", n_thread, j, err);
+	printf ("login/s %.0f\n", ok / (t / 1e6));
+	if (ok > 0) {
+		printf ("latenza login (us): media %.1f, mediana %.1f, p99 %.1f, max %.1f\n",
+			sum / ok, lat [j - ok + ok / 2], lat [j - ok + (int) (ok * 0.99)], lat [j - 1]);
+	}
+
+	free (lat);
+	free (b);
+
+	return 0;
+}
@@ -0,0 +1,360 @@
+/**
+   \file msgidx.c
+   \author Marco Ponza
+   \brief  indice invertito delle parole dei messaggi di un segmento binario del file di log
+   Si dichiara che ogni singolo bit presente in questo file è solo ed esclusivamente "farina del sacco" del rispettivo autore :D
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+#include "usrtab.h"
+#include "msgidx.h"
+
+/** parola in costruzione */
+typedef struct {
+    char * term;               /** parola */
+    unsigned char * buf;       /** lista codificata */
+    size_t len;                /** byte usati di buf */
+    size_t dim;                /** dimensione di buf */
+    unsigned int n;            /** posizioni nella lista */
+    unsigned int last;         /** ultima posizione inserita */
+} term_t;
+
+/** estrae la prossima parola di un testo
+ *  \param p indirizzo del puntatore al testo (avanza oltre la parola)
+ *  \param end fine del testo
+ *  \param term in cui viene copiata la parola (NTERM byte)
+ *
+ *  \retval 0 se il testo non contiene altre parole
+ *  \retval n lunghezza della parola
+ */
+int token_msgidx (char ** p, char * end, char * term)
+{
+	unsigned char * s = (unsigned char *) *p;
+	int n = 0;
+
+	while (s < (unsigned char *) end && !isalnum (*s) && *s < 0x80) {
+		s++;
+	}
+	while (s < (unsigned char *) end && (isalnum (*s) || *s >= 0x80)) {
+		if (n < NTERM - 1) {
+			term [n++] = tolower (*s);
+		}
+		s++;
+	}
+	term [n] = '\0';
+	*p = (char *) s;
+
+	return n;
+}
+
+/** aggiunge una posizione alla lista di una parola (differenza dalla precedente, in varint)
+ *
+ *  \retval 0 in caso di successo
+ *  \retval -1 in caso di errore (setta errno)
+ */
+static int add_post (term_t * t, unsigned int pos)
+{
+	unsigned int d = (t->n == 0) ? pos : pos - t->last;
+	void * p;
+
+	if (t->len + 5 > t->dim) { /* una differenza occupa al piu' 5 byte */
+		t->dim = (t->dim == 0) ? 16 : 2 * t->dim;
+		p = realloc (t->buf, t->dim);
+		if (p == NULL) {
+			return -1;
+		}
+		t->buf = p;
+	}
+	while (d >= 0x80) {
+		t->buf [t->len++] = (d & 0x7F) | 0x80;
+		d >>= 7;
+	}
+	t->buf [t->len++] = d;
+	t->last = pos;
+	t->n++;
+
+	return 0;
+}
+
+/** confronto tra parole per qsort */
+static int cmp_term (const void * a, const void * b)
+{
+	return strcmp ((*(term_t **) a)->term, (*(term_t **) b)->term);
+}
+
+/** dealloca le parole in costruzione */
+static void free_terms (userTable_t * table)
+{
+	unsigned int i;
+	term_t * t;
+
+	for (i = 0; i < table->size; i++) {
+		if (table->table [i].hash != 0) {
+			t = table->table [i].payload;
+			free (t->term);
+			free (t->buf);
+			free (t);
+		}
+	}
+	free_userTable (&table);
+}
+
+/** costruisce in memoria l'indice di un segmento
+ *  \param l segmento
+ *
+ *  \retval NULL in caso di errore (setta errno)
+ *  \retval x indice
+ */
+sidx_t * build_msgidx (mlog_t * l)
+{
+	userTable_t * table = new_userTable (0);
+	term_t ** v = NULL;
+	term_t * t;
+	sidx_t * x;
+	mlogHdr_t * h;
+	char term [NTERM];
+	char * p;
+	char * end;
+	unsigned int i, n = 0, pos;
+	unsigned long long n_docs = 0;
+	size_t tot, strs, off;
+
+	if (table == NULL) {
+		return NULL;
+	}
+
+	/* le posizioni arrivano in ordine crescente: ogni lista si costruisce in coda */
+	for (h = first_mlog (l, 0); h != NULL; h = next_mlog (l, h)) {
+		if (h->type != LREC_MSG && h->type != LREC_BCAST) {
+			continue;
+		}
+		n_docs++;
+		pos = ((char *) h - l->map) / 8;
+		for (p = TEXT_MLOG (h), end = p + TLEN_MLOG (h); token_msgidx (&p, end, term) > 0; ) {
+			t = find_userElement (table, term);
+			if (t == NULL) {
+				t = calloc (1, sizeof (term_t));
+				if (t == NULL || (t->term = strdup (term)) == NULL || add_userElement (table, t->term, t) == -1) {
+					if (t != NULL) {
+						free (t->term);
+					}
+					free (t);
+					free_terms (table);
+					return NULL;
+				}
+			}
+			if (t->n > 0 && t->last == pos) { /* parola ripetuta nello stesso messaggio */
+				continue;
+			}
+			if (add_post (t, pos) == -1) {
+				free_terms (table);
+				return NULL;
+			}
+		}
+	}
+
+	/* parole in ordine, per la ricerca binaria */
+	v = malloc ((table->n + 1) * sizeof (term_t *));
+	x = calloc (1, sizeof (sidx_t));
+	if (v == NULL || x == NULL) {
+		free (v);
+		free (x);
+		free_terms (table);
+		return NULL;
+	}
+	for (i = 0, strs = 0, tot = 0; i < table->size; i++) {
+		if (table->table [i].hash != 0) {
+			t = v [n++] = table->table [i].payload;
+			strs += strlen (t->term) + 1;
+			tot += t->len;
+		}
+	}
+	qsort (v, n, sizeof (term_t *), cmp_term);
+
+	off = sizeof (sidxHead_t) + n * sizeof (sidxTerm_t);
+	x->size = off + MLOG_ALIGN (strs) + tot;
+	x->map = calloc (1, x->size);
+	if (x->map == NULL) {
+		free (v);
+		free (x);
+		free_terms (table);
+		return NULL;
+	}
+	x->head = (sidxHead_t *) x->map;
+	x->terms = (sidxTerm_t *) (x->map + sizeof (sidxHead_t));
+	headidx_mlog (&(x->head->h), SIDX_MAGIC, SIDX_VERSION, l);
+	x->head->h.n = n;
+	x->head->n_docs = n_docs;
+
+	tot = off + MLOG_ALIGN (strs);
+	for (i = 0; i < n; i++) {
+		x->terms [i].term = off;
+		strcpy (x->map + off, v [i]->term);
+		off += strlen (v [i]->term) + 1;
+		x->terms [i].n_post = v [i]->n;
+		x->terms [i].post = tot;
+		x->terms [i].len = v [i]->len;
+		memcpy (x->map + tot, v [i]->buf, v [i]->len);
+		tot += v [i]->len;
+	}
+
+	free (v);
+	free_terms (table);
+
+	return x;
+}
+
+/** restituisce l'indice aggiornato di un segmento: quello su file, oppure lo costruisce
+ *  (e lo scrive, in modo atomico, se il segmento e' chiuso)
+ *  \param file segmento
+ *  \param l segmento aperto
+ *  \param built incrementato se l'indice e' stato costruito (puo' essere NULL)
+ *
+ *  \retval NULL in caso di errore (setta errno)
+ *  \retval x indice
+ */
+sidx_t * load_msgidx (char * file, mlog_t * l, int * built)
+{
+	sidx_t * x = calloc (1, sizeof (sidx_t));
+	int err;
+
+	if (x == NULL) {
+		return NULL;
+	}
+	x->map = mapidx_mlog (file, "sidx", SIDX_MAGIC, SIDX_VERSION, l, &(x->size));
+	if (x->map != NULL) {
+		x->mapped = 1;
+		x->head = (sidxHead_t *) x->map;
+		x->terms = (sidxTerm_t *) (x->map + sizeof (sidxHead_t));
+		if (sizeof (sidxHead_t) + (size_t) x->head->h.n * sizeof (sidxTerm_t) <= x->size) {
+			return x;
+		}
+	}
+	free_msgidx (&x);
+
+	/* indice assente o di una versione precedente del segmento */
+	x = build_msgidx (l);
+	if (x != NULL && built != NULL) {
+		(*built)++;
+	}
+	if (x != NULL && l->own_idx == 0 && saveidx_mlog (file, "sidx", x->map, x->size) == -1) { /* segmento chiuso (ha la coda) */
+		err = errno;
+		free_msgidx (&x);
+		errno = err;
+	}
+
+	return x;
+}
+
+/** costruisce (se manca o non e' aggiornato) l'indice su file di un segmento chiuso
+ *  \param file segmento
+ *
+ *  \retval 0 in caso di successo
+ *  \retval -1 in caso di errore (setta errno; EINVAL se il file non e' un segmento binario)
+ */
+int index_msgidx (char * file)
+{
+	mlog_t * l = open_mlog (file);
+	sidx_t * x;
+
+	if (l == NULL) {
+		return -1;
+	}
+	x = load_msgidx (file, l, NULL);
+	close_mlog (&l);
+	if (x == NULL) {
+		return -1;
+	}
+	free_msgidx (&x);
+
+	return 0;
+}
+
+/** distrugge un indice
+ *  \param px indirizzo del puntatore all'indice (viene messo a NULL)
+ */
+void free_msgidx (sidx_t ** px)
+{
+	if (px == NULL || *px == NULL) {
+		return;
+	}
+	if ((*px)->mapped == 1) {
+		munmap ((*px)->map, (*px)->size);
+	} else {
+		free ((*px)->map);
+	}
+	free (*px);
+	*px = NULL;
+}
+
+/** cerca una parola nell'indice
+ *  \param x indice
+ *  \param term parola (gia' in minuscolo)
+ *
+ *  \retval NULL se nessun record contiene la parola
+ *  \retval t parola
+ */
+sidxTerm_t * find_msgidx (sidx_t * x, char * term)
+{
+	unsigned int lo = 0, hi = x->head->h.n, mid;
+	int c;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		c = strcmp (x->map + x->terms [mid].term, term);
+		if (c == 0) {
+			return &(x->terms [mid]);
+		}
+		if (c < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return NULL;
+}
+
+/** inizia la scansione della lista di una parola
+ *  \param x indice
+ *  \param t parola
+ *  \param it stato della scansione
+ */
+void iter_msgidx (sidx_t * x, sidxTerm_t * t, sidxIter_t * it)
+{
+	it->p = (unsigned char *) x->map + t->post;
+	it->left = t->n_post;
+	it->pos = 0;
+}
+
+/** decodifica la prossima posizione di una lista
+ *  \param it stato della scansione
+ *  \param pos in cui viene scritta la posizione (/ 8) del record
+ *
+ *  \retval 1 se e' stata decodificata una posizione
+ *  \retval 0 se la lista e' finita
+ */
+int next_msgidx (sidxIter_t * it, unsigned int * pos)
+{
+	unsigned int d = 0;
+	int shift = 0;
+
+	if (it->left == 0) {
+		return 0;
+	}
+	do {
+		d |= (unsigned int) (*(it->p) & 0x7F) << shift;
+		shift += 7;
+	} while (*(it->p++) & 0x80);
+	it->pos += d;
+	it->left--;
+	*pos = it->pos;
+
+	return 1;
+}
@@ -0,0 +1,142 @@
+/**  \file
+ *    \author Marco Ponza
+ *  \brief indice invertito delle parole dei messaggi di un segmento binario del file di log
+ *
+ * L'indice di un segmento ("segmento.sidx") contiene, per ogni parola dei testi dei messaggi,
+ * la lista ordinata delle posizioni (/ 8) dei record che la contengono. Ogni lista e' codificata
+ * come differenze tra posizioni successive, in varint (7 bit per byte, il bit alto indica che
+ * il numero continua nel byte successivo).
+ *
+ * Le parole sono le sequenze massimali di caratteri alfanumerici (o di byte non ASCII),
+ * convertite in minuscolo e troncate a \c NTERM - 1 byte.
+ *
+*/
+
+#ifndef _MSGIDX_H
+#define _MSGIDX_H
+
+#include "msglog.h"
+
+/* -= TIPI =- */
+
+#define SIDX_MAGIC "MLOGSIX1" /* intestazione dell'indice */
+#define SIDX_VERSION 1
+#define NTERM 64 /* lunghezza massima di una parola (compreso '\0') */
+
+/** <H3>Intestazione dell'indice</H3>
+ * \c h.n e' il numero di parole nell'indice (ordinate).
+ *
+ * <HR>
+ */
+
+typedef struct {
+    mlogIdxHead_t h;           /** intestazione comune degli indici (SIDX_MAGIC, SIDX_VERSION) */
+    unsigned long long n_docs; /** record di log indicizzati */
+} sidxHead_t;
+
+/** <H3>Parola dell'indice</H3>
+ *
+ * <HR>
+ */
+
+typedef struct {
+    unsigned int term;         /** posizione della parola nell'indice */
+    unsigned int n_post;       /** numero di record che contengono la parola */
+    unsigned long long post;   /** posizione della lista codificata nell'indice */
+    unsigned long long len;    /** byte della lista codificata */
+} sidxTerm_t;
+
+/** <H3>Indice di un segmento</H3>
+ *
+ * <HR>
+ */
+
+typedef struct {
+    char * map;                /** indice (mappato dal file o costruito in memoria) */
+    size_t size;               /** dimensione dell'indice */
+    int mapped;                /** 1 se map va rilasciato con munmap */
+    sidxHead_t * head;         /** intestazione */
+    sidxTerm_t * terms;        /** parole */
+} sidx_t;
+
+/** <H3>Scansione di una lista</H3>
+ *
+ * <HR>
+ */
+
+typedef struct {
+    unsigned char * p;         /** prossimo byte da decodificare */
+    unsigned int left;         /** posizioni ancora da decodificare */
+    unsigned int pos;          /** ultima posizione decodificata */
+} sidxIter_t;
+
+/* -= FUNZIONI =- */
+
+/** estrae la prossima parola di un testo
+ *  \param p indirizzo del puntatore al testo (avanza oltre la parola)
+ *  \param end fine del testo
+ *  \param term in cui viene copiata la parola (NTERM byte)
+ *
+ *  \retval 0 se il testo non contiene altre parole
+ *  \retval n lunghezza della parola
+ */
+int token_msgidx (char ** p, char * end, char * term);
+
+/** costruisce in memoria l'indice di un segmento
+ *  \param l segmento
+ *
+ *  \retval NULL in caso di errore (setta errno)
+ *  \retval x indice
+ */
+sidx_t * build_msgidx (mlog_t * l);
+
+/** restituisce l'indice aggiornato di un segmento: quello su file, oppure lo costruisce
+ *  (e lo scrive, in modo atomico, se il segmento e' chiuso)
+ *  \param file segmento
+ *  \param l segmento aperto
+ *  \param built incrementato se l'indice e' stato costruito (puo' essere NULL)
+ *
+ *  \retval NULL in caso di errore (setta errno)
+ *  \retval x indice
+ */
+sidx_t * load_msgidx (char * file, mlog_t * l, int * built);
+
+/** costruisce (se manca o non e' aggiornato) l'indice su file di un segmento chiuso
+ *  \param file segmento
+ *
+ *  \retval 0 in caso di successo
+ *  \retval -1 in caso di errore (setta errno; EINVAL se il file non e' un segmento binario)
+ */
+int index_msgidx (char * file);
+
+/** distrugge un indice
+ *  \param px indirizzo del puntatore all'indice (viene messo a NULL)
+ */
+void free_msgidx (sidx_t ** px);
+
+/** cerca una parola nell'indice
+ *  \param x indice
+ *  \param term parola (gia' in minuscolo)
+ *
+ *  \retval NULL se nessun record contiene la parola
+ *  \retval t parola
+ */
+sidxTerm_t * find_msgidx (sidx_t * x, char * term);
+
+/** inizia la scansione della lista di una parola
+ *  \param x indice
+ *  \param t parola
+ *  \param it stato della scansione
+ */
+void iter_msgidx (sidx_t * x, sidxTerm_t * t, sidxIter_t * it);
+
+/** decodifica la prossima posizione di una lista
+ *  \param it stato della scansione
+ *  \param pos in cui viene scritta la posizione (/ 8) del record
+ *
+ *  \retval 1 se e' stata decodificata una posizione
+ *  \retval 0 se la lista e' finita
+ */
+int next_msgidx (sidxIter_t * it, unsigned int * pos);
+
+#endif
@@ -0,0 +1,717 @@
+/**
+   \file msglog.c
+   \author Marco Ponza
+   \brief  formato binario dei segmenti del file di log (opzione -B di msgserv) e lettore con mmap
+   Si dichiara che ogni singolo bit presente in questo file è solo ed esclusivamente "farina del sacco" del rispettivo autore :D
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "msglog.h"
+
+/** crea lo stato di scrittura di un segmento vuoto
+ *  \param flags flag dei segmenti (MLOG_STAMPED, MLOG_COMPACT)
+ *
+ *  \retval NULL in caso di errore (setta errno)
+ *  \retval o puntatore al nuovo stato
+ */
+mlogOut_t * new_mlogOut (unsigned int flags)
+{
+	mlogOut_t * o = calloc (1, sizeof (mlogOut_t));
+
+	if (o == NULL) {
+		return NULL;
+	}
+	o->flags = flags;
+
+	return o;
+}
+
+/** distrugge lo stato di scrittura
+ *  \param po indirizzo del puntatore allo stato (viene messo a NULL)
+ */
+void free_mlogOut (mlogOut_t ** po)
+{
+	if (po == NULL || *po == NULL) {
+		return;
+	}
+	free ((*po)->known);
+	free ((*po)->ids);
+	free ((*po)->idx);
+	free (*po);
+	*po = NULL;
+}
+
+/** compone l'intestazione di un nuovo segmento (da scrivere per prima):
+ *  dizionario e indice ripartono da vuoti
+ *  \param o stato di scrittura
+ *  \param head intestazione composta
+ *
+ *  \retval n dimensione dell'intestazione
+ */
+size_t head_mlogOut (mlogOut_t * o, mlogHead_t * head)
+{
+	memset (head, 0, sizeof (mlogHead_t));
+	memcpy (head->magic, MLOG_MAGIC, sizeof (head->magic));
+	head->version = MLOG_VERSION;
+	head->flags = o->flags;
+	o->off = sizeof (mlogHead_t);
+	o->next = 0;
+	if (o->known != NULL) {
+		memset (o->known, 0, o->n_known);
+	}
+	o->n_ids = 0;
+	o->n_idx = 0;
+
+	return sizeof (mlogHead_t);
+}
+
+/** segna un id come presente nel dizionario del segmento
+ *  \param o stato di scrittura
+ *  \param id id dell'utente
+ *
+ *  \retval 1 se l'id era gia' nel dizionario
+ *  \retval 0 se l'id e' stato aggiunto (va scritto il record MLOG_USER)
+ *  \retval -1 in caso di errore (setta errno)
+ */
+int known_mlogOut (mlogOut_t * o, unsigned int id)
+{
+	unsigned int n;
+	void * p;
+
+	if (id < o->n_known && o->known [id] == 1) {
+		return 1;
+	}
+	if (id >= o->n_known) { /* gli id sono densi: raddoppio */
+		for (n = (o->n_known == 0) ? 1024 : o->n_known; n <= id; n *= 2);
+		p = realloc (o->known, n);
+		if (p == NULL) {
+			return -1;
+		}
+		o->known = p;
+		memset (o->known + o->n_known, 0, n - o->n_known);
+		o->n_known = n;
+	}
+	if (o->n_ids == o->dim_ids) {
+		n = (o->dim_ids == 0) ? 1024 : 2 * o->dim_ids;
+		p = realloc (o->ids, n * sizeof (unsigned int));
+		if (p == NULL) {
+			return -1;
+		}
+		o->ids = p;
+		o->dim_ids = n;
+	}
+	o->known [id] = 1;
+	o->ids [o->n_ids++] = id;
+
+	return 0;
+}
+
+/** compone l'intestazione di un record e ne conta i byte (con il riempimento);
+ *  aggiorna l'indice sparso se il record supera la posizione della prossima voce
+ *  \param o stato di scrittura
+ *  \param h intestazione composta
+ *  \param type, mit, dest, seq, stamp, time campi del record
+ *  \param len lunghezza del testo
+ *
+ *  \retval n byte di riempimento da scrivere dopo il testo
+ *  \retval -1 in caso di errore (setta errno)
+ */
+int rec_mlogOut (mlogOut_t * o, mlogHdr_t * h, unsigned int type, unsigned int mit, unsigned int dest,
+                 unsigned long long seq, unsigned long long stamp, unsigned long long time, size_t len)
+{
+	unsigned int n;
+	void * p;
+
+	h->len = sizeof (mlogHdr_t) + len;
+	h->type = type;
+	h->mit = mit;
+	h->dest = dest;
+	h->seq = seq;
+	h->stamp = stamp;
+	h->time = time;
+
+	/* una voce dell'indice per il primo record di log oltre ogni multiplo di MLOG_STRIDE */
+	if (o->off >= o->next && type < MLOG_USER) {
+		if (o->n_idx == o->dim_idx) {
+			n = (o->dim_idx == 0) ? 256 : 2 * o->dim_idx;
+			p = realloc (o->idx, n * sizeof (mlogIdx_t));
+			if (p == NULL) {
+				return -1;
+			}
+			o->idx = p;
+			o->dim_idx = n;
+		}
+		o->idx [o->n_idx].off = o->off;
+		o->idx [o->n_idx].time = time;
+		o->idx [o->n_idx].stamp = stamp;
+		o->n_idx++;
+		o->next = (o->off / MLOG_STRIDE + 1) * MLOG_STRIDE;
+	}
+	o->off += MLOG_ALIGN (h->len);
+
+	return MLOG_ALIGN (h->len) - h->len;
+}
+
+/** aggiunge uno username al dizionario del segmento in lettura
+ *
+ *  \retval 0 in caso di successo
+ *  \retval -1 in caso di errore (setta errno)
+ */
+static int add_name (mlog_t * l, unsigned int id, char * name)
+{
+	unsigned int n;
+	void * p;
+
+	if (id >= l->n_names) {
+		for (n = (l->n_names == 0) ? 1024 : l->n_names; n <= id; n *= 2);
+		p = realloc (l->names, n * sizeof (char *));
+		if (p == NULL) {
+			return -1;
+		}
+		l->names = p;
+		memset (l->names + l->n_names, 0, (n - l->n_names) * sizeof (char *));
+		l->n_names = n;
+	}
+	if (l->names [id] == NULL) {
+		l->names [id] = name;
+	}
+
+	return 0;
+}
+
+/** restituisce il record in posizione off, se completo
+ *
+ *  \retval NULL se a partire da off non c'e' un record completo entro limit
+ *  \retval h record
+ */
+static mlogHdr_t * rec_at (mlog_t * l, size_t off, size_t limit)
+{
+	mlogHdr_t * h;
+
+	if (off + sizeof (mlogHdr_t) > limit) {
+		return NULL;
+	}
+	h = (mlogHdr_t *) (l->map + off);
+	if (h->len < sizeof (mlogHdr_t) || off + h->len > limit) {
+		return NULL;
+	}
+
+	return h;
+}
+
+/** legge dizionario e indice dalla coda di un segmento chiuso
+ *
+ *  \retval 0 se il segmento e' chiuso e la coda e' valida
+ *  \retval 1 se il segmento non ha la coda
+ *  \retval -1 in caso di errore (setta errno)
+ */
+static int read_tail (mlog_t * l)
+{
+	mlogTail_t * t;
+	mlogHdr_t * h;
+	mlogHdr_t * x;
+	char * p;
+	char * end;
+	unsigned int id;
+
+	if (l->size < sizeof (mlogHead_t) + sizeof (mlogTail_t)) {
+		return 1;
+	}
+	t = (mlogTail_t *) (l->map + l->size - sizeof (mlogTail_t));
+	if (memcmp (t->magic, MLOG_TMAGIC, sizeof (t->magic)) != 0 || t->names < sizeof (mlogHead_t) ||
+	    t->names > l->size - sizeof (mlogTail_t)) {
+		return 1;
+	}
+	h = rec_at (l, t->names, l->size - sizeof (mlogTail_t));
+	if (h == NULL || h->type != MLOG_NAMES) {
+		return 1;
+	}
+	x = rec_at (l, t->names + MLOG_ALIGN (h->len), l->size - sizeof (mlogTail_t));
+	if (x == NULL || x->type != MLOG_INDEX) {
+		return 1;
+	}
+
+	/* coppie (id, username con '\0') */
+	for (p = TEXT_MLOG (h), end = p + TLEN_MLOG (h); p + sizeof (unsigned int) < end; p += strlen (p) + 1) {
+		memcpy (&id, p, sizeof (unsigned int));
+		p += sizeof (unsigned int);
+		if (memchr (p, '\0', end - p) == NULL) {
+			errno = EINVAL;
+			return -1;
+		}
+		if (add_name (l, id, p) == -1) {
+			return -1;
+		}
+	}
+	l->idx = (mlogIdx_t *) TEXT_MLOG (x);
+	l->n_idx = TLEN_MLOG (x) / sizeof (mlogIdx_t);
+	l->end = t->names;
+
+	return 0;
+}
+
+/** ricostruisce dizionario e indice di un segmento non chiuso con una scansione
+ *  (gli username dei record MLOG_USER vengono copiati: nel segmento non sono terminati da '\0')
+ *
+ *  \retval 0 in caso di successo
+ *  \retval -1 in caso di errore (setta errno)
+ */
+static int scan (mlog_t * l)
+{
+	size_t off, next = 0;
+	unsigned int dim = 0;
+	mlogHdr_t * h;
+	char * name;
+	void * p;
+
+	l->own_idx = 1;
+	for (off = sizeof (mlogHead_t); (h = rec_at (l, off, l->size)) != NULL; off += MLOG_ALIGN (h->len)) {
+		if (h->type == MLOG_NAMES || h->type == MLOG_INDEX) {
+			break;
+		}
+		if (h->type == MLOG_USER) {
+			name = malloc (TLEN_MLOG (h) + 1);
+			if (name == NULL) {
+				return -1;
+			}
+			memcpy (name, TEXT_MLOG (h), TLEN_MLOG (h));
+			name [TLEN_MLOG (h)] = '\0';
+			if (add_name (l, h->mit, name) == -1) {
+				free (name);
+				return -1;
+			}
+			if (l->names [h->mit] != name) { /* gia' presente */
+				free (name);
+			}
+			continue;
+		}
+		if (off >= next) {
+			if (l->n_idx == dim) {
+				dim = (dim == 0) ? 256 : 2 * dim;
+				p = realloc (l->idx, dim * sizeof (mlogIdx_t));
+				if (p == NULL) {
+					return -1;
+				}
+				l->idx = p;
+			}
+			l->idx [l->n_idx].off = off;
+			l->idx [l->n_idx].time = h->time;
+			l->idx [l->n_idx].stamp = h->stamp;
+			l->n_idx++;
+			next = (off / MLOG_STRIDE + 1) * MLOG_STRIDE;
+		}
+	}
+	l->end = off;
+
+	return 0;
+}
+
+/** apre un segmento in lettura (mmap); se il segmento non e' chiuso dizionario e indice
+ *  vengono ricostruiti con una scansione (i record incompleti in fondo vengono ignorati)
+ *  \param file segmento
+ *
+ *  \retval NULL in caso di errore o se il file non e' un segmento binario (setta errno)
+ *  \retval l puntatore al segmento aperto
+ */
+mlog_t * open_mlog (char * file)
+{
+	int fd, r, err;
+	struct stat st;
+	mlog_t * l;
+	mlogHead_t * head;
+
+	fd = open (file, O_RDONLY);
+	if (fd == -1) {
+		return NULL;
+	}
+	if (fstat (fd, &st) == -1) {
+		err = errno;
+		close (fd);
+		errno = err;
+		return NULL;
+	}
+	if ((size_t) st.st_size < sizeof (mlogHead_t)) {
+		close (fd);
+		errno = EINVAL;
+		return NULL;
+	}
+	l = calloc (1, sizeof (mlog_t));
+	if (l == NULL) {
+		close (fd);
+		return NULL;
+	}
+	l->size = st.st_size;
+	l->ino = st.st_ino;
+	l->mtime = (unsigned long long) st.st_mtim.tv_sec * 1000000000ULL + st.st_mtim.tv_nsec;
+	l->map = mmap (NULL, l->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close (fd);
+	if (l->map == MAP_FAILED) {
+		free (l);
+		return NULL;
+	}
+	madvise (l->map, l->size, MADV_SEQUENTIAL);
+
+	head = (mlogHead_t *) l->map;
+	if (memcmp (head->magic, MLOG_MAGIC, sizeof (head->magic)) != 0 || head->version != MLOG_VERSION) {
+		close_mlog (&l);
+		errno = EINVAL;
+		return NULL;
+	}
+	l->flags = head->flags;
+
+	r = read_tail (l);
+	if (r == 1) {
+		r = scan (l);
+	}
+	if (r == -1) {
+		err = errno;
+		close_mlog (&l);
+		errno = err;
+		return NULL;
+	}
+
+	return l;
+}
+
+/** chiude un segmento aperto in lettura
+ *  \param pl indirizzo del puntatore al segmento (viene messo a NULL)
+ */
+void close_mlog (mlog_t ** pl)
+{
+	unsigned int i;
+	mlog_t * l;
+
+	if (pl == NULL || *pl == NULL) {
+		return;
+	}
+	l = *pl;
+	if (l->own_idx == 1) { /* dizionario e indice ricostruiti: sono copie */
+		for (i = 0; i < l->n_names; i++) {
+			free (l->names [i]);
+		}
+		free (l->idx);
+	}
+	free (l->names);
+	munmap (l->map, l->size);
+	free (l);
+	*pl = NULL;
+}
+
+/** salta i record del dizionario a partire da h
+ *
+ *  \retval NULL se non ci sono altri record di log
+ *  \retval h primo record di log da h in poi
+ */
+static mlogHdr_t * skip_users (mlog_t * l, mlogHdr_t * h)
+{
+	size_t off;
+
+	while (h != NULL && h->type == MLOG_USER) {
+		off = ((char *) h - l->map) + MLOG_ALIGN (h->len);
+		h = rec_at (l, off, l->end);
+	}
+
+	return h;
+}
+
+/** restituisce il primo record di log scritto non prima di un istante (usa l'indice sparso)
+ *  \param l segmento
+ *  \param from istante (ms), 0 per il primo record del segmento
+ *
+ *  \retval NULL se non ci sono record
+ *  \retval h primo record dall'istante from (o poco prima: l'indice e' sparso)
+ */
+mlogHdr_t * first_mlog (mlog_t * l, unsigned long long from)
+{
+	unsigned int lo = 0, hi = l->n_idx, mid;
+	size_t off = sizeof (mlogHead_t);
+	mlogHdr_t * h;
+
+	/* ultima voce con istante < from: i record prima di questa sono tutti troppo vecchi */
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (l->idx [mid].time < from) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	if (lo > 0) {
+		off = l->idx [lo - 1].off;
+	}
+
+	for (h = skip_users (l, rec_at (l, off, l->end)); h != NULL && h->time < from; h = next_mlog (l, h));
+
+	return h;
+}
+
+/** restituisce il record di log successivo (i record del dizionario vengono saltati)
+ *  \param l segmento
+ *  \param h record corrente
+ *
+ *  \retval NULL se h e' l'ultimo record
+ *  \retval h record successivo
+ */
+mlogHdr_t * next_mlog (mlog_t * l, mlogHdr_t * h)
+{
+	size_t off = ((char *) h - l->map) + MLOG_ALIGN (h->len);
+
+	return skip_users (l, rec_at (l, off, l->end));
+}
+
+/** restituisce lo username di un id
+ *  \param l segmento
+ *  \param id id dell'utente
+ *
+ *  \retval NULL se l'id non compare nel segmento
+ *  \retval name username
+ */
+char * name_mlog (mlog_t * l, unsigned int id)
+{
+	return (id < l->n_names) ? l->names [id] : NULL;
+}
+
+/** lunghezza del nome di un segmento senza il numero di rotazione ("file.n" -> "file")
+ *  \param file nome del segmento
+ *  \param n in cui viene scritto il numero di rotazione (-1 per il file attivo, che non ce l'ha)
+ */
+static size_t base_seg (char * file, long long * n)
+{
+	size_t len = strlen (file), i = len;
+
+	while (i > 0 && file [i - 1] >= '0' && file [i - 1] <= '9') {
+		i--;
+	}
+	if (i == len || i < 2 || file [i - 1] != '.') {
+		*n = -1;
+		return len;
+	}
+	*n = strtoll (file + i, NULL, 10);
+
+	return i - 1;
+}
+
+/** confronto tra nomi di segmenti per qsort */
+static int cmp_seg (const void * a, const void * b)
+{
+	char * x = *(char **) a;
+	char * y = *(char **) b;
+	long long nx, ny;
+	size_t lx = base_seg (x, &nx), ly = base_seg (y, &ny);
+	int c = strncmp (x, y, (lx < ly) ? lx : ly);
+
+	if (c != 0 || lx != ly) {
+		return (c != 0) ? c : (lx > ly) - (lx < ly);
+	}
+	/* stesso file di log: il file attivo e' il piu' recente */
+	if (nx == -1 || ny == -1) {
+		return (nx == -1) - (ny == -1);
+	}
+	return (nx > ny) - (nx < ny);
+}
+
+/** ordina i segmenti di rotazione di un file di log come sono stati scritti: "file.1", "file.2", ...,
+ *  "file.10", ... e per ultimo il file attivo "file" (l'ordine lessicografico metterebbe "file.10" prima di "file.2")
+ *  \param files nomi dei segmenti
+ *  \param n numero di segmenti
+ */
+void sort_mlog (char ** files, int n)
+{
+	qsort (files, n, sizeof (char *), cmp_seg);
+}
+
+/** inizializza l'intestazione comune di un indice di un segmento
+ *  \param head intestazione
+ *  \param magic intestazione dell'indice (8 byte)
+ *  \param version versione dell'indice
+ *  \param l segmento indicizzato
+ */
+void headidx_mlog (mlogIdxHead_t * head, char * magic, unsigned int version, mlog_t * l)
+{
+	memcpy (head->magic, magic, sizeof (head->magic));
+	head->version = version;
+	head->size = l->size;
+	head->ino = l->ino;
+	head->mtime = l->mtime;
+}
+
+/** mappa l'indice "segmento.ext" di un segmento, se e' della versione richiesta e del segmento aperto
+ *  \param file segmento
+ *  \param ext estensione dell'indice
+ *  \param magic intestazione dell'indice (8 byte)
+ *  \param version versione dell'indice
+ *  \param l segmento aperto
+ *  \param size in cui viene scritta la dimensione dell'indice
+ *
+ *  \retval NULL se l'indice manca o non e' aggiornato
+ *  \retval map indice mappato (da rilasciare con munmap)
+ */
+char * mapidx_mlog (char * file, char * ext, char * magic, unsigned int version, mlog_t * l, size_t * size)
+{
+	char * name = malloc (strlen (file) + strlen (ext) + 2);
+	char * map = NULL;
+	mlogIdxHead_t * head;
+	struct stat st;
+	int fd;
+
+	if (name == NULL) {
+		return NULL;
+	}
+	sprintf (name, "%s.%s", file, ext);
+	fd = open (name, O_RDONLY);
+	free (name);
+	if (fd == -1) {
+		return NULL;
+	}
+	if (fstat (fd, &st) == 0 && (size_t) st.st_size >= sizeof (mlogIdxHead_t)) {
+		map = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map == MAP_FAILED) {
+			map = NULL;
+		}
+	}
+	close (fd);
+	if (map == NULL) {
+		return NULL;
+	}
+
+	/* la rotazione riusa il nome del file di log attivo: conta il segmento, non il nome */
+	head = (mlogIdxHead_t *) map;
+	if (memcmp (head->magic, magic, sizeof (head->magic)) != 0 || head->version != version ||
+	    head->size != l->size || head->ino != l->ino || head->mtime != l->mtime) {
+		munmap (map, st.st_size);
+		return NULL;
+	}
+	*size = st.st_size;
+
+	return map;
+}
+
+/** scrive in modo atomico l'indice "segmento.ext" di un segmento: l'indice viene scritto in un file
+ *  temporaneo creato con mkstemp, poi rinominato
+ *  \param file segmento
+ *  \param ext estensione dell'indice
+ *  \param map indice
+ *  \param size dimensione dell'indice
+ *
+ *  \retval 0 in caso di successo
+ *  \retval -1 in caso di errore (setta errno)
+ */
+int saveidx_mlog (char * file, char * ext, char * map, size_t size)
+{
+	char * name = malloc (strlen (file) + strlen (ext) + 2);
+	char * tmp = malloc (strlen (file) + strlen (ext) + 9);
+	ssize_t n = 0;
+	size_t done;
+	int fd, err;
+
+	if (name == NULL || tmp == NULL) {
+		free (name);
+		free (tmp);
+		return -1;
+	}
+	sprintf (name, "%s.%s", file, ext);
+	sprintf (tmp, "%s.XXXXXX", name);
+
+	/* nome temporaneo unico: il server e chi cerca possono costruire lo stesso indice insieme */
+	fd = mkstemp (tmp);
+	if (fd == -1) {
+		free (name);
+		free (tmp);
+		return -1;
+	}
+	for (done = 0; done < size && (n = write (fd, map + done, size - done)) != -1; done += n);
+	if (n == -1 || fchmod (fd, 0644) == -1 || close (fd) == -1 || rename (tmp, name) == -1) {
+		err = errno;
+		if (n == -1) {
+			close (fd);
+		}
+		unlink (tmp);
+		free (name);
+		free (tmp);
+		errno = err;
+		return -1;
+	}
+	free (name);
+	free (tmp);
+
+	return 0;
+}
+
+/** scrive su stdout una riga "mittente:destinatario:testo"
+ *  \param mit mittente
+ *  \param dest destinatario
+ *  \param h record con il testo
+ */
+void line_mlog (char * mit, char * dest, mlogHdr_t * h)
+{
+	fputs (mit, stdout);
+	putchar (':');
+	fputs (dest, stdout);
+	putchar (':');
+	fwrite (TEXT_MLOG (h), 1, TLEN_MLOG (h), stdout);
+	putchar ('\n');
+}
+
+/** aggiunge un record ai risultati di una ricerca
+ *  \param hits risultati
+ *  \param l segmento del record
+ *  \param h record
+ *
+ *  \retval 0 in caso di successo
+ *  \retval -1 in caso di errore (setta errno)
+ */
+int addhit_mlog (mlogHits_t * hits, mlog_t * l, mlogHdr_t * h)
+{
+	size_t n;
+	void * p;
+
+	if (hits->n == hits->dim) {
+		n = (hits->dim == 0) ? 1024 : 2 * hits->dim;
+		p = realloc (hits->v, n * sizeof (mlogHit_t));
+		if (p == NULL) {
+			return -1;
+		}
+		hits->v = p;
+		hits->dim = n;
+	}
+	hits->v [hits->n].h = h;
+	hits->v [hits->n++].l = l;
+
+	return 0;
+}
+
+/** confronto tra timbri per qsort */
+static int cmp_stamp (const void * a, const void * b)
+{
+	unsigned long long x = ((mlogHit_t *) a)->h->stamp, y = ((mlogHit_t *) b)->h->stamp;
+
+	return (x > y) - (x < y);
+}
+
+/** scrive su stdout i risultati di una ricerca, una riga "mittente:destinatario:testo" per record
+ *  ("mittente:*:testo" per un broadcast del log compatto); i segmenti di un log diviso (-L) si
+ *  riuniscono nell'ordine dei timbri, gli altri restano nell'ordine dei segmenti
+ *  \param hits risultati
+ *  \param stamped 1 se i record hanno il timbro di sequenza
+ */
+void outhits_mlog (mlogHits_t * hits, int stamped)
+{
+	size_t i;
+	mlogHit_t * x;
+
+	if (stamped) {
+		qsort (hits->v, hits->n, sizeof (mlogHit_t), cmp_stamp);
+	}
+	for (i = 0; i < hits->n; i++) {
+		x = &(hits->v [i]);
+		line_mlog (name_mlog (x->l, x->h->mit), (x->h->type == LREC_BCAST) ? "*" : name_mlog (x->l, x->h->dest), x->h);
+	}
+}
@@ -0,0 +1,336 @@
+/**  \file
+ *    \author Marco Ponza
+ *  \brief formato binario dei segmenti del file di log (opzione -B di msgserv) e lettore con mmap
+ *
+ * Un segmento binario e' composto da:
+ * - un'intestazione (\c MLOG_MAGIC, versione)
+ * - i record, ognuno allineato a 8 byte: intestazione \c mlogHdr_t seguita dal testo (senza '\\0').
+ *   Gli utenti sono rappresentati dal loro id: la prima volta che un id compare nel segmento
+ *   viene preceduto da un record \c MLOG_USER con lo username
+ * - (solo nei segmenti chiusi) un record \c MLOG_NAMES con tutto il dizionario degli username,
+ *   un record \c MLOG_INDEX con l'indice sparso (una voce ogni \c MLOG_STRIDE byte)
+ *   e la coda \c mlogTail_t che punta al dizionario.
+ *
+ * Un segmento senza coda (ancora aperto, o di un server terminato male) resta leggibile:
+ * il lettore ricostruisce dizionario e indice con una scansione.
+ *
+*/
+
+#ifndef _MSGLOG_H
+#define _MSGLOG_H
+
+#include "logring.h"
+
+/* -= TIPI =- */
+
+#define MLOG_MAGIC "MSGLOG1\n" /* intestazione del segmento */
+#define MLOG_TMAGIC "MLOGEND\n" /* coda del segmento chiuso */
+#define MLOG_VERSION 1
+#define MLOG_STRIDE (1 << 16) /* byte tra due voci dell'indice sparso */
+#define MLOG_STAMPED 1 /* flag del segmento: i record hanno il timbro di sequenza (log diviso in segmenti) */
+#define MLOG_COMPACT 2 /* flag del segmento: log compatto (un record per broadcast, ingressi e uscite degli utenti) */
+#define MLOG_ALIGN(n) (((n) + 7) & ~((size_t) 7)) /* dimensione di un record allineata a 8 byte */
+
+/** Tipi di record (i primi coincidono con quelli dei record di log LREC_*) */
+#define MLOG_USER 16 /* dizionario: l'utente mit ha lo username del testo */
+#define MLOG_NAMES 17 /* dizionario completo del segmento: coppie (id a 4 byte, username con '\0') */
+#define MLOG_INDEX 18 /* indice sparso: array di mlogIdx_t */
+
+/** <H3>Intestazione del segmento</H3>
+ *
+ * <HR>
+ */
+
+typedef struct {
+    char magic [8];            /** MLOG_MAGIC */
+    unsigned int version;      /** MLOG_VERSION */
+    unsigned int flags;        /** MLOG_STAMPED, MLOG_COMPACT */
+} mlogHead_t;
+
+/** <H3>Intestazione di un record</H3>
+ * - \c len e' la lunghezza del record (intestazione e testo, senza il riempimento fino a 8 byte)
+ * - \c type e' il tipo del record (LREC_*, MLOG_*)
+ * - \c mit, \c dest, \c seq come nel record di log \c logRec_t
+ * - \c stamp e' il timbro di sequenza (0 se il log non e' diviso in segmenti)
+ * - \c time e' l'istante di scrittura (millisecondi dal 1/1/1970, con la granularita' del Writer)
+ *
+ * <HR>
+ */
+
+typedef struct {
+    unsigned int len;          /** lunghezza del record */
+    unsigned int type;         /** tipo del record */
+    unsigned int mit;          /** id del mittente */
+    unsigned int dest;         /** id del destinatario */
+    unsigned long long seq;    /** numero del broadcast */
+    unsigned long long stamp;  /** timbro di sequenza */
+    unsigned long long time;   /** istante di scrittura (ms) */
+} mlogHdr_t;
+
+/** <H3>Voce dell'indice sparso</H3>
+ *
+ * <HR>
+ */
+
+typedef struct {
+    unsigned long long off;    /** posizione del primo record dopo un multiplo di MLOG_STRIDE */
+    unsigned long long time;   /** istante del record */
+    unsigned long long stamp;  /** timbro del record */
+} mlogIdx_t;
+
+/** <H3>Coda del segmento chiuso</H3>
+ *
+ * <HR>
+ */
+
+typedef struct {
+    unsigned long long names;  /** posizione del record MLOG_NAMES (fine dei record di log) */
+    char magic [8];            /** MLOG_TMAGIC */
+} mlogTail_t;
+
+/** <H3>Scrittura di un segmento</H3>
+ * La struttura \c mlogOut_t contiene lo stato del Writer di un segmento binario.
+ * - \c off e' il numero di byte scritti nel segmento
+ * - \c known indica (per ogni id) se l'utente e' gia' nel dizionario del segmento
+ * - \c ids sono gli id del dizionario, nell'ordine di inserimento
+ * - \c idx e' l'indice sparso
+ *
+ * <HR>
+ */
+
+typedef struct {
+    unsigned long long off;    /** byte scritti */
+    unsigned long long next;   /** posizione oltre la quale va aggiunta la prossima voce dell'indice */
+    unsigned int flags;        /** flag del segmento (MLOG_*) */
+    unsigned char * known;     /** id gia' nel dizionario */
+    unsigned int n_known;      /** dimensione di known */
+    unsigned int * ids;        /** id del dizionario */
+    unsigned int n_ids;        /** numero di id del dizionario */
+    unsigned int dim_ids;      /** dimensione di ids */
+    mlogIdx_t * idx;           /** indice sparso */
+    unsigned int n_idx;        /** numero di voci */
+    unsigned int dim_idx;      /** dimensione di idx */
+} mlogOut_t;
+
+/** <H3>Segmento aperto in lettura</H3>
+ * - \c map e' il segmento mappato in memoria
+ * - \c end e' la fine dei record di log (il dizionario, l'indice o un record incompleto)
+ * - \c names sono gli username indicizzati per id (NULL se l'id non compare nel segmento)
+ *
+ * <HR>
+ */
+
+typedef struct {
+    char * map;                /** segmento mappato */
+    size_t size;               /** dimensione del segmento */
+    size_t end;                /** fine dei record di log */
+    unsigned int flags;        /** flag del segmento (MLOG_*) */
+    char ** names;             /** username per id */
+    unsigned int n_names;      /** dimensione di names */
+    mlogIdx_t * idx;           /** indice sparso */
+    unsigned int n_idx;        /** numero di voci */
+    int own_idx;               /** 1 se idx e' stato ricostruito (va deallocato) */
+    unsigned long long ino;    /** i-node del segmento */
+    unsigned long long mtime;  /** ultima modifica del segmento (ns) */
+} mlog_t;
+
+/** <H3>Intestazione di un indice di un segmento</H3>
+ * Prima parte, comune, dell'intestazione degli indici costruiti su un segmento chiuso ("segmento.qidx"
+ * di logq, "segmento.sidx" di logsearch): \c size, \c ino e \c mtime identificano il segmento
+ * indicizzato, se cambiano l'indice non vale piu'.
+ *
+ * <HR>
+ */
+
+typedef struct {
+    char magic [8];            /** intestazione dell'indice */
+    unsigned int version;      /** versione dell'indice */
+    unsigned int n;            /** voci dell'indice */
+    unsigned long long size;   /** dimensione del segmento */
+    unsigned long long ino;    /** i-node del segmento */
+    unsigned long long mtime;  /** ultima modifica del segmento (ns) */
+} mlogIdxHead_t;
+
+/** <H3>Record trovati da una ricerca</H3>
+ * I record restano nei segmenti mappati, che vanno tenuti aperti fino alla scrittura delle righe.
+ *
+ * <HR>
+ */
+
+typedef struct {
+    mlogHdr_t * h;             /** record */
+    mlog_t * l;                /** segmento del record */
+} mlogHit_t;
+
+typedef struct {
+    mlogHit_t * v;             /** record trovati */
+    size_t n;                  /** numero di record */
+    size_t dim;                /** dimensione di v */
+} mlogHits_t;
+
+/* -= FUNZIONI (scrittura) =- */
+
+/** crea lo stato di scrittura di un segmento vuoto
+ *  \param flags flag dei segmenti (MLOG_STAMPED, MLOG_COMPACT)
+ *
+ *  \retval NULL in caso di errore (setta errno)
+ *  \retval o puntatore al nuovo stato
+ */
+mlogOut_t * new_mlogOut (unsigned int flags);
+
+/** distrugge lo stato di scrittura
+ *  \param po indirizzo del puntatore allo stato (viene messo a NULL)
+ */
+void free_mlogOut (mlogOut_t ** po);
+
+/** compone l'intestazione di un nuovo segmento (da scrivere per prima):
+ *  dizionario e indice ripartono da vuoti
+ *  \param o stato di scrittura
+ *  \param head intestazione composta
+ *
+ *  \retval n dimensione dell'intestazione
+ */
+size_t head_mlogOut (mlogOut_t * o, mlogHead_t * head);
+
+/** segna un id come presente nel dizionario del segmento
+ *  \param o stato di scrittura
+ *  \param id id dell'utente
+ *
+ *  \retval 1 se l'id era gia' nel dizionario
+ *  \retval 0 se l'id e' stato aggiunto (va scritto il record MLOG_USER)
+ *  \retval -1 in caso di errore (setta errno)
+ */
+int known_mlogOut (mlogOut_t * o, unsigned int id);
+
+/** compone l'intestazione di un record e ne conta i byte (con il riempimento);
+ *  aggiorna l'indice sparso se il record supera la posizione della prossima voce
+ *  \param o stato di scrittura
+ *  \param h intestazione composta
+ *  \param type, mit, dest, seq, stamp, time campi del record
+ *  \param len lunghezza del testo
+ *
+ *  \retval n byte di riempimento da scrivere dopo il testo
+ *  \retval -1 in caso di errore (setta errno)
+ */
+int rec_mlogOut (mlogOut_t * o, mlogHdr_t * h, unsigned int type, unsigned int mit, unsigned int dest,
+                 unsigned long long seq, unsigned long long stamp, unsigned long long time, size_t len);
+
+/* -= FUNZIONI (lettura) =- */
+
+/** apre un segmento in lettura (mmap); se il segmento non e' chiuso dizionario e indice
+ *  vengono ricostruiti con una scansione (i record incompleti in fondo vengono ignorati)
+ *  \param file segmento
+ *
+ *  \retval NULL in caso di errore o se il file non e' un segmento binario (setta errno)
+ *  \retval l puntatore al segmento aperto
+ */
+mlog_t * open_mlog (char * file);
+
+/** chiude un segmento aperto in lettura
+ *  \param pl indirizzo del puntatore al segmento (viene messo a NULL)
+ */
+void close_mlog (mlog_t ** pl);
+
+/** restituisce il primo record di log scritto non prima di un istante (usa l'indice sparso)
+ *  \param l segmento
+ *  \param from istante (ms), 0 per il primo record del segmento
+ *
+ *  \retval NULL se non ci sono record
+ *  \retval h primo record dall'istante from (o poco prima: l'indice e' sparso)
+ */
+mlogHdr_t * first_mlog (mlog_t * l, unsigned long long from);
+
+/** restituisce il record di log successivo (i record del dizionario vengono saltati)
+ *  \param l segmento
+ *  \param h record corrente
+ *
+ *  \retval NULL se h e' l'ultimo record
+ *  \retval h record successivo
+ */
+mlogHdr_t * next_mlog (mlog_t * l, mlogHdr_t * h);
+
+/** restituisce lo username di un id
+ *  \param l segmento
+ *  \param id id dell'utente
+ *
+ *  \retval NULL se l'id non compare nel segmento
+ *  \retval name username
+ */
+char * name_mlog (mlog_t * l, unsigned int id);
+
+/** ordina i segmenti di rotazione di un file di log come sono stati scritti: "file.1", "file.2", ...,
+ *  "file.10", ... e per ultimo il file attivo "file"
+ *  \param files nomi dei segmenti
+ *  \param n numero di segmenti
+ */
+void sort_mlog (char ** files, int n);
+
+/* -= FUNZIONI (indici dei segmenti) =- */
+
+/** inizializza l'intestazione comune di un indice di un segmento
+ *  \param head intestazione
+ *  \param magic intestazione dell'indice (8 byte)
+ *  \param version versione dell'indice
+ *  \param l segmento indicizzato
+ */
+void headidx_mlog (mlogIdxHead_t * head, char * magic, unsigned int version, mlog_t * l);
+
+/** mappa l'indice "segmento.ext" di un segmento, se e' della versione richiesta e del segmento aperto
+ *  \param file segmento
+ *  \param ext estensione dell'indice
+ *  \param magic intestazione dell'indice (8 byte)
+ *  \param version versione dell'indice
+ *  \param l segmento aperto
+ *  \param size in cui viene scritta la dimensione dell'indice
+ *
+ *  \retval NULL se l'indice manca o non e' aggiornato
+ *  \retval map indice mappato (da rilasciare con munmap)
+ */
+char * mapidx_mlog (char * file, char * ext, char * magic, unsigned int version, mlog_t * l, size_t * size);
+
+/** scrive in modo atomico l'indice "segmento.ext" di un segmento: l'indice viene scritto in un file
+ *  temporaneo creato con mkstemp, poi rinominato
+ *  \param file segmento
+ *  \param ext estensione dell'indice
+ *  \param map indice
+ *  \param size dimensione dell'indice
+ *
+ *  \retval 0 in caso di successo
+ *  \retval -1 in caso di errore (setta errno)
+ */
+int saveidx_mlog (char * file, char * ext, char * map, size_t size);
+
+/* -= FUNZIONI (risultati delle ricerche) =- */
+
+/** scrive su stdout una riga "mittente:destinatario:testo"
+ *  \param mit mittente
+ *  \param dest destinatario
+ *  \param h record con il testo
+ */
+void line_mlog (char * mit, char * dest, mlogHdr_t * h);
+
+/** aggiunge un record ai risultati di una ricerca
+ *  \param hits risultati
+ *  \param l segmento del record
+ *  \param h record
+ *
+ *  \retval 0 in caso di successo
+ *  \retval -1 in caso di errore (setta errno)
+ */
+int addhit_mlog (mlogHits_t * hits, mlog_t * l, mlogHdr_t * h);
+
+/** scrive su stdout i risultati di una ricerca, una riga "mittente:destinatario:testo" per record
+ *  ("mittente:*:testo" per un broadcast del log compatto); i segmenti di un log diviso (-L) si
+ *  riuniscono nell'ordine dei timbri, gli altri restano nell'ordine dei segmenti
+ *  \param hits risultati
+ *  \param stamped 1 se i record hanno il timbro di sequenza
+ */
+void outhits_mlog (mlogHits_t * hits, int stamped);
+
+/** testo di un record (non terminato da '\\0': la lunghezza e' h->len - sizeof (mlogHdr_t)) */
+#define TEXT_MLOG(h) (((char *) (h)) + sizeof (mlogHdr_t))
+
+/** lunghezza del testo di un record */
+#define TLEN_MLOG(h) ((h)->len - sizeof (mlogHdr_t))
+
+#endif
@@ -0,0 +1,252 @@
+/**
+   \file msgqidx.c
+   \author Marco Ponza
+   \brief  indice per mittente e destinatario di un segmento binario del file di log
+   Si dichiara che ogni singolo bit presente in questo file è solo ed esclusivamente "farina del sacco" del rispettivo autore :D
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+#include "msgqidx.h"
+
+/** utente in costruzione (per l'ordinamento degli username) */
+typedef struct {
+    char * name;               /** username */
+    unsigned int id;           /** id nel segmento */
+} qname_t;
+
+/** confronto tra username per qsort */
+static int cmp_name (const void * a, const void * b)
+{
+	return strcmp (((qname_t *) a)->name, ((qname_t *) b)->name);
+}
+
+/** costruisce in memoria l'indice di un segmento: due passate sui record, la prima conta
+ *  le posizioni di ogni utente, la seconda le scrive
+ *  \param l segmento
+ *
+ *  \retval NULL in caso di errore (setta errno; EINVAL se un record ha un id senza username)
+ *  \retval x indice
+ */
+qidx_t * build_msgqidx (mlog_t * l)
+{
+	unsigned int n = l->n_names + 1;
+	unsigned int * n_sent;
+	unsigned int * n_recv;
+	unsigned int * slot;
+	unsigned long long * fill_s;
+	unsigned long long * fill_r;
+	qname_t * ids;
+	char * work;
+	unsigned int i, n_users = 0, pos;
+	size_t names = 0, tot;
+	qidx_t * x;
+	mlogHdr_t * h;
+
+	/* contatori e posizioni di riempimento di tutti gli utenti in un solo blocco */
+	work = calloc (n, 3 * sizeof (unsigned int) + 2 * sizeof (unsigned long long) + sizeof (qname_t));
+	if (work == NULL) {
+		return NULL;
+	}
+	fill_s = (unsigned long long *) work;
+	fill_r = fill_s + n;
+	ids = (qname_t *) (fill_r + n);
+	n_sent = (unsigned int *) (ids + n);
+	n_recv = n_sent + n;
+	slot = n_recv + n;
+
+	for (h = first_mlog (l, 0); h != NULL; h = next_mlog (l, h)) {
+		if (h->type != LREC_MSG && h->type != LREC_BCAST) {
+			continue;
+		}
+		if (h->mit >= l->n_names || h->dest >= l->n_names || name_mlog (l, h->mit) == NULL ||
+		    name_mlog (l, h->dest) == NULL) {
+			free (work);
+			errno = EINVAL;
+			return NULL;
+		}
+		n_sent [h->mit]++;
+		if (h->type == LREC_MSG) {
+			n_recv [h->dest]++;
+		}
+	}
+
+	/* utenti con almeno un record, in ordine di username */
+	for (i = 0; i < l->n_names; i++) {
+		if (n_sent [i] > 0 || n_recv [i] > 0) {
+			ids [n_users].id = i;
+			ids [n_users++].name = name_mlog (l, i);
+			names += strlen (name_mlog (l, i)) + 1;
+		}
+	}
+	qsort (ids, n_users, sizeof (qname_t), cmp_name);
+
+	tot = sizeof (qidxHead_t) + n_users * sizeof (qidxUser_t) + MLOG_ALIGN (names);
+	for (i = 0; i < n_users; i++) {
+		tot += (n_sent [ids [i].id] + n_recv [ids [i].id]) * sizeof (unsigned int);
+	}
+	x = calloc (1, sizeof (qidx_t));
+	if (x == NULL || (x->map = calloc (1, tot)) == NULL) {
+		free (x);
+		free (work);
+		return NULL;
+	}
+	x->size = tot;
+	x->head = (qidxHead_t *) x->map;
+	x->users = (qidxUser_t *) (x->map + sizeof (qidxHead_t));
+
+	headidx_mlog (&(x->head->h), QIDX_MAGIC, QIDX_VERSION, l);
+	x->head->h.n = n_users;
+	x->head->t_min = (unsigned long long) -1;
+	x->head->t_max = 0;
+	pos = sizeof (qidxHead_t) + n_users * sizeof (qidxUser_t);
+	tot = pos + MLOG_ALIGN (names);
+	for (i = 0; i < n_users; i++) {
+		slot [ids [i].id] = i;
+		x->users [i].name = pos;
+		strcpy (x->map + pos, ids [i].name);
+		pos += strlen (ids [i].name) + 1;
+		x->users [i].n_sent = n_sent [ids [i].id];
+		x->users [i].n_recv = n_recv [ids [i].id];
+		x->users [i].sent = fill_s [i] = tot;
+		tot += x->users [i].n_sent * sizeof (unsigned int);
+		x->users [i].recv = fill_r [i] = tot;
+		tot += x->users [i].n_recv * sizeof (unsigned int);
+	}
+
+	for (h = first_mlog (l, 0); h != NULL; h = next_mlog (l, h)) {
+		pos = ((char *) h - l->map) / 8; /* i record sono allineati a 8 byte */
+		if (h->type == LREC_MSG || h->type == LREC_BCAST) {
+			memcpy (x->map + fill_s [slot [h->mit]], &pos, sizeof (unsigned int));
+			fill_s [slot [h->mit]] += sizeof (unsigned int);
+		}
+		if (h->type == LREC_MSG) {
+			memcpy (x->map + fill_r [slot [h->dest]], &pos, sizeof (unsigned int));
+			fill_r [slot [h->dest]] += sizeof (unsigned int);
+		}
+		if (h->time < x->head->t_min) {
+			x->head->t_min = h->time;
+		}
+		if (h->time > x->head->t_max) {
+			x->head->t_max = h->time;
+		}
+	}
+	free (work);
+
+	return x;
+}
+
+/** restituisce l'indice aggiornato di un segmento: quello su file, oppure lo costruisce
+ *  (e lo scrive, in modo atomico, se il segmento e' chiuso)
+ *  \param file segmento
+ *  \param l segmento aperto
+ *  \param built incrementato se l'indice e' stato costruito (puo' essere NULL)
+ *
+ *  \retval NULL in caso di errore (setta errno)
+ *  \retval x indice
+ */
+qidx_t * load_msgqidx (char * file, mlog_t * l, int * built)
+{
+	qidx_t * x = calloc (1, sizeof (qidx_t));
+	int err;
+
+	if (x == NULL) {
+		return NULL;
+	}
+	x->map = mapidx_mlog (file, "qidx", QIDX_MAGIC, QIDX_VERSION, l, &(x->size));
+	if (x->map != NULL) {
+		x->mapped = 1;
+		x->head = (qidxHead_t *) x->map;
+		x->users = (qidxUser_t *) (x->map + sizeof (qidxHead_t));
+		if (sizeof (qidxHead_t) + (size_t) x->head->h.n * sizeof (qidxUser_t) <= x->size) {
+			return x;
+		}
+	}
+	free_msgqidx (&x);
+
+	/* indice assente o di una versione precedente del segmento */
+	x = build_msgqidx (l);
+	if (x != NULL && built != NULL) {
+		(*built)++;
+	}
+	if (x != NULL && l->own_idx == 0 && saveidx_mlog (file, "qidx", x->map, x->size) == -1) { /* segmento chiuso (ha la coda) */
+		err = errno;
+		free_msgqidx (&x);
+		errno = err;
+	}
+
+	return x;
+}
+
+/** costruisce (se manca o non e' aggiornato) l'indice su file di un segmento chiuso
+ *  \param file segmento
+ *
+ *  \retval 0 in caso di successo
+ *  \retval -1 in caso di errore (setta errno; EINVAL se il file non e' un segmento binario)
+ */
+int index_msgqidx (char * file)
+{
+	mlog_t * l = open_mlog (file);
+	qidx_t * x;
+
+	if (l == NULL) {
+		return -1;
+	}
+	x = load_msgqidx (file, l, NULL);
+	close_mlog (&l);
+	if (x == NULL) {
+		return -1;
+	}
+	free_msgqidx (&x);
+
+	return 0;
+}
+
+/** distrugge un indice
+ *  \param px indirizzo del puntatore all'indice (viene messo a NULL)
+ */
+void free_msgqidx (qidx_t ** px)
+{
+	if (px == NULL || *px == NULL) {
+		return;
+	}
+	if ((*px)->mapped == 1) {
+		munmap ((*px)->map, (*px)->size);
+	} else {
+		free ((*px)->map);
+	}
+	free (*px);
+	*px = NULL;
+}
+
+/** cerca un utente nell'indice
+ *  \param x indice
+ *  \param name username
+ *
+ *  \retval NULL se l'utente non ha record nel segmento
+ *  \retval u utente
+ */
+qidxUser_t * find_msgqidx (qidx_t * x, char * name)
+{
+	unsigned int lo = 0, hi = x->head->h.n, mid;
+	int c;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		c = strcmp (x->map + x->users [mid].name, name);
+		if (c == 0) {
+			return &(x->users [mid]);
+		}
+		if (c < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return NULL;
+}
@@ -0,0 +1,106 @@
+/**  \file
+ *    \author Marco Ponza
+ *  \brief indice per mittente e destinatario di un segmento binario del file di log
+ *
+ * L'indice di un segmento ("segmento.qidx") contiene, per ogni utente, le posizioni (/ 8) dei record
+ * che ha inviato e di quelli che ha ricevuto: le posizioni sono in ordine di file, quindi anche di
+ * tempo, e una ricerca binaria sull'istante dei record trova l'inizio di un intervallo.
+ *
+ * Gli indici dei segmenti chiusi vengono costruiti dal server (opzione -X) quando il segmento
+ * si chiude, o da logq alla prima ricerca se mancano.
+ *
+*/
+
+#ifndef _MSGQIDX_H
+#define _MSGQIDX_H
+
+#include "msglog.h"
+
+/* -= TIPI =- */
+
+#define QIDX_MAGIC "MLOGQIX1" /* intestazione dell'indice */
+#define QIDX_VERSION 1
+
+/** <H3>Intestazione dell'indice</H3>
+ * \c h.n e' il numero di utenti con almeno un record nel segmento.
+ *
+ * <HR>
+ */
+
+typedef struct {
+    mlogIdxHead_t h;           /** intestazione comune degli indici (QIDX_MAGIC, QIDX_VERSION) */
+    unsigned long long t_min;  /** istante del primo record di log */
+    unsigned long long t_max;  /** istante dell'ultimo record di log */
+} qidxHead_t;
+
+/** <H3>Utente dell'indice</H3>
+ *
+ * <HR>
+ */
+
+typedef struct {
+    unsigned int name;         /** posizione dello username nell'indice */
+    unsigned int n_sent;       /** record inviati */
+    unsigned int n_recv;       /** record ricevuti */
+    unsigned int pad;
+    unsigned long long sent;   /** posizione nell'indice dei record inviati (posizioni / 8 nel segmento) */
+    unsigned long long recv;   /** posizione nell'indice dei record ricevuti */
+} qidxUser_t;
+
+/** <H3>Indice di un segmento</H3>
+ *
+ * <HR>
+ */
+
+typedef struct {
+    char * map;                /** indice (mappato dal file o costruito in memoria) */
+    size_t size;               /** dimensione dell'indice */
+    int mapped;                /** 1 se map va rilasciato con munmap */
+    qidxHead_t * head;         /** intestazione */
+    qidxUser_t * users;        /** utenti, in ordine di username */
+} qidx_t;
+
+/* -= FUNZIONI =- */
+
+/** costruisce in memoria l'indice di un segmento
+ *  \param l segmento
+ *
+ *  \retval NULL in caso di errore (setta errno; EINVAL se un record ha un id senza username)
+ *  \retval x indice
+ */
+qidx_t * build_msgqidx (mlog_t * l);
+
+/** restituisce l'indice aggiornato di un segmento: quello su file, oppure lo costruisce
+ *  (e lo scrive, in modo atomico, se il segmento e' chiuso)
+ *  \param file segmento
+ *  \param l segmento aperto
+ *  \param built incrementato se l'indice e' stato costruito (puo' essere NULL)
+ *
+ *  \retval NULL in caso di errore (setta errno)
+ *  \retval x indice
+ */
+qidx_t * load_msgqidx (char * file, mlog_t * l, int * built);
+
+/** costruisce (se manca o non e' aggiornato) l'indice su file di un segmento chiuso
+ *  \param file segmento
+ *
+ *  \retval 0 in caso di successo
+ *  \retval -1 in caso di errore (setta errno; EINVAL se il file non e' un segmento binario)
+ */
+int index_msgqidx (char * file);
+
+/** distrugge un indice
+ *  \param px indirizzo del puntatore all'indice (viene messo a NULL)
+ */
+void free_msgqidx (qidx_t ** px);
+
+/** cerca un utente nell'indice
+ *  \param x indice
+ *  \param name username
+ *
+ *  \retval NULL se l'utente non ha record nel segmento
+ *  \retval u utente
+ */
+qidxUser_t * find_msgqidx (qidx_t * x, char * name);
+
+#endif
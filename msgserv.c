@@ -19,63 +19,129 @@
 #include <ctype.h>
 #include <dirent.h>
 #include <signal.h>
+#include <sys/epoll.h>
+#include <poll.h>
+#include <time.h>
+#include <semaphore.h>
 
 #include "genHash.h"
 #include "genList.h"
 #include "comsock.h"
+#include "usrtab.h"
+#include "usrmph.h"
+#include "logring.h"
+#include "msglog.h"
+#include "msgidx.h"
+#include "msgqidx.h"
 #include "funserv.h"
 
 /** ========== Macro ========== */
 #define DIRSOCK "./tmp"
 #define SOCKNAME "./tmp/msgsock"
-#define NHASH 10 /* dimensione della tabella hash */
 #define NUSR 256 /* lunghezza massima degli username */
-#define NWRITE 1024 /* dimensione iniziale del buffer, raddoppiata se il buffer viene riempito piu' la metà */
+#define NLOGRING (1 << 16) /* numero di record di log che possono essere in attesa del Writer */
 #define ALREADY_CONNECT "Un utente con il tuo username e' gia' connesso\n"
 #define NO_CONNECT "Non sei abilitato alla connessione su questo server\n"
 #define ERROR_RECEIVE_MSG "Server Errore nella ricezione del messaggio\n"
 #define ERROR_SEND_MSG "Server Errore nell'invio del messaggio\n"
 #define CLIENT_DISCONNECT "Server Il client ha chiuso la connessione\n"
 #define DEST_DISCONNECT "utente non connesso"
-#define WRITE_SLEEP 2
+#define NLOGMS 200 /* millisecondi massimi tra l'accodamento di un record di log e la sua scrittura */
+#define NLOGBYTES (64 * 1024) /* byte di log in attesa oltre i quali il Writer viene risvegliato subito */
+#define NLOGBUF (64 * 1024) /* dimensione del buffer in cui il Writer compone le righe di log */
+#define NEVENTS 64 /* numero massimo di eventi restituiti da una epoll_wait */
+#define NQFRAMES 1024 /* massimo numero di frame nella coda di uscita di un utente */
+#define NQBYTES (1024 * 1024) /* massimo numero di byte nella coda di uscita di un utente */
+#define NFANMIN 64 /* numero minimo di destinatari per affidare un broadcast ai thread Fanout */
+#define USAGE "L'applicazione msgserv deve essere eseguita come: \"$ msgserv [-e n_event_loop] [-p block|oldest|newest|disconnect] [-b max_byte_coda] [-t max_secondi_bloccato] [-f n_fanout] [-F min_destinatari_fanout] [-m] [-w max_ms_log] [-W soglia_byte_log] [-s none|batch|ms_sync_log] [-c] [-L n_segmenti_log] [-B] [-R max_byte_segmento] [-T max_secondi_segmento] [-K n_segmenti_tenuti] [-z] [-X] file_utenti_autorizzati file_log\"\n"
+
+/** ========== Tipi ========== */
+typedef struct conn {
+	/* stato di una connessione servita da un event loop */
+	int skt;
+	usr_id_t id; /* id dell'utente (valido se q != NULL) */
+	outq_t * q; /* coda di uscita dell'utente, NULL finche' il client non e' abilitato */
+	msgbuf_t * in; /* buffer di ingresso (byte letti dalla socket non ancora interpretati) */
+} conn_t;
+
+typedef struct logw {
+	/* stato di un thread Writer (usato anche dalla sua procedura di cleanup) */
+	logshard_t * sh; /* segmento del file di log servito dal Writer */
+	int fd; /* file di log */
+	char * buf; /* buffer in cui vengono composte le righe (NLOGBUF byte) */
+	int dirty; /* 1 se sono state scritte righe non ancora sincronizzate con fdatasync */
+	unsigned long segno; /* numero dell'ultimo segmento chiuso (rotazione) */
+	unsigned long size; /* byte scritti nel file di log attivo */
+	struct timespec t_open; /* istante di apertura del file di log attivo */
+} logw_t;
 
 /** ========== Strutture globali ========== */
-hashTable_t * hash_table; /* tabella hash, condivisa tra tutti i thread del server */
+userTable_t * hash_table; /* tabella hash degli utenti autorizzati, condivisa tra tutti i thread del server */
+userMph_t * user_mph = NULL; /* hash perfetto minimo sugli utenti di hash_table (NULL se non richiesto) */
 list_t * thread_list; /* lista che conterrà gli id dei thread */
-char * to_write; /* stringa da scrivere sul file di log */
-unsigned int dim_wr = NWRITE; /* dimensione effettiva della variabile "to_write" */
-char * users_list; /* array che conterrà la lista degli utenti connessi */
+logshard_t * log_shards; /* segmenti del file di log (ognuno con la sua coda dei record e il suo Writer) */
+int n_shards = 1; /* numero di segmenti del file di log */
+unsigned long log_stamp = 0; /* ultimo timbro di sequenza assegnato ad un record (log diviso in segmenti) */
+unsigned long log_threshold = NLOGBYTES; /* byte in attesa oltre i quali il Writer viene risvegliato */
+int log_ms = NLOGMS; /* millisecondi massimi di attesa del Writer */
+int log_sync = LSYNC_NONE; /* politica di sincronizzazione del file di log */
+int sync_ms = 0; /* millisecondi tra due sincronizzazioni (con LSYNC_INTERVAL) */
+int log_compact = 0; /* 1 se i broadcast vengono registrati con un solo record (log compatto) */
+unsigned long bcast_seq = 0; /* numero dell'ultimo broadcast registrato nel log compatto */
+unsigned long rot_bytes = 0; /* byte oltre i quali il file di log attivo viene chiuso e rinominato (0 = mai) */
+int rot_secs = 0; /* secondi dopo i quali il file di log attivo viene chiuso e rinominato (0 = mai) */
+unsigned long log_keep = 0; /* numero di segmenti chiusi da tenere (0 = tutti) */
+int log_gzip = 0; /* 1 se i segmenti chiusi vengono compressi con gzip */
+int log_index = 0; /* 1 se l'Archiver costruisce gli indici dei segmenti chiusi */
+closedq_t log_closed = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, NULL }; /* segmenti chiusi in attesa dell'Archiver */
+field_t * users_head = NULL; /* primo utente connesso (lista in ordine di connessione) */
+field_t * users_tail = NULL; /* ultimo utente connesso */
+int n_users = 0; /* numero di utenti connessi */
+unsigned long users_version = 0; /* versione della lista degli utenti connessi (cresce ad ogni modifica) */
+frame_t * list_frame = NULL; /* risposta a MSG_LIST gia' codificata (NULL se non ancora costruita) */
+unsigned long list_version = 0; /* versione della lista degli utenti connessi a cui corrisponde list_frame */
 int n_worker = 0; /* variabile che indica il numero di worker attivi */
+int n_loop = 0; /* numero di thread event loop (0 = un thread Worker per ogni connessione) */
+int efd = -1; /* descrittore epoll condiviso dagli event loop */
+outq_t ** flush_list = NULL; /* code con frame in attesa che la socket sia pronta in scrittura */
+int n_flush = 0; /* numero di code in flush_list */
+int dim_flush = 0; /* dimensione effettiva di flush_list */
+int flush_pipe [2]; /* pipe per risvegliare il Flusher */
+unsigned int q_frames = NQFRAMES; /* massimo numero di frame in una coda di uscita */
+unsigned long q_bytes = NQBYTES; /* massimo numero di byte in una coda di uscita */
+int q_policy = QBLOCK; /* politica applicata quando la coda di un destinatario e' piena */
+int q_secs = 0; /* secondi senza progressi dopo i quali un destinatario viene disconnesso (0 = mai) */
+int n_fanout = 0; /* numero di thread Fanout (0 = broadcast inviati dal thread mittente) */
+int fan_min = NFANMIN; /* numero minimo di destinatari per affidare un broadcast ai thread Fanout */
+fanq_t * fan_queues = NULL; /* code degli shard, una per ogni thread Fanout */
+fchunk_t * field_chunks = NULL; /* blocchi dei payload degli utenti autorizzati (il primo e' quello corrente) */
+nblock_t * name_blocks = NULL; /* blocchi che contengono gli username degli utenti autorizzati */
+outq_t * free_queues = NULL; /* code di uscita di sessioni terminate, pronte per essere riusate */
+frame_t * ok_frame = NULL; /* risposta MSG_OK gia' codificata, condivisa da tutti i login */
 
 /** ========== Variabili mutex globali ========== */
 pthread_mutex_t mtx_thread = PTHREAD_MUTEX_INITIALIZER;
-pthread_mutex_t mtx_hash = PTHREAD_MUTEX_INITIALIZER; /* mutex per accedere alla tabella hash da parte di un thread */
-pthread_mutex_t mtx_write = PTHREAD_MUTEX_INITIALIZER; /* mutex per accedere alla variabile "to_write" e a "dim_wr" */
-pthread_mutex_t mtx_users = PTHREAD_MUTEX_INITIALIZER; /* mutex per accedere alla variabile users_list */
+pthread_rwlock_t rw_hash = PTHREAD_RWLOCK_INITIALIZER; /* lettura: ricerca nella tabella hash, scrittura: modifica della struttura della tabella */
+pthread_mutex_t mtx_stripe [NSTRIPE]; /* mutex sullo stato (skt, q) degli utenti, scelto in base all id dell utente */
+pthread_mutex_t mtx_users = PTHREAD_MUTEX_INITIALIZER; /* mutex per accedere alla lista degli utenti connessi (e a bcast_seq) */
 pthread_mutex_t mtx_n = PTHREAD_MUTEX_INITIALIZER; /* mutex per accedere alla variabile n_worker */
+pthread_mutex_t mtx_flush = PTHREAD_MUTEX_INITIALIZER; /* mutex per accedere alla lista del Flusher */
+pthread_mutex_t mtx_list = PTHREAD_MUTEX_INITIALIZER; /* mutex per accedere a list_frame e list_version */
+pthread_mutex_t mtx_qpool = PTHREAD_MUTEX_INITIALIZER; /* mutex per accedere alle code libere */
+pthread_mutex_t mtx_fields = PTHREAD_MUTEX_INITIALIZER; /* mutex per accedere ai blocchi dei payload e degli username */
 
-void Cleanup_writer (void * log) {
-	int n;
-	FILE * fd_log = (FILE *) log;
+void Cleanup_writer (void * arg) {
+	logw_t * w = (logw_t *) arg;
 	
-	Lock (&mtx_write);
-		
-		if (to_write [0] != '\0') {
-			n = fprintf (fd_log, "%s", to_write);
-			fflush (fd_log);
-				
-			if (n < strlen (to_write)) {
-				fprintf (stderr, "Errore durante la scrittura sul file di log");
-				exit (EXIT_FAILURE);
-			}
-				
-			Reset_string ();
-		}
-					
-	Unlock (&mtx_write);
+	/* i produttori sono gia' terminati: scrivo i record rimasti nella coda (e chiudo il log binario) */
+	if (Write_log (w->sh, w->fd, w->buf, NLOGBUF) == -1 || End_binlog (w->sh, w->fd, w->buf, NLOGBUF) == -1 ||
+		(log_sync != LSYNC_NONE && fdatasync (w->fd) == -1)) {
+		perror ("Errore durante la scrittura sul file di log");
+		exit (EXIT_FAILURE);
+	}
 	
-	fflush (fd_log);
-	fclose (fd_log);
+	close (w->fd);
+	free (w->buf);
 	
 	return;
 }
@@ -86,39 +152,207 @@ void Cleanup_worker ( void * arg ) {
 	Unlock (&mtx_n);
 }
 
-void * Writer (void * name)
+void Cleanup_buffer ( void * in ) {
+	freeMsgBuffer ( (msgbuf_t *) in );
+}
+
+/** Procedura che apre (troncandolo) il file di log attivo di un Writer
+ * 
+ * 	\param w, stato del Writer
+ */
+void Open_log (logw_t * w) {
+	w->fd = open (w->sh->file, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (w->fd == -1 || Begin_binlog (w->sh, w->fd) == -1) {
+		perror ("Errore nell'apertura del file di log");
+		exit (EXIT_FAILURE);
+	}
+	w->size = 0;
+	w->dirty = 0;
+	clock_gettime (CLOCK_MONOTONIC, &(w->t_open));
+}
+
+/** Procedura che rinomina il file di log attivo nel prossimo segmento ("file_log.n")
+ *  e lo passa all'Archiver (compressione e conservazione)
+ * 
+ * 	\param w, stato del Writer
+ */
+void Close_segment (logw_t * w) {
+	closed_t * c = malloc (sizeof (closed_t));
+	
+	if (c == NULL || (c->name = malloc (strlen (w->sh->file) + 32)) == NULL) {
+		perror ("Errore durante la rotazione del file di log");
+		exit (EXIT_FAILURE);
+	}
+	c->file = w->sh->file;
+	c->n = ++(w->segno);
+	sprintf (c->name, "%s.%lu", c->file, c->n);
+	if (rename (c->file, c->name) == -1) {
+		perror ("Errore durante la rotazione del file di log");
+		exit (EXIT_FAILURE);
+	}
+	Push_closed (&log_closed, c);
+}
+
+/** Procedura che chiude il file di log attivo e ne apre uno nuovo (chiamata solo dal Writer):
+ *  i produttori continuano ad accodare record, che finiscono nel nuovo file
+ * 
+ * 	\param w, stato del Writer
+ */
+void Rotate_log (logw_t * w) {
+	if (End_binlog (w->sh, w->fd, w->buf, NLOGBUF) == -1 ||
+		(log_sync != LSYNC_NONE && fdatasync (w->fd) == -1) || close (w->fd) == -1) {
+		perror ("Errore durante la rotazione del file di log");
+		exit (EXIT_FAILURE);
+	}
+	/* rename e' atomica: chi apre file_log trova il vecchio o il nuovo file, mai un file a meta' */
+	Close_segment (w);
+	Open_log (w);
+	
+	/* log compatto: il segmento riparte dagli utenti connessi (non conta per la dimensione del segmento) */
+	if (w->sh->members == 1 && Log_members (w->sh, w->fd, w->buf, NLOGBUF) == -1) {
+		perror ("Errore durante la rotazione del file di log");
+		exit (EXIT_FAILURE);
+	}
+}
+
+/** Procedura che costruisce gli indici di un segmento chiuso (con -X), lo comprime (con -z) ed elimina
+ *  il segmento che esce dalla finestra di conservazione (con -K); il segmento viene deallocato
+ * 
+ * 	\param c, segmento chiuso
+ */
+void Archive_segment (closed_t * c) {
+	/* indici per parole (logsearch) e per mittente e destinatario (logq): le ricerche non li ricostruiscono */
+	if (log_index == 1 && (index_msgidx (c->name) == -1 || index_msgqidx (c->name) == -1)) {
+		fprintf (stderr, "Errore durante l'indicizzazione del segmento %s\n", c->name);
+	}
+	if (log_gzip == 1 && Gzip_segment (c->name) == -1) {
+		fprintf (stderr, "Errore durante la compressione del segmento %s\n", c->name);
+	}
+	/* i segmenti arrivano in ordine: quando si chiude il segmento n, n - log_keep e' il piu' vecchio da eliminare */
+	if (log_keep > 0 && c->n > log_keep) {
+		Remove_segment (c->file, c->n - log_keep);
+	}
+	free (c->name);
+	free (c);
+}
+
+/** Thread che indicizza e comprime i segmenti chiusi e cancella i piu' vecchi, lontano dal Writer e dai worker
+ */
+void * Archiver (void * not_used)
+{
+	int old;
+	closed_t * c;
+	
+	Add_thread_list ( pthread_self(), "Archiver" );
+	
+	if ( pthread_detach (pthread_self()) != 0) {
+		fprintf (stderr, "Errore durante l'esecuzione di pthread_detach");
+		exit (EXIT_FAILURE);	
+	}
+	
+	while (1) {
+		c = Pop_closed (&log_closed); /* punto di cancellazione */
+		
+		pthread_setcancelstate ( PTHREAD_CANCEL_DISABLE, &old );
+			Archive_segment (c);
+		pthread_setcancelstate ( PTHREAD_CANCEL_ENABLE, &old );
+	}
+	
+	return NULL;
+}
+
+void * Writer (void * shard)
 {	
-	int n;
 	int old;
-	char * name_log = ((char *) name); /* nome del file di log */
-	FILE * fd_log;
+	long n;
+	logw_t w;
+	struct timespec ts;
+	struct timespec now;
+	struct timespec t_sync; /* istante dell'ultima sincronizzazione del file di log */
 	
 	Add_thread_list ( pthread_self (), "Writer");
 	
-	fd_log = fopen (name_log, "w");
+	w.sh = (logshard_t *) shard;
+	w.buf = malloc (NLOGBUF);
+	if (w.buf == NULL) {
+		perror ("Errore nell'apertura del file di log");
+		exit (EXIT_FAILURE);
+	}
+	
+	/* con la rotazione il file di log lasciato da un'esecuzione precedente diventa un segmento
+	 * (la numerazione riprende dall'ultimo), invece di essere troncato */
+	w.segno = 0;
+	if (rot_bytes > 0 || rot_secs > 0) {
+		w.segno = Scan_segments (w.sh->file, 0);
+		if (access (w.sh->file, F_OK) == 0) {
+			Close_segment (&w);
+		}
+		if (log_keep > 0 && w.segno > log_keep) {
+			Scan_segments (w.sh->file, w.segno - log_keep + 1);
+		}
+	}
+	Open_log (&w);
+	clock_gettime (CLOCK_MONOTONIC, &t_sync);
 	
-	pthread_cleanup_push ( Cleanup_writer, fd_log );
+	/* log compatto: anche il primo file parte dalla fotografia (vuota) degli utenti connessi,
+	 * chi lo legge dopo i segmenti dell'esecuzione precedente non eredita i loro connessi */
+	if (w.sh->members == 1 && Log_members (w.sh, w.fd, w.buf, NLOGBUF) == -1) {
+		perror ("Errore nell'apertura del file di log");
+		exit (EXIT_FAILURE);
+	}
+	
+	pthread_cleanup_push ( Cleanup_writer, &w );
 	
 		while (1) {
 
-			sleep (WRITE_SLEEP);
+			/* attesa di log_ms millisecondi, o finche' un produttore porta i byte in attesa oltre
+			 * log_threshold o trova piena la coda dei record (se la soglia e' gia' superata non si attende) */
+			if (__sync_fetch_and_add (&(w.sh->bytes), 0) < log_threshold) {
+				clock_gettime (CLOCK_REALTIME, &ts);
+				ts.tv_sec += log_ms / 1000;
+				ts.tv_nsec += (log_ms % 1000) * 1000000L;
+				if (ts.tv_nsec >= 1000000000L) {
+					ts.tv_sec++;
+					ts.tv_nsec -= 1000000000L;
+				}
+				while (sem_timedwait (&(w.sh->sem), &ts) == -1 && errno == EINTR);
+			}
 		
+			/* nessun lock: la coda dei record ha un solo consumatore */
 			pthread_setcancelstate ( PTHREAD_CANCEL_DISABLE, &old );
-				Lock (&mtx_write);
-		
-					if (to_write [0] != '\0') {
-						n = fprintf (fd_log, "%s", to_write);
-						fflush (fd_log);
+				n = Write_log (w.sh, w.fd, w.buf, NLOGBUF);
+				if (n == -1) {
+					perror ("Errore durante la scrittura sul file di log");
+					exit (EXIT_FAILURE);
+				}
+				if (n > 0) {
+					w.dirty = 1;
+					w.size += n;
+				}
 				
-						if (n < strlen (to_write)) {
-							fprintf (stderr, "Errore durante la scrittura sul file di log");
+				/* group commit: una sola fdatasync per tutte le righe scritte dall'ultima */
+				if (w.dirty == 1 && log_sync != LSYNC_NONE) {
+					clock_gettime (CLOCK_MONOTONIC, &now);
+					if (log_sync == LSYNC_BATCH || (now.tv_sec - t_sync.tv_sec) * 1000 +
+						(now.tv_nsec - t_sync.tv_nsec) / 1000000 >= sync_ms) {
+						if (fdatasync (w.fd) == -1) {
+							perror ("Errore durante la sincronizzazione del file di log");
 							exit (EXIT_FAILURE);
 						}
+						w.dirty = 0;
+						t_sync = now;
+					}
+				}
 				
-						Reset_string ();
+				/* rotazione: il Writer e' l'unico a usare il file, i produttori non si fermano */
+				if (rot_bytes > 0 && w.size >= rot_bytes) {
+					Rotate_log (&w);
+				} else if (rot_secs > 0 && w.size > 0) {
+					clock_gettime (CLOCK_MONOTONIC, &now);
+					if (now.tv_sec - w.t_open.tv_sec >= rot_secs) {
+						Rotate_log (&w);
 					}
-					
-				Unlock (&mtx_write);
+				}
 			pthread_setcancelstate ( PTHREAD_CANCEL_ENABLE, &old );
 		}
 		
@@ -132,10 +366,10 @@ void * Worker (void * fd_socket)
 	int n; /* variabile per conoscere il numero di caratteri ricevuti  */
 	int skt;
 	int old; /* necessaria per abilitare/disabilitare la cancel */
-	char username [NUSR]; /* username dell'utente connesso tramite questo worker */
-	char * dest_username;
+	usr_id_t id; /* id dell'utente connesso tramite questo worker */
 	message_t msg;
-	pthread_mutex_t * this_cli_mtx; /* puntatore alla variabile mutex dell'elemento nella tabella hash che "conversa" con questo worker*/
+	msgbuf_t * in; /* buffer di ingresso della socket */
+	outq_t * this_cli_q; /* coda di uscita dell'elemento nella tabella hash che "conversa" con questo worker*/
 	
 	skt = * ((int *) fd_socket);
 	free (fd_socket);
@@ -160,19 +394,25 @@ void * Worker (void * fd_socket)
 															  */
 	
 		/* verifico che il client sia abilitato alla connessione */
-			this_cli_mtx = Enable_connect (skt, username);
+			this_cli_q = Enable_connect (skt, &id);
 	
-			if (this_cli_mtx == NULL) {
+			if (this_cli_q == NULL) {
 				/* client non puo connettersi a questo server */
 				Remove_thread_list (pthread_self ());
 				return NULL;
 			}
+			in = newMsgBuffer ();
+			if (in == NULL) {
+				perror ("Errore durante la creazione del buffer di ingresso");
+				exit (EXIT_FAILURE);
+			}
 		pthread_setcancelstate ( PTHREAD_CANCEL_ENABLE, &old );
 	
 		/* client è stato abilitato alla connessione */
 
+		pthread_cleanup_push ( Cleanup_buffer, in );
 		while (1) {
-			n = Receive_skt (skt, &msg);
+			n = Receive_buf_skt (skt, in, &msg); /* una sola read puo' ricevere piu' messaggi */
 			pthread_setcancelstate ( PTHREAD_CANCEL_DISABLE, &old ); /* disabilito la cancel in modo da esaudire l'eventuale richiesta pendente ricevuta */
 		
 				/*****************************************************************/
@@ -180,63 +420,261 @@ void * Worker (void * fd_socket)
 				/*****************************************************************/
 
 				if (n == SEOF || msg.type == MSG_EXIT) {
-					Disconnect (pthread_self (), username, skt);	
+					freeMsgBuffer (in);
+					Disconnect (pthread_self (), id);	
 					return NULL;
 				}
 		
 		
-				/*******************************************************************/
-				/** ==================== Messaggio di listing ==================== */
-				/*******************************************************************/
-		
-				if (msg.type == MSG_LIST) {
-					Lock (&mtx_hash); /* locking della tabella hash, in quanto un altro thread nel frattempo potrebbe aggiornarla */
-						Lock (&mtx_users);
-							msg.buffer = Listing ();
-						Unlock (&mtx_users);
-					Unlock (&mtx_hash);
+				/* MSG_LIST, MSG_TO_ONE, MSG_BCAST */
+				Serve_message (&msg, id, this_cli_q);
 			
-					msg.length = strlen ((msg.buffer)) + 1;
-			
-					Lock (this_cli_mtx);
-						Send_skt (skt, &msg);
-					Unlock (this_cli_mtx);
+			pthread_setcancelstate ( PTHREAD_CANCEL_ENABLE, &old );
+		}
+		pthread_cleanup_pop (0);
+		
+	pthread_cleanup_pop (0);
 	
-					free ( (msg.buffer) );
-				}
+	return NULL;
+}
+
+/** Libera una connessione servita da un event loop (la socket deve essere gia' chiusa)
+ *
+ *  \param c, connessione da liberare
+ */
+void Free_conn (conn_t * c) {
+	freeMsgBuffer (c->in);
+	free (c);
+}
+
+/** Procedura che serve una connessione pronta in lettura: svuota la socket,
+ *  serve tutti i messaggi completi ricevuti e riarma la socket sull'epoll.
+ *  Stessa semantica del ciclo di un Worker.
+ *
+ *  \param c, connessione da servire
+ */
+void Serve_conn (conn_t * c) {
+	int n, eof;
+	message_t msg;
+	struct epoll_event ev;
 	
+	/* svuoto la socket: con EPOLLET non verranno generati altri eventi per i byte gia' presenti */
+	while ( (eof = fillMsgBuffer (c->skt, c->in, 1)) > 0 );
+	if (eof == -1) { /* come per la write, un errore sulla socket equivale alla chiusura da parte del peer */
+		eof = SEOF;
+	}
 	
-				/********************************************************************************/
-				/** ==================== Messaggio ad uno specifico client ==================== */
-				/********************************************************************************/
+	while ( (n = nextMessage (c->in, &msg)) != SNOMSG ) {
+		if (n == -1) {
+			perror (ERROR_RECEIVE_MSG);
+			Close_skt (c->skt);
+			exit (EXIT_FAILURE);
+		}
 		
-				if (msg.type == MSG_TO_ONE) {
-			
-					dest_username = Divide_to_one (&msg, username);
-			
+		if (c->q == NULL) { /* primo messaggio: richiesta di connessione */
+			c->q = Enable_user (c->skt, &msg, &(c->id));
+			if (c->q == NULL) {
+				/* client non puo connettersi a questo server (la socket e' gia' stata chiusa) */
+				Free_conn (c);
+				return;
+			}
+			continue;
+		}
+		
+		/*****************************************************************/
+		/** ==================== Fine comunicazione ==================== */
+		/*****************************************************************/
+		
+		if (msg.type == MSG_EXIT) {
+			Disconnect_client (c->id);
+			Free_conn (c);
+			return;
+		}
+		
+		/* MSG_LIST, MSG_TO_ONE, MSG_BCAST */
+		Serve_message (&msg, c->id, c->q);
+	}
+	
+	if (eof == SEOF) {
+		if (c->q == NULL) {
+			fprintf (stderr, CLIENT_DISCONNECT);
+			Close_skt (c->skt);
+		} else {
+			Disconnect_client (c->id);
+		}
+		Free_conn (c);
+		return;
+	}
+	
+	/* la socket e' vuota: la riarmo (EPOLLONESHOT garantisce che una connessione sia servita da un solo event loop alla volta) */
+	ev.events = EPOLLIN | EPOLLET | EPOLLONESHOT;
+	ev.data.ptr = c;
+	if (epoll_ctl (efd, EPOLL_CTL_MOD, c->skt, &ev) == -1) {
+		perror ("Errore durante l'aggiornamento dell'epoll");
+		exit (EXIT_FAILURE);
+	}
+}
 
-					if ( Send_to_one (username, dest_username, &msg, skt, this_cli_mtx) == 1) {
-					/* è necessario deallocare il buffer */
-						free (msg.buffer);
-					}
+void * Event_loop (void * not_used)
+{
+	int i, n;
+	int old; /* necessaria per abilitare/disabilitare la cancel */
+	struct epoll_event ev [NEVENTS];
+	
+	Add_thread_list ( pthread_self(), "Loop" );
+	
+	/* un event loop conta come un worker attivo */
+	Lock (&mtx_n);
+		n_worker++;
+	Unlock (&mtx_n);
+	
+	pthread_cleanup_push ( Cleanup_worker, NULL );
+	
+		if ( pthread_detach (pthread_self()) != 0) {
+			fprintf (stderr, "Errore durante l'esecuzione di pthread_detach");
+			exit (EXIT_FAILURE);	
+		}
+		
+		while (1) {
+			n = epoll_wait (efd, ev, NEVENTS, -1); /* punto di cancellazione */
 			
-					free (dest_username);
+			if (n == -1) {
+				if (errno == EINTR) {
+					continue;
 				}
+				perror ("Errore durante l'esecuzione di epoll_wait");
+				exit (EXIT_FAILURE);
+			}
+			
+			pthread_setcancelstate ( PTHREAD_CANCEL_DISABLE, &old );
+				for (i = 0; i < n; i++) {
+					Serve_conn ( (conn_t *) ev [i].data.ptr );
+				}
+			pthread_setcancelstate ( PTHREAD_CANCEL_ENABLE, &old );
+		}
+		
+	pthread_cleanup_pop (0);
+	
+	return NULL;
+}
 
-
-				/*********************************************************************/
-				/** ==================== Messaggio di broadcast ==================== */
-				/*********************************************************************/
+void * Flusher (void * not_used)
+{
+	int i, j, n;
+	int old; /* necessaria per abilitare/disabilitare la cancel */
+	int done;
+	int dim = 0; /* dimensione effettiva di qs e fds */
+	char c [NEVENTS];
+	outq_t * q;
+	outq_t ** qs = NULL; /* copia locale della lista del Flusher */
+	struct pollfd * fds = NULL;
+	
+	Add_thread_list ( pthread_self(), "Flusher" );
+	if ( pthread_detach (pthread_self()) != 0) {
+		fprintf (stderr, "Errore durante l'esecuzione di pthread_detach");
+		exit (EXIT_FAILURE);	
+	}
+	
+	while (1) {
+		
+		/* solo il Flusher rimuove code dalla lista, quindi la copia resta valida */
+		Lock (&mtx_flush);
+			n = n_flush;
+			if (n + 1 > dim) {
+				dim = 2 * (n + 1);
+				qs = realloc (qs, dim * sizeof (outq_t *));
+				fds = realloc (fds, dim * sizeof (struct pollfd));
+				if (qs == NULL || fds == NULL) {
+					perror ("Errore durante l'espansione della lista del Flusher");
+					exit (EXIT_FAILURE);
+				}
+			}
+			for (i = 0; i < n; i++) {
+				qs [i] = flush_list [i];
+			}
+		Unlock (&mtx_flush);
+		
+		fds [0].fd = flush_pipe [0];
+		fds [0].events = POLLIN;
+		for (i = 0; i < n; i++) {
+			fds [i + 1].fd = qs [i]->skt;
+			fds [i + 1].events = POLLOUT;
+		}
+		
+		/* se e' previsto un limite di tempo, le code vengono controllate almeno ogni secondo */
+		if (poll (fds, n + 1, (q_secs > 0) ? 1000 : -1) == -1) { /* punto di cancellazione */
+			if (errno == EINTR) {
+				continue;
+			}
+			perror ("Errore durante l'esecuzione di poll");
+			exit (EXIT_FAILURE);
+		}
 		
-				if (msg.type == MSG_BCAST) {
+		pthread_setcancelstate ( PTHREAD_CANCEL_DISABLE, &old );
+		
+			if (fds [0].revents != 0) { /* nuove code nella lista */
+				while (read (flush_pipe [0], c, NEVENTS) > 0);
+			}
 			
-					Divide_bcast (&msg, username);
-
-					Bcast (&msg, username);
+			for (i = 0; i < n; i++) {
+				if (fds [i + 1].revents == 0 && q_secs == 0) {
+					continue;
+				}
+				q = qs [i];
+				
+				Lock (&(q->mtx));
+					if (fds [i + 1].revents != 0) {
+						Flush_queue (q); /* non fa nulla se la sessione e' terminata */
+					}
+					if (q->closed == 0 && Stalled_queue (q)) {
+						Shutdown_queue (q, 1);
+					}
+					done = (q->closed == 1 || q->head == NULL);
+					if (done) {
+						q->pending = 0;
+					}
+				Unlock (&(q->mtx));
+				
+				if (done) { /* la coda esce dalla lista del Flusher */
+					Lock (&mtx_flush);
+						for (j = 0; flush_list [j] != q; j++);
+						flush_list [j] = flush_list [--n_flush];
+					Unlock (&mtx_flush);
+					Release_queue (q);
+				}
+			}
 			
-					free (msg.buffer);		
-				}	
+		pthread_setcancelstate ( PTHREAD_CANCEL_ENABLE, &old );
+	}
+	
+	return NULL;
+}
+
+void * Fanout (void * queue)
+{
+	int old; /* necessaria per abilitare/disabilitare la cancel */
+	fanq_t * fq = (fanq_t *) queue; /* coda degli shard di questo thread */
+	shard_t * s;
+	
+	Add_thread_list ( pthread_self(), "Fanout" );
+	
+	/* un thread Fanout conta come un worker attivo */
+	Lock (&mtx_n);
+		n_worker++;
+	Unlock (&mtx_n);
+	
+	pthread_cleanup_push ( Cleanup_worker, NULL );
+	
+		if ( pthread_detach (pthread_self()) != 0) {
+			fprintf (stderr, "Errore durante l'esecuzione di pthread_detach");
+			exit (EXIT_FAILURE);	
+		}
+		
+		while (1) {
+			s = Pop_shard (fq); /* punto di cancellazione */
 			
+			pthread_setcancelstate ( PTHREAD_CANCEL_DISABLE, &old );
+				Send_shard (s);
 			pthread_setcancelstate ( PTHREAD_CANCEL_ENABLE, &old );
 		}
 		
@@ -251,6 +689,8 @@ void * Dispatcher (void * fd_socket)
 	int fd_cli;
 	int * param;
 	pthread_t worker;
+	conn_t * c;
+	struct epoll_event ev;
 	
 	Add_thread_list ( pthread_self(), "Dispatcher" );
 	if ( pthread_detach (pthread_self()) != 0) {
@@ -267,6 +707,23 @@ void * Dispatcher (void * fd_socket)
 			exit (EXIT_FAILURE);
 		}
 		
+		if (n_loop > 0) { /* la connessione viene affidata agli event loop */
+			c = calloc (1, sizeof (conn_t));
+			if (c == NULL || (c->in = newMsgBuffer ()) == NULL) {
+				perror ("Errore durante l'allocazione di una connessione");
+				exit (EXIT_FAILURE);
+			}
+			c->skt = fd_cli;
+			
+			ev.events = EPOLLIN | EPOLLET | EPOLLONESHOT;
+			ev.data.ptr = c;
+			if (epoll_ctl (efd, EPOLL_CTL_ADD, fd_cli, &ev) == -1) {
+				perror ("Errore durante l'inserimento della connessione nell'epoll");
+				exit (EXIT_FAILURE);
+			}
+			continue;
+		}
+		
 		param = malloc (sizeof (int));
 		*param = fd_cli;
 		
@@ -279,12 +736,16 @@ void * Dispatcher (void * fd_socket)
 	return NULL;
 }
 
-void * Handler (void * asd) {
+void * Handler (void * arg) {
 	int signum;
+	char * file_usr = (char *) arg; /* file degli utenti autorizzati (riletto ad ogni SIGHUP) */
+	unsigned int added, removed;
 	sigset_t set;
 	elem_t * p;
 	elem_t * tmp;
-	pthread_t writer; /* id del thread writer (deve esser l'ultimo thread a venir cancellato) */
+	int i, n_writers;
+	pthread_t * writers; /* id dei thread writer (devono essere gli ultimi thread a venir cancellati) */
+	shard_t * s;
 	
 	/******************************************************************/
 	/** ========== Setting e attesa dei segnali da gestire ========== */
@@ -296,20 +757,43 @@ void * Handler (void * asd) {
 	}
 	sigaddset (&set, SIGINT);
 	sigaddset (&set, SIGTERM);
+	sigaddset (&set, SIGHUP);
 	if ( pthread_sigmask (SIG_SETMASK, &set, NULL) == -1 ) {
 		fprintf (stderr, "Errore durante il mascheramento dei segnali");
 		exit (EXIT_FAILURE);
 	}
-	/* attesa dell'arrivo di uno dei segnali settati */
-	if ( sigwait ( &set, &signum ) != 0) {
-		fprintf (stderr, "Errore durante l'esecuzione di sigwait");
-		exit (EXIT_FAILURE);
+	/* attesa dell'arrivo di uno dei segnali settati: SIGHUP fa rileggere il file degli utenti
+	 * autorizzati senza interrompere le sessioni degli utenti che restano autorizzati */
+	while (1) {
+		if ( sigwait ( &set, &signum ) != 0) {
+			fprintf (stderr, "Errore durante l'esecuzione di sigwait");
+			exit (EXIT_FAILURE);
+		}
+		if (signum != SIGHUP) {
+			break;
+		}
+		if (Reload_users (file_usr, &added, &removed) == -1) {
+			if (errno == EINVAL) {
+				fprintf (stderr, "Il file degli utenti autorizzati deve contenere solamente stringhe di caratteri alfanumerici di lunghezza inferiore a 256: utenti invariati\n");
+			} else {
+				perror ("Errore nel ricaricamento del file degli utenti autorizzati, utenti invariati");
+			}
+			continue;
+		}
+		fprintf (stderr, "Ricaricato il file degli utenti autorizzati: %u aggiunti, %u rimossi\n", added, removed);
 	}
 	
 	/**************************************************/
 	/** ========== Terminazione del server ========== */
 	/**************************************************/
 	
+	writers = malloc (n_shards * sizeof (pthread_t));
+	if (writers == NULL) {
+		perror ("Errore durante la terminazione del server");
+		exit (EXIT_FAILURE);
+	}
+	n_writers = 0;
+	
 	Lock (&mtx_thread);
 		p = (thread_list->head);
 		thread_list->head = NULL;
@@ -317,8 +801,8 @@ void * Handler (void * asd) {
 		while (p != NULL) { /* scansione della lista dei thread attivi */
 			tmp = p->next;
 			
-			if ( strcmp ( (p->payload), "Writer") == 0 ) { /* il writer dovrà terminare solo alla fine */
-				writer = *( (pthread_t *) (p->key)); /* salvo l'id del writer */
+			if ( strcmp ( (p->payload), "Writer") == 0 ) { /* i writer dovranno terminare solo alla fine */
+				writers [n_writers++] = *( (pthread_t *) (p->key)); /* salvo l'id del writer */
 				free (p->key);
 				free (p->payload);
 				free (p);
@@ -360,10 +844,24 @@ void * Handler (void * asd) {
 		Lock (&mtx_n);
 	}
 
+	/* shard rimasti nelle code dei thread Fanout (anche loro terminati): li invio qui, prima di fermare
+	 * i Writer, in modo da registrarne i record e rilasciare i frame e i riferimenti alle code */
+	for (i = 0; i < n_fanout; i++) {
+		while (fan_queues [i].head != NULL) {
+			s = fan_queues [i].head;
+			fan_queues [i].head = s->next;
+			Send_shard (s);
+		}
+		fan_queues [i].tail = NULL;
+	}
+
 	/* tutti i worker sono sicuramente terminati (n_worker == 0)
-	 * invio segnale di terminazione al thread writer
+	 * invio segnale di terminazione ai thread writer (uno per segmento del file di log)
 	 */
-	pthread_cancel ( writer );
+	for (i = 0; i < n_writers; i++) {
+		pthread_cancel ( writers [i] );
+	}
+	free (writers);
 		
 	return NULL;
 	
@@ -371,25 +869,180 @@ void * Handler (void * asd) {
 
 int main (int argc, char * argv [])
 {
-	int i, skt, n = 0; /* n è la grandezza massima che potrà assumera users_list */
-	char buf [NUSR]; /* buffer contenente l'ultimo username letto */
-	field_t payload;
-	FILE * fp;
+	int i, skt;
+	unsigned int n, u; /* numero di utenti autorizzati */
+	char * name; /* blocco con gli username degli utenti autorizzati */
+	userElem_t * e; /* utenti autorizzati letti dal file */
+	int n_loader; /* thread usati per leggere il file degli utenti autorizzati */
+	struct timespec t_start, t_end; /* durata del caricamento degli utenti */
+	message_t msg;
 	DIR * dp;
-	pthread_t disp, writer, handler;
+	pthread_t disp, handler, loop, flusher, fanout, archiver;
+	closed_t * closed; /* segmenti chiusi ancora da archiviare alla terminazione */
+	closed_t * next_closed;
+	unsigned long last; /* ultimo broadcast registrato da un'esecuzione precedente */
+	pthread_t * writer; /* un thread Writer per ogni segmento del file di log */
+	int split = 0; /* 1 se il file di log va diviso in segmenti */
+	int binary = 0; /* 1 se il file di log e' binario */
 	sigset_t set;
 	struct sigaction sa;
+	int opt;
+	int use_mph = 0; /* 1 se va costruito l'hash perfetto minimo sugli utenti autorizzati */
+	char * file_usr; /* file degli utenti autorizzati */
+	char * file_log; /* file di log */
 	
-	if (argc != 3) {
-		fprintf(stderr,"L'applicazione msgserv deve essere eseguita come: \"$ msgserv file_utenti_autorizzati file_log\"\n");
+	/*********************************************************/
+	/** ========== Lettura delle opzioni del server ========== */
+	/*********************************************************/
+	
+	while ( (opt = getopt (argc, argv, "e:p:b:t:f:F:mw:W:s:cL:BR:T:K:zX")) != -1 ) {
+		switch (opt) {
+			case 'e': /* numero di thread event loop (epoll) al posto di un thread per connessione */
+				n_loop = atoi (optarg);
+				if (n_loop <= 0) {
+					fprintf (stderr, "Il numero di event loop deve essere maggiore di 0\n");
+					exit (EXIT_FAILURE);
+				}
+				break;
+			case 'p': /* politica per i destinatari che non svuotano la propria coda */
+				if (strcmp (optarg, "block") == 0) {
+					q_policy = QBLOCK;
+				} else if (strcmp (optarg, "oldest") == 0) {
+					q_policy = QDROP_OLD;
+				} else if (strcmp (optarg, "newest") == 0) {
+					q_policy = QDROP_NEW;
+				} else if (strcmp (optarg, "disconnect") == 0) {
+					q_policy = QDISCONNECT;
+				} else {
+					fprintf (stderr, USAGE);
+					exit (EXIT_FAILURE);
+				}
+				break;
+			case 'b': /* massimo numero di byte nella coda di uscita di un utente */
+				q_bytes = strtoul (optarg, NULL, 10);
+				if (q_bytes == 0) {
+					fprintf (stderr, "La dimensione massima della coda deve essere maggiore di 0\n");
+					exit (EXIT_FAILURE);
+				}
+				break;
+			case 't': /* secondi senza progressi dopo i quali un destinatario viene disconnesso */
+				q_secs = atoi (optarg);
+				if (q_secs < 0) {
+					fprintf (stderr, "Il numero di secondi non puo' essere negativo\n");
+					exit (EXIT_FAILURE);
+				}
+				break;
+			case 'f': /* numero di thread Fanout per l'invio dei broadcast */
+				n_fanout = atoi (optarg);
+				if (n_fanout < 0) {
+					fprintf (stderr, "Il numero di thread Fanout non puo' essere negativo\n");
+					exit (EXIT_FAILURE);
+				}
+				break;
+			case 'F': /* sotto questo numero di destinatari il broadcast e' inviato dal mittente */
+				fan_min = atoi (optarg);
+				if (fan_min <= 0) {
+					fprintf (stderr, "Il numero minimo di destinatari deve essere maggiore di 0\n");
+					exit (EXIT_FAILURE);
+				}
+				break;
+			case 'm': /* ricerca degli utenti tramite hash perfetto minimo */
+				use_mph = 1;
+				break;
+			case 'w': /* millisecondi massimi tra la consegna di un messaggio e la sua scrittura sul log */
+				log_ms = atoi (optarg);
+				if (log_ms <= 0) {
+					fprintf (stderr, "La latenza massima del file di log deve essere maggiore di 0\n");
+					exit (EXIT_FAILURE);
+				}
+				break;
+			case 'W': /* byte di log in attesa oltre i quali il Writer scrive subito */
+				log_threshold = strtoul (optarg, NULL, 10);
+				if (log_threshold == 0) {
+					fprintf (stderr, "La soglia del file di log deve essere maggiore di 0\n");
+					exit (EXIT_FAILURE);
+				}
+				break;
+			case 'L': /* log diviso in segmenti (uno per thread Writer), da riunire con logmerge */
+				n_shards = atoi (optarg);
+				if (n_shards <= 0) {
+					fprintf (stderr, "Il numero di segmenti del file di log deve essere maggiore di 0\n");
+					exit (EXIT_FAILURE);
+				}
+				split = 1;
+				break;
+			case 'B': /* log binario, indicizzato (le righe si ottengono con logcat) */
+				binary = 1;
+				break;
+			case 'R': /* rotazione del file di log oltre una dimensione */
+				rot_bytes = strtoul (optarg, NULL, 10);
+				if (rot_bytes == 0) {
+					fprintf (stderr, "La dimensione massima di un segmento del file di log deve essere maggiore di 0\n");
+					exit (EXIT_FAILURE);
+				}
+				break;
+			case 'T': /* rotazione del file di log dopo un intervallo */
+				rot_secs = atoi (optarg);
+				if (rot_secs <= 0) {
+					fprintf (stderr, "La durata massima di un segmento del file di log deve essere maggiore di 0\n");
+					exit (EXIT_FAILURE);
+				}
+				break;
+			case 'K': /* segmenti chiusi da conservare */
+				log_keep = strtoul (optarg, NULL, 10);
+				if (log_keep == 0) {
+					fprintf (stderr, "Il numero di segmenti del file di log da conservare deve essere maggiore di 0\n");
+					exit (EXIT_FAILURE);
+				}
+				break;
+			case 'z': /* compressione dei segmenti chiusi */
+				log_gzip = 1;
+				break;
+			case 'X': /* indici dei segmenti chiusi (ricerche con logq e logsearch) */
+				log_index = 1;
+				break;
+			case 'c': /* log compatto: un solo record per broadcast (le righe si ottengono con logexport) */
+				log_compact = 1;
+				break;
+			case 's': /* politica di sincronizzazione (fdatasync) del file di log */
+				if (strcmp (optarg, "none") == 0) {
+					log_sync = LSYNC_NONE;
+				} else if (strcmp (optarg, "batch") == 0) {
+					log_sync = LSYNC_BATCH;
+				} else if ((sync_ms = atoi (optarg)) > 0) {
+					log_sync = LSYNC_INTERVAL;
+				} else {
+					fprintf (stderr, USAGE);
+					exit (EXIT_FAILURE);
+				}
+				break;
+			default:
+				fprintf (stderr, USAGE);
+				exit (EXIT_FAILURE);
+		}
+	}
+	
+	if (argc - optind != 2) {
+		fprintf (stderr, USAGE);
 		exit (EXIT_FAILURE);
 	}
-
-	if ( (fp = fopen (argv [1], "r")) == NULL) {
-		fprintf (stderr, "Errore nell'apertura del file degli utenti autorizzati");
+	file_usr = argv [optind];
+	file_log = argv [optind + 1];
+	if (log_index == 1 && (binary == 0 || (rot_bytes == 0 && rot_secs == 0))) {
+		fprintf (stderr, "Gli indici dei segmenti (-X) richiedono il log binario (-B) e la rotazione (-R o -T)\n");
 		exit (EXIT_FAILURE);
 	}
-	
+	/* gli indici contengono le posizioni dei record nel segmento non compresso */
+	if (log_index == 1 && log_gzip == 1) {
+		fprintf (stderr, "Gli indici dei segmenti (-X) non possono essere usati con la compressione dei segmenti (-z)\n");
+		exit (EXIT_FAILURE);
+	}
+	/* i segmenti ruotati ripartono dagli utenti connessi, che un Writer conosce solo se vede tutti gli ingressi e le uscite */
+	if (log_compact == 1 && split == 1 && (rot_bytes > 0 || rot_secs > 0)) {
+		fprintf (stderr, "Il log compatto (-c) diviso in segmenti (-L) non puo' essere ruotato (-R o -T)\n");
+		exit (EXIT_FAILURE);
+	}
+
 	
 	/*************************************************************/
 	/** ========== Setting della maschera dei segnali ========== */
@@ -413,41 +1066,71 @@ int main (int argc, char * argv [])
 	/** ==================== Caricamento utenti nella tabella hash ==================== */
 	/************************************************************************************/
 	
-	hash_table = new_hashTable(NHASH, compare_string, copy_string, copy_field, hash_string);
+	/* il file viene mappato in memoria e validato in parallelo; gli username vengono poi inseriti
+	 * in blocco (con il valore hash gia' calcolato) in una tabella dimensionata sul loro numero */
+	clock_gettime (CLOCK_MONOTONIC, &t_start);
+	
+	e = Parse_users (file_usr, &n, &name, &n_loader);
+	if (e == NULL) {
+		if (errno == EINVAL) {
+			fprintf (stderr, "Il file degli utenti autorizzati deve contenere solamente stringhe di caratteri alfanumerici di lunghezza inferiore a 256");
+		} else {
+			perror ("Errore nell'apertura del file degli utenti autorizzati");
+		}
+		exit (EXIT_FAILURE);
+	}
+	Keep_names (name); /* gli username restano nel blocco per tutta la vita del server */
+	
+	Reserve_fields (n); /* i payload di tutti gli utenti vengono allocati con una sola calloc */
+	hash_table = new_userTable (n);
 	if (hash_table == NULL) {
 		fprintf (stderr, "Errore durante la creazione della tabella hash");
 		exit (EXIT_FAILURE);
 	}
-	
-	while ( fgets(buf, NUSR + 1, fp) != NULL ) { /* Viene salvato nel buffer anche '\n' se viene incontrato.
-											   * Dopo l'ultimo carattere letto, viene inserito nel buffer il carattere '\0' (se ci sta).
-											   */
-			
-		for (i = 0; buf [i] != '\n' && buf [i] != '\0' && buf [i] != EOF && (i < NUSR); i++) {	
-			if ( isalnum(buf [i]) == 0) {
-				free_hashTable (&hash_table);
-				fclose (fp);
-				fprintf (stderr, "Il file degli utenti autorizzati deve contenere solamente stringhe di caratteri alfanumerici di lunghezza inferiore a 256");
-				exit (EXIT_FAILURE);
-			}
-		}
-		buf [i] = '\0'; /* in questo modo si può applicare tranquillamente la funzione hash su stringhe */
-		n += strlen (buf) + 1; /* + 1 per l'eventuale spazio o carattere terminatore */
-		payload.skt = -1;
-		
-		/* non è necessario inizializzare payload.mtx in quanto sono tutti client disconnessi */
-		
-		/* si inserisce la stringa dell'username fino a '\0' (compreso per via di strdup) */
-		if ( add_hashElement(hash_table, &buf, &payload) == -1 ) { /* all'avvio del server tutti gli utenti hanno
-														  * come valore del payload (socket) -1 perché 
-														  * ancora non connessi
-														  */
-			perror ("Errore durante il caricamento degli utenti nella tabella hash");
-			free_hashTable (&hash_table);
+	for (i = 0; i < NSTRIPE; i++) {
+		if (pthread_mutex_init (&(mtx_stripe [i]), NULL) != 0) {
+			fprintf (stderr, "Errore nell inizializzazione dei mutex della tabella hash");
 			exit (EXIT_FAILURE);
 		}
 	}
-	fclose (fp);
+	
+	/* il payload viene preso dal blocco preallocato: la tabella ne memorizza l'indirizzo,
+	 * che resta valido per tutta la vita del server (login e logout ne cambiano solo lo stato).
+	 * All'avvio del server tutti gli utenti sono disconnessi; gli id vengono assegnati
+	 * nell'ordine del file (0, 1, 2, ...) */
+	for (u = 0; u < n; u++) {
+		e [u].payload = New_field (e [u].key); /* la chiave dell'elemento e' il nome memorizzato nel payload */
+	}
+	if ( add_userElements (hash_table, e, n) == -1 ) {
+		perror ("Errore durante il caricamento degli utenti nella tabella hash");
+		free_userTable (&hash_table);
+		exit (EXIT_FAILURE);
+	}
+	free (e);
+	
+	/* l'insieme degli utenti autorizzati e' ora fissato: se richiesto costruisco l'hash perfetto
+	 * minimo (se la costruzione non riesce si continua ad usare la tabella hash) */
+	if (use_mph == 1) {
+		user_mph = Build_mph ();
+		if (user_mph == NULL) {
+			perror ("Impossibile costruire l'hash perfetto minimo, uso la tabella hash");
+		}
+	}
+	clock_gettime (CLOCK_MONOTONIC, &t_end);
+	fprintf (stderr, "Caricati %u utenti autorizzati in %.1f ms (%d thread%s)\n", n,
+		(t_end.tv_sec - t_start.tv_sec) * 1e3 + (t_end.tv_nsec - t_start.tv_nsec) / 1e6,
+		n_loader, (user_mph != NULL) ? ", hash perfetto minimo" : "");
+	
+	/* la risposta ai login riusciti e' sempre la stessa: la codifico una volta sola */
+	msg.type = MSG_OK;
+	msg.buffer = NULL;
+	msg.length = 0;
+	ok_frame = newFrame (&msg);
+	if (ok_frame == NULL) {
+		perror ("Errore durante la creazione del messaggio di login");
+		free_userTable (&hash_table);
+		exit (EXIT_FAILURE);
+	}
 	
 	
 	/**************************************************************************************************/
@@ -457,14 +1140,14 @@ int main (int argc, char * argv [])
 	dp = opendir (DIRSOCK);
 	if ( dp == NULL && errno != ENOENT) { /* apertura della directory ha dato un errore diverso dall'errore di non esistenza */
 		perror ("Errore nell'apertura della directory ./tmp");
-		free_hashTable (&hash_table);
+		free_userTable (&hash_table);
 		exit (EXIT_FAILURE);
 	}
 	
 	if (dp == NULL && errno == ENOENT) { /* se la directory non esiste viene creata */
 		if ( mkdir (DIRSOCK, 0777) == -1 ) {
 			perror ("Errore durante la creazione della directory");
-			free_hashTable (&hash_table);
+			free_userTable (&hash_table);
 			exit (EXIT_FAILURE);
 		}
 	}
@@ -476,37 +1159,53 @@ int main (int argc, char * argv [])
 	skt = createServerChannel(SOCKNAME);
 	if (skt < 0) {
 		perror ("Errore durante la creazione della socket");
-		free_hashTable (&hash_table);
+		free_userTable (&hash_table);
 		rmdir (DIRSOCK);
 		exit (EXIT_FAILURE);
 	}
 	
-	/*****************************************************************************/
-	/** ==================== Creazione del buffer "to_write" ==================== */
-	/*****************************************************************************/
+	/*************************************************************************************/
+	/** ==================== Creazione della coda dei record di log ==================== */
+	/*************************************************************************************/
 	
-	to_write = calloc (NWRITE, sizeof (char));
-	if (to_write == NULL) {
-		perror ("Errore durante la creazione del buffer per la scrittura su file");
-		free_hashTable (&hash_table);
+	/* i thread accodano i record senza lock, il Writer li estrae e compone le righe del file di log.
+	 * Con -L ogni segmento (file_log.0, file_log.1, ...) ha la sua coda e il suo Writer */
+	log_shards = calloc (n_shards, sizeof (logshard_t));
+	writer = calloc (n_shards, sizeof (pthread_t));
+	if (log_shards == NULL || writer == NULL) {
+		perror ("Errore durante la creazione della coda per la scrittura su file");
+		free_userTable (&hash_table);
 		Close_skt (skt); /* aggiunto di recente */
 		rmdir (DIRSOCK);
 		exit (EXIT_FAILURE);
 	}
-	
-	
-	/******************************************************************************/
-	/** ==================== Creazione dell'array users_list ==================== */
-	/******************************************************************************/
-	
-	users_list = calloc ( n , sizeof (char) );
-	if (users_list == NULL) {
-		perror ("Errore durante la creazione del buffer per tener traccia degli utenti connessi");
-		free_hashTable (&hash_table);
-		Close_skt (skt); /* aggiunto di recente */
-		free (to_write);
-		rmdir (DIRSOCK);
-		exit (EXIT_FAILURE);
+	for (i = 0; i < n_shards; i++) {
+		log_shards [i].ring = new_logRing (NLOGRING);
+		log_shards [i].bytes = 0;
+		log_shards [i].stamped = split;
+		log_shards [i].out = (binary == 1) ? new_mlogOut (split | (log_compact << 1)) : NULL;
+		log_shards [i].members = (log_compact == 1 && (rot_bytes > 0 || rot_secs > 0));
+		log_shards [i].m_head = NO_USER;
+		log_shards [i].m_tail = NO_USER;
+		log_shards [i].file = malloc (strlen (file_log) + 16);
+		if (log_shards [i].ring == NULL || log_shards [i].file == NULL || (binary == 1 && log_shards [i].out == NULL) || sem_init (&(log_shards [i].sem), 0, 0) == -1) {
+			perror ("Errore durante la creazione della coda per la scrittura su file");
+			free_userTable (&hash_table);
+			Close_skt (skt);
+			rmdir (DIRSOCK);
+			exit (EXIT_FAILURE);
+		}
+		if (split == 1) {
+			sprintf (log_shards [i].file, "%s.%d", file_log, i);
+		} else {
+			strcpy (log_shards [i].file, file_log);
+		}
+		
+		/* log compatto con rotazione: i segmenti dell'esecuzione precedente restano accanto ai nuovi,
+		 * la numerazione dei broadcast riprende dall'ultima (le chiavi "seq:destinatario" restano univoche) */
+		if (log_shards [i].members == 1 && (last = Last_bcast (&(log_shards [i]))) > bcast_seq) {
+			bcast_seq = last;
+		}
 	}
 	
 	
@@ -517,32 +1216,109 @@ int main (int argc, char * argv [])
 	thread_list = new_List ( compare_pthread_t, copy_pthread_t, copy_string );
 	if (thread_list == NULL) {
 		perror ("Errore durante la creazione della lista dei thread");
-		free_hashTable (&hash_table);
+		free_userTable (&hash_table);
 		Close_skt (skt); /* aggiunto di recente */
 		rmdir (DIRSOCK);
 		exit (EXIT_FAILURE);
 	}
 	
+	/* il Flusher svuota le code di uscita quando le socket sono pronte in scrittura */
+	if ( pipe (flush_pipe) == -1 || fcntl (flush_pipe [0], F_SETFL, O_NONBLOCK) == -1 || 
+		fcntl (flush_pipe [1], F_SETFL, O_NONBLOCK) == -1 ) {
+		perror ("Errore durante la creazione della pipe del Flusher");
+		free_userTable (&hash_table);
+		Close_skt (skt);
+		free_List (&thread_list);
+		rmdir (DIRSOCK);
+		exit (EXIT_FAILURE);
+	}
+	if ( pthread_create (&flusher, NULL, Flusher, NULL) != 0) {
+		perror ("Errore durante la creazione del thread Flusher");
+		free_userTable (&hash_table);
+		Close_skt (skt);
+		free_List (&thread_list);
+		rmdir (DIRSOCK);
+		exit (EXIT_FAILURE);
+	}
+	
+	if (n_fanout > 0) { /* creazione delle code e dei thread Fanout */
+		fan_queues = calloc (n_fanout, sizeof (fanq_t));
+		if (fan_queues == NULL) {
+			perror ("Errore durante la creazione delle code dei thread Fanout");
+			free_userTable (&hash_table);
+			Close_skt (skt);
+			free_List (&thread_list);
+			rmdir (DIRSOCK);
+			exit (EXIT_FAILURE);
+		}
+		for (i = 0; i < n_fanout; i++) {
+			if (pthread_mutex_init (&(fan_queues [i].mtx), NULL) != 0 || 
+				pthread_cond_init (&(fan_queues [i].cond), NULL) != 0 || 
+				pthread_create (&fanout, NULL, Fanout, &(fan_queues [i])) != 0) {
+				perror ("Errore durante la creazione di un thread Fanout");
+				free_userTable (&hash_table);
+				Close_skt (skt);
+				free_List (&thread_list);
+				rmdir (DIRSOCK);
+				exit (EXIT_FAILURE);
+			}
+		}
+	}
+	
+	if (n_loop > 0) { /* creazione del descrittore epoll e degli event loop */
+		efd = epoll_create1 (0);
+		if (efd == -1) {
+			perror ("Errore durante la creazione del descrittore epoll");
+			free_userTable (&hash_table);
+			Close_skt (skt);
+			free_List (&thread_list);
+			rmdir (DIRSOCK);
+			exit (EXIT_FAILURE);
+		}
+		
+		for (i = 0; i < n_loop; i++) {
+			if ( pthread_create (&loop, NULL, Event_loop, NULL) != 0) {
+				perror ("Errore durante la creazione di un thread event loop");
+				free_userTable (&hash_table);
+				Close_skt (skt);
+				free_List (&thread_list);
+				rmdir (DIRSOCK);
+				exit (EXIT_FAILURE);
+			}
+		}
+	}
+	
 	if ( pthread_create (&disp, NULL, Dispatcher, &skt) != 0) {
 		perror ("Errore durante la creazione del thread dispatcher");
-		free_hashTable (&hash_table);
+		free_userTable (&hash_table);
 		Close_skt (skt); /* aggiunto di recente */
 		free_List (&thread_list);
 		rmdir (DIRSOCK);
 		exit (EXIT_FAILURE);
 	}
 	
-	if (pthread_create (&writer, NULL, Writer, argv [2]) != 0) {
-		perror ("Errore durante la creazione del thread writer");
-		free_hashTable (&hash_table);
+	/* l'Archiver indicizza, comprime ed elimina i segmenti chiusi dalla rotazione */
+	if ((rot_bytes > 0 || rot_secs > 0) && pthread_create (&archiver, NULL, Archiver, NULL) != 0) {
+		perror ("Errore durante la creazione del thread Archiver");
+		free_userTable (&hash_table);
 		Close_skt (skt);
 		rmdir (DIRSOCK);
 		exit (EXIT_FAILURE);
 	}
 	
-	if (pthread_create (&handler, NULL, Handler, NULL) != 0) {
+	for (i = 0; i < n_shards; i++) {
+		if (pthread_create (&(writer [i]), NULL, Writer, &(log_shards [i])) != 0) {
+			perror ("Errore durante la creazione del thread writer");
+			free_userTable (&hash_table);
+			Close_skt (skt);
+			rmdir (DIRSOCK);
+			exit (EXIT_FAILURE);
+		}
+	}
+	
+	if (pthread_create (&handler, NULL, Handler, file_usr) != 0) {
 		perror ("Errore durante la creazione del thread writer");
-		free_hashTable (&hash_table);
+		free_userTable (&hash_table);
 		Close_skt (skt);
 		rmdir (DIRSOCK);
 		exit (EXIT_FAILURE);
@@ -550,18 +1326,52 @@ int main (int argc, char * argv [])
 	
 	
 	pthread_join (handler, NULL);
-	pthread_join (writer, NULL);
+	for (i = 0; i < n_shards; i++) {
+		pthread_join (writer [i], NULL);
+	}
+	
+	/* segmenti chiusi che l'Archiver (gia' cancellato) non ha fatto in tempo a trattare */
+	Lock (&(log_closed.mtx));
+		closed = log_closed.head;
+		log_closed.head = NULL;
+		log_closed.tail = NULL;
+	Unlock (&(log_closed.mtx));
+	while (closed != NULL) {
+		next_closed = closed->next;
+		Archive_segment (closed);
+		closed = next_closed;
+	}
 	
 	/* mutua esclusione non necessaria, una volta arrivato qui oltre
 	 * al thread main non ci sono altri thread attivi che possono accedere alle
 	 * strutture dati globali 
 	 */
 	Destroy_hash (); 
+	Destroy_queues ();
 	free_List (&thread_list);
 	
-	free ( users_list );
-	free (to_write);
+	for (i = 0; i < n_shards; i++) {
+		free_logRing (&(log_shards [i].ring));
+		sem_destroy (&(log_shards [i].sem));
+		free (log_shards [i].file);
+		free_mlogOut (&(log_shards [i].out));
+		free (log_shards [i].m_prev);
+		free (log_shards [i].m_next);
+	}
+	free (log_shards);
+	free (writer);
 	Close_skt (skt);
+	if (efd != -1) {
+		close (efd);
+	}
+	close (flush_pipe [0]);
+	close (flush_pipe [1]);
+	free (flush_list);
+	free (fan_queues);
+	if (list_frame != NULL) {
+		releaseFrame (list_frame);
+	}
+	releaseFrame (ok_frame);
 	
 	unlink ( SOCKNAME );
 	rmdir (DIRSOCK);
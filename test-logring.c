@@ -0,0 +1,178 @@
+/**
+   \file test-logring.c
+   \author Marco Ponza
+   \brief  test della coda circolare dei record di log (logring)
+   Si dichiara che ogni singolo bit presente in questo file è solo ed esclusivamente "farina del sacco" del rispettivo autore :D
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <mcheck.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "logring.h"
+
+/** ========== Macro ========== */
+#define NCELLS 1000 /* celle richieste: arrotondate a 1024 */
+#define NPROD 4 /* thread produttori */
+#define NRECS 50000 /* record inseriti da ogni produttore */
+
+static logRing_t * ring;
+
+/** produttore: inserisce NRECS record numerati (nel campo dest), riprovando se la coda e' piena */
+static void * producer (void * arg) {
+	logRec_t rec;
+	unsigned int i;
+
+	memset (&rec, 0, sizeof (logRec_t));
+	rec.mit = (unsigned int) (long) arg;
+	for (i = 0; i < NRECS; i++) {
+		rec.dest = i;
+		while (put_logRing (ring, &rec) == -1) {
+			sched_yield ();
+		}
+	}
+
+	return NULL;
+}
+
+int main (void) {
+	logRec_t rec, out;
+	pthread_t th [NPROD];
+	unsigned long next [NPROD];
+	unsigned long i, size, got;
+	int r;
+
+	mtrace ();
+
+	memset (&rec, 0, sizeof (logRec_t));
+
+	/** ========== Creazione ========== */
+	ring = new_logRing (NCELLS);
+	assert (ring != NULL);
+	size = ring->mask + 1;
+	assert (size >= NCELLS && (size & (size - 1)) == 0);
+	assert (ring->room == (long) size);
+	r = get_logRing (ring, &out);
+	assert (r == -1);
+
+	/** ========== Inserimento ed estrazione in ordine ========== */
+	for (i = 0; i < size; i++) {
+		rec.mit = i;
+		rec.dest = i * 3;
+		r = put_logRing (ring, &rec);
+		assert (r == 0);
+	}
+
+	/* coda piena */
+	r = put_logRing (ring, &rec);
+	assert (r == -1);
+
+	for (i = 0; i < size; i++) {
+		r = get_logRing (ring, &out);
+		assert (r == 0);
+		assert (out.mit == i && out.dest == i * 3 && out.f == NULL);
+	}
+	r = get_logRing (ring, &out);
+	assert (r == -1);
+
+	/* piu' giri della coda, con estrazioni intercalate */
+	for (i = 0; i < 10 * size; i++) {
+		rec.mit = i;
+		r = put_logRing (ring, &rec);
+		assert (r == 0);
+		rec.mit = i + 1;
+		r = put_logRing (ring, &rec);
+		assert (r == 0);
+		r = get_logRing (ring, &out);
+		assert (r == 0 && out.mit == i);
+		r = get_logRing (ring, &out);
+		assert (r == 0 && out.mit == i + 1);
+	}
+
+	/** ========== Prenotazioni ========== */
+	for (i = 0; i < size; i++) {
+		r = reserve_logRing (ring);
+		assert (r == 0);
+	}
+	assert (ring->room == 0);
+	r = reserve_logRing (ring);
+	assert (r == -1);
+	r = put_logRing (ring, &rec);
+	assert (r == -1);
+
+	/* una prenotazione annullata torna disponibile */
+	unreserve_logRing (ring);
+	assert (ring->room == 1);
+	r = reserve_logRing (ring);
+	assert (r == 0);
+
+	/* le celle prenotate si riempiono senza mai fallire, nell'ordine di inserimento */
+	for (i = 0; i < size; i++) {
+		rec.mit = i;
+		putres_logRing (ring, &rec);
+	}
+	assert (ring->room == 0);
+	for (i = 0; i < size / 2; i++) {
+		r = get_logRing (ring, &out);
+		assert (r == 0 && out.mit == i);
+	}
+
+	/* l'estrazione rende le celle prenotabili */
+	assert (ring->room == (long) size / 2);
+	r = reserve_logRing (ring);
+	assert (r == 0);
+	rec.mit = size;
+	putres_logRing (ring, &rec);
+	for (i = size / 2; i <= size; i++) {
+		r = get_logRing (ring, &out);
+		assert (r == 0 && out.mit == i);
+	}
+	r = get_logRing (ring, &out);
+	assert (r == -1);
+	assert (ring->room == (long) size);
+
+	free_logRing (&ring);
+	assert (ring == NULL);
+	free_logRing (&ring);
+
+	/* la dimensione minima e' 2 */
+	ring = new_logRing (0);
+	assert (ring != NULL && ring->mask == 1);
+	free_logRing (&ring);
+
+	muntrace ();
+
+	/** ========== Piu' produttori, un consumatore ========== */
+	/* fuori da mtrace: la libreria dei thread tiene le sue allocazioni fino all'uscita */
+	ring = new_logRing (NCELLS);
+	assert (ring != NULL);
+	for (i = 0; i < NPROD; i++) {
+		next [i] = 0;
+		r = pthread_create (&th [i], NULL, producer, (void *) (long) i);
+		assert (r == 0);
+	}
+	for (got = 0; got < NPROD * NRECS; ) {
+		if (get_logRing (ring, &out) == -1) {
+			sched_yield ();
+			continue;
+		}
+		/* i record di ogni produttore arrivano nell'ordine in cui li ha inseriti */
+		assert (out.mit < NPROD && out.dest == next [out.mit]);
+		next [out.mit]++;
+		got++;
+	}
+	for (i = 0; i < NPROD; i++) {
+		r = pthread_join (th [i], NULL);
+		assert (r == 0 && next [i] == NRECS);
+	}
+	r = get_logRing (ring, &out);
+	assert (r == -1);
+	free_logRing (&ring);
+
+	return 0;
+}
@@ -0,0 +1,251 @@
+/**
+   \file test-msgidx.c
+   \author Marco Ponza
+   \brief  test dell'indice invertito delle parole dei messaggi (msgidx)
+   Si dichiara che ogni singolo bit presente in questo file è solo ed esclusivamente "farina del sacco" del rispettivo autore :D
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <mcheck.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "msgidx.h"
+
+/** ========== Macro ========== */
+#define SEGMENT "./.test-msgidx.log" /* segmento scritto dal test */
+#define NRECS 5000 /* record di log del segmento */
+#define NUSERS 10 /* utenti dei record */
+#define NGAPS 12 /* salti tra le posizioni della prova delle liste */
+#define MAXSPAN (6ULL << 30) /* spazio di indirizzi per i salti (non viene mai toccato tutto) */
+
+/** segmento scritto dal test: i record di log bastano all'indice, il dizionario resta vuoto */
+static FILE * seg;
+static mlogOut_t * out;
+
+/** accoda un record al segmento (testo e riempimento fino a 8 byte) */
+static void append (unsigned int type, unsigned int mit, unsigned int dest, char * text, size_t len) {
+	static char zero [8];
+	mlogHdr_t h;
+	size_t n;
+	int pad;
+
+	pad = rec_mlogOut (out, &h, type, mit, dest, 0, 0, 0, len);
+	assert (pad >= 0);
+	n = fwrite (&h, sizeof (mlogHdr_t), 1, seg);
+	assert (n == 1);
+	n = fwrite (text, len, 1, seg);
+	assert (n == 1 || len == 0);
+	n = fwrite (zero, pad, 1, seg);
+	assert (n == 1 || pad == 0);
+}
+
+/** byte della codifica varint di un numero */
+static size_t varint_len (unsigned int d) {
+	size_t n = 1;
+
+	while (d >= 0x80) {
+		d >>= 7;
+		n++;
+	}
+
+	return n;
+}
+
+/** controlla la lista di una parola: le posizioni sono quelle dei record attesi, in ordine */
+static void check_term (sidx_t * x, mlog_t * l, char * term, unsigned int n, int (* match) (unsigned int)) {
+	sidxTerm_t * t;
+	sidxIter_t it;
+	mlogHdr_t * h;
+	unsigned int pos, i, k = 0;
+	int r;
+
+	t = find_msgidx (x, term);
+	assert (t != NULL && t->n_post == n);
+	assert (strcmp (x->map + t->term, term) == 0);
+	iter_msgidx (x, t, &it);
+	for (i = 0, h = first_mlog (l, 0); h != NULL; h = next_mlog (l, h)) {
+		if (h->type != LREC_MSG) {
+			continue;
+		}
+		if (match (i++)) {
+			r = next_msgidx (&it, &pos);
+			assert (r == 1 && pos == ((char *) h - l->map) / 8);
+			k++;
+		}
+	}
+	assert (k == n);
+	r = next_msgidx (&it, &pos);
+	assert (r == 0);
+	assert (it.p == (unsigned char *) x->map + t->post + t->len);
+}
+
+static int all (unsigned int i) { return 1; }
+static int even (unsigned int i) { return i % 2 == 0; }
+static int odd (unsigned int i) { return i % 2 == 1; }
+static int tenth (unsigned int i) { return i % 10 == 0; }
+
+/** controlla che una parola compaia in n record (0: parola assente) */
+static void check_count (sidx_t * x, char * term, unsigned int n) {
+	sidxTerm_t * t;
+
+	t = find_msgidx (x, term);
+	assert ((n == 0) ? (t == NULL) : (t != NULL && t->n_post == n));
+}
+
+int main (void) {
+	mlogHead_t head;
+	mlogTail_t tail;
+	mlogHdr_t * h;
+	mlog_t * l;
+	sidx_t * x;
+	sidx_t * y;
+	sidxIter_t it;
+	sidxTerm_t * t;
+	char term [NTERM];
+	char text [256];
+	char * p;
+	unsigned int i, pos, expect [NGAPS + 1];
+	size_t off, enc, n;
+	int r, built = 0;
+	/* salti (in unita' da 8 byte) la cui differenza occupa da 1 a 5 byte di varint */
+	unsigned long long gap [NGAPS] = { 7, 127, 128, 1000, 16383, 16384, 100000, 2097151, 2097152,
+	                                   30000000, 268435455, 268435456 };
+	/* parole attese nel testo di prova */
+	char * words [] = { "ciao", "mondo", "x2y", "z", "perch\xc3\xa9" };
+
+	mtrace ();
+
+	/** ========== Parole ========== */
+	strcpy (text, "  Ciao, MONDO!! x2Y__z perch\xc3\xa9 ");
+	p = text;
+	for (i = 0; i < sizeof (words) / sizeof (char *); i++) {
+		r = token_msgidx (&p, text + strlen (text), term);
+		assert (r == strlen (words [i]) && strcmp (term, words [i]) == 0);
+	}
+	r = token_msgidx (&p, text + strlen (text), term);
+	assert (r == 0 && term [0] == '\0');
+
+	/* parola troncata a NTERM - 1 byte */
+	memset (text, 'A', 200);
+	p = text;
+	r = token_msgidx (&p, text + 200, term);
+	assert (r == NTERM - 1 && p == text + 200);
+	assert (strlen (term) == NTERM - 1 && term [0] == 'a');
+
+	/** ========== Indice di un segmento ========== */
+	out = new_mlogOut (0);
+	assert (out != NULL);
+	seg = fopen (SEGMENT, "w");
+	assert (seg != NULL);
+	n = head_mlogOut (out, &head);
+	n = fwrite (&head, n, 1, seg);
+	assert (n == 1);
+	for (i = 0; i < NRECS; i++) {
+		sprintf (text, "Tutti, %s: r%u TUTTI%s", (i % 2 == 0) ? "pari" : "dispari", i, (i % 10 == 0) ? " decimo" : "");
+		append (LREC_MSG, i % NUSERS, (i + 1) % NUSERS, text, strlen (text));
+		if (i == NRECS / 2) { /* solo i messaggi e i broadcast vengono indicizzati */
+			append (LREC_JOIN, 0, 0, "nascosto", 8);
+			append (LREC_BCAST, 1, 0, "annuncio", 8);
+		}
+	}
+
+	/* coda del segmento chiuso: dizionario (vuoto), indice sparso */
+	tail.names = out->off;
+	memcpy (tail.magic, MLOG_TMAGIC, sizeof (tail.magic));
+	append (MLOG_NAMES, 0, 0, NULL, 0);
+	append (MLOG_INDEX, 0, 0, (char *) out->idx, out->n_idx * sizeof (mlogIdx_t));
+	n = fwrite (&tail, sizeof (mlogTail_t), 1, seg);
+	assert (n == 1);
+	r = fclose (seg);
+	assert (r == 0);
+	free_mlogOut (&out);
+
+	l = open_mlog (SEGMENT);
+	assert (l != NULL && l->own_idx == 0);
+	unlink (SEGMENT ".sidx");
+
+	/* il primo caricamento costruisce e scrive l'indice, il secondo lo mappa */
+	x = load_msgidx (SEGMENT, l, &built);
+	assert (x != NULL && x->mapped == 0 && built == 1);
+	y = load_msgidx (SEGMENT, l, &built);
+	assert (y != NULL && y->mapped == 1 && built == 1);
+	assert (y->size == x->size && memcmp (y->map, x->map, x->size) == 0);
+	free_msgidx (&y);
+	assert (y == NULL);
+	r = index_msgidx (SEGMENT);
+	assert (r == 0);
+
+	/* parole: r0..., tutti, pari, dispari, decimo, annuncio */
+	assert (x->head->n_docs == NRECS + 1);
+	assert (x->head->h.n == NRECS + 5);
+	for (i = 1; i < x->head->h.n; i++) {
+		assert (strcmp (x->map + x->terms [i - 1].term, x->map + x->terms [i].term) < 0);
+	}
+
+	/* una parola ripetuta nello stesso messaggio compare una volta sola */
+	check_term (x, l, "tutti", NRECS, all);
+	check_term (x, l, "pari", NRECS / 2, even);
+	check_term (x, l, "dispari", NRECS / 2, odd);
+	check_term (x, l, "decimo", NRECS / 10, tenth);
+	check_count (x, "annuncio", 1);
+	check_count (x, "r4999", 1);
+	check_count (x, "nascosto", 0);
+	check_count (x, "Tutti", 0);
+	check_count (x, "", 0);
+	check_count (x, "zzz", 0);
+	free_msgidx (&x);
+	close_mlog (&l);
+	unlink (SEGMENT ".sidx");
+	unlink (SEGMENT);
+
+	/** ========== Codifica delle liste (varint) ========== */
+	/* segmento in memoria con record lontani: i salti sono record non indicizzati lunghi quanto
+	 * la distanza, le pagine in mezzo non vengono mai toccate */
+	l = calloc (1, sizeof (mlog_t));
+	assert (l != NULL);
+	l->size = MAXSPAN;
+	l->map = mmap (NULL, l->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	assert (l->map != MAP_FAILED);
+	memcpy (((mlogHead_t *) l->map)->magic, MLOG_MAGIC, 8);
+	off = sizeof (mlogHead_t);
+	for (i = 0, enc = 0; i <= NGAPS; i++) {
+		h = (mlogHdr_t *) (l->map + off);
+		h->type = LREC_MSG;
+		h->len = sizeof (mlogHdr_t) + 5;
+		memcpy (TEXT_MLOG (h), "varia", 5);
+		expect [i] = off / 8;
+		enc += varint_len ((i == 0) ? expect [i] : expect [i] - expect [i - 1]);
+		off += MLOG_ALIGN (h->len);
+		if (i < NGAPS && gap [i] > 7) { /* 7: record consecutivi */
+			h = (mlogHdr_t *) (l->map + off);
+			h->type = LREC_LEAVE;
+			h->len = gap [i] * 8 - MLOG_ALIGN (sizeof (mlogHdr_t) + 5);
+			off += MLOG_ALIGN (h->len);
+		}
+	}
+	assert (off <= l->size);
+	l->end = off;
+
+	x = build_msgidx (l);
+	assert (x != NULL && x->head->h.n == 1 && x->head->n_docs == NGAPS + 1);
+	t = find_msgidx (x, "varia");
+	assert (t == &(x->terms [0]) && t->n_post == NGAPS + 1 && t->len == enc);
+	iter_msgidx (x, t, &it);
+	for (i = 0; i <= NGAPS; i++) {
+		r = next_msgidx (&it, &pos);
+		assert (r == 1 && pos == expect [i]);
+	}
+	r = next_msgidx (&it, &pos);
+	assert (r == 0);
+	free_msgidx (&x);
+	close_mlog (&l);
+
+	muntrace ();
+
+	return 0;
+}
@@ -0,0 +1,250 @@
+/**
+   \file test-msglog.c
+   \author Marco Ponza
+   \brief  test del formato binario dei segmenti del file di log e del lettore (msglog)
+   Si dichiara che ogni singolo bit presente in questo file è solo ed esclusivamente "farina del sacco" del rispettivo autore :D
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <mcheck.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "msglog.h"
+
+/** ========== Macro ========== */
+#define SEGMENT "./.test-msglog.log" /* segmento scritto dal test */
+#define NRECS 20000 /* record di log: il segmento supera piu' volte MLOG_STRIDE */
+#define NUSERS 100 /* utenti dei record */
+#define T0 1000 /* istante del primo record */
+
+/** username di un id: lettere al posto delle cifre decimali ("a" per 0, "bc" per 12) */
+static void user_name (unsigned int id, char * name) {
+	int n;
+
+	n = sprintf (name, "%u", id);
+	while (n-- > 0) {
+		name [n] += 'a' - '0';
+	}
+}
+
+/** scrive un record (preceduto dal record MLOG_USER se l'utente non e' ancora nel segmento) */
+static void put_rec (FILE * fp, mlogOut_t * o, unsigned int type, unsigned int mit, unsigned int dest,
+                     unsigned long long time, char * text, size_t len) {
+	static char zero [8];
+	char name [16];
+	mlogHdr_t h;
+	size_t n;
+	int pad;
+
+	if (type < MLOG_USER && known_mlogOut (o, mit) == 0) {
+		user_name (mit, name);
+		put_rec (fp, o, MLOG_USER, mit, mit, time, name, strlen (name));
+	}
+	if (type == LREC_MSG && known_mlogOut (o, dest) == 0) {
+		user_name (dest, name);
+		put_rec (fp, o, MLOG_USER, dest, dest, time, name, strlen (name));
+	}
+	pad = rec_mlogOut (o, &h, type, mit, dest, 0, 0, time, len);
+	assert (pad >= 0 && pad < 8);
+	n = fwrite (&h, sizeof (mlogHdr_t), 1, fp);
+	assert (n == 1);
+	if (len > 0) {
+		n = fwrite (text, len, 1, fp);
+		assert (n == 1);
+	}
+	if (pad > 0) {
+		n = fwrite (zero, pad, 1, fp);
+		assert (n == 1);
+	}
+}
+
+/** controlla tutti i record di un segmento aperto */
+static void check_segment (mlog_t * l) {
+	mlogHdr_t * h;
+	char text [32];
+	char name [16];
+	char * s;
+	unsigned int i;
+
+	for (i = 0, h = first_mlog (l, 0); h != NULL; h = next_mlog (l, h), i++) {
+		assert (i < NRECS);
+		assert (h->type == LREC_MSG && h->time == T0 + i);
+		assert (h->mit == i % NUSERS && h->dest == (i * 7 + 3) % NUSERS);
+		sprintf (text, "messaggio %u", i);
+		assert (TLEN_MLOG (h) == strlen (text) && memcmp (TEXT_MLOG (h), text, TLEN_MLOG (h)) == 0);
+		assert (((char *) h - l->map) % 8 == 0);
+	}
+	assert (i == NRECS);
+
+	for (i = 0; i < NUSERS; i++) {
+		user_name (i, name);
+		s = name_mlog (l, i);
+		assert (s != NULL && strcmp (s, name) == 0);
+	}
+	s = name_mlog (l, NUSERS);
+	assert (s == NULL);
+	s = name_mlog (l, 1 << 30);
+	assert (s == NULL);
+
+	/* l'indice sparso ha una voce ogni MLOG_STRIDE byte */
+	assert (l->n_idx == (l->end - 1) / MLOG_STRIDE + 1);
+
+	/* ricerca per istante: il record trovato non e' successivo all'istante */
+	for (i = 0; i < NRECS; i += 997) {
+		h = first_mlog (l, T0 + i);
+		assert (h != NULL && h->time == T0 + i);
+	}
+	h = first_mlog (l, T0 + NRECS);
+	assert (h == NULL);
+}
+
+int main (void) {
+	mlogOut_t * o;
+	mlogHead_t head;
+	mlogTail_t tail;
+	mlogIdxHead_t * ih;
+	char * map;
+	size_t size;
+	mlog_t * l;
+	FILE * fp;
+	char * names;
+	char text [32];
+	unsigned int i;
+	size_t len, tot, n;
+	int r;
+	char * seg [] = { "log.10", "log", "altro.1", "log.2", "log.1", "altro" };
+
+	mtrace ();
+
+	/** ========== Segmento non chiuso ========== */
+	o = new_mlogOut (0);
+	assert (o != NULL);
+	fp = fopen (SEGMENT, "w");
+	assert (fp != NULL);
+	len = head_mlogOut (o, &head);
+	assert (len == sizeof (mlogHead_t) && o->off == len);
+	n = fwrite (&head, len, 1, fp);
+	assert (n == 1);
+	for (i = 0; i < NRECS; i++) {
+		sprintf (text, "messaggio %u", i);
+		put_rec (fp, o, LREC_MSG, i % NUSERS, (i * 7 + 3) % NUSERS, T0 + i, text, strlen (text));
+	}
+	assert (o->n_ids == NUSERS);
+	r = fflush (fp);
+	assert (r == 0 && (unsigned long long) ftell (fp) == o->off);
+
+	/* senza coda: dizionario e indice ricostruiti con una scansione */
+	l = open_mlog (SEGMENT);
+	assert (l != NULL);
+	assert (l->own_idx == 1 && l->end == o->off && l->n_idx == o->n_idx);
+	check_segment (l);
+	close_mlog (&l);
+	assert (l == NULL);
+
+	/* un record incompleto in fondo (server terminato durante una scrittura) viene ignorato */
+	n = fwrite (&head, sizeof (mlogHead_t), 1, fp);
+	r = fflush (fp);
+	assert (n == 1 && r == 0);
+	l = open_mlog (SEGMENT);
+	assert (l != NULL && l->end == o->off);
+	check_segment (l);
+	close_mlog (&l);
+	r = ftruncate (fileno (fp), o->off);
+	assert (r == 0);
+	r = fseek (fp, o->off, SEEK_SET);
+	assert (r == 0);
+
+	/** ========== Segmento chiuso ========== */
+	/* dizionario: coppie (id, username con '\0') */
+	names = malloc (o->n_ids * 16);
+	assert (names != NULL);
+	for (i = 0, tot = 0; i < o->n_ids; i++) {
+		memcpy (names + tot, &(o->ids [i]), sizeof (unsigned int));
+		tot += sizeof (unsigned int);
+		user_name (o->ids [i], names + tot);
+		tot += strlen (names + tot) + 1;
+	}
+	tail.names = o->off;
+	memcpy (tail.magic, MLOG_TMAGIC, sizeof (tail.magic));
+	put_rec (fp, o, MLOG_NAMES, 0, 0, 0, names, tot);
+	put_rec (fp, o, MLOG_INDEX, 0, 0, 0, (char *) o->idx, o->n_idx * sizeof (mlogIdx_t));
+	n = fwrite (&tail, sizeof (mlogTail_t), 1, fp);
+	assert (n == 1);
+	r = fclose (fp);
+	assert (r == 0);
+	free (names);
+
+	l = open_mlog (SEGMENT);
+	assert (l != NULL);
+	assert (l->own_idx == 0 && l->end == tail.names && l->n_idx == o->n_idx);
+	r = memcmp (l->idx, o->idx, o->n_idx * sizeof (mlogIdx_t));
+	assert (r == 0);
+	check_segment (l);
+
+	/** ========== Indici dei segmenti ========== */
+	ih = calloc (1, sizeof (mlogIdxHead_t) + 8);
+	assert (ih != NULL);
+	headidx_mlog (ih, "TESTIDX1", 3, l);
+	ih->n = 1;
+	memcpy (ih + 1, "contenut", 8);
+	r = saveidx_mlog (SEGMENT, "tidx", (char *) ih, sizeof (mlogIdxHead_t) + 8);
+	assert (r == 0);
+
+	map = mapidx_mlog (SEGMENT, "tidx", "TESTIDX1", 3, l, &size);
+	assert (map != NULL && size == sizeof (mlogIdxHead_t) + 8);
+	r = memcmp (map, ih, size);
+	assert (r == 0);
+	munmap (map, size);
+
+	/* intestazione o versione diverse, indice mancante */
+	map = mapidx_mlog (SEGMENT, "tidx", "TESTIDX2", 3, l, &size);
+	assert (map == NULL);
+	map = mapidx_mlog (SEGMENT, "tidx", "TESTIDX1", 4, l, &size);
+	assert (map == NULL);
+	map = mapidx_mlog (SEGMENT, "nidx", "TESTIDX1", 3, l, &size);
+	assert (map == NULL);
+
+	/* un segmento modificato non corrisponde piu' all'indice */
+	l->size--;
+	map = mapidx_mlog (SEGMENT, "tidx", "TESTIDX1", 3, l, &size);
+	assert (map == NULL);
+	l->size++;
+	l->mtime++;
+	map = mapidx_mlog (SEGMENT, "tidx", "TESTIDX1", 3, l, &size);
+	assert (map == NULL);
+	l->mtime--;
+	free (ih);
+	unlink (SEGMENT ".tidx");
+	close_mlog (&l);
+	close_mlog (&l);
+
+	/* un file che non e' un segmento */
+	fp = fopen (SEGMENT, "w");
+	assert (fp != NULL);
+	fprintf (fp, "anna:bruno:ciao\n");
+	r = fclose (fp);
+	assert (r == 0);
+	errno = 0;
+	l = open_mlog (SEGMENT);
+	assert (l == NULL && errno == EINVAL);
+	unlink (SEGMENT);
+	l = open_mlog (SEGMENT);
+	assert (l == NULL && errno == ENOENT);
+	free_mlogOut (&o);
+	assert (o == NULL);
+
+	/** ========== Ordine dei segmenti di rotazione ========== */
+	sort_mlog (seg, sizeof (seg) / sizeof (char *));
+	assert (strcmp (seg [0], "altro.1") == 0 && strcmp (seg [1], "altro") == 0);
+	assert (strcmp (seg [2], "log.1") == 0 && strcmp (seg [3], "log.2") == 0);
+	assert (strcmp (seg [4], "log.10") == 0 && strcmp (seg [5], "log") == 0);
+
+	muntrace ();
+
+	return 0;
+}
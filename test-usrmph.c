@@ -0,0 +1,133 @@
+/**
+   \file test-usrmph.c
+   \author Marco Ponza
+   \brief  test dell'hash perfetto minimo degli utenti autorizzati (usrmph)
+   Si dichiara che ogni singolo bit presente in questo file è solo ed esclusivamente "farina del sacco" del rispettivo autore :D
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <mcheck.h>
+
+#include "usrmph.h"
+
+/** ========== Macro ========== */
+#define NUSERS 3000 /* righe del file degli utenti */
+#define NLINE 24 /* lunghezza massima di una riga (compreso '\n') */
+
+int main (void) {
+	userMph_t * t;
+	char * file;
+	char * s;
+	char ** keys;
+	void ** payloads;
+	unsigned char * used;
+	char miss [NLINE];
+	char * key;
+	unsigned int i, j, seed = 1, len = 0;
+	int id [NUSERS];
+
+	mtrace ();
+
+	/* file degli utenti in memoria, come lo mappa il server: una riga per utente
+	 * (lettere pseudo-casuali seguite dal numero della riga, quindi tutte distinte) */
+	file = malloc (NUSERS * NLINE + 1);
+	keys = malloc (NUSERS * sizeof (char *));
+	payloads = malloc (NUSERS * sizeof (void *));
+	used = calloc (NUSERS, 1);
+	assert (file != NULL && keys != NULL && payloads != NULL && used != NULL);
+	for (i = 0; i < NUSERS; i++) {
+		seed = seed * 1103515245 + 12345;
+		for (j = 0; j < (seed >> 16) % 8; j++) {
+			file [len++] = 'a' + (seed >> (j + 3)) % 26;
+		}
+		len += sprintf (file + len, "%u\n", i);
+	}
+
+	/* le chiavi puntano alle righe del file, terminate al posto di '\n' */
+	for (i = 0, s = file; i < NUSERS; i++, s++) {
+		keys [i] = s;
+		s = strchr (s, '\n');
+		*s = '\0';
+		id [i] = i;
+		payloads [i] = &id [i];
+	}
+
+	/** ========== Costruzione e ricerca ========== */
+	t = new_userMph (keys, payloads, NUSERS);
+	assert (t != NULL && t->n == NUSERS);
+	for (i = 0; i < NUSERS; i++) {
+		key = find_userMph (t, keys [i]);
+		assert (key == (char *) &id [i]);
+	}
+
+	/* minimo: ogni cella contiene una chiave diversa, nessuna cella resta vuota */
+	for (i = 0; i < NUSERS; i++) {
+		assert (t->table [i].key != NULL);
+		j = *(int *) t->table [i].payload;
+		assert (j < NUSERS && used [j] == 0);
+		used [j] = 1;
+	}
+
+	/* chiavi fuori dall'insieme: numeri di riga senza le loro lettere e prefissi delle chiavi */
+	for (i = 0; i < NUSERS; i++) {
+		sprintf (miss, "%u", i);
+		if (strcmp (miss, keys [i]) != 0) {
+			key = find_userMph (t, miss);
+			assert (key == NULL);
+		}
+		if (strlen (keys [i]) > 1) {
+			strcpy (miss, keys [i]);
+			miss [strlen (miss) - 1] = '\0';
+			key = find_userMph (t, miss);
+			assert (key == NULL || strcmp (miss, keys [*(int *) key]) == 0);
+		}
+	}
+	key = find_userMph (t, "");
+	assert (key == NULL);
+	key = find_userMph (t, NULL);
+	assert (key == NULL);
+	free_userMph (&t);
+	assert (t == NULL);
+
+	/** ========== Casi limite ========== */
+	/* insieme vuoto: nessuna chiave viene trovata */
+	t = new_userMph (NULL, NULL, 0);
+	assert (t != NULL);
+	key = find_userMph (t, keys [0]);
+	assert (key == NULL);
+	free_userMph (&t);
+
+	/* una sola chiave */
+	t = new_userMph (keys + 7, payloads + 7, 1);
+	assert (t != NULL);
+	key = find_userMph (t, keys [7]);
+	assert (key == (char *) &id [7]);
+	key = find_userMph (t, keys [8]);
+	assert (key == NULL);
+	free_userMph (&t);
+
+	/* la stessa chiave due volte: la costruzione non puo' riuscire */
+	key = keys [1];
+	keys [1] = keys [0];
+	t = new_userMph (keys, payloads, 2);
+	assert (t == NULL);
+	keys [1] = key;
+
+	/* argomenti non validi */
+	errno = 0;
+	t = new_userMph (NULL, NULL, 10);
+	assert (t == NULL && errno == EINVAL);
+
+	free (file);
+	free (keys);
+	free (payloads);
+	free (used);
+
+	muntrace ();
+
+	return 0;
+}
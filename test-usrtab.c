@@ -0,0 +1,153 @@
+/**
+   \file test-usrtab.c
+   \author Marco Ponza
+   \brief  test della tabella degli utenti ad indirizzamento aperto (usrtab)
+   Si dichiara che ogni singolo bit presente in questo file è solo ed esclusivamente "farina del sacco" del rispettivo autore :D
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <mcheck.h>
+
+#include "usrtab.h"
+
+/** ========== Macro ========== */
+#define NELEM 20000 /* elementi inseriti: la tabella viene espansa piu' volte */
+#define NLEN 8 /* lunghezza massima di una chiave (compreso '\0') */
+
+/** scrive la chiave numero i: "a", ..., "z", "ba", ..., "zz", "baa", ...
+ *  (chiavi corte che differiscono di un solo carattere)
+ */
+static void make_key (unsigned int i, char * key) {
+	char rev [NLEN];
+	int n = 0, j;
+
+	do {
+		rev [n++] = 'a' + i % 26;
+		i /= 26;
+	} while (i > 0);
+	for (j = 0; j < n; j++) {
+		key [j] = rev [n - 1 - j];
+	}
+	key [n] = '\0';
+}
+
+int main (void) {
+	userTable_t * t;
+	userElem_t * e;
+	char (* keys) [NLEN];
+	unsigned int i, h;
+	int r, payload [NELEM];
+	void * p;
+
+	mtrace ();
+
+	keys = malloc (NELEM * NLEN);
+	assert (keys != NULL);
+	for (i = 0; i < NELEM; i++) {
+		make_key (i, keys [i]);
+		payload [i] = i;
+	}
+
+	/* l'hash non e' mai 0 (cella vuota) ed e' una funzione della sola chiave */
+	h = hash_user ("");
+	assert (h != 0);
+	h = hash_user ("ba");
+	assert (h == hash_user (keys [26]));
+
+	/** ========== Inserimento singolo con espansione ========== */
+	t = new_userTable (0);
+	assert (t != NULL);
+	p = find_userElement (t, "a");
+	assert (p == NULL);
+	for (i = 0; i < NELEM; i++) {
+		r = add_userElement (t, keys [i], &payload [i]);
+		assert (r == 0);
+	}
+	assert (t->n == NELEM);
+	assert (t->size >= NELEM && (t->size & (t->size - 1)) == 0);
+
+	/* chiave gia' presente: il payload resta quello inserito per primo */
+	errno = 0;
+	r = add_userElement (t, "zz", &payload [0]);
+	assert (r == -1 && errno == EEXIST);
+	p = find_userElement (t, "zz");
+	assert (p == &payload [26 * 26 - 1]);
+
+	for (i = 0; i < NELEM; i++) {
+		p = find_userElement (t, keys [i]);
+		assert (p == &payload [i]);
+	}
+	p = find_userElement (t, "");
+	assert (p == NULL);
+	p = find_userElement (t, "A");
+	assert (p == NULL);
+	p = find_userElement (t, "zzzzzz");
+	assert (p == NULL);
+
+	/** ========== Rimozione (senza lapidi) ========== */
+	for (i = 0; i < NELEM; i += 2) {
+		p = remove_userElement (t, keys [i]);
+		assert (p == &payload [i]);
+	}
+	p = remove_userElement (t, keys [0]);
+	assert (p == NULL);
+	assert (t->n == NELEM / 2);
+	for (i = 0; i < NELEM; i++) {
+		p = find_userElement (t, keys [i]);
+		assert (p == ((i % 2 == 0) ? NULL : &payload [i]));
+	}
+
+	/* le chiavi rimosse possono essere reinserite */
+	for (i = 0; i < NELEM; i += 2) {
+		r = add_userElement (t, keys [i], &payload [i]);
+		assert (r == 0);
+	}
+	for (i = 0; i < NELEM; i++) {
+		p = find_userElement (t, keys [i]);
+		assert (p == &payload [i]);
+	}
+	free_userTable (&t);
+	assert (t == NULL);
+
+	/** ========== Caricamento in blocco ========== */
+	e = malloc (NELEM * sizeof (userElem_t));
+	assert (e != NULL);
+	for (i = 0; i < NELEM; i++) {
+		e [i].hash = hash_user (keys [i]);
+		e [i].key = keys [i];
+		e [i].payload = &payload [i];
+	}
+	t = new_userTable (NELEM);
+	assert (t != NULL);
+	r = add_userElements (t, e, NELEM);
+	assert (r == 0 && t->n == NELEM);
+	for (i = 0; i < NELEM; i++) {
+		p = find_userElement (t, keys [i]);
+		assert (p == &payload [i]);
+	}
+
+	/* una chiave duplicata ferma il caricamento */
+	errno = 0;
+	r = add_userElements (t, e + 10, 1);
+	assert (r == -1 && errno == EEXIST);
+	free_userTable (&t);
+	free (e);
+
+	/* argomenti non validi */
+	errno = 0;
+	r = add_userElement (NULL, "a", NULL);
+	assert (r == -1 && errno == EINVAL);
+	p = find_userElement (NULL, "a");
+	assert (p == NULL);
+	free_userTable (&t);
+
+	free (keys);
+
+	muntrace ();
+
+	return 0;
+}
@@ -0,0 +1,258 @@
+/**
+   \file usrmph.c
+   \author Marco Ponza
+   \brief  hash perfetto minimo (CHD, hash and displace) per l'insieme statico degli utenti autorizzati
+   Si dichiara che ogni singolo bit presente in questo file è solo ed esclusivamente "farina del sacco" del rispettivo autore :D
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "usrmph.h"
+
+#define LAMBDA 4 /* numero medio di chiavi per gruppo */
+#define NSEED 16 /* tentativi di costruzione (con semi diversi) prima di rinunciare */
+#define NDISP 32 /* spostamenti provati per ogni gruppo (in multipli del numero di chiavi) */
+
+/** funzione hash a 64 bit con seme (FNV-1a seguito dal finalizzatore di MurmurHash3)
+ *  \param key chiave
+ *  \param seed seme
+ *
+ *  \retval h valore hash della chiave
+ */
+static unsigned long long hash_mph (char * key, unsigned long long seed)
+{
+	unsigned long long h = 14695981039346656037ULL ^ seed;
+
+	for (; *key != '\0'; key++) {
+		h ^= (unsigned char) *key;
+		h *= 1099511628211ULL;
+	}
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+
+	return h;
+}
+
+/** riduce x (32 bit) all'intervallo [0, n) con una moltiplicazione invece di una divisione */
+#define RANGE(x, n) ( (unsigned int) (((unsigned long long) (x) * (n)) >> 32) )
+
+/** gruppo della chiave con hash h */
+#define BUCKET(h, nb) RANGE ((h) >> 32, nb)
+
+/** cella della chiave con hash h nel gruppo con spostamento d
+ *  (finalizzatore a 32 bit di MurmurHash3 applicato alla parte bassa dell'hash perturbata da d)
+ */
+static unsigned int pos_mph (unsigned long long h, unsigned int d, unsigned int n)
+{
+	unsigned int x = (unsigned int) h ^ (d * 0x9E3779B9U);
+
+	x ^= x >> 16;
+	x *= 0x85ebca6bU;
+	x ^= x >> 13;
+	x *= 0xc2b2ae35U;
+	x ^= x >> 16;
+
+	return RANGE (x, n);
+}
+
+/** prova a costruire la tabella con il seme t->seed (t->table, t->disp gia' allocati e azzerati)
+ *
+ *  \retval 0 se la costruzione e' riuscita
+ *  \retval -1 se un gruppo non trova celle libere (si riprova con un altro seme)
+ *  \retval -2 in caso di errore di allocazione (setta errno)
+ */
+static int build (userMph_t * t, char ** keys, void ** payloads, unsigned long long * h)
+{
+	unsigned int n = t->n, nb = t->nbucket, i, j, b, s, x, y, maxs;
+	int ret;
+	unsigned int * cnt, * start, * idx, * order, * pos;
+	unsigned long long k, maxk;
+	char * used;
+
+	if (n == 0) { /* insieme vuoto: ogni ricerca fallisce */
+		return 0;
+	}
+
+	cnt = calloc (nb + 1, sizeof (unsigned int));
+	start = calloc (nb + 1, sizeof (unsigned int));
+	idx = malloc (n * sizeof (unsigned int));
+	order = malloc (nb * sizeof (unsigned int));
+	used = calloc (n, sizeof (char));
+	if (cnt == NULL || start == NULL || idx == NULL || order == NULL || used == NULL) {
+		free (cnt); free (start); free (idx); free (order); free (used);
+		return -2;
+	}
+
+	/* chiavi ordinate per gruppo (counting sort) */
+	for (i = 0; i < n; i++) {
+		h [i] = hash_mph (keys [i], t->seed);
+		cnt [BUCKET (h [i], nb)]++;
+	}
+	for (b = 0, maxs = 0; b < nb; b++) {
+		start [b + 1] = start [b] + cnt [b];
+		if (cnt [b] > maxs) {
+			maxs = cnt [b];
+		}
+	}
+	for (i = 0; i < n; i++) {
+		b = BUCKET (h [i], nb);
+		idx [start [b] + (--cnt [b])] = i;
+	}
+
+	/* gruppi in ordine di dimensione decrescente: i piu' grandi trovano piu' facilmente celle libere */
+	for (s = maxs, j = 0; s > 0; s--) {
+		for (b = 0; b < nb; b++) {
+			if (start [b + 1] - start [b] == s) {
+				order [j++] = b;
+			}
+		}
+	}
+
+	pos = malloc ((maxs + 1) * sizeof (unsigned int));
+	if (pos == NULL) {
+		free (cnt); free (start); free (idx); free (order); free (used);
+		return -2;
+	}
+
+	maxk = (unsigned long long) n * NDISP;
+	if (maxk > 0xFFFFFFFFULL) {
+		maxk = 0xFFFFFFFFULL;
+	}
+	ret = 0;
+	for (i = 0; i < j; i++) {
+		b = order [i];
+		s = start [b + 1] - start [b];
+
+		for (k = 0; k < maxk; k++) {
+			for (x = 0; x < s; x++) {
+				pos [x] = pos_mph (h [idx [start [b] + x]], (unsigned int) k, n);
+				if (used [pos [x]]) {
+					break;
+				}
+				/* due chiavi dello stesso gruppo non possono finire nella stessa cella */
+				for (y = 0; y < x && pos [y] != pos [x]; y++);
+				if (y < x) {
+					break;
+				}
+			}
+			if (x == s) { /* tutte le chiavi del gruppo hanno una cella libera */
+				break;
+			}
+		}
+		if (k == maxk) {
+			ret = -1;
+			break;
+		}
+
+		t->disp [b] = (unsigned int) k;
+		for (x = 0; x < s; x++) {
+			used [pos [x]] = 1;
+			t->table [pos [x]].hash = (unsigned int) h [idx [start [b] + x]];
+			t->table [pos [x]].key = keys [idx [start [b] + x]];
+			t->table [pos [x]].payload = payloads [idx [start [b] + x]];
+		}
+	}
+
+	free (cnt); free (start); free (idx); free (order); free (used); free (pos);
+	return ret;
+}
+
+/** costruisce l'hash perfetto minimo su n chiavi distinte
+ *  \param keys chiavi (non vengono copiate)
+ *  \param payloads payload associati alle chiavi (non vengono copiati)
+ *  \param n numero di chiavi
+ *
+ *  \retval NULL in caso di errore o se la costruzione non riesce (ad esempio con chiavi duplicate) (setta errno)
+ *  \retval t puntatore alla nuova tabella
+ */
+userMph_t * new_userMph (char ** keys, void ** payloads, unsigned int n)
+{
+	userMph_t * t;
+	unsigned long long * h;
+	int i, r;
+
+	if ((keys == NULL || payloads == NULL) && n > 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	t = malloc (sizeof (userMph_t));
+	if (t == NULL) {
+		return NULL;
+	}
+	t->n = n;
+	t->nbucket = n / LAMBDA + 1;
+	t->table = malloc ((n + 1) * sizeof (userElem_t));
+	t->disp = malloc (t->nbucket * sizeof (unsigned int));
+	h = malloc ((n + 1) * sizeof (unsigned long long));
+	if (t->table == NULL || t->disp == NULL || h == NULL) {
+		free (h);
+		free_userMph (&t);
+		return NULL;
+	}
+
+	for (i = 0, r = -1; i < NSEED && r == -1; i++) {
+		t->seed = 0x9E3779B97F4A7C15ULL * (i + 1);
+		memset (t->table, 0, (n + 1) * sizeof (userElem_t));
+		memset (t->disp, 0, t->nbucket * sizeof (unsigned int));
+		r = build (t, keys, payloads, h);
+	}
+	free (h);
+
+	if (r != 0) {
+		if (r == -1) {
+			errno = EAGAIN;
+		}
+		free_userMph (&t);
+		return NULL;
+	}
+
+	return t;
+}
+
+/** distrugge la tabella (i payload e le chiavi non vengono deallocati)
+ *  \param pt indirizzo del puntatore alla tabella (viene messo a NULL)
+ */
+void free_userMph (userMph_t ** pt)
+{
+	if (pt == NULL || *pt == NULL) {
+		return;
+	}
+	free ((*pt)->table);
+	free ((*pt)->disp);
+	free (*pt);
+	*pt = NULL;
+}
+
+/** cerca una chiave nella tabella
+ *  \param t tabella
+ *  \param key chiave da cercare (puo' anche non appartenere all'insieme)
+ *
+ *  \retval NULL se la chiave non e' presente
+ *  \retval p payload associato alla chiave
+ */
+void * find_userMph (userMph_t * t, char * key)
+{
+	unsigned long long h;
+	userElem_t * e;
+
+	if (t == NULL || key == NULL || t->n == 0) {
+		return NULL;
+	}
+
+	h = hash_mph (key, t->seed);
+	e = &(t->table [pos_mph (h, t->disp [BUCKET (h, t->nbucket)], t->n)]);
+
+	/* la chiave cercata puo' non appartenere all'insieme: confronto di verifica (prima l'impronta) */
+	if (e->hash == (unsigned int) h && strcmp (e->key, key) == 0) {
+		return e->payload;
+	}
+
+	return NULL;
+}
@@ -0,0 +1,63 @@
+/**  \file
+ *    \author Marco Ponza
+ *  \brief hash perfetto minimo (CHD, hash and displace) per l'insieme statico degli utenti autorizzati
+ *
+*/
+
+#ifndef _USRMPH_H
+#define _USRMPH_H
+
+#include "usrtab.h"
+
+/* -= TIPI =- */
+
+/** <H3>Hash perfetto minimo</H3>
+ * La struttura \c userMph_t rappresenta una funzione hash perfetta minima costruita su un insieme
+ * fissato di n chiavi: ogni chiave ha una cella propria tra le n della tabella, quindi una ricerca
+ * costa un hash della chiave e un solo confronto di verifica (nessuna lista e nessuna scansione).
+ * Le chiavi sono divise in \c nbucket gruppi; per ogni gruppo \c disp contiene lo spostamento
+ * che manda tutte le chiavi del gruppo in celle libere.
+ * - \c table e' l'array delle n celle (\c hash contiene l'impronta della chiave)
+ * - \c n e' il numero di chiavi (e di celle)
+ * - \c nbucket e' il numero di gruppi
+ * - \c disp e' lo spostamento di ogni gruppo
+ * - \c seed e' il seme della funzione hash con cui la costruzione e' riuscita
+ *
+ * <HR>
+ */
+
+typedef struct {
+    userElem_t * table;      /** celle (una per chiave) */
+    unsigned int n;          /** numero di chiavi */
+    unsigned int nbucket;    /** numero di gruppi */
+    unsigned int * disp;     /** spostamento di ogni gruppo */
+    unsigned long long seed; /** seme della funzione hash */
+} userMph_t;
+
+/* -= FUNZIONI =- */
+
+/** costruisce l'hash perfetto minimo su n chiavi distinte
+ *  \param keys chiavi (non vengono copiate)
+ *  \param payloads payload associati alle chiavi (non vengono copiati)
+ *  \param n numero di chiavi
+ *
+ *  \retval NULL in caso di errore o se la costruzione non riesce (ad esempio con chiavi duplicate) (setta errno)
+ *  \retval t puntatore alla nuova tabella
+ */
+userMph_t * new_userMph (char ** keys, void ** payloads, unsigned int n);
+
+/** distrugge la tabella (i payload e le chiavi non vengono deallocati)
+ *  \param pt indirizzo del puntatore alla tabella (viene messo a NULL)
+ */
+void free_userMph (userMph_t ** pt);
+
+/** cerca una chiave nella tabella
+ *  \param t tabella
+ *  \param key chiave da cercare (puo' anche non appartenere all'insieme)
+ *
+ *  \retval NULL se la chiave non e' presente
+ *  \retval p payload associato alla chiave
+ */
+void * find_userMph (userMph_t * t, char * key);
+
+#endif
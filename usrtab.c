@@ -0,0 +1,288 @@
+/**
+   \file usrtab.c
+   \author Marco Ponza
+   \brief  tabella hash ad indirizzamento aperto (Robin Hood) per gli utenti autorizzati
+   Si dichiara che ogni singolo bit presente in questo file è solo ed esclusivamente "farina del sacco" del rispettivo autore :D
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "usrtab.h"
+
+#define NMINTAB 16 /* numero minimo di celle della tabella */
+#define LOADNUM 3 /* la tabella viene espansa quando n supera i LOADNUM/LOADDEN delle celle */
+#define LOADDEN 4
+
+/** distanza dell'elemento in posizione i dalla propria posizione ideale */
+#define DIST(t, i) ( ((i) - (t)->table [i].hash) & ((t)->size - 1) )
+
+/** funzione hash per le stringhe (FNV-1a)
+ *  \param key chiave
+ *
+ *  \retval h valore hash della chiave (mai 0)
+ */
+unsigned int hash_user (char * key)
+{
+	unsigned int h = 2166136261U;
+
+	for (; *key != '\0'; key++) {
+		h ^= (unsigned char) *key;
+		h *= 16777619U;
+	}
+
+	return (h == 0) ? 1 : h; /* 0 indica una cella vuota */
+}
+
+/** inserisce un elemento sapendo che la chiave non e' presente e che c'e' spazio
+ *  (scambia l'elemento da inserire con quelli piu' vicini alla propria posizione ideale)
+ */
+static void insert (userTable_t * t, userElem_t e)
+{
+	unsigned int i, d, dt;
+	userElem_t tmp;
+
+	i = e.hash & (t->size - 1);
+	d = 0; /* distanza di e dalla sua posizione ideale */
+
+	while (t->table [i].hash != 0) {
+		dt = DIST (t, i);
+		if (dt < d) { /* l'occupante e' piu' "ricco": gli cedo il posto */
+			tmp = t->table [i];
+			t->table [i] = e;
+			e = tmp;
+			d = dt;
+		}
+		i = (i + 1) & (t->size - 1);
+		d++;
+	}
+	t->table [i] = e;
+	t->n++;
+}
+
+/** raddoppia il numero di celle della tabella e reinserisce gli elementi
+ *
+ *  \retval 0 se tutto e' andato a buon fine
+ *  \retval -1 in caso di errore (setta errno)
+ */
+static int grow (userTable_t * t)
+{
+	unsigned int i, size;
+	userElem_t * old;
+
+	old = t->table;
+	size = t->size;
+
+	t->table = calloc (2 * size, sizeof (userElem_t));
+	if (t->table == NULL) {
+		t->table = old;
+		return -1;
+	}
+	t->size = 2 * size;
+	t->n = 0;
+
+	for (i = 0; i < size; i++) {
+		if (old [i].hash != 0) {
+			insert (t, old [i]);
+		}
+	}
+	free (old);
+
+	return 0;
+}
+
+/** cerca la cella della chiave key, di cui e' gia' noto il valore hash h
+ *
+ *  \retval i indice della cella
+ *  \retval -1 se la chiave non e' presente
+ */
+static int lookup_hash (userTable_t * t, char * key, unsigned int h)
+{
+	unsigned int i, d;
+
+	i = h & (t->size - 1);
+
+	for (d = 0; t->table [i].hash != 0; d++) {
+		if (DIST (t, i) < d) { /* key sarebbe stata inserita prima di questa cella */
+			return -1;
+		}
+		if (t->table [i].hash == h && strcmp (t->table [i].key, key) == 0) {
+			return i;
+		}
+		i = (i + 1) & (t->size - 1);
+	}
+
+	return -1;
+}
+
+/** cerca la cella della chiave key
+ *
+ *  \retval i indice della cella
+ *  \retval -1 se la chiave non e' presente
+ */
+static int lookup (userTable_t * t, char * key)
+{
+	return lookup_hash (t, key, hash_user (key));
+}
+
+/** crea una tabella in grado di contenere n elementi senza essere espansa
+ *  \param n numero di elementi previsti
+ *
+ *  \retval NULL in caso di errore (setta errno)
+ *  \retval t puntatore alla nuova tabella
+ */
+userTable_t * new_userTable (unsigned int n)
+{
+	userTable_t * t;
+
+	t = malloc (sizeof (userTable_t));
+	if (t == NULL) {
+		return NULL;
+	}
+
+	for (t->size = NMINTAB; (unsigned long) t->size * LOADNUM < (unsigned long) n * LOADDEN; t->size *= 2);
+	t->n = 0;
+
+	t->table = calloc (t->size, sizeof (userElem_t));
+	if (t->table == NULL) {
+		free (t);
+		return NULL;
+	}
+
+	return t;
+}
+
+/** distrugge la tabella (i payload e le chiavi non vengono deallocati)
+ *  \param pt indirizzo del puntatore alla tabella (viene messo a NULL)
+ */
+void free_userTable (userTable_t ** pt)
+{
+	if (pt == NULL || *pt == NULL) {
+		return;
+	}
+	free ((*pt)->table);
+	free (*pt);
+	*pt = NULL;
+}
+
+/** inserisce un elemento nella tabella, espandendola se necessario
+ *  \param t tabella
+ *  \param key chiave (non viene copiata)
+ *  \param payload payload (non viene copiato)
+ *
+ *  \retval 0 se l'inserimento e' andato a buon fine
+ *  \retval -1 se la chiave e' gia' presente o in caso di errore (setta errno)
+ */
+int add_userElement (userTable_t * t, char * key, void * payload)
+{
+	userElem_t e;
+
+	if (t == NULL || key == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (lookup (t, key) != -1) {
+		errno = EEXIST;
+		return -1;
+	}
+	if ( (unsigned long) (t->n + 1) * LOADDEN > (unsigned long) t->size * LOADNUM && grow (t) == -1 ) {
+		return -1;
+	}
+
+	e.hash = hash_user (key);
+	e.key = key;
+	e.payload = payload;
+	insert (t, e);
+
+	return 0;
+}
+
+/** inserisce n elementi nella tabella (caricamento in blocco): la tabella viene espansa
+ *  al piu' una volta e i valori hash non vengono ricalcolati
+ *  \param t tabella
+ *  \param e elementi da inserire, con il campo hash gia' calcolato con hash_user
+ *         (chiavi e payload non vengono copiati)
+ *  \param n numero di elementi
+ *
+ *  \retval 0 se l'inserimento e' andato a buon fine
+ *  \retval -1 se una chiave e' gia' presente (gli elementi precedenti restano inseriti)
+ *          o in caso di errore (setta errno)
+ */
+int add_userElements (userTable_t * t, userElem_t * e, unsigned int n)
+{
+	unsigned int i;
+
+	if (t == NULL || (e == NULL && n > 0)) {
+		errno = EINVAL;
+		return -1;
+	}
+	while ( (unsigned long) (t->n + n) * LOADDEN > (unsigned long) t->size * LOADNUM ) {
+		if (grow (t) == -1) {
+			return -1;
+		}
+	}
+
+	for (i = 0; i < n; i++) {
+		if (lookup_hash (t, e [i].key, e [i].hash) != -1) {
+			errno = EEXIST;
+			return -1;
+		}
+		insert (t, e [i]);
+	}
+
+	return 0;
+}
+
+/** cerca un elemento nella tabella
+ *  \param t tabella
+ *  \param key chiave da cercare
+ *
+ *  \retval NULL se la chiave non e' presente
+ *  \retval p payload associato alla chiave
+ */
+void * find_userElement (userTable_t * t, char * key)
+{
+	int i;
+
+	if (t == NULL || key == NULL) {
+		return NULL;
+	}
+	i = lookup (t, key);
+
+	return (i == -1) ? NULL : t->table [i].payload;
+}
+
+/** rimuove un elemento dalla tabella (le celle successive vengono spostate indietro, senza lapidi)
+ *  \param t tabella
+ *  \param key chiave da rimuovere
+ *
+ *  \retval NULL se la chiave non e' presente
+ *  \retval p payload dell'elemento rimosso
+ */
+void * remove_userElement (userTable_t * t, char * key)
+{
+	int i;
+	unsigned int j;
+	void * payload;
+
+	if (t == NULL || key == NULL || (i = lookup (t, key)) == -1) {
+		return NULL;
+	}
+	payload = t->table [i].payload;
+
+	/* sposto indietro di una cella gli elementi che non sono nella propria posizione ideale */
+	j = (i + 1) & (t->size - 1);
+	while (t->table [j].hash != 0 && DIST (t, j) > 0) {
+		t->table [i] = t->table [j];
+		i = j;
+		j = (j + 1) & (t->size - 1);
+	}
+	t->table [i].hash = 0;
+	t->table [i].key = NULL;
+	t->table [i].payload = NULL;
+	t->n--;
+
+	return payload;
+}
@@ -0,0 +1,107 @@
+/**  \file
+ *    \author Marco Ponza
+ *  \brief tabella hash ad indirizzamento aperto (Robin Hood) per gli utenti autorizzati
+ *
+*/
+
+#ifndef _USRTAB_H
+#define _USRTAB_H
+
+/* -= TIPI =- */
+
+/** <H3>Elemento della tabella</H3>
+ * La struttura \c userElem_t rappresenta una cella della tabella
+ * - \c hash e' il valore hash (completo) della chiave, 0 se la cella e' vuota
+ * - \c key e' la chiave (non viene copiata: deve restare valida finche' l'elemento e' nella tabella)
+ * - \c payload e' il puntatore al payload (non viene copiato: resta lo stesso per tutta la vita dell'elemento)
+ *
+ * <HR>
+ */
+
+typedef struct {
+    unsigned int hash;   /** hash della chiave (0 = cella vuota) */
+    char * key;          /** chiave */
+    void * payload;      /** payload */
+} userElem_t;
+
+/** <H3>Tabella</H3>
+ * La struttura \c userTable_t rappresenta una tabella ad indirizzamento aperto con scansione
+ * lineare e inserimento Robin Hood: le celle sono contigue in memoria e una ricerca fallita
+ * termina non appena si incontra un elemento piu' vicino alla propria posizione ideale
+ * - \c table e' l'array delle celle
+ * - \c size e' il numero di celle (potenza di 2)
+ * - \c n e' il numero di elementi presenti
+ *
+ * <HR>
+ */
+
+typedef struct {
+    userElem_t * table;  /** celle */
+    unsigned int size;   /** numero di celle (potenza di 2) */
+    unsigned int n;      /** numero di elementi */
+} userTable_t;
+
+/* -= FUNZIONI =- */
+
+/** funzione hash per le stringhe (FNV-1a)
+ *  \param key chiave
+ *
+ *  \retval h valore hash della chiave (mai 0)
+ */
+unsigned int hash_user (char * key);
+
+/** crea una tabella in grado di contenere n elementi senza essere espansa
+ *  \param n numero di elementi previsti
+ *
+ *  \retval NULL in caso di errore (setta errno)
+ *  \retval t puntatore alla nuova tabella
+ */
+userTable_t * new_userTable (unsigned int n);
+
+/** distrugge la tabella (i payload e le chiavi non vengono deallocati)
+ *  \param pt indirizzo del puntatore alla tabella (viene messo a NULL)
+ */
+void free_userTable (userTable_t ** pt);
+
+/** inserisce un elemento nella tabella, espandendola se necessario
+ *  \param t tabella
+ *  \param key chiave (non viene copiata)
+ *  \param payload payload (non viene copiato)
+ *
+ *  \retval 0 se l'inserimento e' andato a buon fine
+ *  \retval -1 se la chiave e' gia' presente o in caso di errore (setta errno)
+ */
+int add_userElement (userTable_t * t, char * key, void * payload);
+
+/** inserisce n elementi nella tabella (caricamento in blocco): la tabella viene espansa
+ *  al piu' una volta e i valori hash non vengono ricalcolati
+ *  \param t tabella
+ *  \param e elementi da inserire, con il campo hash gia' calcolato con hash_user
+ *         (chiavi e payload non vengono copiati)
+ *  \param n numero di elementi
+ *
+ *  \retval 0 se l'inserimento e' andato a buon fine
+ *  \retval -1 se una chiave e' gia' presente (gli elementi precedenti restano inseriti)
+ *          o in caso di errore (setta errno)
+ */
+int add_userElements (userTable_t * t, userElem_t * e, unsigned int n);
+
+/** cerca un elemento nella tabella
+ *  \param t tabella
+ *  \param key chiave da cercare
+ *
+ *  \retval NULL se la chiave non e' presente
+ *  \retval p payload associato alla chiave
+ */
+void * find_userElement (userTable_t * t, char * key);
+
+/** rimuove un elemento dalla tabella (le celle successive vengono spostate indietro, senza lapidi)
+ *  \param t tabella
+ *  \param key chiave da rimuovere
+ *
+ *  \retval NULL se la chiave non e' presente
+ *  \retval p payload dell'elemento rimosso
+ */
+void * remove_userElement (userTable_t * t, char * key);
+
+#endif